@@ -0,0 +1,172 @@
+#include "pch.h"
+#include "Animation.h"
+#include "Scene.h"
+#include "Camera.h"
+
+
+namespace {
+
+template<typename Key>
+void insertKey(Array<Key>& keyArr, const Key& key)
+{
+	for (Key& existing : keyArr)
+	{
+		if (existing.time == key.time)
+		{
+			existing = key;
+			return;
+		}
+	}
+
+	keyArr.push_back(key);
+	for (uint i = keyArr.size() - 1; i > 0 && keyArr[i - 1].time > key.time; --i)
+	{
+		keyArr[i] = keyArr[i - 1];
+		keyArr[i - 1] = key;
+	}
+}
+
+// Index i of the keys around time, with keyArr[i].time <= time < keyArr[i + 1].time, and the weight of the second.
+// Out of the range of the keys, both keys are the end one.
+template<typename Key>
+uint findKeys(const Array<Key>& keyArr, float time, float& weight)
+{
+	weight = 0.0f;
+	uint last = keyArr.size() - 1;
+	if (time <= keyArr[0].time)
+		return 0;
+	if (time >= keyArr[last].time)
+		return last;
+
+	uint lo = 0, hi = last;
+	while (hi - lo > 1)
+	{
+		uint mid = (lo + hi) / 2;
+		if (keyArr[mid].time <= time)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	weight = (time - keyArr[lo].time) / (keyArr[hi].time - keyArr[lo].time);
+	return lo;
+}
+
+inline float lerp(float a, float b, float t)
+{
+	return a + (b - a) * t;
+}
+
+inline float3 lerp(const float3& a, const float3& b, float t)
+{
+	return a + (b - a) * t;
+}
+
+// Along the shorter arc, falling back to a normalized lerp when the rotations are nearly the same.
+float4 slerp(const float4& q0, const float4& q1, float t)
+{
+	float cosAngle = q0.x*q1.x + q0.y*q1.y + q0.z*q1.z + q0.w*q1.w;
+	float sign = 1.0f;
+	if (cosAngle < 0.0f)
+	{
+		cosAngle = -cosAngle;
+		sign = -1.0f;
+	}
+
+	float w0, w1;
+	if (cosAngle > 0.9995f)
+	{
+		w0 = 1.0f - t;
+		w1 = t;
+	}
+	else
+	{
+		float angle = acosf(cosAngle);
+		float invSin = 1.0f / sinf(angle);
+		w0 = sinf((1.0f - t) * angle) * invSin;
+		w1 = sinf(t * angle) * invSin;
+	}
+	w1 *= sign;
+
+	float4 q(w0*q0.x + w1*q1.x, w0*q0.y + w1*q1.y, w0*q0.z + w1*q1.z, w0*q0.w + w1*q1.w);
+	float invLength = 1.0f / sqrtf(q.x*q.x + q.y*q.y + q.z*q.z + q.w*q.w);
+	return float4(q.x*invLength, q.y*invLength, q.z*invLength, q.w*invLength);
+}
+
+}	// namespace
+
+
+float Animation::getDuration() const
+{
+	float duration = 0.0f;
+	for (const ObjectTrack& track : trackArr)
+		duration = _max(duration, track.keyArr[track.keyArr.size() - 1].time);
+	if (hasCamera())
+		duration = _max(duration, cameraKeyArr[cameraKeyArr.size() - 1].time);
+	return duration;
+}
+
+void Animation::addObjectKey(uint objIdx, const TransformKey& key)
+{
+	for (ObjectTrack& track : trackArr)
+	{
+		if (track.objIdx == objIdx)
+		{
+			insertKey(track.keyArr, key);
+			return;
+		}
+	}
+
+	ObjectTrack track;
+	track.objIdx = objIdx;
+	track.keyArr.push_back(key);
+	trackArr.push_back(track);
+}
+
+void Animation::addCameraKey(const CameraKey& key)
+{
+	insertKey(cameraKeyArr, key);
+}
+
+void Animation::addTurntable(const CameraKey& start, float duration)
+{
+	CameraKey end = start;
+	end.time = start.time + duration;
+	end.azimuth = start.azimuth + 1.0f;
+	addCameraKey(start);
+	addCameraKey(end);
+}
+
+void Animation::applyToScene(Scene* scene, float time) const
+{
+	for (const ObjectTrack& track : trackArr)
+	{
+		float t;
+		uint k = findKeys(track.keyArr, time, t);
+		const TransformKey& k0 = track.keyArr[k];
+		const TransformKey& k1 = track.keyArr[_min(k + 1, track.keyArr.size() - 1)];
+
+		scene->updateObjectTransform(track.objIdx,
+			lerp(k0.translation, k1.translation, t),
+			slerp(k0.rotation, k1.rotation, t),
+			lerp(k0.scale, k1.scale, t));
+	}
+}
+
+void Animation::applyToCamera(OrbitCamera& camera, float time) const
+{
+	if (!hasCamera())
+		return;
+
+	float t;
+	uint k = findKeys(cameraKeyArr, time, t);
+	const CameraKey& k0 = cameraKeyArr[k];
+	const CameraKey& k1 = cameraKeyArr[_min(k + 1, cameraKeyArr.size() - 1)];
+
+	// OrbitCamera keeps its azimuth in [0, 1].
+	float azimuth = lerp(k0.azimuth, k1.azimuth, t);
+	azimuth -= floorf(azimuth);
+
+	camera.initOrbit(lerp(k0.target, k1.target, t), lerp(k0.distance, k1.distance, t), azimuth,
+		lerp(k0.altitude, k1.altitude, t));
+	camera.setFovY(lerp(k0.fovY, k1.fovY, t));
+}
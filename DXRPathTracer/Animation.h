@@ -0,0 +1,63 @@
+#pragma once
+#include "pch.h"
+
+
+class Scene;
+class OrbitCamera;
+
+
+// Pose of a scene object at one time, with the meaning of SceneObject::translation, rotation and scale.
+struct TransformKey
+{
+	float time				= 0.0f;		// In seconds.
+	float3 translation		= float3(0.0f);
+	float4 rotation			= float4(0.f, 0.f, 0.f, 1.f);
+	float scale				= 1.0f;
+};
+
+
+// Parameters of OrbitCamera::initOrbit() and the field of view at one time. The defaults are the tracers' own camera.
+struct CameraKey
+{
+	float time				= 0.0f;
+	float3 target			= float3(0.0f, 1.5f, 0.0f);
+	float distance			= 10.0f;
+	float azimuth			= 0.0f;		// In turns, and not wrapped: keys at 0 and 1 make a full turn.
+	float altitude			= 0.0f;		// In [-1, 1] for [-Pi/2, Pi/2], as in OrbitCamera.
+	float fovY				= 60.0f;	// In degrees.
+};
+
+
+/*
+Keyframed transforms of scene objects and of the orbit camera. Between two keys the translation, the scale and the
+camera parameters are interpolated linearly and the rotation by slerp; before the first and after the last key a
+track holds its end pose.
+applyToScene() writes the poses at a time through Scene::updateObjectTransform(), so the tracer refits its
+acceleration structures on its next update(). Tracks refer to objects by index, which removeObject() can change.
+*/
+class Animation
+{
+	struct ObjectTrack
+	{
+		uint objIdx;
+		Array<TransformKey> keyArr;		// Sorted by time.
+	};
+
+	Array<ObjectTrack>	trackArr;
+	Array<CameraKey>	cameraKeyArr;	// Sorted by time.
+
+public:
+	void clear()								{ trackArr.clear(); cameraKeyArr.clear(); }
+	bool empty() const							{ return trackArr.size() == 0 && cameraKeyArr.size() == 0; }
+	bool hasCamera() const						{ return cameraKeyArr.size() > 0; }
+	uint numObjectTracks() const				{ return trackArr.size(); }
+	float getDuration() const;					// Time of the last key.
+
+	// A key at the time of an existing key of the same track replaces it.
+	void addObjectKey(uint objIdx, const TransformKey& key);
+	void addCameraKey(const CameraKey& key);
+	void addTurntable(const CameraKey& start, float duration);	// One full turn of the camera around start.target.
+
+	void applyToScene(Scene* scene, float time) const;
+	void applyToCamera(OrbitCamera& camera, float time) const;
+};
@@ -0,0 +1,166 @@
+#include "pch.h"
+#include "Arena.h"
+
+
+static thread_local MemoryArena* currentArena = nullptr;
+
+// Size class of a block which can be recycled, or numSizeClasses if it cannot.
+static uint sizeClassOf(size_t bytes, size_t alignment, uint numSizeClasses)
+{
+	if (alignment > 16)
+		return numSizeClasses;
+
+	uint c = 0;
+	while (c < numSizeClasses && (size_t) (16 << c) < bytes)
+		++c;
+	return c;
+}
+
+MemoryArena* MemoryArena::current()
+{
+	return currentArena;
+}
+
+MemoryArena* MemoryArena::findOwner(const void* ptr)
+{
+	for (MemoryArena* arena = currentArena; arena; arena = arena->parent)
+	{
+		if (arena->owns(ptr))
+			return arena;
+	}
+	return nullptr;
+}
+
+void MemoryArena::addChunk(size_t minBytes)
+{
+	size_t bytes = _max(nextChunkSize, minBytes);
+	nextChunkSize = _min(nextChunkSize * 2, maxChunkSize);
+
+	Chunk chunk;
+	chunk.begin = static_cast<char*>(AlignedAllocator<64>::allocate(bytes));
+	chunk.end = chunk.begin + bytes;
+	chunkArr.push_back(chunk);
+
+	top = chunk.begin;
+	lastAlloc = nullptr;
+	reservedBytes += bytes;
+}
+
+void* MemoryArena::allocate(size_t bytes, size_t alignment)
+{
+	assert(alignment <= 64 && (alignment & (alignment - 1)) == 0);
+	bytes = _max(bytes, (size_t) 1);
+
+	uint sizeClass = sizeClassOf(bytes, alignment, numSizeClasses);
+	if (sizeClass < numSizeClasses)
+	{
+		bytes = (size_t) 16 << sizeClass;
+		if (void* block = freeLists[sizeClass])
+		{
+			freeLists[sizeClass] = *(void**) block;
+			++numLive;
+			return block;
+		}
+	}
+
+	char* begin = top ? (char*) (((size_t) top + alignment - 1) & ~(alignment - 1)) : nullptr;
+	if (!begin || begin + bytes > chunkArr[chunkArr.size() - 1].end)
+	{
+		addChunk(bytes);
+		begin = top;
+	}
+
+	usedBytes += (begin + bytes) - top;
+	lastFrom = top;
+	lastAlloc = begin;
+	top = begin + bytes;
+	++numLive;
+	return begin;
+}
+
+void* MemoryArena::reallocate(void* ptr, size_t oldBytes, size_t newBytes, size_t alignment)
+{
+	// The latest allocation grows or shrinks in place while it fits in its chunk.
+	if (ptr == lastAlloc && lastAlloc + newBytes <= chunkArr[chunkArr.size() - 1].end)
+	{
+		char* newTop = lastAlloc + _max(newBytes, (size_t) 1);
+		usedBytes = usedBytes + (newTop - top);
+		top = newTop;
+		return ptr;
+	}
+
+	void* newPtr = allocate(newBytes, alignment);
+	memcpy(newPtr, ptr, _min(oldBytes, newBytes));
+	deallocate(ptr);
+	return newPtr;
+}
+
+void MemoryArena::deallocate(void* ptr)
+{
+	assert(numLive > 0);
+	--numLive;
+
+	if (ptr == lastAlloc)
+	{
+		usedBytes -= top - lastFrom;
+		top = lastFrom;
+		lastAlloc = nullptr;
+	}
+}
+
+void MemoryArena::deallocate(void* ptr, size_t bytes, size_t alignment)
+{
+	uint sizeClass = sizeClassOf(_max(bytes, (size_t) 1), alignment, numSizeClasses);
+	if (ptr == lastAlloc || sizeClass == numSizeClasses)
+	{
+		deallocate(ptr);
+		return;
+	}
+
+	assert(numLive > 0);
+	--numLive;
+	*(void**) ptr = freeLists[sizeClass];
+	freeLists[sizeClass] = ptr;
+}
+
+bool MemoryArena::owns(const void* ptr) const
+{
+	// The latest chunk is the likeliest.
+	for (uint i = chunkArr.size(); i-- > 0; )
+	{
+		if (ptr >= chunkArr[i].begin && ptr < chunkArr[i].end)
+			return true;
+	}
+	return false;
+}
+
+void MemoryArena::release()
+{
+	for (const Chunk& chunk : chunkArr)
+		AlignedAllocator<64>::deallocate(chunk.begin);
+	chunkArr.clear();
+
+	top = nullptr;
+	lastAlloc = nullptr;
+	lastFrom = nullptr;
+	for (void*& freeList : freeLists)
+		freeList = nullptr;
+	usedBytes = 0;
+	reservedBytes = 0;
+	numLive = 0;
+}
+
+ScopedArena::ScopedArena(size_t firstChunkSize)
+	: arena(firstChunkSize)
+{
+	arena.parent = currentArena;
+	currentArena = &arena;
+}
+
+ScopedArena::~ScopedArena()
+{
+	// A container still alive here would free its memory to the wrong place later.
+	assert(arena.numLive == 0);
+	assert(currentArena == &arena);
+	currentArena = arena.parent;
+}
@@ -0,0 +1,152 @@
+#pragma once
+#include "pch.h"
+#include <vector>
+
+
+/*
+Monotonic allocator for the temporaries of loading: allocations bump a pointer through chunks, and everything is
+freed at once by release() or by the destructor. Only the latest allocation can grow or be freed in place; freeing
+any other is a no-op until the release, except for small blocks of a known size, which are kept in free lists
+for the next allocations of their size class (e.g. the many short vectors of a mesh simplifier, which grow and die).
+Not thread-safe, so every thread uses its own arena (see ScopedArena).
+*/
+class MemoryArena
+{
+	struct Chunk
+	{
+		char* begin;
+		char* end;
+	};
+
+	Array<Chunk>	chunkArr;
+	char*			top = nullptr;			// First free byte of the last chunk.
+	char*			lastAlloc = nullptr;	// The latest allocation, while it is still at the top,
+	char*			lastFrom = nullptr;		// and the top before it, including the alignment padding.
+	size_t			nextChunkSize;
+	uint64			usedBytes = 0;			// Allocated and not released, including the blocks freed out of order.
+	uint64			reservedBytes = 0;		// Of the chunks.
+	uint			numLive = 0;			// Allocations not yet freed.
+	MemoryArena*	parent = nullptr;		// The arena which was current before this one (see ScopedArena).
+
+	static const uint numSizeClasses = 7;	// 16, 32, ..., 1024 bytes.
+	void*			freeLists[numSizeClasses] = {};	// Each free block starts with the pointer to the next one.
+
+	friend class ScopedArena;
+
+	void addChunk(size_t minBytes);
+
+public:
+	static const size_t minChunkSize = 1 << 20;
+	static const size_t maxChunkSize = 64 << 20;
+	static const size_t maxBlockSize = 256 << 10;	// Larger blocks are left to the heap by the allocators below.
+
+	~MemoryArena() { release(); }
+	MemoryArena(size_t firstChunkSize = minChunkSize) : nextChunkSize(firstChunkSize) {}
+	MemoryArena(const MemoryArena&) = delete;
+
+	void* allocate(size_t bytes, size_t alignment = 64);
+	void* reallocate(void* ptr, size_t oldBytes, size_t newBytes, size_t alignment = 64);
+	void deallocate(void* ptr);
+	void deallocate(void* ptr, size_t bytes, size_t alignment);	// Recycles a small block; bytes as allocated.
+	void release();
+	bool owns(const void* ptr) const;
+
+	uint64 getUsedBytes() const				{ return usedBytes; }
+	uint64 getReservedBytes() const			{ return reservedBytes; }
+	uint getNumLiveAllocations() const		{ return numLive; }
+
+	static MemoryArena* current();						// Of this thread, or nullptr.
+	static MemoryArena* findOwner(const void* ptr);		// Among the current arena and its parents.
+};
+
+
+/*
+Makes an arena the current one of this thread until the end of the scope, and releases it then. ArenaAllocator
+and ArenaStlAllocator draw from the current arena, so containers using them must not outlive the scope.
+Scopes can nest: memory of an outer arena is still freed correctly inside an inner scope.
+*/
+class ScopedArena
+{
+	MemoryArena arena;
+
+public:
+	~ScopedArena();
+	ScopedArena(size_t firstChunkSize = MemoryArena::minChunkSize);
+	ScopedArena(const ScopedArena&) = delete;
+
+	MemoryArena& get()						{ return arena; }
+};
+
+
+/*
+Allocator of Array (see AlignedAllocator) which draws from the current arena, or from the heap if there is none.
+Blocks over MemoryArena::maxBlockSize come from the heap too: the arena would save little on them, and every
+growth of a big array would leave a dead copy in it until the release.
+*/
+struct ArenaAllocator
+{
+	static const size_t alignment = 64;
+	typedef AlignedAllocator<alignment> Heap;
+
+	static void* allocate(size_t bytes)
+	{
+		MemoryArena* arena = MemoryArena::current();
+		return (arena && bytes <= MemoryArena::maxBlockSize) ? arena->allocate(bytes, alignment) : Heap::allocate(bytes);
+	}
+	static void* reallocate(void* ptr, size_t oldBytes, size_t newBytes)
+	{
+		MemoryArena* arena = MemoryArena::findOwner(ptr);
+		if (!arena)
+			return Heap::reallocate(ptr, oldBytes, newBytes);
+		if (newBytes <= MemoryArena::maxBlockSize)
+			return arena->reallocate(ptr, oldBytes, newBytes, alignment);
+
+		void* newPtr = Heap::allocate(newBytes);
+		memcpy(newPtr, ptr, _min(oldBytes, newBytes));
+		arena->deallocate(ptr);
+		return newPtr;
+	}
+	static void deallocate(void* ptr)
+	{
+		MemoryArena* arena = MemoryArena::findOwner(ptr);
+		if (arena)
+			arena->deallocate(ptr);
+		else
+			Heap::deallocate(ptr);
+	}
+};
+
+
+// The same for the standard containers, e.g. the node allocations of std::map which dominate some loaders.
+template<typename T>
+struct ArenaStlAllocator
+{
+	typedef T value_type;
+	static const size_t alignment = alignof(T) > 16 ? alignof(T) : 16;
+
+	ArenaStlAllocator() {}
+	template<typename U> ArenaStlAllocator(const ArenaStlAllocator<U>&) {}
+
+	T* allocate(size_t n)
+	{
+		MemoryArena* arena = MemoryArena::current();
+		size_t bytes = n * sizeof(T);
+		return static_cast<T*>((arena && bytes <= MemoryArena::maxBlockSize) ?
+			arena->allocate(bytes, alignment) : ::operator new(bytes));
+	}
+	void deallocate(T* ptr, size_t n)
+	{
+		MemoryArena* arena = MemoryArena::findOwner(ptr);
+		if (arena)
+			arena->deallocate(ptr, n * sizeof(T), alignment);
+		else
+			::operator delete(ptr);
+	}
+
+	template<typename U> bool operator==(const ArenaStlAllocator<U>&) const	{ return true; }
+	template<typename U> bool operator!=(const ArenaStlAllocator<U>&) const	{ return false; }
+};
+
+
+template<typename T> using ScratchArray = Array<T, uint, ArenaAllocator>;
+template<typename T> using ScratchVector = std::vector<T, ArenaStlAllocator<T>>;
@@ -1,5 +1,9 @@
 #pragma once
 #include <initializer_list>
+#include <type_traits>
+#include <new>
+#include <string.h>
+#include <malloc.h>
 
 template< class T > struct remove_ref      {typedef T type;};
 template< class T > struct remove_ref<T&>  {typedef T type;};
@@ -16,13 +20,74 @@ typedef unsigned int uint;
 typedef unsigned long long uint64;
 
 
-template<typename T, typename SizeType = uint> 
+// Default allocator of Array: blocks aligned to a cache line, which realloc can grow in place.
+template<size_t Alignment = 64>
+struct AlignedAllocator
+{
+	static const size_t alignment = Alignment;
+
+	static void* allocate(size_t bytes)
+	{
+		void* ptr = _aligned_malloc(bytes, Alignment);
+		if (!ptr)
+			throw std::bad_alloc();
+		return ptr;
+	}
+	// _aligned_realloc() knows the old size itself.
+	static void* reallocate(void* ptr, size_t /*oldBytes*/, size_t newBytes)
+	{
+		void* newPtr = _aligned_realloc(ptr, newBytes, Alignment);
+		if (!newPtr)
+			throw std::bad_alloc();
+		return newPtr;
+	}
+	static void deallocate(void* ptr)		{ _aligned_free(ptr); }
+};
+
+
+/*
+Elements which are trivially copyable are copied and relocated by memcpy and realloc, and the others one at a time,
+by move construction when the storage grows. Allocator has the static functions of AlignedAllocator; reallocate()
+is used only for the trivially copyable elements, and is given the old size for allocators which copy the block
+themselves, as ArenaAllocator does.
+*/
+template<typename T, typename SizeType = uint, typename Allocator = AlignedAllocator<>> 
 class Array
 {
     SizeType _size = 0;
 	SizeType _capacity = 0;
     T* _data = nullptr;
 
+	static const bool trivial = std::is_trivially_copyable<T>::value;
+
+	SizeType grownCapacity() const			{ return _capacity >= 4 ? _capacity + _capacity / 2 : 4; }
+
+	// Moves the elements into storage of the given capacity, which is at least _size and not zero.
+	void relocate(SizeType capacity)
+	{
+		if (trivial)
+		{
+			_data = static_cast<T*>(_data ? 
+				Allocator::reallocate(_data, sizeof(T) * (size_t) _capacity, sizeof(T) * (size_t) capacity) : 
+				Allocator::allocate(sizeof(T) * (size_t) capacity));
+			_capacity = capacity;
+			return;
+		}
+
+		T* newData = static_cast<T*>(Allocator::allocate(sizeof(T) * (size_t) capacity));
+		for (SizeType i = 0; i < _size; ++i)
+		{
+			new (newData + i) T(move2(_data[i]));
+			_data[i].~T();
+		}
+
+		if(_data)
+			Allocator::deallocate(_data);
+
+		_data = newData;
+		_capacity = capacity;
+	}
+
 public:
 	~Array() { clear(); }
     Array() {}
@@ -36,9 +101,17 @@ public:
 			push_back(ele);
 		}
 	}
-	Array(const Array& arr) : _size(arr._size), _capacity(arr._capacity)
+	Array(const Array& arr) : _size(arr._size), _capacity(arr._size)
 	{
-		_data = static_cast<T*>(::operator new(sizeof(T) * _capacity));
+		if (_size == 0)
+			return;
+
+		_data = static_cast<T*>(Allocator::allocate(sizeof(T) * (size_t) _capacity));
+		if (trivial)
+		{
+			memcpy(_data, arr._data, sizeof(T) * (size_t) _size);
+			return;
+		}
 		for (SizeType i = 0; i < _size; ++i)
 		{
 			new (_data + i) T(arr._data[i]);
@@ -69,21 +142,16 @@ public:
 
 	void reserve(SizeType capacity)
 	{
-		if (capacity <= _capacity)
-			return;
-
-		T* newData = static_cast<T*>(::operator new(sizeof(T) * capacity));
-		for (SizeType i = 0; i < _size; ++i)
-		{
-			new (newData + i) T(_data[i]);
-			_data[i].~T();
-		}
-
-		if(_data)
-			::operator delete(_data);
+		if (capacity > _capacity)
+			relocate(capacity);
+	}
 
-		_data = newData;
-		_capacity = capacity;
+	void shrink_to_fit()
+	{
+		if (_size == 0)
+			clear();
+		else if (_size < _capacity)
+			relocate(_size);
 	}
 
 	void resize(SizeType size)
@@ -136,8 +204,12 @@ public:
 	{
 		if (_size == _capacity)
 		{
-			SizeType newCapacity = _capacity >= 4 ? (SizeType)((float)_capacity * 1.5f) : 4;
-			reserve(newCapacity);
+			// The value may be one of the elements, which the growth moves.
+			T copy(value);
+			reserve(grownCapacity());
+			new (_data + _size) T(move2(copy));
+			++_size;
+			return;
 		}
 		
 		new (_data + _size) T(value);
@@ -148,8 +220,11 @@ public:
 	{
 		if (_size == _capacity)
 		{
-			SizeType newCapacity = _capacity >= 4 ? (SizeType)((float)_capacity * 1.5f) : 4;
-			reserve(newCapacity);
+			T moved(move2(value));
+			reserve(grownCapacity());
+			new (_data + _size) T(move2(moved));
+			++_size;
+			return;
 		}
 		
 		new (_data + _size) T(move2(value));
@@ -164,7 +239,7 @@ public:
 		}
 
 		if(_data)
-			::operator delete(_data);
+			Allocator::deallocate(_data);
 		_data = nullptr;
 		_capacity = 0;
 		_size = 0;
@@ -180,3 +255,7 @@ public:
     const T* end() const					{return _data + _size;}
     const T& operator[](SizeType idx) const	{return _data[idx];}
 };
+
+
+// For arrays which can outgrow 2^32 elements, e.g. the concatenated geometry of huge scenes.
+template<typename T> using Array64 = Array<T, uint64>;
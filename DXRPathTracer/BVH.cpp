@@ -0,0 +1,276 @@
+#include "pch.h"
+#include "BVH.h"
+#include "ThreadPool.h"
+
+
+namespace {
+
+const uint numBins = 16;
+const float traversalCost = 1.0f;		// Relative to the cost of one primitive intersection.
+
+}
+
+
+AABB transformAABB(const Transform& tm, const AABB& box)
+{
+	AABB ret;
+	if (box.empty())
+		return ret;
+
+	float3 corners[8];
+	for (uint i = 0; i < 8; ++i)
+	{
+		corners[i] = float3(
+			(i & 1) ? box.upper.x : box.lower.x,
+			(i & 2) ? box.upper.y : box.lower.y,
+			(i & 4) ? box.upper.z : box.lower.z);
+	}
+	transformPoints(tm, corners, corners, 8);
+
+	for (const float3& corner : corners)
+		ret.grow(corner);
+	return ret;
+}
+
+BoundingSphere transformBoundingSphere(const Transform& tm, const BoundingSphere& sphere)
+{
+	BoundingSphere ret;
+	if (sphere.radius < 0.0f)
+		return ret;
+
+	float scaleX = length(transformVector(tm, float3(1.0f, 0.0f, 0.0f)));
+	float scaleY = length(transformVector(tm, float3(0.0f, 1.0f, 0.0f)));
+	float scaleZ = length(transformVector(tm, float3(0.0f, 0.0f, 1.0f)));
+	ret.center = transformPoint(tm, sphere.center);
+	ret.radius = sphere.radius * _max(scaleX, _max(scaleY, scaleZ));
+	return ret;
+}
+
+void BVH::build(const Array<AABB>& primBoundArr, uint maxLeafSize)
+{
+	uint numPrims = primBoundArr.size();
+	nodeArr.clear();
+	primIdxArr.resize(numPrims);
+
+	if (numPrims == 0)
+		return;
+
+	Array<float3> centroidArr(numPrims);
+	for (uint i = 0; i < numPrims; ++i)
+	{
+		primIdxArr[i] = i;
+		centroidArr[i] = primBoundArr[i].center();
+	}
+
+	nodeArr.reserve(2 * numPrims);
+	nodeArr.push_back(BVHNode());
+	buildRecursive(0, 0, 0, numPrims, primBoundArr, centroidArr, maxLeafSize);
+	buildSAHCost = computeSAHCost();
+}
+
+/*
+The children of a node always come after it in nodeArr. The top of the tree is cut into about 4 subtrees per thread,
+which are refitted in parallel, and then the nodes above the cut are refitted in the reverse of their breadth-first
+order, so that every node is visited after its children.
+*/
+void BVH::refit(const Array<AABB>& primBoundArr)
+{
+	if (nodeArr.size() == 0)
+		return;
+
+	ThreadPool& pool = ThreadPool::get();
+	Array<uint> topArr;
+	Array<uint> cutArr = { 0 };
+
+	while (cutArr.size() < pool.numThreads() * 4)
+	{
+		Array<uint> nextArr;
+		for (uint nodeIdx : cutArr)
+		{
+			const BVHNode& node = nodeArr[nodeIdx];
+			if (node.isLeaf())
+			{
+				nextArr.push_back(nodeIdx);
+			}
+			else
+			{
+				topArr.push_back(nodeIdx);
+				nextArr.push_back(node.childOrFirstPrim);
+				nextArr.push_back(node.childOrFirstPrim + 1);
+			}
+		}
+		if (nextArr.size() == cutArr.size())
+			break;
+		cutArr.swap(nextArr);
+	}
+
+	pool.parallelFor(0, cutArr.size(), 1, [&](uint i) {
+		refitRecursive(cutArr[i], primBoundArr);
+	});
+
+	for (uint i = topArr.size(); i-- > 0; )
+	{
+		BVHNode& node = nodeArr[topArr[i]];
+		node.box = nodeArr[node.childOrFirstPrim].box;
+		node.box.grow(nodeArr[node.childOrFirstPrim + 1].box);
+	}
+}
+
+AABB BVH::refitRecursive(uint nodeIdx, const Array<AABB>& primBoundArr)
+{
+	BVHNode& node = nodeArr[nodeIdx];
+	AABB box;
+
+	if (node.isLeaf())
+	{
+		for (uint i = 0; i < node.numPrims; ++i)
+			box.grow(primBoundArr[primIdxArr[node.childOrFirstPrim + i]]);
+	}
+	else
+	{
+		box = refitRecursive(node.childOrFirstPrim, primBoundArr);
+		box.grow(refitRecursive(node.childOrFirstPrim + 1, primBoundArr));
+	}
+
+	node.box = box;
+	return box;
+}
+
+void BVH::buildRecursive(uint nodeIdx, uint depth, uint begin, uint end,
+	const Array<AABB>& primBoundArr, const Array<float3>& centroidArr, uint maxLeafSize)
+{
+	struct Bin
+	{
+		AABB box;
+		uint count = 0;
+	};
+
+	AABB box, centroidBox;
+	for (uint i = begin; i < end; ++i)
+	{
+		box.grow(primBoundArr[primIdxArr[i]]);
+		centroidBox.grow(centroidArr[primIdxArr[i]]);
+	}
+	nodeArr[nodeIdx].box = box;
+
+	uint numPrims = end - begin;
+	auto makeLeaf = [&]() {
+		nodeArr[nodeIdx].childOrFirstPrim = begin;
+		nodeArr[nodeIdx].numPrims = numPrims;
+	};
+
+	// The tree depth is limited by the traversal stack, but binned splits never get close to it in practice.
+	if (numPrims <= 1 || depth >= maxDepth - 2)
+	{
+		makeLeaf();
+		return;
+	}
+
+	// Binned SAH over the axis with the widest centroid extent and the two others.
+	float bestCost = FLT_MAX;
+	uint bestAxis = 0, bestSplit = 0;
+	float3 centroidExtent = centroidBox.extent();
+
+	for (uint axis = 0; axis < 3; ++axis)
+	{
+		if (centroidExtent[axis] <= 0.0f)
+			continue;
+
+		Bin bins[numBins];
+		float scale = numBins / centroidExtent[axis];
+		for (uint i = begin; i < end; ++i)
+		{
+			uint prim = primIdxArr[i];
+			uint b = _min((uint) ((centroidArr[prim][axis] - centroidBox.lower[axis]) * scale), numBins - 1);
+			bins[b].count++;
+			bins[b].box.grow(primBoundArr[prim]);
+		}
+
+		float rightArea[numBins];
+		uint rightCount[numBins];
+		AABB accum;
+		uint count = 0;
+		for (uint b = numBins - 1; b > 0; --b)
+		{
+			accum.grow(bins[b].box);
+			count += bins[b].count;
+			rightArea[b] = accum.halfArea();
+			rightCount[b] = count;
+		}
+
+		accum = AABB();
+		count = 0;
+		for (uint b = 0; b < numBins - 1; ++b)
+		{
+			accum.grow(bins[b].box);
+			count += bins[b].count;
+			float cost = accum.halfArea() * count + rightArea[b + 1] * rightCount[b + 1];
+			if (count > 0 && rightCount[b + 1] > 0 && cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = b + 1;
+			}
+		}
+	}
+
+	float leafCost = box.halfArea() * numPrims;
+	float splitCost = box.halfArea() * traversalCost + bestCost;
+
+	if (numPrims <= maxLeafSize && (splitCost >= leafCost || bestCost == FLT_MAX))
+	{
+		makeLeaf();
+		return;
+	}
+
+	uint mid;
+	if (bestCost != FLT_MAX)
+	{
+		float scale = numBins / centroidExtent[bestAxis];
+		uint* first = &primIdxArr[begin];
+		uint* last = first + numPrims;
+		while (first < last)
+		{
+			uint b = _min((uint) ((centroidArr[*first][bestAxis] - centroidBox.lower[bestAxis]) * scale), numBins - 1);
+			if (b < bestSplit)
+				++first;
+			else
+			{
+				--last;
+				uint temp = *first; *first = *last; *last = temp;
+			}
+		}
+		mid = (uint) (first - primIdxArr.data());
+	}
+	else
+	{
+		mid = begin + numPrims / 2;
+	}
+
+	if (mid == begin || mid == end)
+		mid = begin + numPrims / 2;
+
+	uint left = nodeArr.size();
+	nodeArr.push_back(BVHNode());
+	nodeArr.push_back(BVHNode());
+	nodeArr[nodeIdx].childOrFirstPrim = left;
+	nodeArr[nodeIdx].numPrims = 0;
+
+	buildRecursive(left, depth + 1, begin, mid, primBoundArr, centroidArr, maxLeafSize);
+	buildRecursive(left + 1, depth + 1, mid, end, primBoundArr, centroidArr, maxLeafSize);
+}
+
+float BVH::computeSAHCost() const
+{
+	if (nodeArr.size() == 0)
+		return 0.0f;
+
+	float rootArea = _max(nodeArr[0].box.halfArea(), 1e-20f);
+	float cost = 0.0f;
+	for (const BVHNode& node : nodeArr)
+	{
+		float relativeArea = node.box.halfArea() / rootArea;
+		cost += relativeArea * (node.isLeaf() ? (float) node.numPrims : traversalCost);
+	}
+	return cost;
+}
@@ -0,0 +1,180 @@
+#pragma once
+#include "pch.h"
+#include <float.h>
+
+
+struct AABB
+{
+	float3 lower = float3(FLT_MAX);
+	float3 upper = float3(-FLT_MAX);
+
+	AABB() {}
+	AABB(const float3& lower, const float3& upper) : lower(lower), upper(upper) {}
+
+	void grow(const float3& p)		{ lower = _min(lower, p); upper = _max(upper, p); }
+	void grow(const AABB& box)		{ lower = _min(lower, box.lower); upper = _max(upper, box.upper); }
+	bool empty() const				{ return lower.x > upper.x; }
+	float3 center() const			{ return 0.5f * (lower + upper); }
+	float3 extent() const			{ return upper - lower; }
+	float halfArea() const
+	{
+		if (empty())
+			return 0.0f;
+		float3 e = extent();
+		return e.x * e.y + e.y * e.z + e.z * e.x;
+	}
+};
+
+AABB transformAABB(const Transform& tm, const AABB& box);
+
+
+struct BoundingSphere
+{
+	float3 center = float3(0.0f);
+	float radius = -1.0f;		// Negative for an empty sphere.
+};
+
+// Bounds the sphere under a transform with uniform or non-uniform scale.
+BoundingSphere transformBoundingSphere(const Transform& tm, const BoundingSphere& sphere);
+
+
+struct Ray
+{
+	float3 origin;
+	float3 direction;
+	float3 invDirection;
+	float tMin;
+	float tMax;
+
+	Ray() {}
+	Ray(const float3& origin, const float3& direction, float tMin, float tMax)
+		: origin(origin), direction(direction), invDirection(1.0f / direction), tMin(tMin), tMax(tMax) {}
+};
+
+// Returns the entry distance, or FLT_MAX if the ray misses the box within [tMin, tMax].
+inline float intersectAABB(const Ray& ray, const AABB& box)
+{
+	float3 t0 = (box.lower - ray.origin) * ray.invDirection;
+	float3 t1 = (box.upper - ray.origin) * ray.invDirection;
+	float3 tNear = _min(t0, t1);
+	float3 tFar = _max(t0, t1);
+	float tEnter = _max(_max(tNear.x, tNear.y), _max(tNear.z, ray.tMin));
+	float tExit = _min(_min(tFar.x, tFar.y), _min(tFar.z, ray.tMax));
+	return tEnter <= tExit ? tEnter : FLT_MAX;
+}
+
+
+struct BVHNode
+{
+	AABB box;
+	uint childOrFirstPrim;	// Inner node: index of the left child (the right one follows it). Leaf: offset into the primitive index array.
+	uint numPrims;			// Zero for inner nodes.
+
+	bool isLeaf() const { return numPrims > 0; }
+};
+
+
+/*
+Binned SAH bounding volume hierarchy over abstract primitives given by their bounds.
+It is used for both levels of the CPU tracer: over the triangles of a mesh, and over the scene objects.
+*/
+class BVH
+{
+	Array<BVHNode> nodeArr;
+	Array<uint> primIdxArr;
+
+	float buildSAHCost = 0.0f;
+
+	void buildRecursive(uint nodeIdx, uint depth, uint begin, uint end, const Array<AABB>& primBoundArr, const Array<float3>& centroidArr, uint maxLeafSize);
+	AABB refitRecursive(uint nodeIdx, const Array<AABB>& primBoundArr);
+
+public:
+	static const uint maxDepth = 64;
+
+	void build(const Array<AABB>& primBoundArr, uint maxLeafSize = 4);
+	void clear() { nodeArr.clear(); primIdxArr.clear(); buildSAHCost = 0.0f; }
+
+	// Recomputes the node boxes for new bounds of the same primitives and keeps the topology, which gets worse as the
+	// primitives move apart from where they were built. Compare computeSAHCost() with getBuildSAHCost() to decide
+	// when to build again.
+	void refit(const Array<AABB>& primBoundArr);
+
+	uint numNodes() const						{ return nodeArr.size(); }
+	const BVHNode& getNode(uint i) const		{ return nodeArr[i]; }
+	const Array<uint>& getPrimIndices() const	{ return primIdxArr; }
+	AABB getBounds() const						{ return nodeArr.size() ? nodeArr[0].box : AABB(); }
+	float computeSAHCost() const;
+	float getBuildSAHCost() const				{ return buildSAHCost; }
+	uint64 memorySize() const					{ return nodeArr.size() * sizeof(BVHNode) + primIdxArr.size() * sizeof(uint); }
+
+	// intersectPrim(uint primIdx, Ray& ray) tests one primitive and shortens ray.tMax on a closer hit.
+	// With anyHit, it returns as soon as intersectPrim() reports a hit (for shadow rays).
+	template<typename IntersectPrim>
+	bool traverse(Ray& ray, IntersectPrim&& intersectPrim, bool anyHit = false) const
+	{
+		return traverseSlots(ray, [&](uint slot, Ray& ray) { return intersectPrim(primIdxArr[slot], ray); }, anyHit);
+	}
+
+	// The same with the slot of the primitive in getPrimIndices() instead of its index: the primitives of a leaf
+	// have consecutive slots, so that data stored in the slot order is read sequentially.
+	template<typename IntersectPrim>
+	bool traverseSlots(Ray& ray, IntersectPrim&& intersectPrim, bool anyHit = false) const;
+};
+
+
+template<typename IntersectPrim>
+bool BVH::traverseSlots(Ray& ray, IntersectPrim&& intersectPrim, bool anyHit) const
+{
+	if (nodeArr.size() == 0 || intersectAABB(ray, nodeArr[0].box) == FLT_MAX)
+		return false;
+
+	uint stack[maxDepth];
+	uint stackSize = 0;
+	uint nodeIdx = 0;
+	bool hit = false;
+
+	while (true)
+	{
+		const BVHNode& node = nodeArr[nodeIdx];
+
+		if (node.isLeaf())
+		{
+			for (uint i = 0; i < node.numPrims; ++i)
+			{
+				if (intersectPrim(node.childOrFirstPrim + i, ray))
+				{
+					hit = true;
+					if (anyHit)
+						return true;
+				}
+			}
+		}
+		else
+		{
+			uint left = node.childOrFirstPrim;
+			float tLeft = intersectAABB(ray, nodeArr[left].box);
+			float tRight = intersectAABB(ray, nodeArr[left + 1].box);
+
+			if (tLeft != FLT_MAX || tRight != FLT_MAX)
+			{
+				// Visit the nearer child first so that tMax shrinks early.
+				uint nearChild = (tLeft <= tRight) ? left : left + 1;
+				uint farChild = (tLeft <= tRight) ? left + 1 : left;
+				if (tLeft != FLT_MAX && tRight != FLT_MAX)
+					stack[stackSize++] = farChild;
+				nodeIdx = nearChild;
+				continue;
+			}
+		}
+
+		// Pop the nodes which are now farther than the closest hit found so far.
+		while (true)
+		{
+			if (stackSize == 0)
+				return hit;
+			nodeIdx = stack[--stackSize];
+			if (intersectAABB(ray, nodeArr[nodeIdx].box) != FLT_MAX)
+				break;
+		}
+	}
+}
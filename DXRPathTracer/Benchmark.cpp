@@ -0,0 +1,1866 @@
+#include "pch.h"
+#include "Benchmark.h"
+#include "Mesh.h"
+#include "SceneLoader.h"
+#include "CPUPathTracer.h"
+#include "sampling.h"
+#include "fastMath.h"
+#include "ToneMapper.h"
+#include "writeImage.h"
+#include "deflate.h"
+#include "pixelFormat.h"
+#include "ThreadPool.h"
+#include "SoftwareQueue.h"
+#include "FrameQueue.h"
+#include "TiledRender.h"
+#include "FrameBudget.h"
+#include "Checkpoint.h"
+#include "DistributedRender.h"
+#include "Input.h"
+#include "timer.h"
+#include <vector>
+#include <chrono>
+
+
+namespace {
+
+const uint numRuns = 5;
+
+// Best time of numRuns calls of func, in milliseconds.
+template<typename Func>
+double measure(Func func)
+{
+	double best = 1e30;
+	for (uint run = 0; run < numRuns; ++run)
+	{
+		double startTime = getCurrentTime();
+		func();
+		best = _min(best, (getCurrentTime() - startTime) * 1000.0);
+	}
+	return best;
+}
+
+void printCase(const char* name, double arrayTime, double vectorTime)
+{
+	printf("    %-36s Array %9.3f ms   std::vector %9.3f ms   (%.2fx)\n", name, arrayTime, vectorTime, vectorTime / arrayTime);
+}
+
+volatile uint64 sink;
+
+// Reads the container, so that the compiler cannot drop its construction.
+template<typename Container>
+void consume(const Container& c)
+{
+	sink = c.size() + (c.size() ? *(const unsigned char*) &c[c.size() - 1] : 0);
+}
+
+template<typename T>
+void benchmarkContainers(const char* typeName, uint count, const T& value)
+{
+	char name[64];
+
+	snprintf(name, sizeof(name), "push_back %u %s", count, typeName);
+	double arrayTime = measure([&]() {
+		Array<T> arr;
+		for (uint i = 0; i < count; ++i)
+			arr.push_back(value);
+		consume(arr);
+	});
+	double vectorTime = measure([&]() {
+		std::vector<T> vec;
+		for (uint i = 0; i < count; ++i)
+			vec.push_back(value);
+		consume(vec);
+	});
+	printCase(name, arrayTime, vectorTime);
+
+	snprintf(name, sizeof(name), "resize %u %s", count, typeName);
+	arrayTime = measure([&]() {
+		Array<T> arr;
+		arr.resize(count, value);
+		consume(arr);
+	});
+	vectorTime = measure([&]() {
+		std::vector<T> vec;
+		vec.resize(count, value);
+		consume(vec);
+	});
+	printCase(name, arrayTime, vectorTime);
+
+	snprintf(name, sizeof(name), "copy %u %s", count, typeName);
+	Array<T> srcArr(count, value);
+	std::vector<T> srcVec(count, value);
+	arrayTime = measure([&]() {
+		Array<T> arr(srcArr);
+		consume(arr);
+	});
+	vectorTime = measure([&]() {
+		std::vector<T> vec(srcVec);
+		consume(vec);
+	});
+	printCase(name, arrayTime, vectorTime);
+}
+
+bool benchmarkArray()
+{
+	printf("Array against std::vector, best of %u runs\n", numRuns);
+
+	benchmarkContainers("float", 1 << 24, 1.0f);
+	benchmarkContainers("Tridex", 1 << 22, Tridex(0, 1, 2));
+
+	Vertex vertex;
+	vertex.position = float3(1.0f, 2.0f, 3.0f);
+	vertex.normal = float3(0.0f, 1.0f, 0.0f);
+	vertex.texcoord = float2(0.5f, 0.5f);
+	benchmarkContainers("Vertex", 1 << 22, vertex);
+
+	// Not trivially copyable, so relocated one at a time by move construction.
+	Array<uint> small(16, 7u);
+	std::vector<uint> smallVec(16, 7u);
+	char name[64];
+	uint count = 1 << 18;
+	snprintf(name, sizeof(name), "push_back %u Array<uint>(16)", count);
+	double arrayTime = measure([&]() {
+		Array<Array<uint>> arr;
+		for (uint i = 0; i < count; ++i)
+			arr.push_back(small);
+		consume(arr);
+	});
+	double vectorTime = measure([&]() {
+		std::vector<std::vector<uint>> vec;
+		for (uint i = 0; i < count; ++i)
+			vec.push_back(smallVec);
+		consume(vec);
+	});
+	printCase(name, arrayTime, vectorTime);
+	return true;
+}
+
+void printSpeedup(const char* name, double baseTime, double fastTime)
+{
+	printf("    %-36s scalar %8.3f ms   SIMD %8.3f ms   (%.2fx)\n", name, baseTime, fastTime, baseTime / fastTime);
+}
+
+// The batch transforms of basic_math.cpp against loops of the scalar functions, and the matrix algebra, in time
+// and in precision.
+bool benchmarkMath()
+{
+	printf("Transforms, best of %u runs\n", numRuns);
+
+	const uint count = 1 << 22;
+	Array<float3> srcArr(count), dstArr(count);
+	uint seed = 7;
+	for (float3& p : srcArr)
+		p = float3(rnd(seed), rnd(seed), rnd(seed)) * 2.0f - float3(1.0f);
+
+	Transform tm = composeMatrix(float3(1.0f, 2.0f, 3.0f), getRotationAsQuternion(normalize(float3(1.0f, 1.0f, 0.0f)), 30.0f), 2.0f);
+	Transform normalMatrix = inverseTranspose(tm);
+	char name[64];
+
+	snprintf(name, sizeof(name), "transform %u points", count);
+	double scalarTime = measure([&]() {
+		for (uint i = 0; i < count; ++i)
+			dstArr[i] = transformPoint(tm, srcArr[i]);
+		consume(dstArr);
+	});
+	double simdTime = measure([&]() {
+		transformPoints(tm, srcArr.data(), dstArr.data(), count);
+		consume(dstArr);
+	});
+	printSpeedup(name, scalarTime, simdTime);
+
+	snprintf(name, sizeof(name), "transform %u normals", count);
+	scalarTime = measure([&]() {
+		for (uint i = 0; i < count; ++i)
+			dstArr[i] = normalize(transformVector(normalMatrix, srcArr[i]));
+		consume(dstArr);
+	});
+	simdTime = measure([&]() {
+		transformNormals(normalMatrix, srcArr.data(), dstArr.data(), count);
+		consume(dstArr);
+	});
+	printSpeedup(name, scalarTime, simdTime);
+
+	const uint numMatrices = 1 << 20;
+	Transform acc = Transform::identity();
+	snprintf(name, sizeof(name), "%u inverses", numMatrices);
+	double time = measure([&]() {
+		for (uint i = 0; i < numMatrices; ++i)
+			acc = inverse(tm * acc);
+		sink = (uint64) acc.mat[0][3];
+	});
+	printf("    %-36s %8.3f ms (with a multiply each)\n", name, time);
+
+	// The batches against the scalar functions, relative to the length of the result, and inverse(M) * M against
+	// the identity on transforms made by composeMatrix() and sheared, so that the inverse has no shortcut.
+	printf("Transforms against the scalar functions\n");
+	double pointError = 0.0, normalError = 0.0, inverseError = 0.0;
+	transformPoints(tm, srcArr.data(), dstArr.data(), count);
+	for (uint i = 0; i < count; ++i)
+	{
+		float3 p = transformPoint(tm, srcArr[i]);
+		pointError = _max(pointError, (double) length(dstArr[i] - p) / _max(length(p), 1.0f));
+	}
+	transformNormals(normalMatrix, srcArr.data(), dstArr.data(), count);
+	for (uint i = 0; i < count; ++i)
+		normalError = _max(normalError, (double) length(dstArr[i] - normalize(transformVector(normalMatrix, srcArr[i]))));
+
+	Transform shear = Transform::identity();
+	shear.mat[0][1] = shear.mat[1][2] = 0.5f;
+	shear.mat[2][0] = -0.25f;
+	for (uint i = 0; i < 10000; ++i)
+	{
+		float3 translation = float3(rnd(seed), rnd(seed), rnd(seed)) * 20.0f - float3(10.0f);
+		float3 axis = float3(rnd(seed), rnd(seed), rnd(seed)) * 2.0f - float3(1.0f) + float3(0.0f, 1e-3f, 0.0f);
+		float scale = (float) exp2(rnd(seed) * 8.0f - 4.0f);
+		Transform m = composeMatrix(translation, getRotationAsQuternion(normalize(axis), rnd(seed) * 360.0f), scale) * shear;
+		Transform product = inverse(m) * m;
+		for (int r = 0; r < 4; ++r)
+			for (int c = 0; c < 4; ++c)
+				inverseError = _max(inverseError, (double) fabsf(product.mat[r][c] - (r == c ? 1.0f : 0.0f)));
+	}
+
+	bool pass = true;
+	auto report = [&](const char* checkName, double error, double bound) {
+		printf("    %-36s max error %.3g, bound %.3g   %s\n", checkName, error, bound, error <= bound ? "PASS" : "FAIL");
+		pass &= error <= bound;
+	};
+	report("transformPoints", pointError, 1e-6);
+	report("transformNormals", normalError, 1e-6);
+	report("inverse(M) * M", inverseError, 1e-5);
+	return pass;
+}
+
+/*
+Returns whether the rays hit as with the indexed layout, at the same distance up to rounding. The layouts test the
+triangles with other arithmetic, so a ray through an edge shared by two triangles can slip between them under one
+test and not the other; a bug in a layout moves far more than those few rays.
+*/
+bool traceBatch(const char* name, const CPUPathTracer& tracer, const Array<float3>& originArr,
+	const Array<float3>& directionArr, const Array<float>& indexedTArr)
+{
+	Array<float> tArr;
+	uint numHits = 0;
+	double time = measure([&]() { numHits = tracer.traceRays(originArr, directionArr, tArr); });
+
+	uint numDiffering = 0;
+	for (uint i = 0; i < tArr.size(); ++i)
+	{
+		bool hit = tArr[i] != FLT_MAX;
+		if (hit != (indexedTArr[i] != FLT_MAX) || (hit && fabsf(tArr[i] - indexedTArr[i]) > 1e-3f * (1.0f + tArr[i])))
+			++numDiffering;
+	}
+	printf("    %-10s %8.2f Mrays/s   %5u hits", name, originArr.size() / (time * 1000.0), numHits);
+	if (numDiffering > 0)
+		printf("   (%u rays differ from indexed)", numDiffering);
+	printf("\n");
+	return numDiffering <= tArr.size() / 10000;
+}
+
+// The leaf intersectors on the triangles of the hyperion scene, without analytic shapes or levels of detail so that
+// every intersection is with a full mesh. The secondary rays start on the primary hits in uniform directions,
+// which is how most of the rays of a path tracer read the triangles.
+bool benchmarkTriangles()
+{
+	SceneLoader loader;
+	Scene* scene = loader.push_hyperionTestScene();
+
+	CPUPathTracer tracer(640, 360);
+	tracer.setUseAnalyticPrimitives(false);
+	tracer.setUseLODs(false);
+	tracer.setupScene(scene);
+
+	const OrbitCamera& camera = tracer.getCamera();
+	float3 cameraPos = camera.getCameraPos();
+	float2 cameraAspect = camera.getCameraAspect();
+	Array<float3> primaryOrigins, primaryDirections;
+	for (uint y = 0; y < 360; ++y)
+	{
+		for (uint x = 0; x < 640; ++x)
+		{
+			float2 ndc((x + 0.5f) / 640 * 2.f - 1.f, (y + 0.5f) / 360 * 2.f - 1.f);
+			primaryOrigins.push_back(cameraPos);
+			primaryDirections.push_back(normalize(ndc.x*cameraAspect.x*camera.getCameraX() +
+				ndc.y*cameraAspect.y*camera.getCameraY() + camera.getCameraZ()));
+		}
+	}
+
+	Array<float> tArr;
+	tracer.traceRays(primaryOrigins, primaryDirections, tArr);
+	Array<float3> secondaryOrigins, secondaryDirections;
+	uint seed = 1;
+	for (uint i = 0; i < tArr.size(); ++i)
+	{
+		if (tArr[i] == FLT_MAX)
+			continue;
+		float3 dir;
+		do
+			dir = float3(rnd(seed), rnd(seed), rnd(seed)) * 2.0f - float3(1.0f);
+		while (dot(dir, dir) > 1.0f || dot(dir, dir) < 1e-4f);
+		secondaryOrigins.push_back(primaryOrigins[i] + primaryDirections[i] * (tArr[i] * 0.999f));
+		secondaryDirections.push_back(normalize(dir));
+	}
+
+	struct Config
+	{
+		const char* name;
+		TriangleLayout layout;
+		bool soa;
+		uint bytesPerTest;		// Read by one triangle test.
+	};
+	const Config configs[] = {
+		{ "indexed interleaved", TriangleLayout::Indexed, false, sizeof(Tridex) + 3 * sizeof(Vertex) },
+		{ "indexed SoA", TriangleLayout::Indexed, true, sizeof(Tridex) + 3 * sizeof(float3) },
+		{ "edges", TriangleLayout::Edges, true, sizeof(CPUTriangleEdges) },
+		{ "woop", TriangleLayout::Woop, true, sizeof(CPUTriangleWoop) },
+	};
+
+	printf("Triangle layouts, %u primary and %u secondary rays, best of %u runs\n", primaryOrigins.size(),
+		secondaryOrigins.size(), numRuns);
+	Array<float> primaryTArr, secondaryTArr;
+	bool pass = true;
+	for (const Config& config : configs)
+	{
+		tracer.setUseSoAGeometry(config.soa);
+		tracer.setTriangleLayout(config.layout);
+		printf("  %s: %.1f MB of triangle data, %u bytes per triangle test\n", config.name,
+			tracer.triangleDataSize() / (1024.0 * 1024.0), config.bytesPerTest);
+
+		if (&config == configs)
+		{
+			tracer.traceRays(primaryOrigins, primaryDirections, primaryTArr);
+			tracer.traceRays(secondaryOrigins, secondaryDirections, secondaryTArr);
+		}
+		pass &= traceBatch("primary", tracer, primaryOrigins, primaryDirections, primaryTArr);
+		pass &= traceBatch("secondary", tracer, secondaryOrigins, secondaryDirections, secondaryTArr);
+	}
+	printf("  %s\n", pass ? "PASS" : "FAIL");
+	return pass;
+}
+
+// Largest error of a fast function against libm over a sweep, against the bound documented in fastMath.h.
+struct ErrorCheck
+{
+	const char* name;
+	double bound;
+	double maxError = 0.0;
+	float worstX = 0.0f;
+
+	ErrorCheck(const char* name, double bound) : name(name), bound(bound) {}
+
+	void add(float x, double error)
+	{
+		if (error > maxError)
+		{
+			maxError = error;
+			worstX = x;
+		}
+	}
+	bool report() const
+	{
+		bool pass = maxError <= bound;
+		printf("    %-36s max error %.3g (at %g), bound %.3g   %s\n", name, maxError, worstX, bound, pass ? "PASS" : "FAIL");
+		return pass;
+	}
+};
+
+inline double relativeError(double approx, double exact)
+{
+	return fabs(approx - exact) / fabs(exact);
+}
+
+// Samples of [lo, hi], uniformly or uniformly in the exponent, with both ends.
+template<typename Func>
+void sweep(float lo, float hi, uint count, bool logarithmic, Func func)
+{
+	for (uint i = 0; i <= count; ++i)
+	{
+		float t = (float) i / count;
+		float x = logarithmic ? (float) exp2(log2(lo) + (log2(hi) - log2(lo)) * t) : lo + (hi - lo) * t;
+		func(_min(_max(x, lo), hi));
+	}
+}
+
+// The whole table of fastMath.h; returns whether every bound holds.
+bool checkFastMath()
+{
+	const uint count = 1 << 20;
+	bool pass = true;
+
+	ErrorCheck sinCheck("sin, |x| <= 8192 (absolute)", 2e-7), cosCheck("cos, |x| <= 8192 (absolute)", 2e-7);
+	sweep(-8192.0f, 8192.0f, count * 8, false, [&](float x) {
+		float s, c;
+		fastSinCos(x, s, c);
+		sinCheck.add(x, fabs(s - sin((double) x)));
+		cosCheck.add(x, fabs(c - cos((double) x)));
+	});
+	sweep(-4.0f * Pi, 4.0f * Pi, count, false, [&](float x) {
+		sinCheck.add(x, fabs(fastSin(x) - sin((double) x)));
+		cosCheck.add(x, fabs(fastCos(x) - cos((double) x)));
+	});
+	pass &= sinCheck.report();
+	pass &= cosCheck.report();
+
+	ErrorCheck exp2Check("exp2, [-126, 127] (relative)", 3e-7);
+	sweep(-126.0f, 127.0f, count, false, [&](float x) { exp2Check.add(x, relativeError(fastExp2(x), exp2((double) x))); });
+	pass &= exp2Check.report();
+
+	ErrorCheck expCheck("exp, [-87, 88] (relative)", 3e-7);
+	sweep(-87.0f, 88.0f, count, false, [&](float x) { expCheck.add(x, relativeError(fastExp(x), exp((double) x))); });
+	pass &= expCheck.report();
+
+	ErrorCheck log2NearCheck("log2, [1/2, 2] (absolute)", 2e-7), log2Check("log2, elsewhere (relative)", 2e-7);
+	sweep(0.5f, 2.0f, count, false, [&](float x) { log2NearCheck.add(x, fabs(fastLog2(x) - log2((double) x))); });
+	sweep(FLT_MIN, 0.5f, count, true, [&](float x) { log2Check.add(x, relativeError(fastLog2(x), log2((double) x))); });
+	sweep(2.0f, FLT_MAX, count, true, [&](float x) { log2Check.add(x, relativeError(fastLog2(x), log2((double) x))); });
+	pass &= log2NearCheck.report();
+	pass &= log2Check.report();
+
+	// Exponents of shading and tone mapping, on bases which keep |y*log2(x)| <= 64.
+	ErrorCheck powCheck("pow, |y*log2(x)| <= 64 (relative)", 5e-6);
+	const float exponents[] = { -2.0f, -1.0f / 2.4f, 0.5f, 1.0f / 2.2f, 1.0f / 2.4f, 2.2f, 5.0f, 8.0f };
+	for (float y : exponents)
+	{
+		float maxLog = 64.0f / fabsf(y);
+		sweep(exp2f(-_min(maxLog, 126.0f)), exp2f(_min(maxLog, 127.0f)), count / 8, true, [&](float x) {
+			powCheck.add(x, relativeError(fastPow(x, y), pow((double) x, (double) y)));
+		});
+	}
+	pass &= powCheck.report();
+
+	ErrorCheck pow5Check("pow5, normal results (relative)", 4e-7);
+	sweep(1.0f / 65536.0f, 1.0f, count, true, [&](float x) { pow5Check.add(x, relativeError(fastPow5(x), pow((double) x, 5.0))); });
+	sweep(1.0f, 1e7f, count, true, [&](float x) { pow5Check.add(x, relativeError(fastPow5(x), pow((double) x, 5.0))); });
+	pass &= pow5Check.report();
+
+	ErrorCheck sqrtCheck("sqrt, normal x >= 0 (relative)", 4e-7);
+	sweep(FLT_MIN, FLT_MAX, count, true, [&](float x) { sqrtCheck.add(x, relativeError(fastSqrt(x), sqrt((double) x))); });
+	sweep(0.0f, 1.0f, count, false, [&](float x) {
+		if (x > 0.0f)
+			sqrtCheck.add(x, relativeError(fastSqrt(x), sqrt((double) x)));
+		else if (fastSqrt(x) != 0.0f)
+			sqrtCheck.add(x, 1.0);
+	});
+	pass &= sqrtCheck.report();
+
+	return pass;
+}
+
+// Sum of func over an array, scalar or four lanes at a time.
+template<typename Func>
+double timeScalar(const Array<float>& xArr, Func func)
+{
+	return measure([&]() {
+		float sum = 0.0f;
+		for (float x : xArr)
+			sum += func(x);
+		sink = (uint64) sum;
+	});
+}
+
+template<typename Func>
+double timeVector(const Array<float>& xArr, Func func)
+{
+	return measure([&]() {
+		__m128 sum = _mm_setzero_ps();
+		for (uint i = 0; i < xArr.size(); i += 4)
+			sum = _mm_add_ps(sum, func(_mm_loadu_ps(&xArr[i])));
+		sink = (uint64) _mm_cvtss_f32(sum);
+	});
+}
+
+void printMathTimes(const char* name, uint count, double libmTime, double scalarTime, double vectorTime)
+{
+	printf("    %-8s libm %7.2f ns   fast %7.2f ns (%.2fx)   fast x4 %7.2f ns (%.2fx)\n", name,
+		libmTime * 1e6 / count, scalarTime * 1e6 / count, libmTime / scalarTime, vectorTime * 1e6 / count,
+		libmTime / vectorTime);
+}
+
+// The accuracy of fastMath.h against its documented bounds, the cost of each function against libm, and what the
+// fast shading gains in a whole frame of the CPU tracer.
+bool benchmarkFastMath()
+{
+	printf("fastMath.h accuracy against libm\n");
+	bool pass = checkFastMath();
+	printf("  %s\n", pass ? "all bounds hold" : "SOME BOUNDS DO NOT HOLD");
+
+	const uint count = 1 << 22;
+	Array<float> angleArr(count), unitArr(count), expArr(count), posArr(count);
+	uint seed = 3;
+	for (uint i = 0; i < count; ++i)
+	{
+		float u = rnd(seed);
+		angleArr[i] = Pi2 * u;
+		unitArr[i] = u;
+		expArr[i] = 20.0f * u - 10.0f;
+		posArr[i] = 1e-3f + 100.0f * u;
+	}
+
+	printf("Per call, %u calls, best of %u runs\n", count, numRuns);
+	printMathTimes("sincos", count,
+		timeScalar(angleArr, [](float x) { return sinf(x) + cosf(x); }),
+		timeScalar(angleArr, [](float x) { float s, c; fastSinCos(x, s, c); return s + c; }),
+		timeVector(angleArr, [](__m128 x) { __m128 s, c; fastSinCos(x, s, c); return _mm_add_ps(s, c); }));
+	printMathTimes("exp", count,
+		timeScalar(expArr, [](float x) { return expf(x); }),
+		timeScalar(expArr, [](float x) { return fastExp(x); }),
+		timeVector(expArr, [](__m128 x) { return fastExp(x); }));
+	printMathTimes("log2", count,
+		timeScalar(posArr, [](float x) { return log2f(x); }),
+		timeScalar(posArr, [](float x) { return fastLog2(x); }),
+		timeVector(posArr, [](__m128 x) { return fastLog2(x); }));
+	printMathTimes("pow", count,
+		timeScalar(posArr, [](float x) { return powf(x, 1.0f / 2.2f); }),
+		timeScalar(posArr, [](float x) { return fastPow(x, 1.0f / 2.2f); }),
+		timeVector(posArr, [](__m128 x) { return fastPow(x, _mm_set1_ps(1.0f / 2.2f)); }));
+	printMathTimes("pow5", count,
+		timeScalar(unitArr, [](float x) { return powf(x, 5); }),
+		timeScalar(unitArr, [](float x) { return fastPow5(x); }),
+		timeVector(unitArr, [](__m128 x) { return fastPow5(x); }));
+	printMathTimes("sqrt", count,
+		timeScalar(unitArr, [](float x) { return sqrtf(x); }),
+		timeScalar(unitArr, [](float x) { return fastSqrt(x); }),
+		timeVector(unitArr, [](__m128 x) { return fastSqrt(x); }));
+
+	SceneLoader loader;
+	Scene* scene = loader.push_hyperionTestScene();
+	CPUPathTracer tracer(640, 360);
+	tracer.setupScene(scene);
+
+	printf("CPUPathTracer frames of the hyperion scene at 640x360, best of %u runs\n", numRuns);
+	const MathMode modes[] = { MathMode::Exact, MathMode::Fast };
+	for (MathMode mode : modes)
+	{
+		tracer.setMathMode(mode);
+		double time = measure([&]() { tracer.shootRays(); });
+		printf("    %-6s %8.2f ms   %6.2f Mrays/s\n", mode == MathMode::Fast ? "fast" : "exact", time,
+			tracer.getNumRaysTraced() / (time * 1000.0));
+	}
+	return pass;
+}
+
+// ToneMapper on a 4K HDR image against the exact curves with libm, one pixel at a time on one thread.
+bool benchmarkToneMapping()
+{
+	const uint width = 3840, height = 2160;
+	Array<float4> hdrImage(width * height);
+	uint seed = 5;
+	for (float4& p : hdrImage)
+	{
+		// About 12 stops around 1, and some fireflies.
+		float scale = exp2f(12.0f * rnd(seed) - 8.0f) * (rnd(seed) < 0.001f ? 1000.0f : 1.0f);
+		p = float4(rnd(seed) * scale, rnd(seed) * scale, rnd(seed) * scale, 1.0f);
+	}
+	TracedResult trResult = { hdrImage.data(), width, height, sizeof(float4) };
+
+	uint pitch = width * 4;
+	Array<uint8> ldrImage(pitch * height), exactImage(pitch * height);
+
+	printf("Tone mapping %ux%u on %u threads, best of %u runs\n", width, height, ThreadPool::get().numThreads(), numRuns);
+	const char* opNames[] = { "exponential", "ACES", "Reinhard" };
+	bool pass = true;
+	const ToneOperator ops[] = { ToneOperator::Exponential, ToneOperator::ACES, ToneOperator::Reinhard };
+	for (uint i = 0; i < 3; ++i)
+	{
+		ToneMapSettings settings;
+		settings.op = ops[i];
+		ToneMapper toneMapper(settings);
+
+		double exactTime = measure([&]() {
+			for (uint p = 0; p < width * height; ++p)
+			{
+				const float4& c = hdrImage[p];
+				uint8* out = &exactImage[4 * p];
+				out[0] = (uint8) (ToneMapper::mapChannel(c.x * settings.exposure, settings.op, false) * 255.0f + 0.5f);
+				out[1] = (uint8) (ToneMapper::mapChannel(c.y * settings.exposure, settings.op, false) * 255.0f + 0.5f);
+				out[2] = (uint8) (ToneMapper::mapChannel(c.z * settings.exposure, settings.op, false) * 255.0f + 0.5f);
+				out[3] = 255;
+			}
+		});
+		double time = measure([&]() { toneMapper.apply(trResult, ldrImage.data(), pitch); });
+
+		uint maxDiff = 0, numDiffs = 0;
+		for (uint b = 0; b < ldrImage.size(); ++b)
+		{
+			uint diff = (uint) abs((int) ldrImage[b] - (int) exactImage[b]);
+			maxDiff = _max(maxDiff, diff);
+			numDiffs += diff != 0;
+		}
+		printf("    %-12s exact %8.2f ms   table %7.2f ms (%.1fx, %.0f Mpixels/s)   off by %u level at most, %.2f%% of channels\n",
+			opNames[i], exactTime, time, exactTime / time, width * height / (time * 1000.0), maxDiff,
+			100.0 * numDiffs / (width * height * 3));
+		// ToneMapper.h promises one level of the exact curve.
+		pass &= maxDiff <= 1;
+	}
+
+	ToneMapSettings settings;
+	settings.autoExposure = true;
+	ToneMapper toneMapper(settings);
+	double histogramTime = measure([&]() { sink = (uint64) toneMapper.measureExposure(trResult); });
+	double time = measure([&]() { toneMapper.apply(trResult, ldrImage.data(), pitch); });
+	printf("    %-12s histogram %5.2f ms   with tone mapping %7.2f ms   exposure %.3f\n", "auto", histogramTime, time,
+		toneMapper.getLastExposure());
+	printf("  %s\n", pass ? "PASS" : "FAIL");
+	return pass;
+}
+
+// The display formats on a 4K HDR image: what they save per frame, what packing and unpacking cost against one
+// pixel at a time, how far they round, and what they add to a frame of the CPU tracer.
+bool benchmarkPixelFormats()
+{
+	const uint width = 3840, height = 2160, count = width * height;
+	Array<float4> hdrImage(count), decoded(count);
+	uint seed = 7;
+	for (float4& p : hdrImage)
+	{
+		float scale = exp2f(16.0f * rnd(seed) - 10.0f);
+		p = float4(rnd(seed) * scale, rnd(seed) * scale, rnd(seed) * scale, 1.0f);
+	}
+	Array<uint8> packed(count * sizeof(float4));
+
+	printf("Pixel formats of a %ux%u image, best of %u runs\n", width, height, numRuns);
+	const char* formatNames[] = { "RGBA32F", "RGBA16F", "RGB9E5" };
+	const PixelFormat formats[] = { PixelFormat::RGBA32F, PixelFormat::RGBA16F, PixelFormat::RGB9E5 };
+	bool pass = true;
+	for (uint f = 0; f < 3; ++f)
+	{
+		PixelFormat format = formats[f];
+		double packTime = measure([&]() { convertPixels(hdrImage.data(), packed.data(), format, count); });
+		double unpackTime = measure([&]() { convertToFloat4(packed.data(), format, decoded.data(), count); });
+
+		// In units of the precision of the format: a half rounds a channel to 11 significant bits, down to the
+		// smallest normal half, and RGB9E5 to 9 bits of the exponent which the channels share.
+		double maxError = 0.0;
+		for (uint i = 0; i < count; ++i)
+		{
+			double unit = 1.0;
+			if (format == PixelFormat::RGB9E5)
+				unit = ldexp(1.0, (int) (((const uint*) packed.data())[i] >> 27) - 15 - 9);
+			for (int c = 0; c < 3; ++c)
+			{
+				if (format == PixelFormat::RGBA16F)
+					unit = ldexp(_max(fabsf(hdrImage[i][c]), 1.0f / 16384), -11);
+				maxError = _max(maxError, fabs(decoded[i][c] - hdrImage[i][c]) / unit);
+			}
+		}
+		double bound = format == PixelFormat::RGBA32F ? 0.0 : 1.0;
+		pass &= maxError <= bound;
+
+		printf("    %-8s %5.1f MB/frame   pack %6.2f ms   unpack %6.2f ms   max error %.2f units, bound %.0f   %s\n",
+			formatNames[f], count * pixelSizeOf(format) / 1e6, packTime, unpackTime, maxError, bound,
+			maxError <= bound ? "PASS" : "FAIL");
+	}
+
+	Array<uint16> halves(4 * count);
+	Array<uint> shared(count);
+	double halfTime = measure([&]() {
+		for (uint i = 0; i < count; ++i)
+		{
+			halves[4 * i] = floatToHalf(hdrImage[i].x);
+			halves[4 * i + 1] = floatToHalf(hdrImage[i].y);
+			halves[4 * i + 2] = floatToHalf(hdrImage[i].z);
+			halves[4 * i + 3] = floatToHalf(hdrImage[i].w);
+		}
+	});
+	double sharedTime = measure([&]() {
+		for (uint i = 0; i < count; ++i)
+			shared[i] = packRGB9E5(float3(hdrImage[i].x, hdrImage[i].y, hdrImage[i].z));
+	});
+	printf("    one pixel at a time: RGBA16F %6.2f ms   RGB9E5 %6.2f ms\n", halfTime, sharedTime);
+
+	SceneLoader loader;
+	Scene* scene = loader.push_hyperionTestScene();
+	CPUPathTracer tracer(640, 360);
+	tracer.setupScene(scene);
+
+	printf("CPUPathTracer frames of the hyperion scene at 640x360, best of %u runs\n", numRuns);
+	for (uint f = 0; f < 3; ++f)
+	{
+		tracer.setOutputFormat(formats[f]);
+		double time = measure([&]() { tracer.shootRays(); });
+		printf("    %-8s %8.2f ms\n", formatNames[f], time);
+	}
+	printf("  %s\n", pass ? "PASS" : "FAIL");
+	return pass;
+}
+
+// Sleeps most of the way, as a present or a GPU leaves the CPU free, and yields the rest for a sharper end.
+void waitFor(double ms)
+{
+	double endTime = getCurrentTime() + ms * 1e-3;
+	for (double remaining = ms; remaining > 0.0; remaining = (endTime - getCurrentTime()) * 1000.0)
+	{
+		if (remaining > 2.0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		else
+			std::this_thread::yield();
+	}
+}
+
+struct PipelineStats
+{
+	double frameTime;		// Between the frames handed out.
+	double latency;			// From the start of the recording of a frame to the end of its display.
+	double waitTime;		// Of the CPU on the timeline, per frame.
+	uint numErrors;			// Frames read before their work completed or after their slot was reused, and frames
+							// handed out again although a newer one had completed, or after a newer one.
+	uint numRepeats;		// Frames handed out again as no newer one had completed.
+};
+
+// The frame loop of DXRPathTracer::shootRays() and D3D12Screen::display() on a SoftwareQueue: the CPU records a
+// frame for recordTime, the queue executes it for queueTime and then writes its number into the readback of its
+// slot, and the CPU displays the frame handed out for displayTime.
+PipelineStats simulatePipeline(uint framesInFlight, double recordTime, double queueTime, double displayTime, uint numFrames)
+{
+	SoftwareQueue queue;
+	FrameRing ring;
+	ring.create(&queue, framesInFlight);
+	Array<uint64> readbacks(framesInFlight, ~0ull);
+	Array<double> startTimes(numFrames);
+
+	PipelineStats stats = {};
+	double latencySum = 0.0, firstTime = 0.0;
+	uint warmupFrames = framesInFlight;
+	uint64 lastShown = ~0ull;
+	ring.beginFrame();
+	for (uint frame = 0; frame < numFrames; ++frame)
+	{
+		startTimes[frame] = getCurrentTime();
+		if (frame == warmupFrames)
+			firstTime = startTimes[frame];
+
+		waitFor(recordTime);
+		uint64* readback = &readbacks[ring.currentSlot()];
+		queue.submit([=]() {
+			waitFor(queueTime);
+			*readback = frame;
+		});
+		ring.endFrame();
+		ring.beginFrame();
+
+		// Completed frames stay completed, so one newer than the last shown must be shown instead of it.
+		bool newerCompleted = lastShown != ~0ull && ring.isFrameComplete(lastShown + 1);
+		uint64 shown = ring.frameToRead();
+		ring.waitForFrame(shown);
+		stats.numErrors += readbacks[ring.slotOf(shown)] != shown;
+		if (lastShown != ~0ull && shown <= lastShown)
+		{
+			stats.numErrors += shown < lastShown || newerCompleted;
+			stats.numRepeats++;
+		}
+		lastShown = shown;
+		waitFor(displayTime);
+
+		if (frame >= warmupFrames)
+		{
+			latencySum += getCurrentTime() - startTimes[shown];
+			stats.waitTime += ring.getWaitTime();
+		}
+	}
+	ring.flush();
+
+	uint numMeasured = numFrames - warmupFrames;
+	stats.frameTime = (getCurrentTime() - firstTime) * 1000.0 / numMeasured;
+	stats.latency = latencySum * 1000.0 / numMeasured;
+	stats.waitTime /= numMeasured;
+	return stats;
+}
+
+// FrameRing on a SoftwareQueue in a GPU-bound and a CPU-bound frame, serialized and with more frames in flight.
+// Perfect pipelining runs at the slower of the CPU (record + display) and the queue.
+bool benchmarkPipeline()
+{
+	struct Case
+	{
+		const char* name;
+		double recordTime, queueTime, displayTime;
+	};
+	const Case cases[] = {
+		{ "queue-bound", 2.0, 8.0, 3.0 },
+		{ "CPU-bound", 3.0, 4.0, 5.0 },
+	};
+	const uint numFrames = 100;
+
+	printf("Frames in flight on a SoftwareQueue, %u frames (times in ms)\n", numFrames);
+	uint numErrors = 0;
+	for (const Case& c : cases)
+	{
+		printf("  %s: record %.1f, queue %.1f, display %.1f; serial %.1f, ideal %.1f\n", c.name, c.recordTime,
+			c.queueTime, c.displayTime, c.recordTime + c.queueTime + c.displayTime,
+			_max(c.recordTime + c.displayTime, c.queueTime));
+		for (uint framesInFlight = 1; framesInFlight <= 3; ++framesInFlight)
+		{
+			PipelineStats stats = simulatePipeline(framesInFlight, c.recordTime, c.queueTime, c.displayTime, numFrames);
+			printf("    %u in flight   frame %6.2f   fps %6.1f   latency %6.2f   CPU waits %5.2f   repeats %u   errors %u\n",
+				framesInFlight, stats.frameTime, 1000.0 / stats.frameTime, stats.latency, stats.waitTime,
+				stats.numRepeats, stats.numErrors);
+			numErrors += stats.numErrors;
+		}
+	}
+	printf("  %s\n", numErrors == 0 ? "PASS: every frame was read complete, before its slot was reused and in order" :
+		"FAIL: frames were read incomplete, overwritten, out of order or again instead of a newer one");
+	return numErrors == 0;
+}
+
+const char* policyName(FrameQueuePolicy policy)
+{
+	return policy == FrameQueuePolicy::LatestWins ? "latest" : (policy == FrameQueuePolicy::DropNewest ? "drop" : "block");
+}
+
+// A producer and a consumer thread at uneven paces. Every word of a frame holds its number, so a buffer written
+// while it is read shows up as a torn frame; the numbers must grow, without gaps for Block, and every frame must be
+// either consumed or counted as dropped.
+bool checkFrameQueue(FrameQueuePolicy policy)
+{
+	const uint numFrames = 2000, numWords = 16 * 1024;
+	FrameQueue queue(policy, 2);
+	std::atomic<bool> producerDone(false);
+
+	std::thread producer([&]() {
+		for (uint frameIdx = 0; frameIdx < numFrames; ++frameIdx)
+		{
+			QueuedFrame& frame = queue.beginWrite();
+			frame.pixels.resize(numWords * sizeof(uint));
+			uint* words = (uint*) frame.pixels.data();
+			for (uint w = 0; w < numWords; ++w)
+				words[w] = frameIdx;
+			queue.publish();
+			if (frameIdx % 7 == 0)
+				std::this_thread::yield();
+		}
+		producerDone = true;
+	});
+
+	uint numTorn = 0, numOutOfOrder = 0, numConsumed = 0;
+	uint64 nextIdx = 0;
+	for (;;)
+	{
+		bool done = producerDone;
+		const QueuedFrame* frame = queue.acquire();
+		if (!frame)
+		{
+			if (done)
+				break;
+			std::this_thread::yield();
+			continue;
+		}
+
+		++numConsumed;
+		// Checked twice around a yield, to give a producer which wrongly writes this buffer the time to.
+		const uint* words = (const uint*) frame->pixels.data();
+		for (uint pass = 0; pass < 2; ++pass)
+		{
+			for (uint w = 0; w < numWords; ++w)
+				numTorn += words[w] != frame->frameIdx;
+			std::this_thread::yield();
+		}
+		bool inOrder = policy == FrameQueuePolicy::Block ? frame->frameIdx == nextIdx : frame->frameIdx >= nextIdx;
+		numOutOfOrder += !inOrder;
+		nextIdx = frame->frameIdx + 1;
+		if (numConsumed % 3 == 0)
+			std::this_thread::sleep_for(std::chrono::microseconds(200));
+	}
+	producer.join();
+
+	FrameQueueStats stats = queue.getStats();
+	bool balanced = stats.numPublished == numFrames && stats.numConsumed + stats.numDropped == numFrames;
+	bool pass = numTorn == 0 && numOutOfOrder == 0 && balanced;
+	printf("    %-6s consumed %4llu  dropped %4llu  torn words %u  out of order %u  %s\n", policyName(policy),
+		(unsigned long long) stats.numConsumed, (unsigned long long) stats.numDropped, numTorn, numOutOfOrder,
+		pass ? "PASS" : "FAIL");
+	return pass;
+}
+
+// Small frames through a queue of capacity 1 as fast as both threads go, so that publish() often meets a full queue
+// while the consumer is inside acquire(). A buffer handed to the producer while it is still queued or read shows up
+// as a torn frame, as the same frame number twice, or as the same buffer consumed twice in a row.
+bool stressFrameQueue(FrameQueuePolicy policy)
+{
+	const uint numFrames = 200000, numWords = 16;
+	FrameQueue queue(policy, 1);
+	std::atomic<bool> producerDone(false);
+
+	std::thread producer([&]() {
+		for (uint frameIdx = 0; frameIdx < numFrames; ++frameIdx)
+		{
+			QueuedFrame& frame = queue.beginWrite();
+			frame.pixels.resize(numWords * sizeof(uint));
+			uint* words = (uint*) frame.pixels.data();
+			for (uint w = 0; w < numWords; ++w)
+				words[w] = frameIdx;
+			queue.publish();
+		}
+		producerDone = true;
+	});
+
+	uint numTorn = 0, numDuplicates = 0, numOutOfOrder = 0;
+	const QueuedFrame* last = nullptr;
+	uint64 nextIdx = 0;
+	for (;;)
+	{
+		bool done = producerDone;
+		const QueuedFrame* frame = queue.acquire();
+		if (!frame)
+		{
+			if (done)
+				break;
+			std::this_thread::yield();
+			continue;
+		}
+
+		const uint* words = (const uint*) frame->pixels.data();
+		for (uint w = 0; w < numWords; ++w)
+			numTorn += words[w] != frame->frameIdx;
+		numDuplicates += frame == last || (last && frame->frameIdx < nextIdx);
+		numOutOfOrder += policy == FrameQueuePolicy::Block && frame->frameIdx != nextIdx;
+		nextIdx = frame->frameIdx + 1;
+		last = frame;
+	}
+	producer.join();
+
+	FrameQueueStats stats = queue.getStats();
+	bool balanced = stats.numPublished == numFrames && stats.numConsumed + stats.numDropped == numFrames;
+	bool pass = numTorn == 0 && numDuplicates == 0 && numOutOfOrder == 0 && balanced;
+	printf("    %-6s stress: consumed %6llu  dropped %6llu  torn words %u  duplicates %u  out of order %u  %s\n",
+		policyName(policy), (unsigned long long) stats.numConsumed, (unsigned long long) stats.numDropped, numTorn,
+		numDuplicates, numOutOfOrder, pass ? "PASS" : "FAIL");
+	return pass;
+}
+
+// The CPU tracer against a display which waits for a 60 Hz vertical blank, in the lockstep loop of main.cpp and
+// on two threads through each policy of FrameQueue.
+bool benchmarkFrameQueue()
+{
+	printf("FrameQueue between a producer and a consumer thread\n");
+	bool pass = true;
+	const FrameQueuePolicy policies[] = { FrameQueuePolicy::LatestWins, FrameQueuePolicy::DropNewest, FrameQueuePolicy::Block };
+	for (FrameQueuePolicy policy : policies)
+		pass &= checkFrameQueue(policy);
+	for (FrameQueuePolicy policy : policies)
+		pass &= stressFrameQueue(policy);
+
+	const uint width = 320, height = 180;
+	const double vblankTime = 1000.0 / 60.0, runTime = 2.0;
+	SceneLoader loader;
+	Scene* scene = loader.push_hyperionTestScene();
+	CPUPathTracer tracer(width, height);
+	tracer.setupScene(scene);
+	InputEngine input(nullptr);
+
+	printf("CPUPathTracer at %ux%u with a display of %.1f ms, %.0f s per mode\n", width, height, vblankTime, runTime);
+	auto print = [&](const char* name, uint numTraced, uint numShown, double latencySum, double elapsed, uint64 numDropped) {
+		printf("    %-9s traced %6.1f fps  %6.2f Msamples/s   shown %5.1f fps   latency %6.1f ms   dropped %llu\n",
+			name, numTraced / elapsed, numTraced * (double) width * height / (elapsed * 1e6), numShown / elapsed,
+			latencySum * 1000.0 / _max(numShown, 1u), (unsigned long long) numDropped);
+	};
+
+	{
+		uint numFrames = 0;
+		double latencySum = 0.0;
+		double startTime = getCurrentTime();
+		while (getCurrentTime() - startTime < runTime)
+		{
+			double frameStart = getCurrentTime();
+			tracer.update(input);
+			tracer.shootRays();
+			waitFor(vblankTime);
+			latencySum += getCurrentTime() - frameStart;
+			++numFrames;
+		}
+		print("lockstep", numFrames, numFrames, latencySum, getCurrentTime() - startTime, 0);
+	}
+
+	for (FrameQueuePolicy policy : policies)
+	{
+		FrameQueue queue(policy, 2);
+		tracer.setOutputTarget(&queue);
+		std::atomic<bool> stopping(false);
+		std::atomic<uint> numTraced(0);
+		std::thread tracerThread([&]() {
+			while (!stopping)
+			{
+				double frameStart = getCurrentTime();
+				tracer.update(input);
+				queue.publish(tracer.shootRays(), frameStart);
+				++numTraced;
+			}
+		});
+
+		uint numShown = 0;
+		double latencySum = 0.0;
+		double startTime = getCurrentTime();
+		while (getCurrentTime() - startTime < runTime)
+		{
+			const QueuedFrame* frame = queue.acquire();
+			if (!frame)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				continue;
+			}
+			waitFor(vblankTime);
+			latencySum += getCurrentTime() - frame->startTime;
+			++numShown;
+		}
+		double elapsed = getCurrentTime() - startTime;
+		uint tracedInTime = numTraced;
+
+		// Emptying the queue once lets a blocked producer publish its last frame and see the stop.
+		stopping = true;
+		while (queue.acquire())
+			;
+		tracerThread.join();
+		tracer.setOutputTarget(nullptr);
+		print(policyName(policy), tracedInTime, numShown, latencySum, elapsed, queue.getStats().numDropped);
+	}
+	printf("  %s\n", pass ? "PASS" : "FAIL");
+	return pass;
+}
+
+// The upload buffer of a screen: rows aligned to 256 bytes, as D3D12 requires of texture uploads.
+struct PitchedTarget : public IOutputTarget
+{
+	Array<uint8>	memory;
+	uint64			rowPitch = 0;
+
+	virtual OutputBuffer acquireOutput(uint width, uint height, PixelFormat format)
+	{
+		rowPitch = ((uint64) width * pixelSizeOf(format) + 255) & ~255ull;
+		memory.resize((uint) (rowPitch * height));
+		OutputBuffer buffer;
+		buffer.data = memory.data();
+		buffer.rowPitch = rowPitch;
+		return buffer;
+	}
+};
+
+bool benchmarkOutputTarget()
+{
+	const uint width = 1280, height = 720;
+	SceneLoader loader;
+	Scene* scene = loader.push_hyperionTestScene();
+	CPUPathTracer ownTracer(width, height), targetTracer(width, height);
+	ownTracer.setupScene(scene);
+	targetTracer.setupScene(scene);
+	PitchedTarget copyTarget, tracedTarget;
+	targetTracer.setOutputTarget(&tracedTarget);
+
+	printf("CPUPathTracer frames of the hyperion scene at %ux%u into a pitched buffer, best of %u runs\n",
+		width, height, numRuns);
+	const char* formatNames[] = { "RGBA32F", "RGBA16F", "RGB9E5" };
+	const PixelFormat formats[] = { PixelFormat::RGBA32F, PixelFormat::RGBA16F, PixelFormat::RGB9E5 };
+	bool pass = true;
+	for (uint f = 0; f < 3; ++f)
+	{
+		ownTracer.setOutputFormat(formats[f]);
+		targetTracer.setOutputFormat(formats[f]);
+
+		// The same frames from both, the first copied after the frame as display() used to.
+		TracedResult own = {}, traced = {};
+		double copyTime = 0.0;
+		double ownTime = measure([&]() {
+			own = ownTracer.shootRays();
+			double startTime = getCurrentTime();
+			OutputBuffer buffer = copyTarget.acquireOutput(own.width, own.height, own.format);
+			uint64 rowSize = (uint64) own.width * own.pixelSize;
+			for (uint y = 0; y < own.height; ++y)
+				memcpy((uint8*) buffer.data + buffer.rowPitch * y, (const uint8*) own.data + own.getRowPitch() * y, rowSize);
+			copyTime = (getCurrentTime() - startTime) * 1000.0;
+		});
+		double targetTime = measure([&]() { traced = targetTracer.shootRays(); });
+
+		uint64 rowSize = (uint64) width * pixelSizeOf(formats[f]);
+		pass &= traced.data == tracedTarget.memory.data() && traced.getRowPitch() == tracedTarget.rowPitch;
+		for (uint y = 0; y < height; ++y)
+			pass &= memcmp(&copyTarget.memory[(uint) (copyTarget.rowPitch * y)], &tracedTarget.memory[(uint) (tracedTarget.rowPitch * y)], rowSize) == 0;
+
+		printf("    %-8s traced then copied %8.2f ms (copy %5.2f ms)   traced in place %8.2f ms\n",
+			formatNames[f], ownTime, copyTime, targetTime);
+	}
+	printf("  %s\n", pass ? "PASS" : "FAIL");
+	return pass;
+}
+
+uint64 fileSize(const char* filename)
+{
+	FILE* file = fopen(filename, "rb");
+	if (!file)
+		return 0;
+	fseek(file, 0, SEEK_END);
+	uint64 size = (uint64) ftell(file);
+	fclose(file);
+	return size;
+}
+
+Array<uint8> readFile(const char* filename)
+{
+	Array<uint8> bytes((uint) fileSize(filename));
+	FILE* file = fopen(filename, "rb");
+	if (!file || fread(bytes.data(), 1, bytes.size(), file) != bytes.size())
+		bytes.clear();
+	if (file)
+		fclose(file);
+	return bytes;
+}
+
+// Whether the PFM file holds the RGB of the image exactly, its rows from the bottom one up.
+bool checkPFM(const char* filename, const float4* image, uint width, uint height)
+{
+	Array<uint8> file = readFile(filename);
+	file.push_back(0);
+	uint fileWidth = 0, fileHeight = 0;
+	float scale = 0.0f;
+	int headerSize = 0;
+	if (sscanf((const char*) file.data(), "PF\n%u %u\n%f%n", &fileWidth, &fileHeight, &scale, &headerSize) != 3 ||
+		file[headerSize] != '\n' || fileWidth != width || fileHeight != height || scale != -1.0f ||
+		file.size() - 1 != headerSize + 1 + (uint64) width * height * 12)
+		return false;
+
+	const float* values = (const float*) &file[headerSize + 1];
+	for (uint y = 0; y < height; ++y)
+	{
+		const float4* row = image + (size_t) (height - 1 - y) * width;
+		for (uint x = 0; x < width; ++x, values += 3)
+		{
+			if (memcmp(values, &row[x], 12) != 0)
+				return false;
+		}
+	}
+	return true;
+}
+
+bool rleDecompress(const uint8* src, uint size, Array<uint8>& dst)
+{
+	for (uint i = 0; i < size; )
+	{
+		int count = (signed char) src[i++];
+		if (count >= 0 && i < size)
+			dst.resize(dst.size() + count + 1, src[i++]);
+		else if (count < 0 && i - count <= size)
+		{
+			for (; count < 0; ++count)
+				dst.push_back(src[i++]);
+		}
+		else
+			return false;
+	}
+	return true;
+}
+
+/*
+Whether the EXR file, as ExrWriter writes it, decodes to the image and the layers, with each channel rounded to
+the halves or floats of its type: the header is parsed for the channels, compression and data window, and every
+block is unpacked and its values compared, so that a writer which loses or garbles data fails. Only the files of
+this writer are read, with the image the whole data window.
+*/
+bool checkEXR(const char* filename, const float4* image, uint width, uint height, const ExrLayer* layers,
+	uint numLayers)
+{
+	Array<uint8> file = readFile(filename);
+	file.push_back(0);
+	uint pos = 0;
+	auto readInt = [&]() {
+		int value = 0;
+		if (pos + 4 <= file.size())
+			memcpy(&value, &file[pos], 4);
+		pos += 4;
+		return value;
+	};
+	auto readString = [&]() {
+		const char* s = (const char*) &file[_min(pos, file.size() - 1)];
+		pos += (uint) strlen(s) + 1;
+		return s;
+	};
+	if (readInt() != 20000630 || (readInt() & 0xff) != 2)
+		return false;
+
+	// The source of each channel in the file, with its type: 1 for halves, 2 for floats.
+	struct Channel { const float* data; uint stride; int type; };
+	Array<Channel> channels;
+	int compression = -1, dataWindow[4] = {};
+	while (pos < file.size() - 1 && file[pos] != 0)
+	{
+		std::string name = readString();
+		std::string type = readString();
+		uint size = (uint) readInt(), end = pos + size;
+		if (end >= file.size())
+			return false;
+		if (name == "channels" && type == "chlist")
+		{
+			while (pos < end && file[pos] != 0)
+			{
+				std::string channelName = readString();
+				Channel channel = { nullptr, 4, readInt() };
+				pos += 12;
+				size_t dot = channelName.find('.');
+				if (dot == std::string::npos && channelName.size() == 1 && strchr("RGB", channelName[0]))
+					channel.data = &image[0].x + (channelName[0] == 'R' ? 0 : channelName[0] == 'G' ? 1 : 2);
+				for (uint layerIdx = 0; layerIdx < numLayers && dot != std::string::npos; ++layerIdx)
+				{
+					const char* letter = strchr(layers[layerIdx].channels, channelName[dot + 1]);
+					if (channelName.compare(0, dot, layers[layerIdx].name) == 0 && letter && channelName.size() == dot + 2)
+					{
+						channel.stride = (uint) strlen(layers[layerIdx].channels);
+						channel.data = layers[layerIdx].data + (letter - layers[layerIdx].channels);
+					}
+				}
+				if (!channel.data || (channel.type != 1 && channel.type != 2))
+					return false;
+				channels.push_back(channel);
+			}
+		}
+		else if (name == "compression" && size == 1)
+			compression = file[pos];
+		else if (name == "dataWindow" && size == sizeof(dataWindow))
+			memcpy(dataWindow, &file[pos], size);
+		pos = end;
+	}
+	++pos;
+
+	uint numChannels = 3;
+	for (uint layerIdx = 0; layerIdx < numLayers; ++layerIdx)
+		numChannels += (uint) strlen(layers[layerIdx].channels);
+	if (channels.size() != numChannels || compression < 0 || compression > 3 || dataWindow[0] != 0 ||
+		dataWindow[1] != 0 || dataWindow[2] != (int) width - 1 || dataWindow[3] != (int) height - 1)
+		return false;
+
+	uint lineSize = 0;
+	for (const Channel& channel : channels)
+		lineSize += width * (channel.type == 1 ? 2 : 4);
+	uint linesPerBlock = compression == 3 ? 16 : 1;
+	uint numBlocks = (height + linesPerBlock - 1) / linesPerBlock;
+	const uint8* offsets = &file[pos];
+	if (pos + numBlocks * sizeof(uint64) > file.size())
+		return false;
+
+	Array<uint8> raw, packed;
+	for (uint blockIdx = 0; blockIdx < numBlocks; ++blockIdx)
+	{
+		uint64 offset;
+		memcpy(&offset, offsets + blockIdx * sizeof(uint64), sizeof(uint64));
+		uint yBegin = blockIdx * linesPerBlock, yEnd = _min(yBegin + linesPerBlock, height);
+		uint rawSize = (yEnd - yBegin) * lineSize;
+		if (offset + 8 > file.size())
+			return false;
+		pos = (uint) offset;
+		int y = readInt();
+		uint dataSize = (uint) readInt();
+		if (y != (int) yBegin || pos + (uint64) dataSize > file.size() || dataSize > rawSize)
+			return false;
+
+		const uint8* data = &file[pos];
+		if (dataSize < rawSize)
+		{
+			packed.clear();
+			if (compression == 0 || !(compression == 1 ? rleDecompress(data, dataSize, packed) :
+				zlibDecompress(data, dataSize, packed)) || packed.size() != rawSize)
+				return false;
+			uint half = (rawSize + 1) / 2;
+			for (uint i = 1; i < rawSize; ++i)
+				packed[i] = (uint8) (packed[i - 1] + packed[i] - 128);
+			raw.resize(rawSize);
+			for (uint i = 0; i < rawSize; ++i)
+				raw[i] = packed[(i & 1) ? half + i / 2 : i / 2];
+			data = raw.data();
+		}
+
+		for (uint y = yBegin; y < yEnd; ++y)
+		{
+			for (const Channel& channel : channels)
+			{
+				const float* src = channel.data + (size_t) y * width * channel.stride;
+				for (uint x = 0; x < width; ++x)
+				{
+					float value = src[(size_t) x * channel.stride];
+					bool same = true;
+					if (channel.type == 1)
+					{
+						uint16 half = floatToHalf(value);
+						same = memcmp(data, &half, 2) == 0;
+						data += 2;
+					}
+					else
+					{
+						same = memcmp(data, &value, 4) == 0;
+						data += 4;
+					}
+					if (!same)
+						return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+bool benchmarkImageWriters()
+{
+	// A converged render has smooth shading under a little noise, which a few frames of the tracer do not have yet;
+	// the AOVs are those of the hyperion scene.
+	const uint width = 1920, height = 1080;
+	Array<float4> hdrImage(width * height);
+	uint seed = 11;
+	for (uint y = 0; y < height; ++y)
+	{
+		for (uint x = 0; x < width; ++x)
+		{
+			float shade = 4.0f * (1.0f + sinf(x * 0.004f) * cosf(y * 0.006f)) * (0.97f + 0.06f * rnd(seed));
+			hdrImage[width * y + x] = float4(shade * 0.9f, shade * (0.5f + 0.5f * y / height), shade * 0.7f, 1.0f);
+		}
+	}
+	TracedResult trResult = { hdrImage.data(), width, height, sizeof(float4) };
+
+	SceneLoader loader;
+	Scene* scene = loader.push_hyperionTestScene();
+	CPUPathTracer tracer(width, height);
+	tracer.setupScene(scene);
+	Array<float> depthArr;
+	Array<float3> normalArr;
+	tracer.renderAOVs(depthArr, normalArr);
+	ExrLayer layers[] = { { "depth", "Z", depthArr.data(), false }, { "normal", "XYZ", &normalArr[0].x, true } };
+
+	const char* filename = "benchmark_image.tmp";
+	printf("Writing an HDR image at %ux%u on %u threads, best of %u runs\n", width, height,
+		ThreadPool::get().numThreads(), numRuns);
+	// Each file is read back after it is written; a file which does not hold the data fails the benchmark.
+	bool pass = true;
+	auto print = [&](const char* name, double time, uint64 rawSize, bool readsBack) {
+		uint64 size = fileSize(filename);
+		printf("    %-22s %8.2f ms %8.1f MB  %5.1f%% of the raw channels   %7.1f MB/s   %s\n", name, time, size / 1e6,
+			100.0 * size / rawSize, rawSize / (time * 1e3), readsBack ? "reads back" : "DIFFERS");
+		pass &= readsBack;
+	};
+
+	uint64 rgbFloatSize = (uint64) width * height * 12;
+	double pfmTime = measure([&]() { writePFM(filename, trResult); });
+	print("PFM", pfmTime, rgbFloatSize, checkPFM(filename, hdrImage.data(), width, height));
+
+	const char* compressionNames[] = { "none", "RLE", "ZIPS", "ZIP" };
+	for (uint c = 0; c < 4; ++c)
+	{
+		for (uint withLayers = 0; withLayers < 2; ++withLayers)
+		{
+			ExrSettings settings;
+			settings.compression = (ExrCompression) c;
+			uint64 rawSize = (uint64) width * height * (6 + (withLayers ? 4 + 6 : 0));
+
+			char name[64];
+			snprintf(name, sizeof(name), "EXR %s half%s", compressionNames[c], withLayers ? " + AOVs" : "");
+			double time = measure([&]() { writeEXR(filename, trResult, settings, layers, withLayers ? 2 : 0); });
+			print(name, time, rawSize, checkEXR(filename, hdrImage.data(), width, height, layers, withLayers ? 2 : 0));
+		}
+	}
+	remove(filename);
+	printf("  %s\n", pass ? "PASS" : "FAIL");
+	return pass;
+}
+
+// Frames of the CPU tracer accumulated over its region, as renderToFile() does.
+TracedResult accumulate(CPUPathTracer& tracer, uint numFrames)
+{
+	InputEngine input(nullptr);
+	TracedResult trResult = {};
+	for (uint frame = 0; frame < numFrames; ++frame)
+	{
+		tracer.update(input);
+		trResult = tracer.shootRays();
+	}
+	return trResult;
+}
+
+bool benchmarkTiles()
+{
+	const uint width = 960, height = 540, numFrames = 2;
+	SceneLoader loader;
+	Scene* scene = loader.push_hyperionTestScene();
+	CPUPathTracer tracer(width, height);
+	tracer.setupScene(scene);
+	InputEngine input(nullptr);
+
+	printf("CPUPathTracer renders of the hyperion scene at %ux%u, %u frames, by regions\n", width, height, numFrames);
+	double startTime = getCurrentTime();
+	TracedResult whole = accumulate(tracer, numFrames);
+	double wholeTime = (getCurrentTime() - startTime) * 1000.0;
+	Array<float4> reference(width * height);
+	memcpy(reference.data(), whole.data, width * height * sizeof(float4));
+	printf("    %-28s %9.1f ms\n", "whole image", wholeTime);
+
+	// The tiles do not divide the image, so there are smaller ones at the right and bottom edges.
+	bool pass = true;
+	const uint tileSizes[] = { 64, 200 };
+	for (uint tileSize : tileSizes)
+	{
+		TiledRender tiled(tracer, width, height, tileSize, tileSize);
+		startTime = getCurrentTime();
+		for (uint bandIdx = 0; bandIdx < tiled.numBands(); ++bandIdx)
+		{
+			TracedResult band = tiled.renderBand(bandIdx, numFrames, input);
+			for (uint y = 0; y < band.height; ++y)
+			{
+				pass &= memcmp((const uint8*) band.data + band.getRowPitch() * y,
+					&reference[width * (tiled.bandY(bandIdx) + y)], width * sizeof(float4)) == 0;
+			}
+		}
+		double time = (getCurrentTime() - startTime) * 1000.0;
+
+		char name[64];
+		snprintf(name, sizeof(name), "tiles of %ux%u", tileSize, tileSize);
+		printf("    %-28s %9.1f ms  %5.2fx   band %6.2f MB\n", name, time, time / wholeTime, tiled.bandMemory() / 1e6);
+	}
+
+	// Rendering a small problem area again.
+	PixelRegion crop = { 600, 300, 128, 96 };
+	tracer.setRegion(width, height, crop);
+	startTime = getCurrentTime();
+	TracedResult region = accumulate(tracer, numFrames);
+	double cropTime = (getCurrentTime() - startTime) * 1000.0;
+	for (uint y = 0; y < crop.height; ++y)
+	{
+		pass &= memcmp((const uint8*) region.data + region.getRowPitch() * y,
+			&reference[width * (crop.y + y) + crop.x], crop.width * sizeof(float4)) == 0;
+	}
+	printf("    %-28s %9.1f ms  %5.2fx\n", "crop of 128x96", cropTime, cropTime / wholeTime);
+
+	// What a poster costs in memory, accumulated whole or by tiles of 512x512.
+	const uint posterW = 16384, posterH = 8192, posterTile = 512;
+	printf("    %ux%u: %.0f MB accumulated whole, %.0f MB by tiles of %u (band and tile)\n", posterW, posterH,
+		posterW * (double) posterH * sizeof(float4) / 1e6,
+		(posterW + posterTile) * (double) posterTile * sizeof(float4) / 1e6, posterTile);
+	printf("  %s\n", pass ? "PASS" : "FAIL");
+	return pass;
+}
+
+// Root mean square difference of the RGB of two images of numPixels.
+double rmsError(const float4* image, const float4* reference, uint numPixels)
+{
+	double sum = 0.0;
+	for (uint i = 0; i < numPixels; ++i)
+	{
+		float3 d(image[i].x - reference[i].x, image[i].y - reference[i].y, image[i].z - reference[i].z);
+		sum += d.x * d.x + d.y * d.y + d.z * d.z;
+	}
+	return sqrt(sum / (3.0 * numPixels));
+}
+
+struct BudgetRun
+{
+	double	meanTime = 0.0;			// Of tracing a frame, in milliseconds.
+	double	maxTime = 0.0;
+	double	meanSamples = 0.0;		// Per pixel and frame.
+	uint	numOver = 0;			// Frames over 1.25 times the target.
+	float	scale = 1.0f;			// At the end.
+	double	targetTime = 0.0;		// Of the budget.
+};
+
+// numFrames frames of the CPU tracer at width x height, whose samples per frame come from budget if there is one;
+// the first few frames, before the budget has measured the scene, are not counted.
+BudgetRun runBudget(CPUPathTracer& tracer, FrameBudget* budget, uint width, uint height, uint numFrames)
+{
+	const uint warmupFrames = 4;
+	InputEngine input(nullptr);
+	BudgetRun run;
+	float scale = 1.0f;
+	tracer.setRegion(width, height, PixelRegion());
+	if (budget)
+	{
+		budget->setNumPixels((uint64) width * height);
+		tracer.setNumSamplesPerFrame(budget->getNumSamples());
+	}
+
+	for (uint frame = 0; frame < numFrames; ++frame)
+	{
+		tracer.update(input);
+		TracedResult trResult = tracer.shootRays();
+		FrameTimings timings = tracer.getFrameTimings();
+		if (frame >= warmupFrames)
+		{
+			run.meanTime += timings.trace;
+			run.maxTime = _max(run.maxTime, timings.trace);
+			run.meanSamples += timings.numSamples;
+			run.numOver += budget && timings.trace > budget->getSettings().targetTime * 1.25 ? 1 : 0;
+		}
+		if (!budget)
+			continue;
+
+		budget->addFrame(timings, (uint64) trResult.width * trResult.height);
+		tracer.setNumSamplesPerFrame(budget->getNumSamples());
+		if (budget->getResolutionScale() != scale)
+		{
+			scale = budget->getResolutionScale();
+			tracer.setRegion(scaleSize(width, scale), scaleSize(height, scale), PixelRegion());
+		}
+	}
+	run.meanTime /= numFrames - warmupFrames;
+	run.meanSamples /= numFrames - warmupFrames;
+	run.scale = scale;
+	run.targetTime = budget ? budget->getSettings().targetTime : 0.0;
+	return run;
+}
+
+/*
+The accumulation of frames of different samples against one of as many samples in frames of the same count: both
+weigh every sample alike, so they are about as far from a reference of many more samples. Weighing the frames alike
+instead, as the tracers did, is recomputed from the same frames for comparison, and is noisier. Then the frame
+budget on a light and a heavy scene against a fixed count of samples, and with the internal resolution on the
+heavy one.
+*/
+bool benchmarkFrameBudget()
+{
+	const uint width = 320, height = 180;
+	SceneLoader loader;
+	Scene* hyperion = loader.push_hyperionTestScene();
+	CPUPathTracer tracer(width, height);
+	tracer.setupScene(hyperion);
+	InputEngine input(nullptr);
+
+	// The paths find the lights seldom, so the accumulations take hundreds of samples, over a crop. The frames are
+	// seeded by their index in the accumulation, so the reference is that of frames 8 to 23 alone, which none of
+	// the accumulations compared shares a sample with.
+	PixelRegion crop = { 128, 72, 64, 36 };
+	uint numPixels = crop.width * crop.height;
+	tracer.setRegion(width, height, crop);
+	printf("CPUPathTracer accumulation of the hyperion scene over %ux%u, error against 4096 samples\n",
+		crop.width, crop.height);
+	tracer.setNumSamplesPerFrame(256);
+	Array<float4> reference(numPixels);
+	memcpy(reference.data(), accumulate(tracer, 8).data, numPixels * sizeof(float4));
+	const float* allFrames = (const float*) accumulate(tracer, 16).data;
+	for (uint i = 0; i < numPixels * 4; ++i)
+		(&reference[0].x)[i] = 1.5f * allFrames[i] - 0.5f * (&reference[0].x)[i];
+
+	tracer.setupScene(hyperion);		// Which restarts the accumulation.
+	tracer.setNumSamplesPerFrame(64);
+	double constantError = rmsError((const float4*) accumulate(tracer, 8).data, reference.data(), numPixels);
+	printf("    %-36s %.5f\n", "8 frames of 64 samples", constantError);
+
+	const uint sampleCounts[] = { 16, 128, 32, 80, 48, 96, 64, 48 };
+	Array<float4> previous(numPixels, float4(0.0f)), frameMean(numPixels, float4(0.0f));
+	uint numSamples = 0, numFrames = 0;
+	tracer.setupScene(hyperion);
+	for (uint count : sampleCounts)
+	{
+		tracer.setNumSamplesPerFrame(count);
+		tracer.update(input);
+		const float4* accumulation = (const float4*) tracer.shootRays().data;
+
+		// The frame alone, out of the accumulations before and after it, into the mean of the frames.
+		++numFrames;
+		const float* after = &accumulation[0].x;
+		float* before = &previous[0].x;
+		float* mean = &frameMean[0].x;
+		for (uint i = 0; i < numPixels * 4; ++i)
+		{
+			float frame = (after[i] * (numSamples + count) - before[i] * numSamples) / count;
+			mean[i] += (frame - mean[i]) / numFrames;
+			before[i] = after[i];
+		}
+		numSamples += count;
+	}
+	double weightedError = rmsError(previous.data(), reference.data(), numPixels);
+	double frameWeightedError = rmsError(frameMean.data(), reference.data(), numPixels);
+	printf("    %-36s %.5f  %5.2fx\n", "8 frames of 16 to 128, by samples", weightedError,
+		weightedError / constantError);
+	printf("    %-36s %.5f  %5.2fx\n", "the same, frames weighed alike", frameWeightedError,
+		frameWeightedError / constantError);
+	bool pass = weightedError < frameWeightedError && tracer.getAccumulatedSamples() == numSamples;
+
+	const uint numBudgetFrames = 24;
+	auto print = [](const char* name, const BudgetRun& run) {
+		printf("    %-36s %5.1f spp  %7.1f ms mean  %7.1f ms max  %2u over  %3.0f%% resolution\n", name,
+			run.meanSamples, run.meanTime, run.maxTime, run.numOver, run.scale * 100.0f);
+	};
+
+	// Two samples per frame, and a budget of the time of tracing hyperion at four.
+	tracer.setNumSamplesPerFrame(2);
+	BudgetRun fixedHyperion = runBudget(tracer, nullptr, width, height, 8);
+	tracer.setNumSamplesPerFrame(4);
+	FrameBudgetSettings settings;
+	settings.targetTime = runBudget(tracer, nullptr, width, height, 8).meanTime;
+	settings.maxSamples = 256;
+	tracer.setNumSamplesPerFrame(2);
+
+	printf("Frame budget of %.1f ms per frame at %ux%u, %u frames\n", settings.targetTime, width, height, numBudgetFrames);
+	Scene* light = loader.push_testScene1();
+	tracer.setupScene(light);
+	print("test scene, 2 samples", runBudget(tracer, nullptr, width, height, 8));
+	FrameBudget lightBudget(settings);
+	BudgetRun lightRun = runBudget(tracer, &lightBudget, width, height, numBudgetFrames);
+	print("test scene, budget", lightRun);
+
+	tracer.setupScene(hyperion);
+	tracer.setNumSamplesPerFrame(2);
+	print("hyperion, 2 samples", fixedHyperion);
+	FrameBudget heavyBudget(settings);
+	BudgetRun heavyRun = runBudget(tracer, &heavyBudget, width, height, numBudgetFrames);
+	print("hyperion, budget", heavyRun);
+
+	// A quarter of the target does not fit one sample of every pixel.
+	settings.targetTime *= 0.25;
+	settings.scaleResolution = true;
+	settings.minScale = 0.25f;
+	char name[64];
+	snprintf(name, sizeof(name), "hyperion, %.1f ms and resolution", settings.targetTime);
+	FrameBudget scaledBudget(settings);
+	BudgetRun scaledRun = runBudget(tracer, &scaledBudget, width, height, numBudgetFrames);
+	print(name, scaledRun);
+
+	// Whole samples fit the target only so closely: n of them may be all that fit where n + 1 just miss, and a
+	// scale below 1 is the largest step of 1/8 at which one sample fits, so that it may trace as few as
+	// ((scale - 1/8) / scale)^2 of the pixels that would. The rest is noise of the timings.
+	for (const BudgetRun* run : { &lightRun, &heavyRun, &scaledRun })
+	{
+		double stepFraction = (run->scale - 0.125) / run->scale;
+		double fits = run->scale < 1.0f ? stepFraction * stepFraction : run->meanSamples / (run->meanSamples + 1.0);
+		pass &= run->meanTime > run->targetTime * 0.9 * fits && run->meanTime < run->targetTime * 1.2;
+	}
+	pass &= lightRun.meanSamples > heavyRun.meanSamples && scaledRun.scale < 1.0f;
+	printf("  %s\n", pass ? "PASS" : "FAIL");
+	return pass;
+}
+
+/*
+Frames of the CPU tracer with a checkpoint every other frame, written on the thread of a CheckpointWriter and
+in the loop of the frames, against none. Then a render stopped halfway, resumed from its checkpoint by another
+tracer, must end bit for bit as the render straight through, and a checkpoint of another camera, crop or scene must
+be refused.
+*/
+bool benchmarkCheckpoints()
+{
+	const uint width = 640, height = 360, numFrames = 12, checkpointEvery = 2;
+	SceneLoader loader;
+	Scene* scene = loader.push_hyperionTestScene();
+	CPUPathTracer tracer(width, height);
+	tracer.setupScene(scene);
+	InputEngine input(nullptr);
+	const char* filename = "benchmark_checkpoint.tmp";
+
+	printf("CPUPathTracer renders of the hyperion scene at %ux%u, %u frames, a checkpoint of %.1f MB every %u\n",
+		width, height, numFrames, width * height * sizeof(float4) / 1e6, checkpointEvery);
+	auto print = [&](const char* name, double time, double waitTime, double noneTime) {
+		printf("    %-24s %7.1f ms per frame  %5.2fx   %7.2f ms per checkpoint in the loop\n", name,
+			time / numFrames, time / noneTime, waitTime / (numFrames / checkpointEvery));
+	};
+
+	double startTime = getCurrentTime();
+	TracedResult straight = accumulate(tracer, numFrames);
+	double noneTime = (getCurrentTime() - startTime) * 1000.0;
+	Array<float4> reference(width * height);
+	memcpy(reference.data(), straight.data, width * height * sizeof(float4));
+	print("no checkpoints", noneTime, 0.0, noneTime);
+
+	double asyncWait = 0.0, asyncTime;
+	CheckpointStats stats;
+	{
+		CheckpointWriter writer(filename);
+		tracer.setupScene(scene);
+		startTime = getCurrentTime();
+		for (uint frame = 0; frame < numFrames; ++frame)
+		{
+			tracer.update(input);
+			tracer.shootRays();
+			if ((frame + 1) % checkpointEvery == 0)
+				asyncWait += writer.save(tracer);
+		}
+		asyncTime = (getCurrentTime() - startTime) * 1000.0;
+		writer.flush();
+		stats = writer.getStats();
+	}
+	print("asynchronous", asyncTime, asyncWait, noneTime);
+	printf("        %u written, %u replaced before their write, %.2f ms writing each\n", stats.numWritten,
+		stats.numReplaced, stats.writeTime / _max(stats.numWritten, 1u));
+
+	double syncWait = 0.0;
+	AccumulationState state;
+	tracer.setupScene(scene);
+	startTime = getCurrentTime();
+	for (uint frame = 0; frame < numFrames; ++frame)
+	{
+		tracer.update(input);
+		tracer.shootRays();
+		if ((frame + 1) % checkpointEvery == 0)
+		{
+			double saveTime = getCurrentTime();
+			tracer.saveAccumulation(state);
+			writeCheckpoint(filename, state);
+			syncWait += (getCurrentTime() - saveTime) * 1000.0;
+		}
+	}
+	print("in the loop", (getCurrentTime() - startTime) * 1000.0, syncWait, noneTime);
+
+	// Stopped halfway, and resumed by a tracer which knows nothing of the render but its checkpoint. Both start as
+	// the reference did, from frame 0.
+	CPUPathTracer stopped(width, height);
+	stopped.setupScene(scene);
+	accumulate(stopped, numFrames / 2);
+	{
+		CheckpointWriter writer(filename);
+		writer.save(stopped);
+	}
+	CPUPathTracer resumed(width, height);
+	resumed.setupScene(scene);
+	bool pass = readCheckpoint(filename, state) && resumed.restoreAccumulation(state);
+	TracedResult rest = accumulate(resumed, numFrames - numFrames / 2);
+	pass &= memcmp(rest.data, reference.data(), width * height * sizeof(float4)) == 0
+		&& resumed.getAccumulatedSamples() == stopped.getNumSamplesPerFrame() * numFrames;
+	printf("    resumed after %u of %u frames: %s\n", numFrames / 2, numFrames, pass ? "identical" : "DIFFERENT");
+
+	// Whatever does not match leaves the accumulation of the tracer alone.
+	CPUPathTracer other(width, height);
+	other.setupScene(scene);
+	other.getCamera().setCameraPos(other.getCamera().getCameraPos() + float3(0.0f, 0.0f, 0.01f));
+	bool refused = !other.restoreAccumulation(state);
+	other.getCamera().setCameraPos(resumed.getCamera().getCameraPos());
+	other.setRegion(width, height, { 0, 0, width, height / 2 });
+	refused &= !other.restoreAccumulation(state);
+	other.setRegion(width, height, PixelRegion());
+	other.setupScene(loader.push_testScene1());
+	refused &= !other.restoreAccumulation(state);
+	printf("    another camera, crop and scene: %s\n", refused ? "refused" : "ACCEPTED");
+	remove(filename);
+	printf("  %s\n", pass && refused ? "PASS" : "FAIL");
+	return pass && refused;
+}
+
+/*
+Distributed renders of the CPU tracer by 1, 2, 4 and 8 worker processes of this program, split by samples and by
+tiles, merged here as the coordinator of DXRPathTracer --workers would. Every worker gets one thread, standing in for
+a host of its own, so that the speedup over one worker, and the efficiency (the speedup over the number of workers),
+show what the processes cost: loading the scene in each, the streams of partials and the merge. Split by tiles,
+every pixel is traced by one worker as by one process alone and must come out bit for bit; split by samples, the
+partials average to the same samples up to rounding. A partial of another scene or outside the image is refused.
+*/
+bool benchmarkDistributed()
+{
+	const uint width = 480, height = 270, numFrames = 16;
+	const uint workerCounts[] = { 1, 2, 4, 8 };
+	char exePath[MAX_PATH];
+	GetModuleFileNameA(nullptr, exePath, sizeof(exePath));
+
+	SceneLoader loader;
+	CPUPathTracer tracer(width, height);
+	tracer.setupScene(loader.push_hyperionTestScene());
+	PixelRegion area = { 0, 0, width, height };
+	uint64 sceneHash = tracer.getSceneHash();
+	uint numSamples = tracer.getNumSamplesPerFrame() * numFrames;
+
+	printf("Distributed CPUPathTracer renders of the hyperion scene at %ux%u, %u frames, by workers of one thread\n",
+		width, height, numFrames);
+	bool pass = true;
+	for (WorkSplit split : { WorkSplit::Samples, WorkSplit::Tiles })
+	{
+		const char* splitName = split == WorkSplit::Tiles ? "tiles" : "samples";
+		Array<float4> single;
+		double singleTime = 0.0;
+		for (uint numWorkers : workerCounts)
+		{
+			Array<std::string> commandLines(numWorkers);
+			for (uint i = 0; i < numWorkers; ++i)
+			{
+				char line[MAX_PATH + 128];
+				snprintf(line, sizeof(line), "\"%s\" --cpu --render %u - --size %u %u --workers %u --split %s "
+					"--worker %u --threads 1", exePath, numFrames, width, height, numWorkers, splitName, i);
+				commandLines[i] = line;
+			}
+
+			AccumulationMerger merger(width, height, area, sceneHash);
+			Array<WorkerResult> results;
+			double startTime = getCurrentTime();
+			bool succeeded = runWorkers(commandLines, merger, results);
+			double time = (getCurrentTime() - startTime) * 1000.0;
+
+			Array<float4> pixels;
+			Array<uint> samples;
+			startTime = getCurrentTime();
+			merger.resolve(pixels, samples);
+			double mergeTime = (getCurrentTime() - startTime) * 1000.0;
+			for (uint pixelSamples : samples)
+				succeeded &= pixelSamples == numSamples;
+			pass &= succeeded;
+
+			char name[64];
+			snprintf(name, sizeof(name), "%s, %u worker%s", splitName, numWorkers, numWorkers > 1 ? "s" : "");
+			MergerStats stats = merger.getStats();
+			if (numWorkers == 1)
+			{
+				singleTime = time;
+				single.swap(pixels);
+				printf("    %-20s %9.1f ms                   %3u partials %6.1f MB  merged in %6.2f ms%s\n", name,
+					time, stats.numPartials, stats.bytesReceived / 1e6, mergeTime, succeeded ? "" : "  FAILED");
+				continue;
+			}
+
+			// Tiles are bit for bit; the samples of every pixel are averaged in another order.
+			double error = rmsError(pixels.data(), single.data(), width * height);
+			bool same = split == WorkSplit::Tiles ?
+				memcmp(pixels.data(), single.data(), width * height * sizeof(float4)) == 0 : error < 1e-5;
+			pass &= same;
+			double speedup = singleTime / time;
+			printf("    %-20s %9.1f ms  %5.2fx  %5.1f%%  %3u partials %6.1f MB  merged in %6.2f ms  rms %.1e%s\n",
+				name, time, speedup, speedup / numWorkers * 100.0, stats.numPartials, stats.bytesReceived / 1e6,
+				mergeTime, error, succeeded && same ? "" : "  FAILED");
+		}
+	}
+
+	AccumulationMerger merger(width, height, area, sceneHash);
+	AccumulationState partial;
+	partial.imageWidth = width;
+	partial.imageHeight = height;
+	partial.region = { 0, 0, 64, 64 };
+	partial.accumulatedSamples = 1;
+	partial.sceneHash = sceneHash + 1;
+	partial.pixels.resize(64 * 64);
+	bool refused = !merger.add(0, partial);
+	partial.sceneHash = sceneHash;
+	partial.region = { width - 32, 0, 64, 64 };
+	refused &= !merger.add(0, partial) && merger.getStats().numRefused == 2;
+	printf("    another scene and a region outside the image: %s\n", refused ? "refused" : "ACCEPTED");
+	printf("  %s\n", pass && refused ? "PASS" : "FAIL");
+	return pass && refused;
+}
+
+struct BenchmarkEntry
+{
+	const char* name;
+	bool (*run)();		// Whether its checks hold.
+};
+
+const BenchmarkEntry benchmarks[] = {
+	{ "array", benchmarkArray },
+	{ "triangles", benchmarkTriangles },
+	{ "math", benchmarkMath },
+	{ "fastmath", benchmarkFastMath },
+	{ "tonemap", benchmarkToneMapping },
+	{ "pixelformat", benchmarkPixelFormats },
+	{ "pipeline", benchmarkPipeline },
+	{ "framequeue", benchmarkFrameQueue },
+	{ "outputtarget", benchmarkOutputTarget },
+	{ "imagewrite", benchmarkImageWriters },
+	{ "tiles", benchmarkTiles },
+	{ "budget", benchmarkFrameBudget },
+	{ "checkpoint", benchmarkCheckpoints },
+	{ "distributed", benchmarkDistributed },
+};
+
+}	// namespace
+
+
+bool runBenchmark(const char* name)
+{
+	bool found = false, pass = true;
+	for (const BenchmarkEntry& entry : benchmarks)
+	{
+		if (strcmp(name, "all") == 0 || strcmp(name, entry.name) == 0)
+		{
+			pass &= entry.run();
+			found = true;
+		}
+	}
+
+	if (!found)
+	{
+		printf("Unknown benchmark '%s'. Benchmarks:", name);
+		for (const BenchmarkEntry& entry : benchmarks)
+			printf(" %s", entry.name);
+		printf(" all\n");
+	}
+	return found && pass;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+
+/*
+Microbenchmarks of the building blocks of the framework, run by "DXRPathTracer --bench <name>" before any window
+or device is created. Every case prints the best of a few runs, so that the numbers can be compared across changes.
+Returns false if there is no benchmark of that name or a check of one failed, so that main() exits with an error;
+"all" runs every one.
+*/
+bool runBenchmark(const char* name);
@@ -0,0 +1,1220 @@
+#include "pch.h"
+#include "CPUPathTracer.h"
+#include "Scene.h"
+#include "ThreadPool.h"
+#include "sampling.h"
+#include "pixelFormat.h"
+#include "Checkpoint.h"
+#include "hash.h"
+#include "timer.h"
+#include <atomic>
+#include <map>
+#include <tuple>
+
+
+namespace {
+
+// Moller-Trumbore without culling, as DXR does not cull triangles unless asked to.
+inline bool intersectEdges(const float3& p0, const float3& e1, const float3& e2, const Ray& ray, float& t, float2& uv)
+{
+	float3 pv = cross(ray.direction, e2);
+	float det = dot(e1, pv);
+	if (det == 0.0f)
+		return false;
+	float invDet = 1.0f / det;
+
+	float3 tv = ray.origin - p0;
+	float u = dot(tv, pv) * invDet;
+	if (u < 0.0f || u > 1.0f)
+		return false;
+
+	float3 qv = cross(tv, e1);
+	float v = dot(ray.direction, qv) * invDet;
+	if (v < 0.0f || u + v > 1.0f)
+		return false;
+
+	t = dot(e2, qv) * invDet;
+	if (t < ray.tMin || t > ray.tMax)
+		return false;
+
+	uv = float2(u, v);
+	return true;
+}
+
+inline float transformRow(const float4& row, const float3& p)
+{
+	return row.x * p.x + row.y * p.y + row.z * p.z + row.w;
+}
+
+inline float transformRowVector(const float4& row, const float3& v)
+{
+	return row.x * v.x + row.y * v.y + row.z * v.z;
+}
+
+// In the unit triangle space the plane is w = 0, so t comes first, and u and v are the coordinates of the hit.
+inline bool intersectWoop(const CPUTriangleWoop& tri, const Ray& ray, float& t, float2& uv)
+{
+	t = -transformRow(tri.rows[2], ray.origin) / transformRowVector(tri.rows[2], ray.direction);
+	if (!(t >= ray.tMin && t <= ray.tMax))		// Also rejects the NaN of a ray in the plane.
+		return false;
+
+	float u = transformRow(tri.rows[0], ray.origin) + t * transformRowVector(tri.rows[0], ray.direction);
+	if (u < 0.0f || u > 1.0f)
+		return false;
+
+	float v = transformRow(tri.rows[1], ray.origin) + t * transformRowVector(tri.rows[1], ray.direction);
+	if (v < 0.0f || u + v > 1.0f)
+		return false;
+
+	uv = float2(u, v);
+	return true;
+}
+
+CPUTriangleWoop makeWoopTriangle(const float3& p0, const float3& p1, const float3& p2)
+{
+	float3 e1 = p1 - p0;
+	float3 e2 = p2 - p0;
+	float3 n = cross(e1, e2);
+
+	// The rows of the inverse of the matrix of columns e1, e2 and n are the cross products of the other two.
+	float det = dot(e1, cross(e2, n));
+	CPUTriangleWoop tri;
+	if (det == 0.0f)
+	{
+		// Degenerate: t is always -inf, so it never hits, as with Moller-Trumbore.
+		tri.rows[0] = tri.rows[1] = float4(0.0f, 0.0f, 0.0f, 0.0f);
+		tri.rows[2] = float4(0.0f, 0.0f, 0.0f, 1.0f);
+		return tri;
+	}
+
+	float invDet = 1.0f / det;
+	float3 r0 = cross(e2, n) * invDet;
+	float3 r1 = cross(n, e1) * invDet;
+	float3 r2 = n * invDet;
+	tri.rows[0] = float4(r0, -dot(r0, p0));
+	tri.rows[1] = float4(r1, -dot(r1, p0));
+	tri.rows[2] = float4(r2, -dot(r2, p0));
+	return tri;
+}
+
+// Positions of the vertices of a mesh with any stride, e.g. in an interleaved Vertex or in a tight array.
+struct PositionStream
+{
+	const uint8* base;
+	uint stride;
+
+	const float3& operator[](uint i) const		{ return *(const float3*) (base + (size_t) i * stride); }
+};
+
+}	// namespace
+
+
+struct CPUPathTracer::RayPayload
+{
+	float3 radiance;
+	float3 attenuation;
+	float3 hitPos;
+	float3 bounceDir;
+	uint rayDepth;
+	uint seed;
+};
+
+
+CPUPathTracer::CPUPathTracer(uint width, uint height) : IGRTTracer(width, height)
+{
+	scene = nullptr;
+
+	camera.setFovY(60.0f);
+	camera.setScreenSize((float) tracerOutW, (float) tracerOutH);
+	camera.initOrbit(float3(0.0f, 1.5f, 0.0f), 10.0f, 0.0f, 0.0f);
+
+	tracerOutBuffer.resize(tracerOutW * tracerOutH, float4(0.0f));
+}
+
+void CPUPathTracer::setRegion(uint imageWidth, uint imageHeight, const PixelRegion& region)
+{
+	imageWidth = imageWidth ? imageWidth : 1;
+	imageHeight = imageHeight ? imageHeight : 1;
+	PixelRegion traced = clampRegion(region, imageWidth, imageHeight);
+	if (imageWidth == imageW && imageHeight == imageH && traced.x == regionX && traced.y == regionY &&
+		traced.width == tracerOutW && traced.height == tracerOutH)
+		return;
+
+	// The aspect of the camera is computed again only for another image, so that a region gets the very rays of
+	// the whole image.
+	if (imageWidth != imageW || imageHeight != imageH)
+		camera.setScreenSize((float) imageWidth, (float) imageHeight);
+	camera.setChanged();		// Which restarts the accumulation.
+
+	imageW = imageWidth;
+	imageH = imageHeight;
+	regionX = traced.x;
+	regionY = traced.y;
+	tracerOutW = traced.width;
+	tracerOutH = traced.height;
+
+	tracerOutBuffer.resize(tracerOutW * tracerOutH, float4(0.0f));
+	if (outputFormat != PixelFormat::RGBA32F)
+		displayBuffer.resize(tracerOutW * tracerOutH * pixelSizeOf(outputFormat));
+}
+
+void CPUPathTracer::setOutputFormat(PixelFormat format)
+{
+	outputFormat = format;
+	displayBuffer.clear();
+	if (format != PixelFormat::RGBA32F)
+		displayBuffer.resize(tracerOutW * tracerOutH * pixelSizeOf(format));
+}
+
+void CPUPathTracer::update(const InputEngine& input)
+{
+	double startTime = getCurrentTime();
+	timings = FrameTimings();
+	camera.update(input);
+
+	bool cameraChanged = camera.notifyChanged();
+	bool sceneChanged = scene && !scene->getChanges().empty();
+
+	if (sceneChanged)
+		applySceneChanges();
+	else if (cameraChanged && scene)
+		selectLODs();
+
+	bool resumed = continuesResumed();
+	if ((cameraChanged || sceneChanged) && !resumed)
+		restartAccumulation();
+	else
+		accumulatedFrames++;
+
+	timings.sceneUpdate = (getCurrentTime() - startTime) * 1000.0 - timings.accelUpdate;
+}
+
+void CPUPathTracer::setupScene(const Scene* scene)
+{
+	this->scene = const_cast<Scene*>(scene);
+	vtxArr = &scene->getVertexArray();
+	tdxArr = &scene->getTridexArray();
+	const Array<Material>& sceneMtlArr = scene->getMaterialArray();
+	mtlArr.resize(sceneMtlArr.size());
+	for (uint mtlIdx = 0; mtlIdx < mtlArr.size(); ++mtlIdx)
+		mtlArr[mtlIdx] = bakeMaterial(sceneMtlArr[mtlIdx]);
+
+	if (useSoAGeometry)
+		streams.build(*scene);
+	else
+		streams.clear();
+
+	buildAccelerationStructure();
+	restartAccumulation();
+}
+
+void CPUPathTracer::buildAccelerationStructure()
+{
+	double startTime = getCurrentTime();
+
+	blasArr.clear();
+	blasOfRange.clear();
+	instArr.resize(scene->numObjects());
+	hitGroupArr.resize(scene->numObjects());
+	numRefits = numRebuilds = 0;
+
+	for (uint objIdx = 0; objIdx < instArr.size(); ++objIdx)
+		setupInstance(objIdx);
+
+	buildTopLevel(false);
+	selectLODs();
+
+	printf("CPUPathTracer: acceleration structure built in %.1f ms\n", (getCurrentTime() - startTime) * 1000.0);
+	printStatistics();
+}
+
+// The level of detail and the BLAS of a mesh instance are left to selectLODs().
+void CPUPathTracer::setupInstance(uint objIdx)
+{
+	const SceneObject& obj = scene->getObject(objIdx);
+	CPUInstance& inst = instArr[objIdx];
+	inst.objectToWorld = obj.modelMatrix;
+	inst.worldToObject = composeInverseMatrix(obj.translation, obj.rotation, obj.scale);
+	inst.normalToWorld = inverseTranspose(obj.modelMatrix);
+	inst.shape = obj.shape;
+	inst.blasIdx = uint(-1);
+	inst.lodLevel = 0;
+
+	AABB objectBox;
+	if (useAnalyticPrimitives && obj.shape.type == AnalyticSphere)
+	{
+		objectBox = AABB(obj.shape.center - float3(obj.shape.radius), obj.shape.center + float3(obj.shape.radius));
+	}
+	else if (useAnalyticPrimitives && obj.shape.type == AnalyticBox)
+	{
+		objectBox = AABB(obj.shape.center - obj.shape.halfSize, obj.shape.center + obj.shape.halfSize);
+	}
+	else
+	{
+		inst.shape.type = TriangleMesh;
+		objectBox = obj.meshBox;
+	}
+
+	inst.worldBox = transformAABB(inst.objectToWorld, objectBox);
+	selectHitGroup(objIdx);
+}
+
+// The same choice as DXRPathTracer::writeHitGroupRecord().
+template<MathMode Mode>
+CPUPathTracer::ClosestHitShader CPUPathTracer::findHitGroup(int shadingType)
+{
+	switch (shadingType)
+	{
+	case Glass:		return &CPUPathTracer::closestHitGlass<Mode>;
+	case Metal:		return &CPUPathTracer::closestHit<Metal, Mode>;
+	case Plastic:	return &CPUPathTracer::closestHit<Plastic, Mode>;
+	default:		return &CPUPathTracer::closestHit<AnyMaterial, Mode>;
+	}
+}
+
+void CPUPathTracer::selectHitGroup(uint objIdx)
+{
+	int shadingType = scene->getShadingType(objIdx);
+	hitGroupArr[objIdx] = mathMode == MathMode::Fast ?
+		findHitGroup<MathMode::Fast>(shadingType) : findHitGroup<MathMode::Exact>(shadingType);
+}
+
+// A level of detail never gets out of the box of its full mesh, so switching levels keeps the top level valid.
+void CPUPathTracer::buildTopLevel(bool refit)
+{
+	Array<AABB> instBoxArr(instArr.size());
+	for (uint objIdx = 0; objIdx < instArr.size(); ++objIdx)
+		instBoxArr[objIdx] = instArr[objIdx].worldBox;
+
+	if (refit)
+		refitOrRebuild(tlas, instBoxArr, 1);
+	else
+		tlas.build(instBoxArr, 1);
+}
+
+void CPUPathTracer::computeTriangleBounds(const CPUMeshBVH& blas, Array<AABB>& boxArr) const
+{
+	const Vertex* vtx = vtxArr->data() + blas.vertexOffset;
+	boxArr.resize(blas.numTridices);
+
+	ThreadPool::get().parallelForRange(0, blas.numTridices, 4096, [&](uint begin, uint end) {
+		for (uint t = begin; t < end; ++t)
+		{
+			const Tridex& tdx = (*tdxArr)[blas.tridexOffset + t];
+			boxArr[t] = AABB();
+			boxArr[t].grow(vtx[tdx.x].position);
+			boxArr[t].grow(vtx[tdx.y].position);
+			boxArr[t].grow(vtx[tdx.z].position);
+		}
+	});
+}
+
+// The precomputed triangles follow the slots of the BVH, so they are built again whenever the BVH is.
+void CPUPathTracer::buildTriangleLayout(CPUMeshBVH& blas) const
+{
+	uint numTris = blas.bvh.numNodes() > 0 ? blas.numTridices : 0;
+	blas.edgesArr.resize(triangleLayout == TriangleLayout::Edges ? numTris : 0);
+	blas.woopArr.resize(triangleLayout == TriangleLayout::Woop ? numTris : 0);
+	blas.edgesArr.shrink_to_fit();
+	blas.woopArr.shrink_to_fit();
+	if (triangleLayout == TriangleLayout::Indexed || numTris == 0)
+		return;
+
+	const Vertex* vtx = vtxArr->data() + blas.vertexOffset;
+	const Tridex* tdx = tdxArr->data() + blas.tridexOffset;
+	const Array<uint>& primIdxArr = blas.bvh.getPrimIndices();
+
+	ThreadPool::get().parallelForRange(0, numTris, 4096, [&](uint begin, uint end) {
+		for (uint slot = begin; slot < end; ++slot)
+		{
+			const Tridex& t = tdx[primIdxArr[slot]];
+			const float3& p0 = vtx[t.x].position;
+			const float3& p1 = vtx[t.y].position;
+			const float3& p2 = vtx[t.z].position;
+
+			if (triangleLayout == TriangleLayout::Edges)
+				blas.edgesArr[slot] = { p0, p1 - p0, p2 - p0 };
+			else
+				blas.woopArr[slot] = makeWoopTriangle(p0, p1, p2);
+		}
+	});
+}
+
+// Keeps the topology while its SAH cost stays within refitCostLimit times that of its last build.
+void CPUPathTracer::refitOrRebuild(BVH& bvh, const Array<AABB>& primBoundArr, uint maxLeafSize)
+{
+	bvh.refit(primBoundArr);
+	++numRefits;
+
+	if (bvh.computeSAHCost() > refitCostLimit * bvh.getBuildSAHCost())
+	{
+		bvh.build(primBoundArr, maxLeafSize);
+		++numRebuilds;
+	}
+}
+
+/*
+Only the instances in the dirty range are set up again. The bottom levels of deformed meshes and the top level are
+refitted, falling back to a build when the refit has degraded them too much, and the other bottom levels are kept.
+A different number of objects builds the top level again. Dirty materials are baked again, and as one may have
+changed its type, every object chooses its hit group again.
+*/
+void CPUPathTracer::applySceneChanges()
+{
+	const SceneChanges& changes = scene->getChanges();
+
+	if (!changes.vertices.empty())
+	{
+		double startTime = getCurrentTime();
+		if (useSoAGeometry)
+			streams.update(*scene, changes.vertices);
+
+		Array<AABB> boxArr;
+		for (CPUMeshBVH& blas : blasArr)
+		{
+			bool overlaps = blas.vertexOffset < changes.vertices.end && blas.vertexOffset + blas.numVertices > changes.vertices.begin;
+			if (!overlaps || blas.bvh.numNodes() == 0)
+				continue;
+
+			computeTriangleBounds(blas, boxArr);
+			refitOrRebuild(blas.bvh, boxArr, 4);
+			buildTriangleLayout(blas);
+		}
+		timings.accelUpdate += (getCurrentTime() - startTime) * 1000.0;
+	}
+
+	if (!changes.objects.empty() || changes.numObjectsChanged)
+	{
+		instArr.resize(scene->numObjects());
+		hitGroupArr.resize(scene->numObjects());
+		for (uint objIdx = changes.objects.begin; objIdx < _min(changes.objects.end, instArr.size()); ++objIdx)
+			setupInstance(objIdx);
+
+		double startTime = getCurrentTime();
+		buildTopLevel(!changes.numObjectsChanged);
+		timings.accelUpdate += (getCurrentTime() - startTime) * 1000.0;
+	}
+
+	if (!changes.materials.empty())
+	{
+		const Array<Material>& sceneMtlArr = scene->getMaterialArray();
+		mtlArr.resize(sceneMtlArr.size());
+		for (uint mtlIdx = changes.materials.begin; mtlIdx < _min(changes.materials.end, mtlArr.size()); ++mtlIdx)
+			mtlArr[mtlIdx] = bakeMaterial(sceneMtlArr[mtlIdx]);
+		for (uint objIdx = 0; objIdx < instArr.size(); ++objIdx)
+			selectHitGroup(objIdx);
+	}
+
+	scene->clearChanges();
+	selectLODs();
+}
+
+uint CPUPathTracer::findOrAddBLAS(uint vertexOffset, uint numVertices, uint tridexOffset, uint numTridices)
+{
+	// Objects made from the same mesh share its vertex and tridex ranges, and so one BLAS.
+	auto range = std::make_tuple(vertexOffset, tridexOffset, numTridices);
+	auto found = blasOfRange.find(range);
+	if (found != blasOfRange.end())
+		return found->second;
+
+	CPUMeshBVH blas;
+	blas.vertexOffset = vertexOffset;
+	blas.numVertices = numVertices;
+	blas.tridexOffset = tridexOffset;
+	blas.numTridices = numTridices;
+	blasArr.push_back(move2(blas));
+	blasOfRange.emplace(range, blasArr.size() - 1);
+	return blasArr.size() - 1;
+}
+
+/*
+Every mesh instance takes the coarsest level of detail whose error, projected at the distance from the camera to
+the instance's bounding box, is at most lodPixelError pixels. The pixel footprint follows the vertical field of
+view of the camera, as in the ray generation of shootRays().
+*/
+void CPUPathTracer::selectLODs()
+{
+	float3 cameraPos = camera.getCameraPos();
+	float pixelsPerUnit = imageH / (2.0f * camera.getCameraAspect().y);	// At the unit distance.
+
+	for (uint objIdx = 0; objIdx < instArr.size(); ++objIdx)
+	{
+		CPUInstance& inst = instArr[objIdx];
+		if (inst.shape.type != TriangleMesh)
+			continue;
+
+		const SceneObject& obj = scene->getObject(objIdx);
+		uint level = 0;
+
+		if (useLODs && obj.numLODs > 0)
+		{
+			float3 nearest = _max(inst.worldBox.lower, _min(cameraPos, inst.worldBox.upper));
+			float distance = length(cameraPos - nearest);
+
+			for (level = obj.numLODs; level > 0; --level)
+			{
+				float error = scene->getLOD(obj.lodOffset + level - 1).error * obj.scale;
+				if (error * pixelsPerUnit <= lodPixelError * distance)
+					break;
+			}
+		}
+
+		inst.lodLevel = level;
+		if (level == 0)
+		{
+			inst.blasIdx = findOrAddBLAS(obj.vertexOffset, obj.numVertices, obj.tridexOffset, obj.numTridices);
+		}
+		else
+		{
+			const LODRange& lod = scene->getLOD(obj.lodOffset + level - 1);
+			inst.blasIdx = findOrAddBLAS(lod.vertexOffset, lod.numVertices, lod.tridexOffset, lod.numTridices);
+		}
+	}
+
+	// Build the BLAS which have just come into use, and free those which are no longer used.
+	Array<bool> used(blasArr.size(), false);
+	for (const CPUInstance& inst : instArr)
+	{
+		if (inst.blasIdx != uint(-1))
+			used[inst.blasIdx] = true;
+	}
+
+	Array<uint> buildArr;
+	for (uint blasIdx = 0; blasIdx < blasArr.size(); ++blasIdx)
+	{
+		bool built = blasArr[blasIdx].bvh.numNodes() > 0;
+		if (used[blasIdx] && !built)
+			buildArr.push_back(blasIdx);
+		else if (!used[blasIdx] && built)
+		{
+			blasArr[blasIdx].bvh.clear();
+			buildTriangleLayout(blasArr[blasIdx]);
+		}
+	}
+
+	double startTime = getCurrentTime();
+	ThreadPool::get().parallelFor(0, buildArr.size(), 1, [&](uint i) {
+		CPUMeshBVH& blas = blasArr[buildArr[i]];
+		Array<AABB> boxArr;
+		computeTriangleBounds(blas, boxArr);
+		blas.bvh.build(boxArr);
+		buildTriangleLayout(blas);
+	});
+	timings.accelUpdate += (getCurrentTime() - startTime) * 1000.0;
+}
+
+void CPUPathTracer::printStatistics() const
+{
+	uint numAnalytic = 0, numCoarse = 0, numBuilt = 0;
+	uint64 numTriangles = 0, bvhSize = tlas.memorySize();
+
+	for (const CPUInstance& inst : instArr)
+	{
+		numAnalytic += (inst.shape.type != TriangleMesh);
+		numCoarse += (inst.lodLevel > 0);
+	}
+	for (const CPUMeshBVH& blas : blasArr)
+	{
+		if (blas.bvh.numNodes() == 0)
+			continue;
+		++numBuilt;
+		numTriangles += blas.numTridices;
+		bvhSize += blas.bvh.memorySize();
+	}
+
+	printf("CPUPathTracer: %u objects (%u analytic, %u at a coarser LOD), %u BLAS with %llu triangles, BVH %.1f KB, "
+		"%u refits (%u rebuilt)\n", instArr.size(), numAnalytic, numCoarse, numBuilt, numTriangles, bvhSize / 1024.0,
+		numRefits, numRebuilds);
+
+	static const char* layoutNames[] = { "indexed", "edges", "woop" };
+	printf("CPUPathTracer: %s triangles%s, %.1f MB\n", layoutNames[(uint) triangleLayout],
+		(triangleLayout == TriangleLayout::Indexed && useSoAGeometry) ? " on SoA positions" : "",
+		triangleDataSize() / (1024.0 * 1024.0));
+}
+
+bool CPUPathTracer::intersectMesh(const CPUMeshBVH& blas, Ray& ray, CPUHit& hit) const
+{
+	const Array<uint>& primIdxArr = blas.bvh.getPrimIndices();
+	float t;
+	float2 uv;
+
+	auto reportHit = [&](uint slot, Ray& ray) {
+		ray.tMax = t;
+		hit.t = t;
+		hit.primIdx = primIdxArr[slot];
+		hit.barycentrics = uv;
+		return true;
+	};
+
+	if (triangleLayout == TriangleLayout::Woop)
+	{
+		const CPUTriangleWoop* triArr = blas.woopArr.data();
+		return blas.bvh.traverseSlots(ray, [&](uint slot, Ray& ray) {
+			return intersectWoop(triArr[slot], ray, t, uv) && reportHit(slot, ray);
+		});
+	}
+
+	if (triangleLayout == TriangleLayout::Edges)
+	{
+		const CPUTriangleEdges* triArr = blas.edgesArr.data();
+		return blas.bvh.traverseSlots(ray, [&](uint slot, Ray& ray) {
+			const CPUTriangleEdges& tri = triArr[slot];
+			return intersectEdges(tri.p0, tri.e1, tri.e2, ray, t, uv) && reportHit(slot, ray);
+		});
+	}
+
+	PositionStream pos;
+	if (useSoAGeometry)
+		pos = { (const uint8*) (streams.getPositions() + blas.vertexOffset), sizeof(float3) };
+	else
+		pos = { (const uint8*) &(*vtxArr)[blas.vertexOffset].position, sizeof(Vertex) };
+	const Tridex* tdx = tdxArr->data() + blas.tridexOffset;
+
+	return blas.bvh.traverseSlots(ray, [&](uint slot, Ray& ray) {
+		const Tridex& tri = tdx[primIdxArr[slot]];
+		float3 p0 = pos[tri.x];
+		return intersectEdges(p0, pos[tri.y] - p0, pos[tri.z] - p0, ray, t, uv) && reportHit(slot, ray);
+	});
+}
+
+// The ray is given in the object coordinates where it is not normalized, so t is the same as in the world.
+bool CPUPathTracer::intersectShape(const AnalyticShape& shape, Ray& ray, CPUHit& hit) const
+{
+	float t;
+
+	if (shape.type == AnalyticSphere)
+	{
+		// The discriminant is computed from the distance between the center and the ray,
+		// which does not lose the precision for the small spheres far from the ray origin.
+		float3 f = ray.origin - shape.center;
+		float a = dot(ray.direction, ray.direction);
+		float b = dot(f, ray.direction);
+		float3 l = f - (b / a) * ray.direction;
+		float disc = shape.radius * shape.radius - dot(l, l);
+		if (disc < 0.0f)
+			return false;
+
+		float sq = sqrtf(a * disc);
+		float t0 = (-b - sq) / a;
+		float t1 = (-b + sq) / a;
+		if (t0 >= ray.tMin && t0 <= ray.tMax)
+			t = t0;
+		else if (t1 >= ray.tMin && t1 <= ray.tMax)
+			t = t1;
+		else
+			return false;
+
+		hit.objectNormal = (ray.origin + t * ray.direction - shape.center) / shape.radius;
+	}
+	else
+	{
+		float3 t0 = (shape.center - shape.halfSize - ray.origin) * ray.invDirection;
+		float3 t1 = (shape.center + shape.halfSize - ray.origin) * ray.invDirection;
+		float3 tNear = _min(t0, t1);
+		float3 tFar = _max(t0, t1);
+		float tEnter = _max(_max(tNear.x, tNear.y), tNear.z);
+		float tExit = _min(_min(tFar.x, tFar.y), tFar.z);
+		if (tEnter > tExit)
+			return false;
+
+		if (tEnter >= ray.tMin && tEnter <= ray.tMax)
+			t = tEnter;
+		else if (tExit >= ray.tMin && tExit <= ray.tMax)
+			t = tExit;
+		else
+			return false;
+
+		// The face is the one on which the hit point is relatively farthest from the center.
+		float3 local = (ray.origin + t * ray.direction - shape.center) / shape.halfSize;
+		float3 absLocal(fabsf(local.x), fabsf(local.y), fabsf(local.z));
+		uint axis = (absLocal.x > absLocal.y) ? (absLocal.x > absLocal.z ? 0 : 2) : (absLocal.y > absLocal.z ? 1 : 2);
+		hit.objectNormal = float3(0.0f);
+		hit.objectNormal[axis] = local[axis] > 0.0f ? 1.0f : -1.0f;
+	}
+
+	ray.tMax = t;
+	hit.t = t;
+	hit.primIdx = 0;
+	return true;
+}
+
+bool CPUPathTracer::traceRay(const float3& origin, const float3& direction, CPUHit& hit) const
+{
+	Ray ray(origin, direction, rayTmin, rayTmax);
+
+	return tlas.traverse(ray, [&](uint objIdx, Ray& ray) {
+		const CPUInstance& inst = instArr[objIdx];
+		Ray objRay(transformPoint(inst.worldToObject, ray.origin), transformVector(inst.worldToObject, ray.direction), ray.tMin, ray.tMax);
+
+		bool found;
+		if (inst.blasIdx == uint(-1))
+		{
+			found = intersectShape(inst.shape, objRay, hit);
+		}
+		else
+		{
+			found = intersectMesh(blasArr[inst.blasIdx], objRay, hit);
+		}
+
+		if (!found)
+			return false;
+		ray.tMax = objRay.tMax;
+		hit.objIdx = objIdx;
+		return true;
+	});
+}
+
+void CPUPathTracer::computeNormal(float3& normal, float3& faceNormal, const CPUHit& hit) const
+{
+	const CPUInstance& inst = instArr[hit.objIdx];
+
+	// An analytic shape has no shading normal apart from the geometric one, and it is exact.
+	if (inst.blasIdx == uint(-1))
+	{
+		faceNormal = normal = normalize(transformVector(inst.normalToWorld, hit.objectNormal));
+		return;
+	}
+
+	const CPUMeshBVH& blas = blasArr[inst.blasIdx];
+	const Tridex& tridex = (*tdxArr)[blas.tridexOffset + hit.primIdx];
+	uint i0 = blas.vertexOffset + tridex.x;
+	uint i1 = blas.vertexOffset + tridex.y;
+	uint i2 = blas.vertexOffset + tridex.z;
+
+	float3 p0, p1, p2, n0, n1, n2;
+	if (useSoAGeometry)
+	{
+		const float3* pos = streams.getPositions();
+		const VertexAttributes* attr = streams.getAttributes();
+		p0 = pos[i0];	p1 = pos[i1];	p2 = pos[i2];
+		n0 = attr[i0].normal;	n1 = attr[i1].normal;	n2 = attr[i2].normal;
+	}
+	else
+	{
+		const Vertex* vtx = vtxArr->data();
+		p0 = vtx[i0].position;	p1 = vtx[i1].position;	p2 = vtx[i2].position;
+		n0 = vtx[i0].normal;	n1 = vtx[i1].normal;	n2 = vtx[i2].normal;
+	}
+
+	float t0 = 1.0f - hit.barycentrics.x - hit.barycentrics.y;
+	float t1 = hit.barycentrics.x;
+	float t2 = hit.barycentrics.y;
+
+	faceNormal = normalize(transformVector(inst.normalToWorld, cross(p1 - p0, p2 - p0)));
+	normal = normalize(transformVector(inst.normalToWorld, t0 * n0 + t1 * n1 + t2 * n2));
+}
+
+/*
+The shading below follows samplingBRDF(), closestHit(), closestHitGlass() and missRay() of DXRShader.hlsl
+statement by statement; see the comments there.
+*/
+namespace {
+
+// Specialized for one material type at compile time, so that the other types cost nothing. Glass and the types
+// without a kernel sample nothing, as in DXRShader.hlsl.
+template<int ReflectType, MathMode Mode>
+void samplingBRDF(float3& sampleDir, float& sampleProb, float3& brdfCos,
+	const float3& surfaceNormal, const float3& baseDir, const BakedMaterial& mtl, uint& seed)
+{
+	float3 brdfEval = float3(0.0f);
+	float3 albedo = mtl.albedo;
+
+	float3 I = float3(0.0f), O = baseDir, N = surfaceNormal, H;
+	float ON = dot(O, N), IN = 0.0f, HN, OH;
+	float alpha2 = mtl.alpha2;
+	sampleProb = 0.0f;
+
+	if (ReflectType == Lambertian)
+	{
+		I = sample_hemisphere_cos<Mode>(seed);
+		IN = I.z;
+		I = applyRotationMappingZToN(N, I);
+
+		sampleProb = InvPi * IN;
+		brdfEval = InvPi * albedo;
+	}
+
+	else if (ReflectType == Metal)
+	{
+		H = sample_hemisphere_TrowbridgeReitzCos<Mode>(alpha2, seed);
+		HN = H.z;
+		H = applyRotationMappingZToN(N, H);
+		OH = dot(O, H);
+
+		I = 2 * OH * H - O;
+		IN = dot(I, N);
+
+		if (IN < 0)
+		{
+			brdfEval = float3(0.0f);
+			sampleProb = 0;
+		}
+		else
+		{
+			float D = TrowbridgeReitz(HN*HN, alpha2);
+			float G = Smith_TrowbridgeReitz<Mode>(I, O, H, N, alpha2);
+			float3 F = mtl.F0 + (float3(1.0f) - mtl.F0) * mathPow5<Mode>(_max(0.0f, 1 - OH));
+			brdfEval = ((D * G) / (4 * IN * ON)) * F;
+			sampleProb = D*HN / (4*OH);
+		}
+	}
+
+	else if (ReflectType == Plastic)
+	{
+		float r = mtl.reflectivity;
+
+		if (rnd(seed) < r)
+		{
+			H = sample_hemisphere_TrowbridgeReitzCos<Mode>(alpha2, seed);
+			HN = H.z;
+			H = applyRotationMappingZToN(N, H);
+			OH = dot(O, H);
+
+			I = 2 * OH * H - O;
+			IN = dot(I, N);
+		}
+		else
+		{
+			I = sample_hemisphere_cos<Mode>(seed);
+			IN = I.z;
+			I = applyRotationMappingZToN(N, I);
+
+			H = O + I;
+			H = (1 / length(H)) * H;
+			HN = dot(H, N);
+			OH = dot(O, H);
+		}
+
+		if (IN < 0)
+		{
+			brdfEval = float3(0.0f);
+			sampleProb = 0;
+		}
+		else
+		{
+			float D = TrowbridgeReitz(HN*HN, alpha2);
+			float G = Smith_TrowbridgeReitz<Mode>(I, O, H, N, alpha2);
+			float spec = ((D * G) / (4 * IN * ON));
+			brdfEval = r * float3(spec) + (1 - r) * InvPi * albedo;
+			sampleProb = r * (D*HN / (4*OH)) + (1 - r) * (InvPi * IN);
+		}
+	}
+
+	sampleDir = I;
+	brdfCos = brdfEval * IN;
+}
+
+typedef void (*SamplingBRDF)(float3&, float&, float3&, const float3&, const float3&, const BakedMaterial&, uint&);
+
+// The kernel of a material type, indexed by the type, for the hit group which reads the type at every hit.
+template<MathMode Mode>
+struct SamplingBRDFTable
+{
+	static const SamplingBRDF ofType[];
+};
+
+template<MathMode Mode>
+const SamplingBRDF SamplingBRDFTable<Mode>::ofType[] = {
+	samplingBRDF<Lambertian, Mode>, samplingBRDF<Metal, Mode>, samplingBRDF<Plastic, Mode>, samplingBRDF<Glass, Mode>,
+};
+
+template<MathMode Mode>
+inline SamplingBRDF findSamplingBRDF(uint type)
+{
+	return type <= (uint) Glass ? SamplingBRDFTable<Mode>::ofType[type] : samplingBRDF<Glass, Mode>;
+}
+
+inline bool any(const float3& v)
+{
+	return v.x != 0.0f || v.y != 0.0f || v.z != 0.0f;
+}
+
+}	// namespace
+
+template<int ReflectType, MathMode Mode>
+void CPUPathTracer::closestHit(RayPayload& payload, const float3& rayOrigin, const float3& rayDir, const CPUHit& hit) const
+{
+	const SceneObject& obj = scene->getObject(hit.objIdx);
+
+	float3 N, fN, E = -rayDir;
+	computeNormal(N, fN, hit);
+	float EN = dot(E, N), EfN = dot(E, fN);
+
+	payload.radiance = float3(0.0f);
+	payload.attenuation = float3(1.0f);
+	payload.hitPos = rayOrigin - hit.t * E;
+
+	uint mtlIdx = obj.materialIdx;
+
+	if (obj.twoSided && EfN < 0)
+	{
+		mtlIdx = obj.backMaterialIdx;
+		N = -N;
+		EN = -EN;
+	}
+
+	if (EN < 0)
+	{
+		payload.bounceDir = rayDir;
+		--payload.rayDepth;
+		return;
+	}
+
+	const BakedMaterial& mtl = mtlArr[mtlIdx];
+
+	if (any(mtl.emittance))
+	{
+		payload.radiance += mtl.emittance;
+	}
+
+	float3 sampleDir, brdfCos;
+	float sampleProb;
+	if (ReflectType == AnyMaterial)
+		findSamplingBRDF<Mode>(mtl.type)(sampleDir, sampleProb, brdfCos, N, E, mtl, payload.seed);
+	else
+		samplingBRDF<ReflectType, Mode>(sampleDir, sampleProb, brdfCos, N, E, mtl, payload.seed);
+
+	if (dot(sampleDir, N) <= 0)
+		payload.rayDepth = maxPathLength;
+	payload.attenuation = brdfCos / sampleProb;
+	payload.bounceDir = sampleDir;
+}
+
+template<MathMode Mode>
+void CPUPathTracer::closestHitGlass(RayPayload& payload, const float3& rayOrigin, const float3& rayDir, const CPUHit& hit) const
+{
+	const SceneObject& obj = scene->getObject(hit.objIdx);
+
+	float3 N, fN, E = -rayDir;
+	computeNormal(N, fN, hit);
+	float EN = dot(E, N), EfN = dot(E, fN);
+
+	payload.radiance = float3(0.0f);
+	payload.attenuation = float3(1.0f);
+	payload.hitPos = rayOrigin - hit.t * E;
+
+	if (EN * EfN < 0)
+	{
+		payload.bounceDir = rayDir;
+		--payload.rayDepth;
+		return;
+	}
+
+	const BakedMaterial& mtl = mtlArr[obj.materialIdx];
+
+	if (any(mtl.emittance) && EN > 0)
+	{
+		payload.radiance += mtl.emittance;
+	}
+
+	float3 sampleDir = float3(0.0f);
+	float sampleProb, Fresnel;
+
+	float R, g = 0.0f, x, y;
+	float n, c1, gg;
+
+	if (EN > 0)
+	{
+		n = mtl.invIor;			// n <- relative index of air-to-glass (n_air/n_glass)
+		c1 = EN;
+	}
+	else
+	{
+		n = mtl.ior;			// n <- relative index of glass-to-air (n_glass/n_air)
+		c1 = -EN;
+	}
+
+	gg = 1 / (n*n) - 1 + c1*c1;	// gg == (c2/n)^2
+	if (gg < 0)
+	{
+		R = 1;
+	}
+	else
+	{
+		g = mathSqrt<Mode>(gg);
+		x = (c1*(g + c1) - 1) / (c1*(g - c1) + 1);
+		y = (g - c1) / (g + c1);
+		R = 0.5f * y*y * (1 + x*x);
+	}
+
+	if (rnd(payload.seed) < R)
+	{
+		sampleProb = R;
+		Fresnel = R;
+		sampleDir = 2 * EN * N - E;
+	}
+	else
+	{
+		sampleProb = 1 - R;
+		Fresnel = 1 - R;
+
+		if (gg < 0)
+		{
+			payload.rayDepth = maxPathLength;
+		}
+		else
+		{
+			float ON = -(EN > 0 ? 1.0f : (EN < 0 ? -1.0f : 0.0f)) * n * g;
+			sampleDir = (ON + n * EN)*N - n * E;
+		}
+	}
+
+	if (EN > 0)			// Additional bounce for the case of air-to-glass.
+		--payload.rayDepth;
+
+	payload.attenuation = float3(Fresnel / sampleProb);
+	payload.bounceDir = sampleDir;
+}
+
+void CPUPathTracer::missRay(RayPayload& payload) const
+{
+	payload.radiance = backgroundLight;
+	payload.rayDepth = maxPathLength;
+}
+
+float3 CPUPathTracer::tracePath(const float3& startPos, const float3& startDir, uint& seed, uint& numRays) const
+{
+	float3 radiance = float3(0.0f);
+	float3 attenuation = float3(1.0f);
+
+	float3 rayOrigin = startPos;
+	float3 rayDir = startDir;
+	RayPayload prd;
+	prd.radiance = float3(0.0f);
+	prd.attenuation = float3(1.0f);
+	prd.seed = seed;
+	prd.rayDepth = 0;
+
+	while (prd.rayDepth < maxPathLength)
+	{
+		CPUHit hit;
+		++numRays;
+		if (!traceRay(rayOrigin, rayDir, hit))
+		{
+			missRay(prd);
+		}
+		else
+		{
+			(this->*hitGroupArr[hit.objIdx])(prd, rayOrigin, rayDir, hit);
+		}
+
+		radiance += attenuation * prd.radiance;
+		attenuation *= prd.attenuation;
+
+		rayOrigin = prd.hitPos;
+		rayDir = prd.bounceDir;
+		++prd.rayDepth;
+	}
+
+	seed = prd.seed;
+
+	return radiance;
+}
+
+TracedResult CPUPathTracer::shootRays()
+{
+	double startTime = getCurrentTime();
+	float3 cameraPos = camera.getCameraPos();
+	float3 cameraX = camera.getCameraX();
+	float3 cameraY = camera.getCameraY();
+	float3 cameraZ = camera.getCameraZ();
+	float2 cameraAspect = camera.getCameraAspect();
+	std::atomic<uint64> numRays(0);
+
+	// The frame's share of the samples of the accumulation, so that a frame of more samples weighs more.
+	float frameWeight = (float) numSamplesPerFrame / (float) (accumulatedSamples + numSamplesPerFrame);
+
+	// Each row goes to its place in the output as soon as it is traced, while it is still in the cache.
+	OutputBuffer output = outputTarget ? outputTarget->acquireOutput(tracerOutW, tracerOutH, outputFormat) : OutputBuffer();
+	if (!output.data && outputFormat != PixelFormat::RGBA32F)
+		output = { displayBuffer.data(), (uint64) tracerOutW * pixelSizeOf(outputFormat) };
+
+	ThreadPool::get().parallelFor(0, tracerOutH, 1, [&](uint y) {
+		uint rowRays = 0;
+		for (uint x = 0; x < tracerOutW; ++x)
+		{
+			uint bufferOffset = tracerOutW * y + x;
+			uint pixelX = regionX + x, pixelY = regionY + y;		// In the image.
+			uint seed = getNewSeed(imageW * pixelY + pixelX, accumulatedFrames, 8);
+
+			float3 newRadiance = float3(0.0f);
+			for (uint i = 0; i < numSamplesPerFrame; ++i)
+			{
+				float sx = (float) pixelX + rnd(seed);
+				float sy = (float) pixelY + rnd(seed);
+				float2 ndc(sx / imageW * 2.f - 1.f, sy / imageH * 2.f - 1.f);
+				float3 rayDir = normalize(ndc.x*cameraAspect.x*cameraX + ndc.y*cameraAspect.y*cameraY + cameraZ);
+
+				newRadiance += tracePath(cameraPos, rayDir, seed, rowRays);
+			}
+			newRadiance = newRadiance * (1.0f / float(numSamplesPerFrame));
+
+			float4& out = tracerOutBuffer[bufferOffset];
+			if (accumulatedSamples != 0)
+				newRadiance = float3(out.x, out.y, out.z) + (newRadiance - float3(out.x, out.y, out.z)) * frameWeight;
+			out = float4(newRadiance, 1.0f);
+		}
+		numRays += rowRays;
+
+		if (output.data)
+			convertPixels(&tracerOutBuffer[tracerOutW * y], (uint8*) output.data + output.rowPitch * y, outputFormat, tracerOutW);
+	});
+	numRaysTraced = numRays;
+	accumulatedSamples += numSamplesPerFrame;
+
+	TracedResult result;
+	result.data = output.data ? output.data : (void*) tracerOutBuffer.data();
+	result.width = tracerOutW;
+	result.height = tracerOutH;
+	result.pixelSize = pixelSizeOf(outputFormat);
+	result.format = outputFormat;
+	result.rowPitch = output.data ? output.rowPitch : 0;
+
+	timings.trace = (getCurrentTime() - startTime) * 1000.0;
+	timings.numSamples = numSamplesPerFrame;
+	return result;
+}
+
+void CPUPathTracer::setUseSoAGeometry(bool use)
+{
+	useSoAGeometry = use;
+	restartAccumulation();
+	if (!scene)
+		return;
+
+	if (use && streams.empty())
+		streams.build(*scene);
+	else if (!use)
+		streams.clear();
+}
+
+void CPUPathTracer::setTriangleLayout(TriangleLayout layout)
+{
+	triangleLayout = layout;
+	restartAccumulation();
+	for (CPUMeshBVH& blas : blasArr)
+		buildTriangleLayout(blas);
+}
+
+void CPUPathTracer::setMathMode(MathMode mode)
+{
+	mathMode = mode;
+	restartAccumulation();
+	if (!scene)
+		return;
+
+	for (uint objIdx = 0; objIdx < hitGroupArr.size(); ++objIdx)
+		selectHitGroup(objIdx);
+}
+
+// Neither the math mode nor the layouts of the geometry, which change only the noise of the image, or nothing.
+uint64 CPUPathTracer::getSceneHash() const
+{
+	uint64 h = hashView(camera, imageW, imageH, getRegion());
+	if (scene)
+		h = hashCombine(h, hashScene(*scene));
+	h = hashBytes(&backgroundLight, sizeof(backgroundLight), h);
+	h = hashBytes(&rayTmin, sizeof(rayTmin), h);
+	h = hashBytes(&rayTmax, sizeof(rayTmax), h);
+	h = hashBytes(&lodPixelError, sizeof(lodPixelError), h);
+	h = hashCombine(h, maxPathLength);
+	return hashCombine(h, (useAnalyticPrimitives ? 1 : 0) | (useLODs ? 2 : 0));
+}
+
+void CPUPathTracer::saveAccumulation(AccumulationState& state)
+{
+	state.imageWidth = imageW;
+	state.imageHeight = imageH;
+	state.region = getRegion();
+	state.accumulatedFrames = accumulatedFrames;
+	state.accumulatedSamples = accumulatedSamples;
+	state.sceneHash = getSceneHash();
+	state.pixels.resize(tracerOutBuffer.size());
+	memcpy(state.pixels.data(), tracerOutBuffer.data(), tracerOutBuffer.size() * sizeof(float4));
+}
+
+// The next update() goes on from the frame after that of the state, as if the frames had been traced here.
+bool CPUPathTracer::restoreAccumulation(const AccumulationState& state)
+{
+	if (!isResumable(state, *this))
+		return false;
+	if (state.accumulatedSamples == 0)
+		return true;
+
+	memcpy(tracerOutBuffer.data(), state.pixels.data(), tracerOutBuffer.size() * sizeof(float4));
+	accumulatedFrames = state.accumulatedFrames;
+	accumulatedSamples = state.accumulatedSamples;
+	resumedHash = state.sceneHash;
+	return true;
+}
+
+uint64 CPUPathTracer::triangleDataSize() const
+{
+	uint64 size = 0;
+	for (const CPUMeshBVH& blas : blasArr)
+	{
+		if (blas.bvh.numNodes() == 0)
+			continue;
+
+		if (triangleLayout == TriangleLayout::Woop)
+			size += blas.woopArr.size() * sizeof(CPUTriangleWoop);
+		else if (triangleLayout == TriangleLayout::Edges)
+			size += blas.edgesArr.size() * sizeof(CPUTriangleEdges);
+		else
+			size += blas.numTridices * sizeof(Tridex) + blas.numVertices * (useSoAGeometry ? sizeof(float3) : sizeof(Vertex));
+	}
+	return size;
+}
+
+void CPUPathTracer::renderAOVs(Array<float>& depthArr, Array<float3>& normalArr) const
+{
+	float3 cameraPos = camera.getCameraPos();
+	float3 cameraX = camera.getCameraX();
+	float3 cameraY = camera.getCameraY();
+	float3 cameraZ = camera.getCameraZ();
+	float2 cameraAspect = camera.getCameraAspect();
+	depthArr.resize(tracerOutW * tracerOutH);
+	normalArr.resize(tracerOutW * tracerOutH);
+
+	ThreadPool::get().parallelFor(0, tracerOutH, 1, [&](uint y) {
+		for (uint x = 0; x < tracerOutW; ++x)
+		{
+			float2 ndc((regionX + x + 0.5f) / imageW * 2.f - 1.f, (regionY + y + 0.5f) / imageH * 2.f - 1.f);
+			float3 rayDir = normalize(ndc.x*cameraAspect.x*cameraX + ndc.y*cameraAspect.y*cameraY + cameraZ);
+
+			uint pixel = tracerOutW * y + x;
+			CPUHit hit;
+			if (!traceRay(cameraPos, rayDir, hit))
+			{
+				depthArr[pixel] = FLT_MAX;
+				normalArr[pixel] = float3(0.0f);
+				continue;
+			}
+
+			float3 normal, faceNormal;
+			computeNormal(normal, faceNormal, hit);
+			depthArr[pixel] = hit.t * dot(rayDir, cameraZ);
+			normalArr[pixel] = normal;
+		}
+	});
+}
+
+uint CPUPathTracer::traceRays(const Array<float3>& originArr, const Array<float3>& directionArr, Array<float>& tArr) const
+{
+	uint numRays = originArr.size();
+	tArr.resize(numRays);
+	std::atomic<uint> numHits(0);
+
+	ThreadPool::get().parallelForRange(0, numRays, 1024, [&](uint begin, uint end) {
+		uint hits = 0;
+		for (uint i = begin; i < end; ++i)
+		{
+			CPUHit hit;
+			bool found = traceRay(originArr[i], directionArr[i], hit);
+			tArr[i] = found ? hit.t : FLT_MAX;
+			hits += found;
+		}
+		numHits += hits;
+	});
+	return numHits;
+}
@@ -0,0 +1,185 @@
+#pragma once
+#include "IGRTTracer.h"
+#include "Camera.h"
+#include "BVH.h"
+#include "Mesh.h"
+#include "Scene.h"
+#include "fastMath.h"
+#include <map>
+#include <tuple>
+
+
+struct Material;
+
+
+// One entry of the top level: a scene object with its model transform.
+struct CPUInstance
+{
+	Transform	objectToWorld;
+	Transform	worldToObject;
+	Transform	normalToWorld;	// inverseTranspose(objectToWorld)
+	uint		blasIdx;		// uint(-1) if the object is intersected as its analytic shape.
+	uint		lodLevel;		// 0 for the full mesh, otherwise SceneObject::lodOffset + lodLevel - 1 of the scene.
+	AnalyticShape shape;
+	AABB		worldBox;		// Of the full mesh, which contains every level of detail too.
+};
+
+
+// How the leaf intersector of a bottom level reads its triangles.
+enum class TriangleLayout
+{
+	Indexed,	// Tridices into the scene's vertices, interleaved or the SoA positions (see setUseSoAGeometry()).
+	Edges,		// A vertex and the two edges from it, precomputed in the slot order of the BVH (36 bytes).
+	Woop,		// The affine transform of the triangle to the unit one, in the slot order of the BVH (48 bytes).
+};
+
+struct CPUTriangleEdges
+{
+	float3 p0;
+	float3 e1;			// p1 - p0
+	float3 e2;			// p2 - p0
+};
+
+// The rows of the inverse of [e1 e2 n | p0], which maps a point to its barycentrics u, v and its distance along n.
+struct CPUTriangleWoop
+{
+	float4 rows[3];
+};
+
+
+// Bottom level: triangles of one mesh range in the object coordinates, shared by the objects which use the mesh.
+// A range is either a full mesh or one of its levels of detail, and its BVH is built only while some object uses it.
+struct CPUMeshBVH
+{
+	uint	vertexOffset;
+	uint	numVertices;
+	uint	tridexOffset;
+	uint	numTridices;
+	BVH		bvh;
+	Array<CPUTriangleEdges>	edgesArr;	// Of the selected TriangleLayout only.
+	Array<CPUTriangleWoop>	woopArr;
+};
+
+
+struct CPUHit
+{
+	float	t;
+	uint	objIdx;
+	uint	primIdx;
+	float2	barycentrics;
+	float3	objectNormal;		// Only for the analytic shapes.
+};
+
+
+/*
+Multithreaded CPU port of DXRShader.hlsl, presented through the same IGRTTracer interface as DXRPathTracer.
+Rays are traced against a two-level BVH whose instances are either triangle meshes or analytic shapes.
+*/
+class CPUPathTracer : public IGRTTracer
+{
+	OrbitCamera			camera;
+
+	float3				backgroundLight = float3(0.0f);
+	float				rayTmin = 0.001f;	// 1mm
+	float				rayTmax = 1e27f;
+	uint				accumulatedFrames = 0;		// Which seeds the samples of a frame.
+	uint				accumulatedSamples = 0;		// Per pixel, in tracerOutBuffer; 0 restarts the accumulation.
+	uint				numSamplesPerFrame = 1;
+	uint				maxPathLength = 6;
+	bool				useAnalyticPrimitives = true;
+	bool				useLODs = true;
+	float				lodPixelError = 1.0f;		// Largest allowed on-screen error of a level of detail, in pixels.
+	FrameTimings		timings;
+	float				refitCostLimit = 1.5f;		// A refitted BVH is built again beyond this times its SAH cost at build.
+	uint				numRefits = 0;
+	uint				numRebuilds = 0;
+	bool				useSoAGeometry = true;
+	TriangleLayout		triangleLayout = TriangleLayout::Woop;
+	MathMode			mathMode = MathMode::Exact;	// Of the shading; Exact converges to the image of DXRPathTracer.
+	uint64				numRaysTraced = 0;			// By the last shootRays().
+
+	Array<float4>		tracerOutBuffer;			// The accumulation, always in full precision.
+	PixelFormat			outputFormat = PixelFormat::RGBA32F;
+	Array<uint8>		displayBuffer;				// tracerOutBuffer in outputFormat, unless that is RGBA32F.
+
+	const Array<Vertex>*	vtxArr = nullptr;
+	const Array<Tridex>*	tdxArr = nullptr;
+	Array<BakedMaterial>	mtlArr;				// Of the scene, baked again when they change.
+	SceneGeometryStreams	streams;			// Built only with useSoAGeometry.
+	Array<CPUMeshBVH>		blasArr;
+	Array<CPUInstance>		instArr;
+	BVH						tlas;
+	std::map<std::tuple<uint, uint, uint>, uint> blasOfRange;
+
+	// The closest hit shader of every object, chosen by its material type as DXRPathTracer picks the hit groups.
+	struct RayPayload;
+	typedef void (CPUPathTracer::*ClosestHitShader)(RayPayload&, const float3&, const float3&, const CPUHit&) const;
+	Array<ClosestHitShader>	hitGroupArr;
+
+	void buildAccelerationStructure();
+	void setupInstance(uint objIdx);
+	void buildTopLevel(bool refit);
+	void applySceneChanges();
+	uint findOrAddBLAS(uint vertexOffset, uint numVertices, uint tridexOffset, uint numTridices);
+	void computeTriangleBounds(const CPUMeshBVH& blas, Array<AABB>& boxArr) const;
+	void buildTriangleLayout(CPUMeshBVH& blas) const;
+	void refitOrRebuild(BVH& bvh, const Array<AABB>& primBoundArr, uint maxLeafSize);
+	void selectLODs();
+	void restartAccumulation()					{ accumulatedFrames = firstFrame; accumulatedSamples = 0; }
+	void selectHitGroup(uint objIdx);
+	template<MathMode Mode>
+	static ClosestHitShader findHitGroup(int shadingType);
+
+	bool intersectMesh(const CPUMeshBVH& blas, Ray& ray, CPUHit& hit) const;
+	bool intersectShape(const AnalyticShape& shape, Ray& ray, CPUHit& hit) const;
+	bool traceRay(const float3& origin, const float3& direction, CPUHit& hit) const;
+	void computeNormal(float3& normal, float3& faceNormal, const CPUHit& hit) const;
+
+	template<int ReflectType, MathMode Mode>		// AnyMaterial reads the type of the material at every hit.
+	void closestHit(RayPayload& payload, const float3& rayOrigin, const float3& rayDir, const CPUHit& hit) const;
+	template<MathMode Mode>
+	void closestHitGlass(RayPayload& payload, const float3& rayOrigin, const float3& rayDir, const CPUHit& hit) const;
+	void missRay(RayPayload& payload) const;
+	float3 tracePath(const float3& startPos, const float3& startDir, uint& seed, uint& numRays) const;
+
+public:
+	CPUPathTracer(uint width, uint height);
+	virtual void setRegion(uint imageWidth, uint imageHeight, const PixelRegion& region);
+	virtual void update(const InputEngine& input);
+	virtual TracedResult shootRays();
+	virtual void setupScene(const Scene* scene);
+	virtual OrbitCamera& getCamera()			{ return camera; }
+	virtual FrameTimings getFrameTimings() const	{ return timings; }
+	virtual void setOutputFormat(PixelFormat format);
+	virtual void setNumSamplesPerFrame(uint num)	{ numSamplesPerFrame = _max(num, 1u); }
+	virtual uint getNumSamplesPerFrame() const		{ return numSamplesPerFrame; }
+	virtual uint getAccumulatedSamples() const		{ return accumulatedSamples; }
+	virtual void setFirstFrame(uint frame)			{ firstFrame = frame; camera.setChanged(); }
+	virtual uint64 getSceneHash() const;
+	virtual void saveAccumulation(AccumulationState& state);
+	virtual bool restoreAccumulation(const AccumulationState& state);
+
+	// Switching it after setupScene() takes effect on the next setupScene().
+	void setUseAnalyticPrimitives(bool use)		{ useAnalyticPrimitives = use; }
+	void setUseLODs(bool use)					{ useLODs = use; if (scene) selectLODs(); restartAccumulation(); }
+	void setLODPixelError(float pixels)			{ lodPixelError = pixels; if (scene) selectLODs(); restartAccumulation(); }
+	void printStatistics() const;
+	void setRefitCostLimit(float ratio)			{ refitCostLimit = ratio; }
+
+	// Both take effect at once; the hits are the same up to rounding.
+	void setUseSoAGeometry(bool use);
+	void setTriangleLayout(TriangleLayout layout);
+	uint64 triangleDataSize() const;			// Of what the leaf intersector reads, in the current layouts.
+
+	// Fast shades with the approximations of fastMath.h, which changes the noise but not what the image converges to.
+	void setMathMode(MathMode mode);
+	uint64 getNumRaysTraced() const				{ return numRaysTraced; }	// By the last shootRays().
+
+	// Closest hits of a batch of world space rays, for benchmarks; tArr gets FLT_MAX for a miss.
+	// Returns the number of rays which hit.
+	uint traceRays(const Array<float3>& originArr, const Array<float3>& directionArr, Array<float>& tArr) const;
+
+	// AOVs of the primary rays through the pixel centers of the traced region: the distance of the first hit along
+	// the view axis, or FLT_MAX, and its shading normal in world space, or 0.
+	void renderAOVs(Array<float>& depthArr, Array<float3>& normalArr) const;
+};
@@ -5,6 +5,14 @@
 
 const float OrbitCamera::minOrbitRadius = 0.01f;
 
+// A tangent the compiler folds at a constant field of view can differ in its last bit from the one computed at run
+// time, which would give a region traced after a resize other rays than the whole image.
+void PinholeCamera::updateCameraAspect()
+{
+	cameraAspect.y = tanf( (fovY*0.5f) * DEGREE );
+	cameraAspect.x = cameraAspect.y * screenWidth / screenHeight;
+}
+
 inline void OrbitCamera::updateCameraOrientation() 
 {
 	float A	= azimuth * 2.0f * PI;	
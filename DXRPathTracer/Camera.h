@@ -17,10 +17,7 @@ class PinholeCamera
 	float3 cameraZ;
 
 	float2 cameraAspect;
-	void updateCameraAspect() {
-		cameraAspect.y = tanf( (fovY*0.5f) * DEGREE );
-		cameraAspect.x = cameraAspect.y * screenWidth / screenHeight;
-	}
+	void updateCameraAspect();		// Out of line, so that the aspect never depends on where it was folded.
 
 	bool changed = false;
 
@@ -51,6 +48,9 @@ public:
 		changed = true;
 	}
 
+	// For what changes the rays of the camera besides its parameters, such as the region traced of its image.
+	void setChanged() { changed = true; }
+
 	bool notifyChanged() {
 		if (changed) {
 			changed = false;
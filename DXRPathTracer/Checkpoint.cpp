@@ -0,0 +1,265 @@
+#include "pch.h"
+#include "Checkpoint.h"
+#include "IGRTTracer.h"
+#include "Scene.h"
+#include "Camera.h"
+#include "hash.h"
+#include "timer.h"
+
+
+namespace {
+
+const char checkpointMagic[8] = "IGRTACC";
+const uint checkpointVersion = 1;		// Increase it whenever the layout below changes.
+
+struct CheckpointHeader
+{
+	char magic[8];
+	uint version;
+	uint imageWidth;
+	uint imageHeight;
+	uint regionX;
+	uint regionY;
+	uint regionWidth;
+	uint regionHeight;
+	uint accumulatedFrames;
+	uint accumulatedSamples;
+	uint pad;
+	uint64 sceneHash;
+	uint64 pixelHash;					// Of the pixels which follow the header.
+};
+
+template<typename T>
+inline uint64 hashValue(uint64 h, const T& value)
+{
+	return hashBytes(&value, sizeof(T), h);
+}
+
+template<typename T>
+inline uint64 hashArray(uint64 h, const Array<T>& arr)
+{
+	return hashBytes(arr.data(), (uint64) arr.size() * sizeof(T), h);
+}
+
+}	// namespace
+
+
+uint64 hashScene(const Scene& scene)
+{
+	uint64 h = hashArray(0, scene.getVertexArray());
+	h = hashArray(h, scene.getTridexArray());
+	h = hashArray(h, scene.getMaterialArray());
+
+	// Field by field, since the bounds and the padding of SceneObject say nothing about what is traced.
+	for (uint i = 0; i < scene.numObjects(); ++i)
+	{
+		const SceneObject& obj = scene.getObject(i);
+		h = hashValue(h, obj.vertexOffset);
+		h = hashValue(h, obj.tridexOffset);
+		h = hashValue(h, obj.numVertices);
+		h = hashValue(h, obj.numTridices);
+		h = hashValue(h, obj.twoSided);
+		h = hashValue(h, obj.materialIdx);
+		h = hashValue(h, obj.backMaterialIdx);
+		h = hashValue(h, obj.modelMatrix);
+		h = hashValue(h, obj.shape);
+		h = hashValue(h, obj.numLODs);
+		for (uint j = 0; j < obj.numLODs; ++j)
+			h = hashValue(h, scene.getLOD(obj.lodOffset + j));
+	}
+	return hashCombine(h, scene.numObjects());
+}
+
+uint64 hashView(const PinholeCamera& camera, uint imageWidth, uint imageHeight, const PixelRegion& region)
+{
+	uint64 h = hashValue(0, camera.getCameraPos());
+	h = hashValue(h, camera.getCameraX());
+	h = hashValue(h, camera.getCameraY());
+	h = hashValue(h, camera.getCameraZ());
+	h = hashValue(h, camera.getCameraAspect());
+	h = hashValue(h, camera.getFovY());
+	h = hashCombine(h, ((uint64) imageWidth << 32) | imageHeight);
+	h = hashCombine(h, ((uint64) region.x << 32) | region.y);
+	return hashCombine(h, ((uint64) region.width << 32) | region.height);
+}
+
+bool isResumable(const AccumulationState& state, const IGRTTracer& tracer)
+{
+	PixelRegion region = tracer.getRegion();
+	return state.sceneHash == tracer.getSceneHash()
+		&& state.imageWidth == tracer.getImageWidth() && state.imageHeight == tracer.getImageHeight()
+		&& state.region.x == region.x && state.region.y == region.y
+		&& state.region.width == region.width && state.region.height == region.height
+		&& state.pixels.size() == region.width * region.height;
+}
+
+bool writeAccumulation(FILE* stream, const AccumulationState& state)
+{
+	CheckpointHeader header = {};
+	memcpy(header.magic, checkpointMagic, sizeof(header.magic));
+	header.version = checkpointVersion;
+	header.imageWidth = state.imageWidth;
+	header.imageHeight = state.imageHeight;
+	header.regionX = state.region.x;
+	header.regionY = state.region.y;
+	header.regionWidth = state.region.width;
+	header.regionHeight = state.region.height;
+	header.accumulatedFrames = state.accumulatedFrames;
+	header.accumulatedSamples = state.accumulatedSamples;
+	header.sceneHash = state.sceneHash;
+	header.pixelHash = hashArray(0, state.pixels);
+
+	uint64 pixelBytes = (uint64) state.pixels.size() * sizeof(float4);
+	return fwrite(&header, sizeof(header), 1, stream) == 1
+		&& (pixelBytes == 0 || fwrite(state.pixels.data(), 1, (size_t) pixelBytes, stream) == pixelBytes);
+}
+
+bool readAccumulation(FILE* stream, AccumulationState& state)
+{
+	CheckpointHeader header;
+	bool ok = fread(&header, sizeof(header), 1, stream) == 1
+		&& memcmp(header.magic, checkpointMagic, sizeof(header.magic)) == 0
+		&& header.version == checkpointVersion
+		&& header.regionWidth > 0 && header.regionHeight > 0
+		&& (uint64) header.regionX + header.regionWidth <= header.imageWidth
+		&& (uint64) header.regionY + header.regionHeight <= header.imageHeight;
+	if (!ok)
+		return false;
+
+	Array<float4> pixels(header.regionWidth * header.regionHeight);
+	uint64 pixelBytes = (uint64) pixels.size() * sizeof(float4);
+	if (fread(pixels.data(), 1, (size_t) pixelBytes, stream) != pixelBytes || hashArray(0, pixels) != header.pixelHash)
+		return false;
+
+	state.imageWidth = header.imageWidth;
+	state.imageHeight = header.imageHeight;
+	state.region = { header.regionX, header.regionY, header.regionWidth, header.regionHeight };
+	state.accumulatedFrames = header.accumulatedFrames;
+	state.accumulatedSamples = header.accumulatedSamples;
+	state.sceneHash = header.sceneHash;
+	state.pixels.swap(pixels);
+	return true;
+}
+
+bool writeCheckpoint(const char* filename, const AccumulationState& state)
+{
+	std::string path(filename);
+	std::string tempPath = path + ".tmp";
+	FILE* file = fopen(tempPath.c_str(), "wb");
+	if (!file)
+		return false;
+
+	bool ok = writeAccumulation(file, state);
+	ok = (fclose(file) == 0) && ok;
+
+	if (ok && MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+		return true;
+
+	DeleteFileA(tempPath.c_str());
+	return false;
+}
+
+// A checkpoint file holds one state and nothing after it.
+bool readCheckpoint(const char* filename, AccumulationState& state)
+{
+	FILE* file = fopen(filename, "rb");
+	if (!file)
+		return false;
+
+	AccumulationState read;
+	bool ok = readAccumulation(file, read) && fgetc(file) == EOF;
+	fclose(file);
+	if (!ok)
+		return false;
+
+	state.imageWidth = read.imageWidth;
+	state.imageHeight = read.imageHeight;
+	state.region = read.region;
+	state.accumulatedFrames = read.accumulatedFrames;
+	state.accumulatedSamples = read.accumulatedSamples;
+	state.sceneHash = read.sceneHash;
+	state.pixels.swap(read.pixels);
+	return true;
+}
+
+
+CheckpointWriter::CheckpointWriter(const char* filename) : filename(filename)
+{
+	writer = std::thread([this]() { writerLoop(); });
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock(stateLock);
+		stopping = true;
+	}
+	stateSignal.notify_all();
+	writer.join();
+}
+
+void CheckpointWriter::writerLoop()
+{
+	std::unique_lock<std::mutex> lock(stateLock);
+	for (;;)
+	{
+		stateSignal.wait(lock, [this]() { return stopping || pendingIdx >= 0; });
+		if (pendingIdx < 0)
+			return;
+
+		writingIdx = pendingIdx;
+		pendingIdx = -1;
+		lock.unlock();
+
+		double startTime = getCurrentTime();
+		bool ok = writeCheckpoint(filename.c_str(), states[writingIdx]);
+		double writeTime = (getCurrentTime() - startTime) * 1000.0;
+
+		lock.lock();
+		writingIdx = -1;
+		++(ok ? stats.numWritten : stats.numFailed);
+		stats.writeTime += writeTime;
+		stateSignal.notify_all();
+	}
+}
+
+double CheckpointWriter::save(IGRTTracer& tracer)
+{
+	double startTime = getCurrentTime();
+
+	// The slot of a save which is still pending is taken over, otherwise the one which is not being written.
+	int idx;
+	{
+		std::lock_guard<std::mutex> lock(stateLock);
+		if (pendingIdx >= 0)
+		{
+			idx = pendingIdx;
+			pendingIdx = -1;
+			++stats.numReplaced;
+		}
+		else
+			idx = writingIdx == 0 ? 1 : 0;
+	}
+
+	tracer.saveAccumulation(states[idx]);
+
+	{
+		std::lock_guard<std::mutex> lock(stateLock);
+		pendingIdx = idx;
+	}
+	stateSignal.notify_all();
+
+	return (getCurrentTime() - startTime) * 1000.0;
+}
+
+void CheckpointWriter::flush()
+{
+	std::unique_lock<std::mutex> lock(stateLock);
+	stateSignal.wait(lock, [this]() { return pendingIdx < 0 && writingIdx < 0; });
+}
+
+CheckpointStats CheckpointWriter::getStats() const
+{
+	std::lock_guard<std::mutex> lock(stateLock);
+	return stats;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "IGRTCommon.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+
+
+class Scene;
+class PinholeCamera;
+class IGRTTracer;
+
+/*
+What a progressive render has accumulated, as much as another process needs to go on with it: the pixels of the
+traced region in full precision, the samples per pixel in them, and the frame index which seeds the samples of
+every frame (see getNewSeed() in sampling.h), so that the frames after a resume draw the samples they would have
+drawn without the interruption. sceneHash is IGRTTracer::getSceneHash() of the tracer it was taken from.
+*/
+struct AccumulationState
+{
+	uint			imageWidth = 0;
+	uint			imageHeight = 0;
+	PixelRegion		region;
+	uint			accumulatedFrames = 0;		// Index of the last frame in the pixels.
+	uint			accumulatedSamples = 0;		// Per pixel; 0 if nothing was accumulated.
+	uint64			sceneHash = 0;
+	Array<float4>	pixels;						// region.width x region.height, RGBA32F.
+};
+
+// What the accumulation of a tracer depends on besides its own settings, for IGRTTracer::getSceneHash(): the
+// geometry, materials and objects of the scene, and the view of the camera over the image and its traced region.
+uint64 hashScene(const Scene& scene);
+uint64 hashView(const PinholeCamera& camera, uint imageWidth, uint imageHeight, const PixelRegion& region);
+
+// For IGRTTracer::restoreAccumulation(): whether the state is of the scene hash, image and region of the tracer.
+bool isResumable(const AccumulationState& state, const IGRTTracer& tracer);
+
+// A checkpoint file is replaced whole: written aside, then renamed over the old one, so that a process killed while
+// writing leaves the previous checkpoint. readCheckpoint() returns false for a missing, truncated or corrupt file.
+bool writeCheckpoint(const char* filename, const AccumulationState& state);
+bool readCheckpoint(const char* filename, AccumulationState& state);
+
+// The same format in a stream of states one after another, such as the partial accumulations of the workers of a
+// distributed render (see DistributedRender.h). readAccumulation() returns false at the end of the stream as well.
+bool writeAccumulation(FILE* stream, const AccumulationState& state);
+bool readAccumulation(FILE* stream, AccumulationState& state);
+
+
+struct CheckpointStats
+{
+	uint	numWritten = 0;
+	uint	numReplaced = 0;		// Saves which replaced one that was not written yet.
+	uint	numFailed = 0;
+	double	writeTime = 0.0;		// Of all the writes, in milliseconds.
+};
+
+/*
+Writes the checkpoints of a render on a thread of its own, so that tracing goes on while a file is written. It is
+double buffered: one state is written while the tracer saves the next one into the other, and a save which comes
+before the write of the last one began replaces that one, as only the newest checkpoint matters. The tracer thus
+waits only for saveAccumulation(), a copy of the accumulation (and its readback, with DXRPathTracer).
+*/
+class CheckpointWriter
+{
+	std::string				filename;
+	AccumulationState		states[2];
+	int						pendingIdx = -1;	// Saved and not yet being written.
+	int						writingIdx = -1;
+	bool					stopping = false;
+	CheckpointStats			stats;
+	mutable std::mutex		stateLock;
+	std::condition_variable	stateSignal;
+	std::thread				writer;
+
+	void writerLoop();
+
+public:
+	~CheckpointWriter();						// After the pending checkpoint is written.
+	CheckpointWriter(const char* filename);
+
+	// Saves the accumulation of the tracer and queues it for writing; returns the milliseconds the caller waited.
+	double save(IGRTTracer& tracer);
+	void flush();								// Waits until every saved checkpoint is written.
+	CheckpointStats getStats() const;
+};
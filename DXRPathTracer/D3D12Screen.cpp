@@ -10,18 +10,32 @@ namespace DescriptorID {
 	};
 }
 
+inline DXGI_FORMAT dxgiFormatOf(PixelFormat format)
+{
+	switch (format)
+	{
+	case PixelFormat::RGBA16F:	return DXGI_FORMAT_R16G16B16A16_FLOAT;
+	case PixelFormat::RGB9E5:	return DXGI_FORMAT_R9G9B9E5_SHAREDEXP;
+	default:					return DXGI_FORMAT_R32G32B32A32_FLOAT;
+	}
+}
+
 
 D3D12Screen::~D3D12Screen()
 {
+	mFrameRing.flush();
 	SAFE_RELEASE(mCmdQueue);
 	SAFE_RELEASE(mCmdList);
-	SAFE_RELEASE(mCmdAllocator);
+	for (ID3D12CommandAllocator*& allocator : mCmdAllocators)
+	{
+		SAFE_RELEASE(allocator);
+	}
 	SAFE_RELEASE(mPipeline);
 	SAFE_RELEASE(mDevice);
 }
 
-D3D12Screen::D3D12Screen(HWND hwnd, uint width, uint height) 
-: IGRTScreen(hwnd, width, height)
+D3D12Screen::D3D12Screen(HWND hwnd, uint width, uint height, uint framesInFlight) 
+: IGRTScreen(hwnd, width, height), framesInFlight(_min(_max(framesInFlight, 1u), maxFramesInFlight))
 {
 	tracerOutW = screenW;
 	tracerOutH = screenH;
@@ -38,7 +52,7 @@ D3D12Screen::D3D12Screen(HWND hwnd, uint width, uint height)
 
 	initializeResources();
 
-	mFence.waitCommandQueue(mCmdQueue);
+	mFence.waitIdle();
 }
 
 void D3D12Screen::initD3D12()
@@ -49,12 +63,14 @@ void D3D12Screen::initD3D12()
 	cqDesc.Type = D3D12_COMMAND_LIST_TYPE_DIRECT;
 	ThrowFailedHR(mDevice->CreateCommandQueue(&cqDesc, IID_PPV_ARGS(&mCmdQueue)));
 
-	ThrowFailedHR(mDevice->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&mCmdAllocator)));
+	for (uint slot = 0; slot < framesInFlight; ++slot)
+		ThrowFailedHR(mDevice->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&mCmdAllocators[slot])));
 
-	ThrowFailedHR(mDevice->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, mCmdAllocator, nullptr, IID_PPV_ARGS(&mCmdList)));
+	ThrowFailedHR(mDevice->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, mCmdAllocators[0], nullptr, IID_PPV_ARGS(&mCmdList)));
 	ThrowFailedHR(mCmdList->Close());
 
-	mFence.create(mDevice);
+	mFence.create(mDevice, mCmdQueue);
+	mFrameRing.create(&mFence, framesInFlight);
 }
 
 void D3D12Screen::declareRootSignature()
@@ -80,10 +96,24 @@ void D3D12Screen::createPipeline()
 
 void D3D12Screen::initializeResources()
 {
-	mTextureUploader.create(_textureDataSize(tracerOutFormat, 1920, 1080));
+	createTracerOutTexture();
+}
+
+// Every frame in flight must have completed, since the upload buffers follow the size of the texture.
+void D3D12Screen::createTracerOutTexture()
+{
+	mTracerOutTexture.destroy();
 	mTracerOutTexture.create(tracerOutFormat, tracerOutW, tracerOutH);
 
 	mSrvUavHeap[DescriptorID::tracerOutTextureSRV].assignSRV(mTracerOutTexture, nullptr);
+
+	for (uint slot = 0; slot < framesInFlight; ++slot)
+	{
+		if (mTextureUploaders[slot].getBufferSize() == mTracerOutTexture.getTextureSize())
+			continue;
+		mTextureUploaders[slot].destroy();
+		mTextureUploaders[slot].create(mTracerOutTexture.getTextureSize());
+	}
 }
 
 void D3D12Screen::fillCommandLists()
@@ -114,16 +144,37 @@ void D3D12Screen::fillCommandLists()
 
 void D3D12Screen::display(const TracedResult& trResult)
 {
-	ThrowFailedHR(mCmdAllocator->Reset());
-	ThrowFailedHR(mCmdList->Reset(mCmdAllocator, nullptr));
-
-	uint64 trResultPitch = trResult.width * trResult.pixelSize;
-	assert(trResultPitch == mTracerOutTexture.getRowDataSize());
-
-	memcpyPitch(mTextureUploader.map(), mTracerOutTexture.getRowPitch(),
-		trResult.data, trResultPitch, trResultPitch, trResult.height);
-
-	mTracerOutTexture.uploadData(mCmdList, mTextureUploader);
+	uint slot = mFrameRing.beginFrame();
+	ThrowFailedHR(mCmdAllocators[slot]->Reset());
+	ThrowFailedHR(mCmdList->Reset(mCmdAllocators[slot], nullptr));
+
+	// The texture follows the frames, which are of a region of the screen when the tracer traces one, and is
+	// stretched over the screen.
+	DXGI_FORMAT format = dxgiFormatOf(trResult.format);
+	if (format != tracerOutFormat || trResult.width != tracerOutW || trResult.height != tracerOutH)
+	{
+		mFrameRing.flush();
+		tracerOutFormat = format;
+		tracerOutW = trResult.width;
+		tracerOutH = trResult.height;
+		createTracerOutTexture();
+	}
+
+	assert(trResult.width * trResult.pixelSize == mTracerOutTexture.getRowDataSize());
+
+	// Unless the tracer wrote the frame here through acquireOutput().
+	UploadBuffer& uploader = mTextureUploaders[slot];
+	if (trResult.data != uploader.map())
+	{
+		memcpyPitch(uploader.map(), mTracerOutTexture.getRowPitch(),
+			trResult.data, trResult.getRowPitch(), mTracerOutTexture.getRowDataSize(), trResult.height);
+	}
+	else
+	{
+		assert(trResult.getRowPitch() == mTracerOutTexture.getRowPitch());
+	}
+
+	mTracerOutTexture.uploadData(mCmdList, uploader);
 
 	fillCommandLists();
 
@@ -134,7 +185,24 @@ void D3D12Screen::display(const TracedResult& trResult)
 
 	mSwapChain.present();
 
-	mFence.waitCommandQueue(mCmdQueue);
+	mFrameRing.endFrame();
+}
+
+/*
+The upload buffer of the slot display() will use next, once the frame which last read it has completed. A frame
+of another size or format than the texture gets no buffer: display() recreates the texture for it, and the frames
+after it are written in place again.
+*/
+OutputBuffer D3D12Screen::acquireOutput(uint width, uint height, PixelFormat format)
+{
+	if (width != tracerOutW || height != tracerOutH || dxgiFormatOf(format) != tracerOutFormat)
+		return OutputBuffer();
+
+	uint slot = mFrameRing.beginFrame();
+	OutputBuffer buffer;
+	buffer.data = mTextureUploaders[slot].map();
+	buffer.rowPitch = mTracerOutTexture.getRowPitch();
+	return buffer;
 }
 
 void D3D12Screen::onSizeChanged(uint width, uint height)
@@ -148,12 +216,9 @@ void D3D12Screen::onSizeChanged(uint width, uint height)
 	tracerOutW = screenW = width;
 	tracerOutH = screenH = height;
 
+	mFrameRing.flush();
 	mSwapChain.resize(screenW, screenH);
+	createTracerOutTexture();
 
-	mTracerOutTexture.destroy();
-	mTracerOutTexture.create(tracerOutFormat, tracerOutW, tracerOutH);
-
-	mSrvUavHeap[DescriptorID::tracerOutTextureSRV].assignSRV(mTracerOutTexture, nullptr);
-
-	mFence.waitCommandQueue(mCmdQueue);
+	mFence.waitIdle();
 }
\ No newline at end of file
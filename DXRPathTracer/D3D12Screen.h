@@ -3,17 +3,25 @@
 #include "dxHelpers.h"
 
 
-class D3D12Screen : public IGRTScreen
+/*
+The screen is also an IOutputTarget: a tracer registered with it writes each frame into the upload buffer of the
+frame slot, in the row pitch of the texture, and display() then only records the upload.
+*/
+class D3D12Screen : public IGRTScreen, public IOutputTarget
 {
-	static const DXGI_FORMAT		tracerOutFormat = DXGI_FORMAT_R32G32B32A32_FLOAT;
 	static const DXGI_FORMAT		screenOutFormat = DXGI_FORMAT_R8G8B8A8_UNORM;
 	static const uint				backBufferCount = 2;
+	static const uint				maxFramesInFlight = 3;
 
 	ID3D12Device*					mDevice;
 	ID3D12CommandQueue*				mCmdQueue;
 	ID3D12GraphicsCommandList*		mCmdList;
-	ID3D12CommandAllocator*			mCmdAllocator;
-	BinaryFence						mFence;
+	TimelineFence					mFence;
+
+	// A frame waits for the one framesInFlight earlier, whose allocator and upload buffer it reuses.
+	uint							framesInFlight;
+	FrameRing						mFrameRing;
+	ID3D12CommandAllocator*			mCmdAllocators[maxFramesInFlight] = {};
 	void initD3D12();
 
 	SwapChain						mSwapChain;
@@ -26,15 +34,18 @@ class D3D12Screen : public IGRTScreen
 	ID3D12PipelineState*			mPipeline;
 	void createPipeline();
 
+	DXGI_FORMAT						tracerOutFormat = DXGI_FORMAT_R32G32B32A32_FLOAT;	// Follows the TracedResult.
 	DefaultTexture					mTracerOutTexture;
-	UploadBuffer					mTextureUploader;
+	UploadBuffer					mTextureUploaders[maxFramesInFlight];
 	void initializeResources();
+	void createTracerOutTexture();
 
 	void fillCommandLists();
 
 public:
 	~D3D12Screen();
-	D3D12Screen(HWND hwnd, uint width, uint height);
+	D3D12Screen(HWND hwnd, uint width, uint height, uint framesInFlight = 2);	// At most maxFramesInFlight.
 	virtual void onSizeChanged(uint width, uint height);
 	virtual void display(const TracedResult& trResult);
+	virtual OutputBuffer acquireOutput(uint width, uint height, PixelFormat format);
 };
\ No newline at end of file
@@ -2,20 +2,23 @@
 #include "DXRPathTracer.h"
 #include "Camera.h"
 #include "Scene.h"
+#include "Checkpoint.h"
+#include "hash.h"
 
 
 namespace DescriptorID {
 	enum {
 		// First RootParameter
 		outUAV = 0,	
+		displayUAV = 1,
 		
 		// Third RootParameter
-		sceneObjectBuff = 1,
-		vertexBuff = 2,		
-		tridexBuff = 3,
-		materialBuff = 4,
-		cdfBuff = 5,
-		transformBuff = 6,
+		sceneObjectBuff = 2,
+		vertexBuff = 3,		
+		tridexBuff = 4,
+		materialBuff = 5,
+		cdfBuff = 6,
+		transformBuff = 7,
 		
 		// Not used since we use RootPointer instead of RootTable
 		accelerationStructure = 10,
@@ -41,16 +44,47 @@ namespace HitGroupParamID {
 	};
 }
 
+// GPU timestamps of a frame, from update() to shootRays().
+namespace TimestampID {
+	enum {
+		frameBegin = 0,
+		sceneUploaded = 1,
+		accelUpdated = 2,
+		raysTraced = 3,
+		numStamps = 4
+	};
+}
+
+static GPUSceneObject makeGPUSceneObject(const SceneObject& obj)
+{
+	GPUSceneObject gpuObj = {};
+	gpuObj.vertexOffset = obj.vertexOffset;
+	gpuObj.tridexOffset = obj.tridexOffset;
+	gpuObj.numTridices = obj.numTridices;
+	gpuObj.objectArea = obj.meshArea * obj.scale * obj.scale;
+	gpuObj.twoSided = obj.twoSided;
+	gpuObj.materialIdx = obj.materialIdx;
+	gpuObj.backMaterialIdx = obj.backMaterialIdx;
+	//gpuObj.material = obj.material;
+	//gpuObj.emittance = obj.lightColor * obj.lightIntensity;
+	gpuObj.modelMatrix = obj.modelMatrix;
+	return gpuObj;
+}
+
 DXRPathTracer::~DXRPathTracer()
 {
+	mFrameRing.flush();
 	SAFE_RELEASE(mCmdQueue);
 	SAFE_RELEASE(mCmdList);
-	SAFE_RELEASE(mCmdAllocator);
+	for (ID3D12CommandAllocator*& allocator : mCmdAllocators)
+	{
+		SAFE_RELEASE(allocator);
+	}
 	SAFE_RELEASE(mDevice);
 }
 
-DXRPathTracer::DXRPathTracer(uint width, uint height)
-	: IGRTTracer(width, height)
+DXRPathTracer::DXRPathTracer(uint width, uint height, uint framesInFlight)
+	: IGRTTracer(width, height), framesInFlight(_min(_max(framesInFlight, 1u), maxFramesInFlight))
 {
 	initD3D12();
 	
@@ -62,7 +96,7 @@ DXRPathTracer::DXRPathTracer(uint width, uint height)
 
 	initializeApplication();
 
-	//mFence.waitCommandQueue(mCmdQueue);
+	//mFence.waitIdle();
 }
 
 void DXRPathTracer::initD3D12()
@@ -74,15 +108,40 @@ void DXRPathTracer::initD3D12()
 
 	ThrowFailedHR(mDevice->CreateCommandQueue(&cqDesc, IID_PPV_ARGS(&mCmdQueue)));
 
-	ThrowFailedHR(mDevice->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&mCmdAllocator)));
+	for (uint slot = 0; slot < framesInFlight; ++slot)
+	{
+		ThrowFailedHR(mDevice->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&mCmdAllocators[slot])));
+		mTimestamps[slot].create(mCmdQueue, TimestampID::numStamps);
+	}
 
-	ThrowFailedHR(mDevice->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, mCmdAllocator, nullptr, IID_PPV_ARGS(&mCmdList)));
+	ThrowFailedHR(mDevice->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, mCmdAllocators[0], nullptr, IID_PPV_ARGS(&mCmdList)));
 	
 	ThrowFailedHR(mCmdList->Close());
-	ThrowFailedHR(mCmdAllocator->Reset());
-	ThrowFailedHR(mCmdList->Reset(mCmdAllocator, nullptr));
 
-	mFence.create(mDevice);
+	mFence.create(mDevice, mCmdQueue);
+	mFrameRing.create(&mFence, framesInFlight);
+	beginFrame();
+}
+
+// The command list stays open between frames, for update() and shootRays() to record into.
+void DXRPathTracer::beginFrame()
+{
+	uint slot = mFrameRing.beginFrame();
+	ThrowFailedHR(mCmdAllocators[slot]->Reset());
+	ThrowFailedHR(mCmdList->Reset(mCmdAllocators[slot], nullptr));
+}
+
+// For the setup of resources, off the frame loop: executes what is recorded and drains the queue.
+void DXRPathTracer::executeAndWait()
+{
+	ThrowFailedHR(mCmdList->Close());
+	ID3D12CommandList* cmdLists[] = { mCmdList };
+	mCmdQueue->ExecuteCommandLists(1, cmdLists);
+	mFence.waitIdle();
+
+	uint slot = mFrameRing.currentSlot();
+	ThrowFailedHR(mCmdAllocators[slot]->Reset());
+	ThrowFailedHR(mCmdList->Reset(mCmdAllocators[slot], nullptr));
 }
 
 void DXRPathTracer::declareRootSignatures()
@@ -92,13 +151,13 @@ void DXRPathTracer::declareRootSignatures()
 	// Global(usual) Root Signature
 	mGlobalRS.resize(RootParamID::numParams);
 	mGlobalRS[RootParamID::tableForOutBuffer] 
-		= new RootTable("u0", mSrvUavHeap[DescriptorID::outUAV].getGpuHandle());
+		= new RootTable("u0-u1", mSrvUavHeap[DescriptorID::outUAV].getGpuHandle());
 	mGlobalRS[RootParamID::pointerForAccelerationStructure] 
 		= new RootPointer("(100) t0");					// It will be bound to mAccelerationStructure that is not initialized yet.
 	mGlobalRS[RootParamID::tableForGeometryInputs] 
 		= new RootTable("(0) t0-t5", mSrvUavHeap[DescriptorID::sceneObjectBuff].getGpuHandle());
 	mGlobalRS[RootParamID::pointerForGlobalConstants] 
-		= new RootPointer("b0");						// It will be bound to mGlobalConstantsBuffer that is not initialized yet.
+		= new RootPointer("b0");						// It will be bound to the mGlobalConstantsBuffers of each frame.
 	mGlobalRS.build();
 
 	// Local Root Sinatures
@@ -116,7 +175,10 @@ void DXRPathTracer::buildRaytracingPipeline()
 	mRtPipeline.setGlobalRootSignature(&mGlobalRS);
 	mRtPipeline.addHitGroup(HitGroup(L"hitGp", L"closestHit", nullptr));
 	mRtPipeline.addHitGroup(HitGroup(L"hitGpGlass", L"closestHitGlass", nullptr));
-	mRtPipeline.addLocalRootSignature(LocalRootSignature(&mHitGroupRS, { L"hitGp", L"hitGpGlass" }));
+	mRtPipeline.addHitGroup(HitGroup(L"hitGpMetal", L"closestHitMetal", nullptr));
+	mRtPipeline.addHitGroup(HitGroup(L"hitGpPlastic", L"closestHitPlastic", nullptr));
+	mRtPipeline.addLocalRootSignature(LocalRootSignature(&mHitGroupRS, 
+		{ L"hitGp", L"hitGpGlass", L"hitGpMetal", L"hitGpPlastic" }));
 	mRtPipeline.setMaxPayloadSize(sizeof(float) * 16);
 	mRtPipeline.setMaxRayDepth(2);
 	mRtPipeline.build();
@@ -130,18 +192,27 @@ void DXRPathTracer::initializeApplication()
 
 	mGlobalConstants.rayTmin = 0.001f;  // 1mm
 	mGlobalConstants.accumulatedFrames = 0;
-	mGlobalConstants.numSamplesPerFrame = 32;
+	mGlobalConstants.accumulatedSamples = 0;
+	mGlobalConstants.numSamplesPerFrame = numSamplesPerFrame;
 	mGlobalConstants.maxPathLength = 6;
+	mGlobalConstants.displayFormat = (uint) displayFormat;
 	mGlobalConstants.backgroundLight = float3(.0f);
+	mGlobalConstants.regionOffset[0] = mGlobalConstants.regionOffset[1] = 0;
+	mGlobalConstants.imageSize[0] = imageW;
+	mGlobalConstants.imageSize[1] = imageH;
 
-	mGlobalConstantsBuffer.create(sizeof(GloabalContants));
+	for (uint slot = 0; slot < framesInFlight; ++slot)
+		mGlobalConstantsBuffers[slot].create(sizeof(GloabalContants));
 	* (RootPointer*) mGlobalRS[RootParamID::pointerForGlobalConstants] 
-		= mGlobalConstantsBuffer.getGpuAddress();
+		= mGlobalConstantsBuffers[0].getGpuAddress();
 
-	uint64 maxBufferSize = _bpp(tracerOutFormat) * 1920 *1080;
-	mReadBackBuffer.create(maxBufferSize);
+	createOutputBuffers();
+}
 
-	uint64 bufferSize = _bpp(tracerOutFormat) * tracerOutW * tracerOutH;
+void DXRPathTracer::createOutputBuffers()
+{
+	UINT64 bufferSize = _bpp(tracerOutFormat) * tracerOutW * tracerOutH;
+	mTracerOutBuffer.destroy();
 	mTracerOutBuffer.create(bufferSize);
 
 	D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
@@ -151,57 +222,242 @@ void DXRPathTracer::initializeApplication()
 		uavDesc.Buffer.NumElements = tracerOutW * tracerOutH;
 	}
 	mSrvUavHeap[DescriptorID::outUAV].assignUAV(mTracerOutBuffer, &uavDesc);
+
+	// Grown to the traced region, the largest frame read back, and never shrunk: a frame still in flight may be of
+	// the previous size.
+	for (uint slot = 0; slot < framesInFlight; ++slot)
+	{
+		if (mReadBackBuffers[slot].getMaxReadbackSize() >= bufferSize)
+			continue;
+		mReadBackBuffers[slot].destroy();
+		mReadBackBuffers[slot].create(bufferSize);
+	}
+
+	createDisplayBuffer();
+}
+
+// The display buffer exists even for RGBA32F, so that u1 is always a valid view.
+void DXRPathTracer::createDisplayBuffer()
+{
+	uint displayPixelSize = displayFormat == PixelFormat::RGBA32F ? _bpp(displayViewFormat) : pixelSizeOf(displayFormat);
+	UINT64 displaySize = displayPixelSize * tracerOutW * tracerOutH;
+	mDisplayBuffer.destroy();
+	mDisplayBuffer.create(displaySize);
+
+	D3D12_UNORDERED_ACCESS_VIEW_DESC displayDesc = {};
+	{
+		displayDesc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
+		displayDesc.Format = displayViewFormat;
+		displayDesc.Buffer.NumElements = (uint) (displaySize / _bpp(displayViewFormat));
+	}
+	mSrvUavHeap[DescriptorID::displayUAV].assignUAV(mDisplayBuffer, &displayDesc);
 }
 
-void DXRPathTracer::onSizeChanged(uint width, uint height)
+void DXRPathTracer::setOutputFormat(PixelFormat format)
 {
-	if (width == tracerOutW && height == tracerOutH)
+	if (format == displayFormat)
 		return;
 
-	width = width ? width : 1;
-	height = height ? height : 1;
+	mFrameRing.flush();
+	displayFormat = format;
+	mGlobalConstants.displayFormat = (uint) format;
+	createDisplayBuffer();
+}
 
-	tracerOutW = width;
-	tracerOutH = height;
+void DXRPathTracer::setRegion(uint imageWidth, uint imageHeight, const PixelRegion& region)
+{
+	imageWidth = imageWidth ? imageWidth : 1;
+	imageHeight = imageHeight ? imageHeight : 1;
+	PixelRegion traced = clampRegion(region, imageWidth, imageHeight);
+	if (imageWidth == imageW && imageHeight == imageH && traced.x == regionX && traced.y == regionY &&
+		traced.width == tracerOutW && traced.height == tracerOutH)
+		return;
 
-	camera.setScreenSize((float) tracerOutW, (float) tracerOutH);
+	bool sizeChanged = traced.width != tracerOutW || traced.height != tracerOutH;
+	if (imageWidth != imageW || imageHeight != imageH)
+		camera.setScreenSize((float) imageWidth, (float) imageHeight);
+	camera.setChanged();		// Which restarts the accumulation.
 
-	UINT64 bufferSize = _bpp(tracerOutFormat) * tracerOutW * tracerOutH;
-	mTracerOutBuffer.destroy();
-	mTracerOutBuffer.create(bufferSize);
+	imageW = imageWidth;
+	imageH = imageHeight;
+	regionX = traced.x;
+	regionY = traced.y;
+	tracerOutW = traced.width;
+	tracerOutH = traced.height;
 
-	D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+	mGlobalConstants.regionOffset[0] = regionX;
+	mGlobalConstants.regionOffset[1] = regionY;
+	mGlobalConstants.imageSize[0] = imageW;
+	mGlobalConstants.imageSize[1] = imageH;
+
+	if (sizeChanged)
 	{
-		uavDesc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
-		uavDesc.Format = tracerOutFormat;
-		uavDesc.Buffer.NumElements = tracerOutW * tracerOutH;
+		mFrameRing.flush();
+		createOutputBuffers();
 	}
-	mSrvUavHeap[DescriptorID::outUAV].assignUAV(mTracerOutBuffer, &uavDesc);
 }
 
 void DXRPathTracer::update(const InputEngine& input)
 {
 	camera.update(input);
+	frameTimestamps().stamp(mCmdList, TimestampID::frameBegin);
 
-	if (camera.notifyChanged())
+	bool sceneChanged = scene && !scene->getChanges().empty();
+	if (sceneChanged)
+		applySceneChanges();
+	else
+		frameTimestamps().stamp(mCmdList, TimestampID::sceneUploaded);
+	frameTimestamps().stamp(mCmdList, TimestampID::accelUpdated);
+
+	bool cameraChanged = camera.notifyChanged();
+	if (cameraChanged)
 	{
 		mGlobalConstants.cameraPos = camera.getCameraPos();
 		mGlobalConstants.cameraX = camera.getCameraX();
 		mGlobalConstants.cameraY = camera.getCameraY();
 		mGlobalConstants.cameraZ = camera.getCameraZ();
 		mGlobalConstants.cameraAspect = camera.getCameraAspect();
-		mGlobalConstants.accumulatedFrames = 0;
+	}
+
+	bool resumed = continuesResumed();
+	if ((cameraChanged || sceneChanged) && !resumed)
+	{
+		mGlobalConstants.accumulatedFrames = firstFrame;
+		mGlobalConstants.accumulatedSamples = 0;
 	}
 	else
+	{
+		// The samples of the last frame are in the accumulation now; the shader weighs this one by its own.
 		mGlobalConstants.accumulatedFrames++;
+		mGlobalConstants.accumulatedSamples += mGlobalConstants.numSamplesPerFrame;
+	}
+	mGlobalConstants.numSamplesPerFrame = numSamplesPerFrame;
 
 	
-	* (GloabalContants*) mGlobalConstantsBuffer.map() = mGlobalConstants;
+	UploadBuffer& constantsBuffer = mGlobalConstantsBuffers[mFrameRing.currentSlot()];
+	* (GloabalContants*) constantsBuffer.map() = mGlobalConstants;
+	* (RootPointer*) mGlobalRS[RootParamID::pointerForGlobalConstants] = constantsBuffer.getGpuAddress();
+}
+
+/*
+The edits recorded in the scene are applied with the commands of the next shootRays(). They rewrite upload buffers,
+hit group records and instance descriptions which the frames in flight may still read, so those frames are waited
+for first; frames without edits keep the pipeline full. Only the dirty scene objects, materials, vertices and hit
+group records are copied, through one upload buffer. The bottom levels of deformed meshes and the top level are refitted. The object
+buffer and the shader table grow by half when objects are added beyond their capacity, and are then uploaded as a whole.
+*/
+void DXRPathTracer::applySceneChanges()
+{
+	const SceneChanges& changes = scene->getChanges();
+	const Array<Material>& mtlArr = scene->getMaterialArray();
+	uint numObjs = scene->numObjects();
+
+	uint objBegin = _min(changes.objects.begin, numObjs);
+	uint objEnd = _min(changes.objects.end, numObjs);
+	uint mtlBegin = _min(changes.materials.begin, mtlArr.size());
+	uint mtlEnd = _min(changes.materials.end, mtlArr.size());
+	uint vtxBegin = _min(changes.vertices.begin, scene->getVertexArray().size());
+	uint vtxEnd = _min(changes.vertices.end, scene->getVertexArray().size());
+
+	mFrameRing.flush();
+
+	bool grown = numObjs > sceneObjectCapacity;
+	if (grown)
+	{
+		sceneObjectCapacity = _max(numObjs, sceneObjectCapacity + sceneObjectCapacity / 2);
+		mSceneObjectBuffer.destroy();
+		mSceneObjectBuffer.create(sceneObjectCapacity * sizeof(GPUSceneObject));
+		mShaderTable.destroy();
+		setupShaderTable();
+		objBegin = 0;
+		objEnd = numObjs;
+	}
+
+	uint64 objBytes = objBegin < objEnd ? (objEnd - objBegin) * sizeof(GPUSceneObject) : 0;
+	uint64 mtlBytes = mtlBegin < mtlEnd ? (mtlEnd - mtlBegin) * sizeof(BakedMaterial) : 0;
+	uint64 vtxBytes = vtxBegin < vtxEnd ? (vtxEnd - vtxBegin) * (uint64) sizeof(Vertex) : 0;
+	uint64 totalBytes = objBytes + mtlBytes + vtxBytes;
+	if (totalBytes > mSceneUpdateUploader.getBufferSize())
+	{
+		mSceneUpdateUploader.destroy();
+		mSceneUpdateUploader.create(_max(totalBytes, 2 * mSceneUpdateUploader.getBufferSize()));
+	}
+
+	if (objBytes > 0)
+	{
+		GPUSceneObject* copyDst = (GPUSceneObject*) mSceneUpdateUploader.map();
+		for (uint objIdx = objBegin; objIdx < objEnd; ++objIdx)
+			copyDst[objIdx - objBegin] = makeGPUSceneObject(scene->getObject(objIdx));
+		mSceneObjectBuffer.uploadData(mCmdList, objBegin * sizeof(GPUSceneObject), objBytes, mSceneUpdateUploader, 0);
+	}
+	if (mtlBytes > 0)
+	{
+		BakedMaterial* copyDst = (BakedMaterial*) ((uint8*) mSceneUpdateUploader.map() + objBytes);
+		for (uint mtlIdx = mtlBegin; mtlIdx < mtlEnd; ++mtlIdx)
+			copyDst[mtlIdx - mtlBegin] = bakeMaterial(mtlArr[mtlIdx]);
+		mMaterialBuffer.uploadData(mCmdList, mtlBegin * sizeof(BakedMaterial), mtlBytes, mSceneUpdateUploader, objBytes);
+	}
+	if (vtxBytes > 0)
+	{
+		uint64 offset = objBytes + mtlBytes;
+		memcpy((uint8*) mSceneUpdateUploader.map() + offset, &scene->getVertexArray()[vtxBegin], vtxBytes);
+		mVertexBuffer.uploadData(mCmdList, vtxBegin * (uint64) sizeof(Vertex), vtxBytes, mSceneUpdateUploader, offset);
+	}
+
+	// A dirty object may have another material, and a dirty material may have changed its type, which selects
+	// another hit group. The records are compared, so only those which really change are uploaded.
+	if (!grown)
+	{
+		HitGroupRecord* table = (HitGroupRecord*) mShaderTable.map();
+		uint recBegin = objBegin, recEnd = objEnd;
+		uint checkBegin = (mtlBytes > 0) ? 0 : objBegin;
+		uint checkEnd = (mtlBytes > 0) ? numObjs : objEnd;
+		for (uint objIdx = checkBegin; objIdx < checkEnd; ++objIdx)
+		{
+			if (writeHitGroupRecord(table[3 + objIdx], objIdx))
+			{
+				recBegin = _min(recBegin, objIdx);
+				recEnd = _max(recEnd, objIdx + 1);
+			}
+		}
+		if (recBegin < recEnd)
+		{
+			uint64 offset = (3 + recBegin) * (uint64) recordSize;
+			mShaderTable.uploadData(mCmdList, offset, (recEnd - recBegin) * (uint64) recordSize, offset);
+		}
+	}
+
+	if (changes.numObjectsChanged)
+		assignSceneObjectSRV();
+
+	frameTimestamps().stamp(mCmdList, TimestampID::sceneUploaded);
+	if (!changes.objects.empty() || changes.numObjectsChanged || vtxBytes > 0)
+	{
+		if (buildMode == BLAS_PER_OBJECT_AND_TOP_LEVEL_TRANSFORM)
+		{
+			bool moved = vtxBytes > 0 && updateBottomLevels(changes.vertices);
+			buildTopLevel(!changes.numObjectsChanged, moved);
+		}
+		else
+		{
+			buildAllLevels();
+		}
+
+		* (RootPointer*) mGlobalRS[RootParamID::pointerForAccelerationStructure]
+			= mAccelerationStructure.getGpuAddress();
+	}
+
+	scene->clearChanges();
 }
 
+/*
+The frame is submitted without waiting for it. What is handed out is the frame which last used the next slot, which
+beginFrame() waits for: framesInFlight - 1 frames older than the one submitted, so the queue traces while the
+caller displays. Until the ring is full it is the newest completed frame (FrameRing::frameToRead()). Its readback buffer stays mapped and is written again only by the commands of the next call.
+*/
 TracedResult DXRPathTracer::shootRays()
 {
-	mReadBackBuffer.unmap();
+	uint slot = mFrameRing.currentSlot();
 	
 	mRtPipeline.bind(mCmdList);
 	mSrvUavHeap.bind(mCmdList);
@@ -217,34 +473,121 @@ TracedResult DXRPathTracer::shootRays()
 		desc.HitGroupTable = mShaderTable.getSubTable(3, scene->numObjects());
 	}
 	mCmdList->DispatchRays(&desc);
+	mTimestamps[slot].stamp(mCmdList, TimestampID::raysTraced);
 
-	mReadBackBuffer.readback(mCmdList, mTracerOutBuffer);
+	if (displayFormat == PixelFormat::RGBA32F)
+		mReadBackBuffers[slot].readback(mCmdList, mTracerOutBuffer);
+	else
+		mReadBackBuffers[slot].readback(mCmdList, mDisplayBuffer);
+	mTimestamps[slot].resolve(mCmdList);
+	frameOutputs[slot] = { tracerOutW, tracerOutH, displayFormat, mGlobalConstants.numSamplesPerFrame };
 	
 	ThrowFailedHR(mCmdList->Close());
 	ID3D12CommandList* cmdLists[] = { mCmdList };
 	mCmdQueue->ExecuteCommandLists(1, cmdLists);
-	mFence.waitCommandQueue(mCmdQueue);
-	ThrowFailedHR(mCmdAllocator->Reset());
-	ThrowFailedHR(mCmdList->Reset(mCmdAllocator, nullptr));
+	mFrameRing.endFrame();
+	beginFrame();
+
+	uint64 frame = mFrameRing.frameToRead();
+	mFrameRing.waitForFrame(frame);
+	uint readSlot = mFrameRing.slotOf(frame);
+
+	GPUTimestamps& timestamps = mTimestamps[readSlot];
+	timings.sceneUpdate = timestamps.getElapsedTime(TimestampID::frameBegin, TimestampID::sceneUploaded);
+	timings.accelUpdate = timestamps.getElapsedTime(TimestampID::sceneUploaded, TimestampID::accelUpdated);
+	timings.trace = timestamps.getElapsedTime(TimestampID::accelUpdated, TimestampID::raysTraced);
 
+	const FrameOutput& output = frameOutputs[readSlot];
+	timings.numSamples = output.numSamples;
 	TracedResult result;
-	result.data = mReadBackBuffer.map();
-	result.width = tracerOutW;
-	result.height = tracerOutH;
-	result.pixelSize = _bpp(tracerOutFormat);
+	result.data = mReadBackBuffers[readSlot].map();
+	result.width = output.width;
+	result.height = output.height;
+	result.pixelSize = pixelSizeOf(output.format);
+	result.format = output.format;
+
+	// The readback heap has to be copied out by someone; here it goes straight into the memory of the consumer.
+	OutputBuffer target = outputTarget ? outputTarget->acquireOutput(output.width, output.height, output.format) : OutputBuffer();
+	if (target.data)
+	{
+		uint64 rowSize = result.getRowPitch();
+		memcpyPitch(target.data, target.rowPitch, result.data, rowSize, rowSize, result.height);
+		result.data = target.data;
+		result.rowPitch = target.rowPitch;
+	}
 
 	return result;
 }
 
+uint64 DXRPathTracer::getSceneHash() const
+{
+	uint64 h = hashView(camera, imageW, imageH, getRegion());
+	if (scene)
+		h = hashCombine(h, hashScene(*scene));
+	h = hashBytes(&mGlobalConstants.backgroundLight, sizeof(mGlobalConstants.backgroundLight), h);
+	h = hashBytes(&mGlobalConstants.rayTmin, sizeof(mGlobalConstants.rayTmin), h);
+	h = hashBytes(&mGlobalConstants.rayTmax, sizeof(mGlobalConstants.rayTmax), h);
+	return hashCombine(h, mGlobalConstants.maxPathLength);
+}
+
+// The accumulation is complete only once the frames in flight are, so this drains the queue once per checkpoint.
+void DXRPathTracer::saveAccumulation(AccumulationState& state)
+{
+	mFrameRing.flush();
+	ReadbackBuffer readback(mTracerOutBuffer.getBufferSize());
+	readback.readback(mCmdList, mTracerOutBuffer);
+	executeAndWait();
+
+	state.imageWidth = imageW;
+	state.imageHeight = imageH;
+	state.region = getRegion();
+	state.accumulatedFrames = mGlobalConstants.accumulatedFrames;
+	state.accumulatedSamples = getAccumulatedSamples();
+	state.sceneHash = getSceneHash();
+	state.pixels.resize(tracerOutW * tracerOutH);
+	memcpy(state.pixels.data(), readback.map(), state.pixels.size() * sizeof(float4));
+	readback.unmap();
+}
+
+// The constants are left as after the last frame of the state, with no samples of its own, so that the next
+// update() goes on from the frame after it.
+bool DXRPathTracer::restoreAccumulation(const AccumulationState& state)
+{
+	if (!isResumable(state, *this))
+		return false;
+	if (state.accumulatedSamples == 0)
+		return true;
+
+	mFrameRing.flush();
+	uint64 bufferSize = mTracerOutBuffer.getBufferSize();
+	UploadBuffer uploader(bufferSize);
+	memcpy(uploader.map(), state.pixels.data(), bufferSize);
+	D3D12_RESOURCE_STATES prevState = mTracerOutBuffer.changeResourceState(mCmdList, D3D12_RESOURCE_STATE_COPY_DEST);
+	mCmdList->CopyBufferRegion(mTracerOutBuffer.get(), 0, uploader.get(), 0, bufferSize);
+	mTracerOutBuffer.changeResourceState(mCmdList, prevState);
+	executeAndWait();
+
+	mGlobalConstants.accumulatedFrames = state.accumulatedFrames;
+	mGlobalConstants.accumulatedSamples = state.accumulatedSamples;
+	mGlobalConstants.numSamplesPerFrame = 0;
+	resumedHash = state.sceneHash;
+	return true;
+}
+
 void DXRPathTracer::setupScene(const Scene* scene)
 {
+	// The frames in flight read the scene buffers, the acceleration structure and the shader table replaced below.
+	mFrameRing.flush();
+
 	uint numObjs = scene->numObjects();
 
 	const Array<Vertex> vtxArr = scene->getVertexArray();
 	const Array<Tridex> tdxArr = scene->getTridexArray();
 	const Array<Transform> trmArr = scene->getTransformArray();
 	const Array<float> cdfArr = scene->getCdfArray();
-	const Array<Material> mtlArr = scene->getMaterialArray();
+	Array<BakedMaterial> mtlArr;
+	for (const Material& mtl : scene->getMaterialArray())
+		mtlArr.push_back(bakeMaterial(mtl));
 
 	assert(cdfArr.size() == 0 || cdfArr.size() == tdxArr.size());
 
@@ -252,7 +595,7 @@ void DXRPathTracer::setupScene(const Scene* scene)
 	uint64 tdxBuffSize = tdxArr.size() * sizeof(Tridex);
 	uint64 trmBuffSize = trmArr.size() * sizeof(Transform);
 	uint64 cdfBuffSize = cdfArr.size() * sizeof(float);
-	uint64 mtlBuffSize = mtlArr.size() * sizeof(Material);
+	uint64 mtlBuffSize = mtlArr.size() * sizeof(BakedMaterial);
 	uint64 objBuffSize = numObjs * sizeof(GPUSceneObject);
 
 	UploadBuffer uploader(vtxBuffSize + tdxBuffSize + trmBuffSize + cdfBuffSize + mtlBuffSize + objBuffSize);
@@ -274,46 +617,21 @@ void DXRPathTracer::setupScene(const Scene* scene)
 	initBuffer(mMaterialBuffer,	 mtlBuffSize, (void*) mtlArr.data());
 
 	mSceneObjectBuffer.create(objBuffSize);
+	sceneObjectCapacity = numObjs;
 	GPUSceneObject* copyDst = (GPUSceneObject*) ((uint8*) uploader.map() + uploaderOffset);
 	for (uint objIdx = 0; objIdx < numObjs; ++objIdx)
 	{
-		const SceneObject& obj = scene->getObject(objIdx);
-
-		GPUSceneObject gpuObj = {};
-		gpuObj.vertexOffset = obj.vertexOffset;
-		gpuObj.tridexOffset = obj.tridexOffset;
-		gpuObj.numTridices = obj.numTridices;
-		gpuObj.objectArea = obj.meshArea * obj.scale * obj.scale;
-		gpuObj.twoSided = obj.twoSided;
-		gpuObj.materialIdx = obj.materialIdx;
-		gpuObj.backMaterialIdx = obj.backMaterialIdx;
-		//gpuObj.material = obj.material;
-		//gpuObj.emittance = obj.lightColor * obj.lightIntensity;
-		gpuObj.modelMatrix = obj.modelMatrix;
-		
-		copyDst[objIdx] = gpuObj;
+		copyDst[objIdx] = makeGPUSceneObject(scene->getObject(objIdx));
 	}
 	mSceneObjectBuffer.uploadData(mCmdList, uploader, uploaderOffset);
 
-	ThrowFailedHR(mCmdList->Close());
-	ID3D12CommandList* cmdLists[] = { mCmdList };
-	mCmdQueue->ExecuteCommandLists(1, cmdLists);
-	mFence.waitCommandQueue(mCmdQueue);
-	ThrowFailedHR(mCmdAllocator->Reset());
-	ThrowFailedHR(mCmdList->Reset(mCmdAllocator, nullptr));
+	executeAndWait();
 
 	this->scene = const_cast<Scene*>(scene);
 
-	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
-	{
-		srvDesc.Format = DXGI_FORMAT_UNKNOWN;
-		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
-		srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-		srvDesc.Buffer.StructureByteStride = sizeof(GPUSceneObject);
-		srvDesc.Buffer.NumElements = numObjs;
-	}
-	mSrvUavHeap[DescriptorID::sceneObjectBuff].assignSRV(mSceneObjectBuffer, &srvDesc);
+	assignSceneObjectSRV();
 
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
 	{
 		srvDesc.Format = DXGI_FORMAT_UNKNOWN;
 		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
@@ -336,7 +654,7 @@ void DXRPathTracer::setupScene(const Scene* scene)
 		srvDesc.Format = DXGI_FORMAT_UNKNOWN;
 		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
 		srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-		srvDesc.Buffer.StructureByteStride = sizeof(Material);
+		srvDesc.Buffer.StructureByteStride = sizeof(BakedMaterial);
 		srvDesc.Buffer.NumElements = mtlArr.size();
 	}
 	mSrvUavHeap[DescriptorID::materialBuff].assignSRV(mMaterialBuffer, &srvDesc);
@@ -349,37 +667,160 @@ void DXRPathTracer::setupScene(const Scene* scene)
 		= mAccelerationStructure.getGpuAddress();
 }
 
+void DXRPathTracer::assignSceneObjectSRV()
+{
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	{
+		srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
+		srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+		srvDesc.Buffer.StructureByteStride = sizeof(GPUSceneObject);
+		srvDesc.Buffer.NumElements = scene->numObjects();
+	}
+	mSrvUavHeap[DescriptorID::sceneObjectBuff].assignSRV(mSceneObjectBuffer, &srvDesc);
+}
+
 void DXRPathTracer::setupShaderTable()
 {
 	ShaderIdentifier* rayGenID = mRtPipeline.getIdentifier(L"rayGen");
 	ShaderIdentifier* missRayID = mRtPipeline.getIdentifier(L"missRay");
 	ShaderIdentifier* missShadowID = mRtPipeline.getIdentifier(L"missShadow");
-	ShaderIdentifier* hitGpID = mRtPipeline.getIdentifier(L"hitGp");
-	ShaderIdentifier* hitGpGlassID = mRtPipeline.getIdentifier(L"hitGpGlass");
 
 	uint numObjs = scene->numObjects();
-	mShaderTable.create(recordSize, numObjs + 3);
+	mShaderTable.create(recordSize, sceneObjectCapacity + 3);
 
 	HitGroupRecord* table = (HitGroupRecord*) mShaderTable.map();
 	table[0].shaderIdentifier = *rayGenID;
 	table[1].shaderIdentifier = *missRayID;
 	table[2].shaderIdentifier = *missShadowID;
 
-	auto& mtlArr = scene->getMaterialArray();
 	for (uint i = 0; i < numObjs; ++i)
 	{
-		if(mtlArr[ scene->getObject(i).materialIdx ].type == Glass)
-			table[3 + i].shaderIdentifier = *hitGpGlassID;
-		else
-			table[3 + i].shaderIdentifier = *hitGpID;
-
-		table[3 + i].objConsts.objectIdx = i;
+		writeHitGroupRecord(table[3 + i], i);
 	}
 
 	mShaderTable.uploadData(mCmdList);
 }
 
+// Returns whether the record changed.
+bool DXRPathTracer::writeHitGroupRecord(HitGroupRecord& record, uint objIdx)
+{
+	ShaderIdentifier* hitGpID = mRtPipeline.getIdentifier(L"hitGp");
+	ShaderIdentifier* hitGpGlassID = mRtPipeline.getIdentifier(L"hitGpGlass");
+	ShaderIdentifier* hitGpMetalID = mRtPipeline.getIdentifier(L"hitGpMetal");
+	ShaderIdentifier* hitGpPlasticID = mRtPipeline.getIdentifier(L"hitGpPlastic");
+
+	HitGroupRecord newRecord = record;
+	switch (scene->getShadingType(objIdx))
+	{
+	case Glass:		newRecord.shaderIdentifier = *hitGpGlassID;		break;
+	case Metal:		newRecord.shaderIdentifier = *hitGpMetalID;		break;
+	case Plastic:	newRecord.shaderIdentifier = *hitGpPlasticID;	break;
+	default:		newRecord.shaderIdentifier = *hitGpID;			break;
+	}
+
+	newRecord.objConsts.objectIdx = objIdx;
+
+	bool changed = memcmp(&newRecord, &record, sizeof(HitGroupRecord)) != 0;
+	record = newRecord;
+	return changed;
+}
+
 void DXRPathTracer::buildAccelerationStructure()
+{
+	if (buildMode == BLAS_PER_OBJECT_AND_TOP_LEVEL_TRANSFORM)
+	{
+		mAccelerationStructure.destroy();
+		blasOfRange.clear();
+		instanceBlasArr.clear();
+		bottomLevelArr.clear();
+		topLevelRefits = false;
+		buildTopLevel(false);
+	}
+	else
+	{
+		buildAllLevels();
+	}
+
+	executeAndWait();
+
+	//mAccelerationStructure.flush();
+}
+
+/*
+Objects made from the same mesh share its bottom level, as in CPUPathTracer, so adding an instance of a mesh which
+is already in the scene costs only the rebuild of the top level. Bottom levels which are no longer instanced stay
+until the next setupScene(), so that their meshes can come back for free.
+
+An update refits the top level to the moved instances. The refit loses quality as the instances move away from where
+they were at the build, and the GPU tells nothing about it, so every maxUpdatesPerBuild-th update builds instead.
+A scene which is never edited is never refitted either, so the top level allows updates only from the first one
+asked for, which builds it again with refitFlags(). Bottom levels which have moved to new resources need a build too.
+*/
+void DXRPathTracer::buildTopLevel(bool update, bool movedBottomLevels)
+{
+	bool refittable = topLevelRefits;
+	topLevelRefits = topLevelRefits || update;
+	update = update && refittable && !movedBottomLevels;
+
+	uint numObjs = scene->numObjects();
+	instanceBlasArr.resize(numObjs);
+	Array<dxTransform> transformArr(numObjs);
+
+	D3D12_GPU_VIRTUAL_ADDRESS vtxAddr = mVertexBuffer.getGpuAddress();
+	D3D12_GPU_VIRTUAL_ADDRESS tdxAddr = mTridexBuffer.getGpuAddress();
+	for (uint objIdx = 0; objIdx < numObjs; ++objIdx)
+	{
+		const SceneObject& obj = scene->getObject(objIdx);
+
+		auto range = std::make_tuple(obj.vertexOffset, obj.tridexOffset, obj.numTridices);
+		auto found = blasOfRange.find(range);
+		if (found == blasOfRange.end())
+		{
+			GPUMesh gpuMesh;
+			gpuMesh.numVertices = obj.numVertices;
+			gpuMesh.vertexBufferVA = vtxAddr + obj.vertexOffset * sizeof(Vertex);
+			gpuMesh.numTridices = obj.numTridices;
+			gpuMesh.tridexBufferVA = tdxAddr + obj.tridexOffset * sizeof(Tridex);
+			uint blasIdx = mAccelerationStructure.addBottomLevel(mCmdList, gpuMesh, sizeof(Vertex), buildFlags);
+			found = blasOfRange.emplace(range, blasIdx).first;
+			bottomLevelArr.push_back({ obj.vertexOffset, obj.numVertices, 0, false });
+			update = false;
+		}
+
+		instanceBlasArr[objIdx] = found->second;
+		transformArr[objIdx] = obj.modelMatrix;
+	}
+
+	// A new bottom level changes an instance, which an update cannot take.
+	update = update && (numTopLevelUpdates + 1) % maxUpdatesPerBuild != 0;
+	numTopLevelUpdates = update ? numTopLevelUpdates + 1 : 0;
+	mAccelerationStructure.buildTopLevel(mCmdList, instanceBlasArr, transformArr, 1, 
+		topLevelRefits ? refitFlags() : buildFlags, update);
+}
+
+/*
+Refits the bottom levels which have some of the dirty vertices, building every maxUpdatesPerBuild-th time. A level
+deformed for the first time is built again with refitFlags() instead, in a new resource; returns whether any was.
+*/
+bool DXRPathTracer::updateBottomLevels(const DirtyRange& vertices)
+{
+	bool moved = false;
+	for (uint blasIdx = 0; blasIdx < bottomLevelArr.size(); ++blasIdx)
+	{
+		BottomLevel& level = bottomLevelArr[blasIdx];
+		if (level.vertexOffset >= vertices.end || level.vertexOffset + level.numVertices <= vertices.begin)
+			continue;
+
+		bool update = level.refits && (level.numUpdates + 1) % maxUpdatesPerBuild != 0;
+		level.numUpdates = update ? level.numUpdates + 1 : 0;
+		level.refits = true;
+		moved |= mAccelerationStructure.rebuildBottomLevel(mCmdList, blasIdx, sizeof(Vertex), refitFlags(), update);
+	}
+	return moved;
+}
+
+void DXRPathTracer::buildAllLevels()
 {
 	uint numObjs = scene->numObjects();
 	Array<GPUMesh> gpuMeshArr(numObjs);
@@ -399,15 +840,7 @@ void DXRPathTracer::buildAccelerationStructure()
 		transformArr[objIdx] = obj.modelMatrix;
 	}
 	
+	mAccelerationStructure.destroy();
 	mAccelerationStructure.build(mCmdList, gpuMeshArr, transformArr, 
 		sizeof(Vertex), 1, buildMode, buildFlags);
-
-	ThrowFailedHR(mCmdList->Close());
-	ID3D12CommandList* cmdLists[] = { mCmdList };
-	mCmdQueue->ExecuteCommandLists(1, cmdLists);
-	mFence.waitCommandQueue(mCmdQueue);
-	ThrowFailedHR(mCmdAllocator->Reset());
-	ThrowFailedHR(mCmdList->Reset(mCmdAllocator, nullptr));
-
-	//mAccelerationStructure.flush();
 }
@@ -2,6 +2,8 @@
 #include "IGRTTracer.h"
 #include "dxHelpers.h"
 #include "Camera.h"
+#include <map>
+#include <tuple>
 #define NextAlignedLine __declspec(align(16))
 
 
@@ -26,6 +28,12 @@ NextAlignedLine
 	uint accumulatedFrames;
 	uint numSamplesPerFrame;
 	uint maxPathLength;
+	uint displayFormat;			// PixelFormat of displayBuffer, which is left alone for RGBA32F.
+NextAlignedLine
+	uint regionOffset[2];		// Of the traced region, which the dispatch covers, in the image.
+	uint imageSize[2];
+NextAlignedLine
+	uint accumulatedSamples;	// Per pixel, before the frame; 0 restarts the accumulation.
 };
 
 
@@ -53,18 +61,39 @@ private:
 
 
 class Scene;
+struct DirtyRange;
 class InputEngine;
 class DXRPathTracer : public IGRTTracer
 {
 	static const DXGI_FORMAT			tracerOutFormat = DXGI_FORMAT_R32G32B32A32_FLOAT;
+	static const DXGI_FORMAT			displayViewFormat = DXGI_FORMAT_R32_UINT;	// RGB9E5 is not UAV-writable, so the shader packs.
 	static const uint					recordSize = hitGroupRecordSize;
+	static const uint					maxFramesInFlight = 3;
 
 	ID3D12Device5*						mDevice;
 	ID3D12CommandQueue*					mCmdQueue;
 	ID3D12GraphicsCommandList4*			mCmdList;
-	ID3D12CommandAllocator*				mCmdAllocator;
-	BinaryFence							mFence;
+	TimelineFence						mFence;
+
+	// What a frame writes on the CPU or reads back is kept per slot of mFrameRing, so that shootRays() waits for
+	// the frame framesInFlight - 1 before the one it submits rather than for that one.
+	uint								framesInFlight;
+	FrameRing							mFrameRing;
+	ID3D12CommandAllocator*				mCmdAllocators[maxFramesInFlight] = {};
+	GPUTimestamps						mTimestamps[maxFramesInFlight];
+	struct FrameOutput
+	{
+		uint width;
+		uint height;
+		PixelFormat format;
+		uint numSamples;
+	};
+	FrameOutput							frameOutputs[maxFramesInFlight];
+	FrameTimings						timings;
 	void initD3D12();
+	void beginFrame();
+	void executeAndWait();
+	GPUTimestamps& frameTimestamps()	{ return mTimestamps[mFrameRing.currentSlot()]; }
 	
 	DescriptorHeap						mSrvUavHeap;
 
@@ -77,16 +106,22 @@ class DXRPathTracer : public IGRTTracer
 	void buildRaytracingPipeline();
 	
 	GloabalContants						mGlobalConstants;
-	UploadBuffer						mGlobalConstantsBuffer;
-	UnorderAccessBuffer					mTracerOutBuffer;
-	ReadbackBuffer						mReadBackBuffer;
+	uint								numSamplesPerFrame = 32;	// Of the next update(); the constants have the last.
+	UploadBuffer						mGlobalConstantsBuffers[maxFramesInFlight];
+	UnorderAccessBuffer					mTracerOutBuffer;	// The accumulation, always RGBA32F.
+	UnorderAccessBuffer					mDisplayBuffer;		// The accumulation in displayFormat, as read back.
+	PixelFormat							displayFormat = PixelFormat::RGBA32F;
+	ReadbackBuffer						mReadBackBuffers[maxFramesInFlight];
 	void initializeApplication();
+	void createOutputBuffers();
+	void createDisplayBuffer();
 //------Until here, scene independent members-------------------------//
 
 	OrbitCamera camera;
 
 //------From now, scene dependent members-----------------------------//
 	DefaultBuffer						mSceneObjectBuffer;
+	uint								sceneObjectCapacity = 0;
 	DefaultBuffer						mVertexBuffer;
 	DefaultBuffer						mTridexBuffer;
 	DefaultBuffer						mCdfBuffer;			// Now not use.
@@ -95,23 +130,58 @@ class DXRPathTracer : public IGRTTracer
 	
 	ShaderTable							mShaderTable;
 	void setupShaderTable();
+	bool writeHitGroupRecord(HitGroupRecord& record, uint objIdx);
+	void assignSceneObjectSRV();
 
 	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags = 
 		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE;
 		//D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PREFER_FAST_TRACE;
+	// Of the levels which get refitted; ALLOW_UPDATE costs memory and trace time, which static levels do not pay.
+	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS refitFlags() const
+		{ return buildFlags | D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE; }
 	AccelerationStructureBuildMode		buildMode = 
 		//ONLY_ONE_BLAS;
 		//BLAS_PER_OBJECT_AND_BOTTOM_LEVEL_TRANSFORM;
 		BLAS_PER_OBJECT_AND_TOP_LEVEL_TRANSFORM;
 	dxAccelerationStructure				mAccelerationStructure;
+	std::map<std::tuple<uint, uint, uint>, uint> blasOfRange;
+	Array<uint>							instanceBlasArr;
+	struct BottomLevel
+	{
+		uint vertexOffset;
+		uint numVertices;
+		uint numUpdates;
+		bool refits;
+	};
+	Array<BottomLevel>					bottomLevelArr;		// Indexed like the bottom levels of mAccelerationStructure.
+	uint								numTopLevelUpdates = 0;
+	bool								topLevelRefits = false;
+	static const uint					maxUpdatesPerBuild = 32;
 	void buildAccelerationStructure();
+	void buildTopLevel(bool update, bool movedBottomLevels = false);
+	bool updateBottomLevels(const DirtyRange& vertices);
+	void buildAllLevels();
+
+	UploadBuffer						mSceneUpdateUploader;
+	void applySceneChanges();
 	//void buildAccelerationStructure1();
 
 public:
 	~DXRPathTracer();
-	DXRPathTracer(uint width, uint height);
-	virtual void onSizeChanged(uint width, uint height);
+	DXRPathTracer(uint width, uint height, uint framesInFlight = 2);	// At most maxFramesInFlight.
+	virtual void setRegion(uint imageWidth, uint imageHeight, const PixelRegion& region);
 	virtual void update(const InputEngine& input);
 	virtual TracedResult shootRays();
 	virtual void setupScene(const Scene* scene);
+	virtual OrbitCamera& getCamera()			{ return camera; }
+	virtual FrameTimings getFrameTimings() const	{ return timings; }
+	virtual void setOutputFormat(PixelFormat format);
+	virtual void setNumSamplesPerFrame(uint num)	{ numSamplesPerFrame = _max(num, 1u); }
+	virtual uint getNumSamplesPerFrame() const		{ return numSamplesPerFrame; }
+	virtual uint getAccumulatedSamples() const
+		{ return mGlobalConstants.accumulatedSamples + mGlobalConstants.numSamplesPerFrame; }
+	virtual void setFirstFrame(uint frame)			{ firstFrame = frame; camera.setChanged(); }
+	virtual uint64 getSceneHash() const;
+	virtual void saveAccumulation(AccumulationState& state);		// Waits for the frames in flight.
+	virtual bool restoreAccumulation(const AccumulationState& state);
 };
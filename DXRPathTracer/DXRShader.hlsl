@@ -3,6 +3,7 @@
 
 RaytracingAccelerationStructure scene : register(t0, space100);
 RWBuffer<float4> tracerOutBuffer : register(u0);
+RWBuffer<uint> displayBuffer : register(u1);				// tracerOutBuffer packed in displayFormat.
 
 struct Vertex
 {
@@ -15,14 +16,18 @@ static const int Lambertian = 0;
 static const int Metal = 1;
 static const int Plastic = 2;
 static const int Glass = 3;
-struct Material 
+static const int AnyMaterial = -1;
+struct Material						// BakedMaterial of Material.h
 {
 	float3 emittance;
 	uint type;
 	float3 albedo;
-	float roughness;
+	float alpha2;
+	float3 F0;
 	float reflectivity;
-	float transmittivity;
+	float ior;
+	float invIor;
+	float2 pad;
 };
 
 struct GPUSceneObject
@@ -57,6 +62,33 @@ cbuffer GLOBAL_CONSTANTS : register(b0)
 	uint accumulatedFrames;
 	uint numSamplesPerFrame;
 	uint maxPathLength;
+	uint displayFormat;
+	uint2 regionOffset;
+	uint2 imageSize;
+	uint accumulatedSamples;
+}
+
+// As PixelFormat of IGRTCommon.h.
+static const uint RGBA32F = 0;
+static const uint RGBA16F = 1;
+static const uint RGB9E5 = 2;
+
+// As DXGI_FORMAT_R9G9B9E5_SHAREDEXP, and packRGB9E5() of pixelFormat.cpp.
+uint packRGB9E5(float3 rgb)
+{
+	rgb = min(max(rgb, 0.0f), 65408.0f);
+	float maxChannel = max(max(rgb.r, rgb.g), max(rgb.b, 1.0f / 65536.0f));
+	uint biasedExponent = asuint(maxChannel) >> 23;
+	uint sharedExponent = biasedExponent - (127 - 16);
+	float scale = asfloat((127 + 24 + 127 - 16 - biasedExponent) << 23);
+	if (uint(maxChannel * scale + 0.5f) == 512)
+	{
+		sharedExponent += 1;
+		scale *= 0.5f;
+	}
+
+	uint3 mantissa = uint3(rgb * scale + 0.5f);
+	return mantissa.r | (mantissa.g << 9) | (mantissa.b << 18) | (sharedExponent << 27);
 }
 
 cbuffer OBJECT_CONSTANTS : register(b1)
@@ -170,41 +202,52 @@ void rayGen()
 	uint2 launchIdx = DispatchRaysIndex().xy;
 	uint2 launchDim = DispatchRaysDimensions().xy;
 	uint bufferOffset = launchDim.x * launchIdx.y + launchIdx.x;
+	uint2 pixel = regionOffset + launchIdx;		// In the image, of which the dispatch covers the traced region.
 	
-	uint seed = getNewSeed(bufferOffset, accumulatedFrames, 8);
+	uint seed = getNewSeed(imageSize.x * pixel.y + pixel.x, accumulatedFrames, 8);
 
 	float3 newRadiance = 0.0f;
 	for (uint i = 0; i < numSamplesPerFrame; ++i)
 	{
-		float2 screenCoord = float2(launchIdx) + float2(rnd(seed), rnd(seed));
-		float2 ndc = screenCoord / float2(launchDim) * 2.f - 1.f;	
+		float2 screenCoord = float2(pixel) + float2(rnd(seed), rnd(seed));
+		float2 ndc = screenCoord / float2(imageSize) * 2.f - 1.f;	
 		float3 rayDir = normalize(ndc.x*cameraAspect.x*cameraX + ndc.y*cameraAspect.y*cameraY + cameraZ);
 
 		newRadiance += tracePath(cameraPos, rayDir, seed);
 	}
 	newRadiance *= 1.0f / float(numSamplesPerFrame);
 
+	// Every frame weighs by its samples, which may differ from one frame to the next.
 	float3 avrRadiance;
-	if(accumulatedFrames == 0)
+	if(accumulatedSamples == 0)
 		avrRadiance = newRadiance;
 	else
-		avrRadiance = lerp( tracerOutBuffer[bufferOffset].xyz, newRadiance, 1.f / (accumulatedFrames + 1.0f) );
+		avrRadiance = lerp( tracerOutBuffer[bufferOffset].xyz, newRadiance,
+			float(numSamplesPerFrame) / float(accumulatedSamples + numSamplesPerFrame) );
 		
 	tracerOutBuffer[bufferOffset] = float4(avrRadiance, 1.0f);
+
+	if (displayFormat == RGBA16F)
+	{
+		displayBuffer[2 * bufferOffset] = f32tof16(avrRadiance.r) | (f32tof16(avrRadiance.g) << 16);
+		displayBuffer[2 * bufferOffset + 1] = f32tof16(avrRadiance.b) | (f32tof16(1.0f) << 16);
+	}
+	else if (displayFormat == RGB9E5)
+	{
+		displayBuffer[bufferOffset] = packRGB9E5(avrRadiance);
+	}
 }
 
+// reflectType is a literal in the specialized hit groups, so that the branches of the other types are compiled out.
 void samplingBRDF(out float3 sampleDir, out float sampleProb, out float3 brdfCos, 
-	in float3 surfaceNormal, in float3 baseDir, in uint materialIdx, inout uint seed)
+	in float3 surfaceNormal, in float3 baseDir, in Material mtl, in int reflectType, inout uint seed)
 {
-	Material mtl = materialBuffer[materialIdx];
-
 	float3 brdfEval;
 	float3 albedo = mtl.albedo;	
-	uint reflectType = mtl.type;
 
 	float3 I, O = baseDir, N = surfaceNormal, H;
 	float ON = dot(O, N), IN, HN, OH;
-	float alpha2 = mtl.roughness * mtl.roughness;
+	float alpha2 = mtl.alpha2;
 
 	if (reflectType == Lambertian)
 	{
@@ -235,7 +278,7 @@ void samplingBRDF(out float3 sampleDir, out float sampleProb, out float3 brdfCos
 		{
 			float D = TrowbridgeReitz(HN*HN, alpha2);
 			float G = Smith_TrowbridgeReitz(I, O, H, N, alpha2);
-			float3 F = albedo + (1 - albedo) * pow(max(0, 1-OH), 5);
+			float3 F = mtl.F0 + (1 - mtl.F0) * pow(max(0, 1-OH), 5);
 			brdfEval = ((D * G) / (4 * IN * ON)) * F;
 			sampleProb = D*HN / (4*OH);		// IN > 0 imply OH > 0
 		}
@@ -296,8 +339,7 @@ void samplingBRDF(out float3 sampleDir, out float sampleProb, out float3 brdfCos
    but this is rare so we ignore the codition dot(E, fN)<0 and only check dot(E, N)<0.
 5. In results, we do not need the face nomal fN which take a little time to compute.
 */
-[shader("closesthit")]
-void closestHit(inout RayPayload payload, in BuiltInTriangleIntersectionAttributes attr)
+void shadeSurface(inout RayPayload payload, in BuiltInTriangleIntersectionAttributes attr, in int reflectType)
 {
 	GPUSceneObject obj = objectBuffer[objIdx];
 
@@ -334,7 +376,8 @@ void closestHit(inout RayPayload payload, in BuiltInTriangleIntersectionAttribut
 
 	float3 sampleDir, brdfCos;
 	float sampleProb;
-	samplingBRDF(sampleDir, sampleProb, brdfCos, N, E, mtlIdx, payload.seed);
+	samplingBRDF(sampleDir, sampleProb, brdfCos, N, E, mtl, 
+		reflectType == AnyMaterial ? (int) mtl.type : reflectType, payload.seed);
 	
 	if(dot(sampleDir, N) <= 0)
 		payload.rayDepth = maxPathLength;
@@ -343,6 +386,28 @@ void closestHit(inout RayPayload payload, in BuiltInTriangleIntersectionAttribut
 	payload.bounceDir = sampleDir;
 }
 
+/*
+Hit groups: closestHit reads the type of the material at every hit, and the others are specialized for the type
+of the object's materials (see Scene::getShadingType()).
+*/
+[shader("closesthit")]
+void closestHit(inout RayPayload payload, in BuiltInTriangleIntersectionAttributes attr)
+{
+	shadeSurface(payload, attr, AnyMaterial);
+}
+
+[shader("closesthit")]
+void closestHitMetal(inout RayPayload payload, in BuiltInTriangleIntersectionAttributes attr)
+{
+	shadeSurface(payload, attr, Metal);
+}
+
+[shader("closesthit")]
+void closestHitPlastic(inout RayPayload payload, in BuiltInTriangleIntersectionAttributes attr)
+{
+	shadeSurface(payload, attr, Plastic);
+}
+
 [shader("closesthit")]
 void closestHitGlass(inout RayPayload payload, in BuiltInTriangleIntersectionAttributes attr)
 {
@@ -373,21 +438,17 @@ void closestHitGlass(inout RayPayload payload, in BuiltInTriangleIntersectionAtt
 	float3 sampleDir;
 	float sampleProb, Fresnel;
 
-	float T0 = mtl.transmittivity;
-	float n = sqrt(1 - T0);
-	n = (1+n) / (1-n);			// n <- refractive index of glass
-	
 	float R, g, x, y;
-	float c1, gg;
+	float n, c1, gg;
 
 	if (EN > 0)
 	{
-		n = 1 / n;				// n <- relative index of air-to-glass (n_air/n_glass)
+		n = mtl.invIor;			// n <- relative index of air-to-glass (n_air/n_glass)
 		c1 = EN;
 	}
 	else
 	{
-		n = n;					// n <- relative index of glass-to-air (n_glass/n_air)
+		n = mtl.ior;			// n <- relative index of glass-to-air (n_glass/n_air)
 		c1 = -EN;
 	}
 
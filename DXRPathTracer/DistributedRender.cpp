@@ -0,0 +1,282 @@
+#include "pch.h"
+#include "DistributedRender.h"
+#include "IGRTTracer.h"
+#include "Input.h"
+#include "timer.h"
+#include <io.h>
+#include <fcntl.h>
+#include <thread>
+#include <vector>
+
+
+void workerFrames(const WorkerJob& job, uint& firstFrame, uint& numFrames)
+{
+	if (job.split == WorkSplit::Tiles)
+	{
+		firstFrame = 0;
+		numFrames = job.numFrames;
+		return;
+	}
+	uint64 begin = (uint64) job.numFrames * job.workerIdx / job.numWorkers;
+	uint64 end = (uint64) job.numFrames * (job.workerIdx + 1) / job.numWorkers;
+	firstFrame = (uint) begin;
+	numFrames = (uint) (end - begin);
+}
+
+Array<PixelRegion> workerTiles(const WorkerJob& job)
+{
+	PixelRegion area = clampRegion(job.area, job.imageWidth, job.imageHeight);
+	Array<PixelRegion> tiles;
+	if (job.split == WorkSplit::Samples)
+	{
+		tiles.push_back(area);
+		return tiles;
+	}
+
+	// Along the rows and the columns alike, so that a column of costly tiles does not go to one worker.
+	uint tileSize = _max(job.tileSize, 1u);
+	for (uint row = 0; row * tileSize < area.height; ++row)
+	{
+		for (uint col = 0; col * tileSize < area.width; ++col)
+		{
+			if ((row + col) % job.numWorkers != job.workerIdx)
+				continue;
+			uint x = col * tileSize, y = row * tileSize;
+			tiles.push_back({ area.x + x, area.y + y, _min(tileSize, area.width - x), _min(tileSize, area.height - y) });
+		}
+	}
+	return tiles;
+}
+
+bool renderWork(IGRTTracer& tracer, const WorkerJob& job, const std::function<bool(const AccumulationState&)>& send)
+{
+	uint firstFrame, numFrames;
+	workerFrames(job, firstFrame, numFrames);
+	if (numFrames == 0)
+		return true;
+
+	uint64 areaHash = tracer.getSceneHash();
+	InputEngine input(nullptr);
+	AccumulationState state;
+	tracer.setFirstFrame(firstFrame);
+	for (const PixelRegion& tile : workerTiles(job))
+	{
+		tracer.setRegion(job.imageWidth, job.imageHeight, tile);
+		double nextSend = getCurrentTime() + job.streamInterval;
+		for (uint frame = 0; frame < numFrames; ++frame)
+		{
+			tracer.update(input);
+			tracer.shootRays();
+			if (frame + 1 < numFrames && getCurrentTime() < nextSend)
+				continue;
+
+			tracer.saveAccumulation(state);
+			state.sceneHash = areaHash;
+			if (!send(state))
+				return false;
+			nextSend = getCurrentTime() + job.streamInterval;
+		}
+	}
+	return true;
+}
+
+
+AccumulationMerger::AccumulationMerger(uint imageWidth, uint imageHeight, const PixelRegion& area, uint64 sceneHash)
+	: imageW(imageWidth), imageH(imageHeight), area(clampRegion(area, imageWidth, imageHeight)), sceneHash(sceneHash)
+{
+}
+
+bool AccumulationMerger::add(uint workerIdx, AccumulationState& partial)
+{
+	const PixelRegion& region = partial.region;
+	bool valid = partial.sceneHash == sceneHash
+		&& partial.imageWidth == imageW && partial.imageHeight == imageH
+		&& region.x >= area.x && region.x + region.width <= area.x + area.width
+		&& region.y >= area.y && region.y + region.height <= area.y + area.height
+		&& partial.pixels.size() == region.width * region.height;
+
+	std::lock_guard<std::mutex> lock(partialLock);
+	if (!valid)
+	{
+		++stats.numRefused;
+		return false;
+	}
+
+	AccumulationState& stored = partials[PartialKey(workerIdx, region.x, region.y)];
+	stored.imageWidth = partial.imageWidth;
+	stored.imageHeight = partial.imageHeight;
+	stored.region = region;
+	stored.accumulatedFrames = partial.accumulatedFrames;
+	stored.accumulatedSamples = partial.accumulatedSamples;
+	stored.sceneHash = partial.sceneHash;
+	stored.pixels.swap(partial.pixels);
+
+	++stats.numPartials;
+	stats.bytesReceived += (uint64) stored.pixels.size() * sizeof(float4);
+	return true;
+}
+
+void AccumulationMerger::resolve(Array<float4>& pixels, Array<uint>& samples) const
+{
+	uint numPixels = area.width * area.height;
+	Array<double> sums(numPixels * 4, 0.0);
+	samples.clear();
+	samples.resize(numPixels, 0u);
+
+	std::lock_guard<std::mutex> lock(partialLock);
+	for (const auto& entry : partials)
+	{
+		const AccumulationState& partial = entry.second;
+		const PixelRegion& region = partial.region;
+		double weight = (double) partial.accumulatedSamples;
+		for (uint y = 0; y < region.height; ++y)
+		{
+			uint offset = area.width * (region.y - area.y + y) + (region.x - area.x);
+			const float* src = &partial.pixels[region.width * y].x;
+			double* dst = &sums[offset * 4];
+			for (uint i = 0; i < region.width * 4; ++i)
+				dst[i] += weight * src[i];
+			for (uint x = 0; x < region.width; ++x)
+				samples[offset + x] += partial.accumulatedSamples;
+		}
+	}
+
+	pixels.resize(numPixels);
+	for (uint i = 0; i < numPixels; ++i)
+	{
+		double scale = samples[i] ? 1.0 / samples[i] : 0.0;
+		const double* sum = &sums[i * 4];
+		pixels[i] = float4((float) (sum[0] * scale), (float) (sum[1] * scale), (float) (sum[2] * scale),
+			(float) (sum[3] * scale));
+	}
+}
+
+MergerStats AccumulationMerger::getStats() const
+{
+	std::lock_guard<std::mutex> lock(partialLock);
+	return stats;
+}
+
+
+namespace {
+
+struct WorkerProcess
+{
+	HANDLE	process = nullptr;
+	FILE*	output = nullptr;		// The read end of the pipe of its standard output.
+};
+
+bool startWorker(const std::string& commandLine, WorkerProcess& worker)
+{
+	SECURITY_ATTRIBUTES security = { sizeof(security), nullptr, TRUE };
+	HANDLE readHandle, writeHandle;
+	if (!CreatePipe(&readHandle, &writeHandle, &security, 0))
+		return false;
+	SetHandleInformation(readHandle, HANDLE_FLAG_INHERIT, 0);		// Only the write end goes to the worker.
+
+	STARTUPINFOA startup = {};
+	startup.cb = sizeof(startup);
+	startup.dwFlags = STARTF_USESTDHANDLES;
+	startup.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+	startup.hStdOutput = writeHandle;
+	startup.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+
+	// The workers are started one after another, and the write end of each is closed here before the next one
+	// inherits anything, so that every stream ends with its own worker.
+	PROCESS_INFORMATION info = {};
+	std::string line = commandLine;		// CreateProcessA may write into it.
+	BOOL started = CreateProcessA(nullptr, &line[0], nullptr, nullptr, TRUE, 0, nullptr, nullptr, &startup, &info);
+	CloseHandle(writeHandle);
+	if (!started)
+	{
+		CloseHandle(readHandle);
+		return false;
+	}
+
+	CloseHandle(info.hThread);
+	worker.process = info.hProcess;
+	worker.output = _fdopen(_open_osfhandle((intptr_t) readHandle, _O_RDONLY | _O_BINARY), "rb");
+	return worker.output != nullptr;
+}
+
+}	// namespace
+
+bool runWorkers(const Array<std::string>& commandLines, AccumulationMerger& merger, Array<WorkerResult>& results)
+{
+	uint numWorkers = commandLines.size();
+	Array<WorkerProcess> workers(numWorkers);
+	results.clear();
+	results.resize(numWorkers);
+
+	double startTime = getCurrentTime();
+	std::vector<std::thread> readers;
+	for (uint workerIdx = 0; workerIdx < numWorkers; ++workerIdx)
+	{
+		if (!startWorker(commandLines[workerIdx], workers[workerIdx]))
+		{
+			printf("Could not start worker %u: %s\n", workerIdx, commandLines[workerIdx].c_str());
+			continue;
+		}
+
+		readers.emplace_back([&, workerIdx]() {
+			WorkerProcess& worker = workers[workerIdx];
+			WorkerResult& result = results[workerIdx];
+
+			// The stream ends cleanly only between two partials.
+			AccumulationState partial;
+			bool clean = true;
+			for (int c; (c = fgetc(worker.output)) != EOF; )
+			{
+				ungetc(c, worker.output);
+				if (!readAccumulation(worker.output, partial))
+				{
+					clean = false;
+					break;
+				}
+				if (merger.add(workerIdx, partial))
+					++result.numPartials;
+				else
+					clean = false;
+			}
+			fclose(worker.output);
+
+			DWORD exitCode = 1;
+			WaitForSingleObject(worker.process, INFINITE);
+			GetExitCodeProcess(worker.process, &exitCode);
+			CloseHandle(worker.process);
+			result.succeeded = clean && exitCode == 0;
+			result.finishTime = getCurrentTime() - startTime;
+		});
+	}
+
+	for (std::thread& reader : readers)
+		reader.join();
+
+	bool succeeded = true;
+	for (const WorkerResult& result : results)
+		succeeded &= result.succeeded;
+	return succeeded;
+}
+
+FILE* openWorkerStream()
+{
+	fflush(stdout);
+	int streamFd = _dup(_fileno(stdout));
+	if (streamFd < 0)
+		return nullptr;
+	_dup2(_fileno(stderr), _fileno(stdout));
+	_setmode(streamFd, _O_BINARY);
+	return _fdopen(streamFd, "wb");
+}
+
+int runWorker(IGRTTracer& tracer, const WorkerJob& job, FILE* stream)
+{
+	if (!stream)
+		return 1;
+
+	bool ok = renderWork(tracer, job, [&](const AccumulationState& state) {
+		return writeAccumulation(stream, state) && fflush(stream) == 0;
+	});
+	ok = (fclose(stream) == 0) && ok;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include "IGRTCommon.h"
+#include "Checkpoint.h"
+#include <functional>
+#include <string>
+#include <mutex>
+#include <map>
+#include <tuple>
+
+
+class IGRTTracer;
+
+enum class WorkSplit
+{
+	Samples,	// Every worker traces the whole area, over its own range of the frames.
+	Tiles,		// Every worker traces all the frames, over its own set of tiles of the area.
+};
+
+// The share of one of numWorkers processes in a headless render of numFrames frames of area.
+struct WorkerJob
+{
+	uint		workerIdx = 0;
+	uint		numWorkers = 1;
+	WorkSplit	split = WorkSplit::Samples;
+	uint		tileSize = 128;
+	uint		numFrames = 1;
+	uint		imageWidth = 0;
+	uint		imageHeight = 0;
+	PixelRegion	area;						// Of the image; the whole image if empty.
+	double		streamInterval = 1.0;		// Seconds between the partial accumulations of a region being traced.
+};
+
+// The frames of the worker are firstFrame .. firstFrame + numFrames - 1; with WorkSplit::Tiles all of them.
+void workerFrames(const WorkerJob& job, uint& firstFrame, uint& numFrames);
+
+// The tiles of the worker, dealt in turn, so that every worker gets some of the costly parts of the image; with
+// WorkSplit::Samples the whole area.
+Array<PixelRegion> workerTiles(const WorkerJob& job);
+
+/*
+Traces the share of the job with tracer, which is set up on the scene and on the area of the job, and passes the
+accumulation of every region to send every streamInterval seconds and when the region is done. The partials of a
+region add up: each holds all of the samples of the worker in it. Their sceneHash is that of the tracer over the
+whole area, whatever region they cover, so that the coordinator checks them against its own. Stops early, returning
+false, when send() does.
+*/
+bool renderWork(IGRTTracer& tracer, const WorkerJob& job, const std::function<bool(const AccumulationState&)>& send);
+
+
+struct MergerStats
+{
+	uint	numPartials = 0;		// Merged.
+	uint	numRefused = 0;
+	uint64	bytesReceived = 0;		// Of the pixels of the merged partials.
+};
+
+/*
+The accumulation of a distributed render, merged from the partials of the workers as they come in. The last partial
+of each worker and region replaces its previous ones, and resolve() averages the partials over every pixel, each
+weighed by its samples per pixel, in double precision: a pixel of a single partial comes out exactly as traced.
+Partials of another scene hash or image, or outside the area, are refused. It may be fed from several threads.
+*/
+class AccumulationMerger
+{
+	typedef std::tuple<uint, uint, uint> PartialKey;	// Worker, and the corner of the region in the image.
+
+	uint								imageW;
+	uint								imageH;
+	PixelRegion							area;
+	uint64								sceneHash;
+	std::map<PartialKey, AccumulationState>	partials;
+	MergerStats							stats;
+	mutable std::mutex					partialLock;
+
+public:
+	AccumulationMerger(uint imageWidth, uint imageHeight, const PixelRegion& area, uint64 sceneHash);
+
+	bool add(uint workerIdx, AccumulationState& partial);		// Takes the pixels of the partial.
+
+	// The merged accumulation of the area, RGBA32F, and the samples of each pixel; pixels of no partial are 0.
+	void resolve(Array<float4>& pixels, Array<uint>& samples) const;
+	const PixelRegion& getArea() const			{ return area; }
+	MergerStats getStats() const;
+};
+
+
+// How the render went at one worker, for the report of the coordinator.
+struct WorkerResult
+{
+	bool	succeeded = false;		// Exited with 0, and its stream ended after whole partials.
+	uint	numPartials = 0;
+	double	finishTime = 0.0;		// From the start of all the workers, in seconds.
+};
+
+/*
+Runs one worker process per command line and merges the partials which every worker writes to its standard
+output (see runWorker()), each stream read on a thread of its own. A pipe stands in for a socket here, and any
+command which ends in a worker process and carries its output back, such as a remote shell, works as well. Returns
+whether every worker succeeded.
+*/
+bool runWorkers(const Array<std::string>& commandLines, AccumulationMerger& merger, Array<WorkerResult>& results);
+
+// Turns the standard output of a worker process over to the stream of its partials, which it returns, and sends
+// whatever is printed from then on to its standard error. Call it before anything is printed.
+FILE* openWorkerStream();
+
+// The body of a worker process: renderWork() with the partials written to stream. Returns the exit code.
+int runWorker(IGRTTracer& tracer, const WorkerJob& job, FILE* stream);
@@ -0,0 +1,70 @@
+#include "pch.h"
+#include "FrameBudget.h"
+
+
+namespace {
+
+const double smoothing = 0.25;			// Of the cost of each frame, in the running cost.
+const double spikeRatio = 1.5;			// A frame this much costlier than the running cost replaces it.
+const float scaleStep = 0.125f;			// Of the resolution scale, up and down.
+const uint settleFrames = 8;			// At a scale before it steps up.
+const double stepUpMargin = 1.25;		// Of the samples fitting at the higher scale over minSamples.
+
+}	// namespace
+
+
+FrameBudget::FrameBudget(const FrameBudgetSettings& settings)
+	: settings(settings), numSamples(settings.minSamples)
+{
+	this->settings.minSamples = _max(settings.minSamples, 1u);
+	this->settings.maxSamples = _max(settings.maxSamples, this->settings.minSamples);
+	this->settings.minScale = _min(_max(settings.minScale, scaleStep), 1.0f);
+	numSamples = this->settings.minSamples;
+}
+
+double FrameBudget::samplesFitting(float atScale) const
+{
+	double pixels = _max((double) fullPixels * atScale * atScale, 1.0);
+	return settings.targetTime / (costPerSample * pixels);
+}
+
+void FrameBudget::addFrame(const FrameTimings& timings, uint64 numPixels)
+{
+	if (timings.numSamples == 0 || numPixels == 0 || timings.trace <= 0.0)
+		return;
+	if (fullPixels == 0)
+		fullPixels = (uint64) (numPixels / (scale * scale));
+
+	double cost = timings.trace / ((double) timings.numSamples * numPixels);
+	if (costPerSample == 0.0 || cost > costPerSample * spikeRatio)
+		costPerSample = cost;
+	else
+		costPerSample += (cost - costPerSample) * smoothing;
+
+	double fitting = samplesFitting(scale);
+	++framesAtScale;
+	if (settings.scaleResolution && fitting < settings.minSamples && scale > settings.minScale)
+	{
+		// Down to the largest step at which minSamples fits, as far as minScale.
+		float fittingScale = scale * (float) sqrt(fitting / settings.minSamples);
+		scale = _max(floorf(fittingScale / scaleStep) * scaleStep, settings.minScale);
+		framesAtScale = 0;
+		numSamples = settings.minSamples;
+		return;
+	}
+	if (settings.scaleResolution && scale < 1.0f && framesAtScale >= settleFrames)
+	{
+		float up = _min(scale + scaleStep, 1.0f);
+		if (samplesFitting(up) >= settings.minSamples * stepUpMargin)
+		{
+			scale = up;
+			framesAtScale = 0;
+			numSamples = settings.minSamples;
+			return;
+		}
+	}
+
+	uint next = fitting >= settings.maxSamples ? settings.maxSamples : (uint) fitting;
+	next = _min(next, numSamples * 2);
+	numSamples = _min(_max(next, settings.minSamples), settings.maxSamples);
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include "IGRTCommon.h"
+
+
+struct FrameBudgetSettings
+{
+	double	targetTime = 16.0;			// Of tracing a frame, in milliseconds.
+	uint	minSamples = 1;				// Per pixel and frame.
+	uint	maxSamples = 64;
+	bool	scaleResolution = false;	// Trace fewer pixels once minSamples no longer fits in the target.
+	float	minScale = 0.5f;			// Of the internal resolution, in each dimension.
+};
+
+
+/*
+Holds the trace time of the interactive frames at a target by choosing the samples per pixel of the next frame, and
+optionally the internal resolution. The time is modeled as a cost per sample of a pixel times the samples of the
+frame; the cost follows the measured frames, smoothed while they agree and taken at once when a frame is much
+slower, so that a heavy view overshoots for one frame at most. The samples at most double from one frame to the
+next, since the frames in flight of DXRPathTracer are timed late. The resolution scale restarts the accumulation, so
+it steps down only when minSamples misses the target at the current scale, and back up only when the next step
+would fit minSamples with a margin, after a few frames at the current one.
+*/
+class FrameBudget
+{
+	FrameBudgetSettings	settings;
+	double				costPerSample = 0.0;	// In milliseconds per sample per pixel; 0 until the first frame.
+	uint64				fullPixels = 0;			// Of the traced region at full resolution.
+	uint				numSamples;
+	float				scale = 1.0f;
+	uint				framesAtScale = 0;
+
+	double samplesFitting(float atScale) const;	// In the target, at the scale.
+
+public:
+	FrameBudget(const FrameBudgetSettings& settings = FrameBudgetSettings());
+
+	const FrameBudgetSettings& getSettings() const	{ return settings; }
+	void setNumPixels(uint64 numPixels)			{ fullPixels = numPixels; }	// Of the traced region at scale 1.
+
+	// Feeds the timings of a frame that traced numPixels pixels, and chooses the next frame's samples and scale.
+	void addFrame(const FrameTimings& timings, uint64 numPixels);
+
+	uint getNumSamples() const					{ return numSamples; }		// For the next frame.
+	float getResolutionScale() const			{ return scale; }
+	double getCostPerSample() const				{ return costPerSample; }
+};
+
+// size * scale, at least 1.
+inline uint scaleSize(uint size, float scale)		{ return _max((uint) (size * scale + 0.5f), 1u); }
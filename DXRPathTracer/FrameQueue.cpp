@@ -0,0 +1,164 @@
+#include "pch.h"
+#include "FrameQueue.h"
+#include "timer.h"
+#include <thread>
+
+
+bool FrameQueue::IndexRing::push(uint idx)
+{
+	uint64 t = tail.load(std::memory_order_relaxed);
+	if (t - head.load(std::memory_order_acquire) == slots.size())
+		return false;
+
+	slots[(uint) (t % slots.size())] = idx;
+	tail.store(t + 1, std::memory_order_release);
+	return true;
+}
+
+bool FrameQueue::IndexRing::pop(uint& idx)
+{
+	uint64 h = head.load(std::memory_order_relaxed);
+	if (h == tail.load(std::memory_order_acquire))
+		return false;
+
+	idx = slots[(uint) (h % slots.size())];
+	head.store(h + 1, std::memory_order_release);
+	return true;
+}
+
+bool FrameQueue::IndexRing::empty() const
+{
+	return head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire);
+}
+
+FrameQueue::FrameQueue(FrameQueuePolicy policy, uint capacity)
+	: policy(policy)
+{
+	capacity = policy == FrameQueuePolicy::LatestWins ? 1 : _max(capacity, 1u);
+	uint numBuffers = capacity + 2;
+	pool.resize(numBuffers);
+
+	writeIdx = 0;
+	if (policy == FrameQueuePolicy::LatestWins)
+	{
+		mailbox = 1;
+		readIdx = 2;
+	}
+	else
+	{
+		readyRing.slots.resize(capacity);
+		freeRing.slots.resize(numBuffers);
+		for (uint idx = 1; idx < numBuffers; ++idx)
+			freeRing.push(idx);
+		readIdx = numBuffers;
+	}
+}
+
+QueuedFrame& FrameQueue::beginWrite()
+{
+	return pool[writeIdx];
+}
+
+void FrameQueue::publish()
+{
+	QueuedFrame& frame = pool[writeIdx];
+	frame.frameIdx = nextFrameIdx++;
+	frame.readyTime = getCurrentTime();
+	++numPublished;
+
+	if (policy == FrameQueuePolicy::LatestWins)
+	{
+		uint previous = mailbox.exchange(writeIdx | unreadFlag, std::memory_order_acq_rel);
+		if (previous & unreadFlag)
+			++numDropped;
+		writeIdx = previous & ~unreadFlag;
+		return;
+	}
+
+	if (!readyRing.push(writeIdx))
+	{
+		if (policy == FrameQueuePolicy::DropNewest)
+		{
+			++numDropped;		// The buffer is written again by the next frame.
+			return;
+		}
+
+		double startTime = getCurrentTime();
+		while (!readyRing.push(writeIdx))
+			std::this_thread::yield();
+		producerWaitMicroseconds += (uint64) ((getCurrentTime() - startTime) * 1e6);
+	}
+
+	// The consumer holds one buffer at most, as it gives back the one it read before it takes the next, so with
+	// capacity + 2 buffers one is always free once the written one is queued.
+	bool gotFree = freeRing.pop(writeIdx);
+	assert(gotFree);
+}
+
+void FrameQueue::publish(const TracedResult& trResult, double startTime)
+{
+	QueuedFrame& frame = beginWrite();
+	uint64 rowSize = (uint64) trResult.width * trResult.pixelSize;
+	if (trResult.data != frame.pixels.data())
+	{
+		frame.pixels.resize((uint) (rowSize * trResult.height));
+		for (uint y = 0; y < trResult.height; ++y)
+			memcpy(&frame.pixels[(uint) (rowSize * y)], (const uint8*) trResult.data + trResult.getRowPitch() * y, rowSize);
+	}
+	else
+	{
+		assert(trResult.getRowPitch() == rowSize);
+	}
+	frame.width = trResult.width;
+	frame.height = trResult.height;
+	frame.pixelSize = trResult.pixelSize;
+	frame.format = trResult.format;
+	frame.startTime = startTime;
+	publish();
+}
+
+OutputBuffer FrameQueue::acquireOutput(uint width, uint height, PixelFormat format)
+{
+	QueuedFrame& frame = beginWrite();
+	uint64 rowSize = (uint64) width * pixelSizeOf(format);
+	frame.pixels.resize((uint) (rowSize * height));
+
+	OutputBuffer buffer;
+	buffer.data = frame.pixels.data();
+	buffer.rowPitch = rowSize;
+	return buffer;
+}
+
+const QueuedFrame* FrameQueue::acquire()
+{
+	if (policy == FrameQueuePolicy::LatestWins)
+	{
+		if (!(mailbox.load(std::memory_order_acquire) & unreadFlag))
+			return nullptr;
+		readIdx = mailbox.exchange(readIdx, std::memory_order_acq_rel) & ~unreadFlag;
+	}
+	else
+	{
+		// Only this thread pops the ring, so it stays non-empty until the pop. Freeing the read buffer first keeps
+		// the producer from finding the ring full and no buffer free while this one holds two.
+		if (readyRing.empty())
+			return nullptr;
+		if (readIdx < pool.size())
+			freeRing.push(readIdx);
+		bool gotReady = readyRing.pop(readIdx);
+		assert(gotReady);
+	}
+
+	++numConsumed;
+	return &pool[readIdx];
+}
+
+FrameQueueStats FrameQueue::getStats() const
+{
+	FrameQueueStats stats;
+	stats.numPublished = numPublished;
+	stats.numDropped = numDropped;
+	stats.numConsumed = numConsumed;
+	stats.producerWaitTime = producerWaitMicroseconds.load() * 1e-3;
+	return stats;
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include "IGRTCommon.h"
+#include <atomic>
+
+
+enum class FrameQueuePolicy
+{
+	LatestWins,		// The consumer gets the newest frame; the unread older one is dropped. The producer never waits.
+	DropNewest,		// Every frame in order up to the capacity; what is published to a full queue is dropped.
+	Block,			// Every frame in order; the producer waits while the queue is full.
+};
+
+// A frame owned by a FrameQueue: the pixels of a TracedResult in pooled memory, written there by the tracer or
+// copied, so that it stays valid while the tracer goes on writing (or reading back into) its own buffers.
+struct QueuedFrame
+{
+	Array<uint8>	pixels;
+	uint			width = 0;
+	uint			height = 0;
+	uint			pixelSize = 0;
+	PixelFormat		format = PixelFormat::RGBA32F;
+	uint64			frameIdx = 0;				// Counted by publish().
+	double			startTime = 0.0;			// getCurrentTime() when the producer began the frame.
+	double			readyTime = 0.0;			// And when it published it.
+
+	TracedResult result() const					{ return { (void*) pixels.data(), width, height, pixelSize, format }; }
+};
+
+struct FrameQueueStats
+{
+	uint64	numPublished = 0;
+	uint64	numDropped = 0;
+	uint64	numConsumed = 0;
+	double	producerWaitTime = 0.0;				// In milliseconds, with FrameQueuePolicy::Block.
+};
+
+
+/*
+A bounded queue of frames from one producer thread (the tracer) to one consumer thread (the display), without
+locks. The frames live in a pool of capacity + 2 buffers: one written by the producer, one read by the consumer,
+and the others queued or free, so no buffer is ever written while it is read. Their indices move between the two
+threads through two single-producer single-consumer rings, ready and free. LatestWins is the triple buffering
+special case: one mailbox index, exchanged atomically by both sides, with a flag telling whether it is unread.
+As an IOutputTarget of the producing tracer, the queue lends it the buffer of beginWrite(), and publishing the
+TracedResult then copies nothing.
+*/
+class FrameQueue : public IOutputTarget
+{
+	// Bounded single-producer single-consumer ring of buffer indices; head and tail only grow.
+	struct IndexRing
+	{
+		Array<uint>			slots;
+		std::atomic<uint64>	head{0};			// Written by the consumer of the ring.
+		std::atomic<uint64>	tail{0};			// Written by its producer.
+
+		bool push(uint idx);
+		bool pop(uint& idx);
+		bool empty() const;					// Certain only for the consumer of the ring.
+	};
+
+	static const uint		unreadFlag = 0x80000000u;
+
+	FrameQueuePolicy		policy;
+	Array<QueuedFrame>		pool;
+	IndexRing				readyRing;
+	IndexRing				freeRing;
+	std::atomic<uint>		mailbox;			// LatestWins only.
+	uint					writeIdx;			// Owned by the producer.
+	uint					readIdx;			// Owned by the consumer; pool.size() until the first acquire().
+	uint64					nextFrameIdx = 0;
+
+	std::atomic<uint64>		numPublished{0};
+	std::atomic<uint64>		numDropped{0};
+	std::atomic<uint64>		numConsumed{0};
+	std::atomic<uint64>		producerWaitMicroseconds{0};
+
+public:
+	FrameQueue(FrameQueuePolicy policy, uint capacity = 2);	// LatestWins always holds one frame.
+
+	// Producer: fill the frame of beginWrite(), then publish() it; or publish a TracedResult in one call, which
+	// copies it unless it was written into the buffer of acquireOutput().
+	QueuedFrame& beginWrite();
+	void publish();
+	void publish(const TracedResult& trResult, double startTime);
+	virtual OutputBuffer acquireOutput(uint width, uint height, PixelFormat format);
+
+	// Consumer: the next frame by the policy, or nullptr if nothing new was published. A frame stays valid, and is
+	// not written, until an acquire() returns another one.
+	const QueuedFrame* acquire();
+
+	FrameQueuePolicy getPolicy() const			{ return policy; }
+	FrameQueueStats getStats() const;
+};
@@ -0,0 +1,63 @@
+#include "pch.h"
+#include "FrameRing.h"
+#include "timer.h"
+
+
+void FrameRing::create(ITimeline* newTimeline, uint numSlots)
+{
+	assert(numSlots > 0);
+	timeline = newTimeline;
+	frameValues.clear();
+	frameValues.resize(numSlots, 0);
+	frameIdx = 0;
+	lastRead = ~0ull;
+	waitTime = 0.0;
+}
+
+uint FrameRing::beginFrame()
+{
+	double startTime = getCurrentTime();
+	timeline->waitForValue(frameValues[currentSlot()]);
+	waitTime = (getCurrentTime() - startTime) * 1000.0;
+	return currentSlot();
+}
+
+void FrameRing::endFrame()
+{
+	frameValues[currentSlot()] = timeline->signal();
+	++frameIdx;
+}
+
+uint64 FrameRing::frameToRead()
+{
+	assert(frameIdx > 0);
+	uint64 frame = frameIdx >= numSlots() ? frameIdx - numSlots() : 0;
+	if (lastRead != ~0ull && lastRead >= frame)
+	{
+		frame = lastRead;
+		while (frame + 1 < frameIdx && isFrameComplete(frame + 1))
+			++frame;
+	}
+	lastRead = frame;
+	return frame;
+}
+
+bool FrameRing::isFrameComplete(uint64 frame)
+{
+	assert(frame < frameIdx && frame + numSlots() >= frameIdx);		// Still remembered by its slot.
+	return timeline->getCompletedValue() >= frameValues[slotOf(frame)];
+}
+
+void FrameRing::waitForFrame(uint64 frame)
+{
+	assert(frame < frameIdx && frame + numSlots() >= frameIdx);
+	double startTime = getCurrentTime();
+	timeline->waitForValue(frameValues[slotOf(frame)]);
+	waitTime += (getCurrentTime() - startTime) * 1000.0;
+}
+
+void FrameRing::flush()
+{
+	for (uint64 value : frameValues)
+		timeline->waitForValue(value);
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include "pch.h"
+
+
+/*
+The completion of the work submitted to a queue, as a counter which only grows: every signal() is ordered after
+the work submitted before it, and the counter reaches its value when that work is done. TimelineFence implements
+it on a D3D12 command queue (dxHelpers.h), and SoftwareQueue on a thread of its own, without a GPU.
+*/
+class ITimeline
+{
+public:
+	virtual ~ITimeline() {}
+	virtual uint64 signal() = 0;						// Returns the value which will be reached.
+	virtual uint64 getCompletedValue() = 0;
+	virtual void waitForValue(uint64 value) = 0;		// Blocks the calling thread.
+
+	void waitIdle() { waitForValue(signal()); }
+};
+
+
+/*
+N frames in flight on one timeline. The resources a frame writes on the CPU and reads back (command allocator,
+constants, readback and upload buffers) are kept in N slots, and frame i uses slot i % N. beginFrame() waits only
+until the last frame which used that slot has completed, so with N > 1 the CPU records frame i while the queue
+still executes frames i-N+1 .. i-1, and N = 1 is the fully serialized loop.
+*/
+class FrameRing
+{
+	ITimeline*		timeline = nullptr;
+	Array<uint64>	frameValues;		// Timeline value of the last frame submitted in each slot; 0 if none.
+	uint64			frameIdx = 0;		// Of the frame being recorded.
+	uint64			lastRead = ~0ull;	// The last frame handed out by frameToRead(); ~0 before the first.
+	double			waitTime = 0.0;		// In milliseconds, of the last beginFrame() and waitForFrame().
+
+public:
+	void create(ITimeline* timeline, uint numSlots);
+
+	uint numSlots() const						{ return frameValues.size(); }
+	uint64 getFrameIdx() const					{ return frameIdx; }
+	uint currentSlot() const					{ return (uint) (frameIdx % frameValues.size()); }
+	uint slotOf(uint64 frame) const				{ return (uint) (frame % frameValues.size()); }
+	double getWaitTime() const					{ return waitTime; }
+
+	uint beginFrame();							// Waits until the current slot is free, and returns it.
+	void endFrame();							// After the work of the current frame is submitted.
+
+	// The frame to read back after beginFrame(): the last one of the current slot, which beginFrame() waited for.
+	// When that one was handed out already, which happens while the first numSlots() frames fill the ring, it is
+	// the newest completed frame instead, and the last one handed out again only if no newer one has completed;
+	// those repeats let the queue get ahead by up to numSlots() - 1 frames. The frames handed out never go back.
+	// The queue writes into the slot of the frame again only after the next endFrame().
+	uint64 frameToRead();
+	bool isFrameComplete(uint64 frame);
+	void waitForFrame(uint64 frame);
+	void flush();								// Waits for every submitted frame.
+};
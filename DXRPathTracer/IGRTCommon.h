@@ -15,10 +15,79 @@ For example,
 #include "pch.h"
 
 
+// Of the pixels of a TracedResult. The tracers accumulate in RGBA32F and convert to the others for display only.
+enum class PixelFormat
+{
+	RGBA32F,		// float4
+	RGBA16F,		// Four halves.
+	RGB9E5,			// Three 9-bit mantissas with a shared 5-bit exponent (DXGI_FORMAT_R9G9B9E5_SHAREDEXP).
+};
+
+inline uint pixelSizeOf(PixelFormat format)
+{
+	return format == PixelFormat::RGBA32F ? 16 : (format == PixelFormat::RGBA16F ? 8 : 4);
+}
+
 struct TracedResult
 {
 	void* data;
 	uint width;
 	uint height;
 	uint pixelSize;
-};
\ No newline at end of file
+	PixelFormat format = PixelFormat::RGBA32F;
+	uint64 rowPitch = 0;			// In bytes; 0 for rows of width * pixelSize.
+
+	uint64 getRowPitch() const { return rowPitch ? rowPitch : (uint64) width * pixelSize; }
+};
+
+// A rectangle of the pixels of an image; an empty one stands for the whole image.
+struct PixelRegion
+{
+	uint x = 0;
+	uint y = 0;
+	uint width = 0;
+	uint height = 0;
+
+	bool empty() const { return width == 0 || height == 0; }
+};
+
+// region within an image of width x height pixels, cut at its edges; the whole image if region is empty.
+inline PixelRegion clampRegion(const PixelRegion& region, uint width, uint height)
+{
+	if (region.empty())
+		return { 0, 0, width, height };
+	if (region.x >= width || region.y >= height)
+		throw Error("The region is outside of the image.");
+
+	return { region.x, region.y, _min(region.width, width - region.x), _min(region.height, height - region.y) };
+}
+
+// Memory of a consumer for a tracer to write a frame into: rows of rowPitch bytes, or no data.
+struct OutputBuffer
+{
+	void* data = nullptr;
+	uint64 rowPitch = 0;
+};
+
+/*
+A consumer of TracedResults which lends the tracer its own memory, such as the upload buffer of a screen or a slot
+of a FrameQueue, so that the frame is written where it is used instead of being copied there. The tracer calls
+acquireOutput() once per frame, before it writes the frame, and the TracedResult of that frame points into the
+buffer. The buffer is owned by the tracer until its TracedResult is handed to the consumer. A consumer which cannot
+take a frame of that size or format returns no data, and the tracer then writes into its own memory.
+*/
+class IOutputTarget
+{
+public:
+	virtual ~IOutputTarget() {}
+	virtual OutputBuffer acquireOutput(uint width, uint height, PixelFormat format) = 0;
+};
+
+// Durations of the parts of the last frame in milliseconds, on the processor which did the work (the GPU for DXR).
+struct FrameTimings
+{
+	double sceneUpdate = 0.0;		// Applying the scene edits apart from the acceleration structures.
+	double accelUpdate = 0.0;		// Refits and builds of the acceleration structures.
+	double trace = 0.0;				// Tracing the rays of the frame.
+	uint numSamples = 0;			// Per pixel, of the frame timed.
+};
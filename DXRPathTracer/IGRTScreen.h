@@ -15,5 +15,10 @@ protected:
 public:
 	IGRTScreen(HWND hwnd, uint w, uint h) : targetWindow(hwnd), screenW(w), screenH(h) {}
 	virtual void onSizeChanged(uint width, uint height) = 0;
+	// Of a TracedResult of any size, such as a crop or a frame traced at a lower resolution by the frame budget,
+	// which is stretched over the whole screen.
 	virtual void display(const TracedResult& trResult) = 0;
+
+	uint getScreenWidth() const		{ return screenW; }
+	uint getScreenHeight() const	{ return screenH; }
 };
\ No newline at end of file
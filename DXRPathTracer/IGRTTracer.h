@@ -4,18 +4,72 @@
 
 class Scene;
 class InputEngine;
+class OrbitCamera;
+struct AccumulationState;
 class IGRTTracer
 {
 protected:
-	uint	tracerOutW;
+	uint	tracerOutW;		// Of the traced region, which is what the TracedResult and the buffers of the tracer cover.
 	uint	tracerOutH;
+	uint	imageW;			// Of the image the camera frames.
+	uint	imageH;
+	uint	regionX = 0;	// Of the traced region in the image.
+	uint	regionY = 0;
 
 	Scene*	scene;
 
+	IOutputTarget*	outputTarget = nullptr;	// Where the frames are written, if set.
+	uint64			resumedHash = 0;		// getSceneHash() at restoreAccumulation(), until the next update().
+	uint			firstFrame = 0;			// Index which seeds the first frame of an accumulation.
+
+	// For update(): whether the accumulation restored since the last update() goes on, which it does although the
+	// camera and the scene were set up anew if they are still those of the checkpoint.
+	bool continuesResumed()
+	{
+		bool same = resumedHash != 0 && getSceneHash() == resumedHash;
+		resumedHash = 0;
+		return same;
+	}
+
 public:
-	IGRTTracer(uint w, uint h) : tracerOutW(w), tracerOutH(h) {}
-	virtual void onSizeChanged(uint width, uint height) = 0;
+	IGRTTracer(uint w, uint h) : tracerOutW(w), tracerOutH(h), imageW(w), imageH(h) {}
+	void onSizeChanged(uint width, uint height) { setRegion(width, height, PixelRegion()); }
+
+	// Traces only region of an image of imageWidth x imageHeight: the camera frames the whole image, and every pixel
+	// of the region gets the samples it would get in the whole image, but the frames and the memory of the tracer are
+	// of the region. Restarts the accumulation.
+	virtual void setRegion(uint imageWidth, uint imageHeight, const PixelRegion& region) = 0;
+	PixelRegion getRegion() const { return { regionX, regionY, tracerOutW, tracerOutH }; }
+	uint getImageWidth() const { return imageW; }
+	uint getImageHeight() const { return imageH; }
+
 	virtual void update(const InputEngine& input) = 0;
 	virtual TracedResult shootRays() = 0;
 	virtual void setupScene(const Scene* scene) = 0;
+	virtual OrbitCamera& getCamera() = 0;
+	virtual FrameTimings getFrameTimings() const = 0;	// Of the last update() and shootRays().
+	virtual void setOutputFormat(PixelFormat format) = 0;	// Of the TracedResult; the accumulation stays RGBA32F.
+
+	// Samples per pixel of the frames from the next update() on. It may change between any two frames without
+	// restarting the accumulation, which weighs every frame by its samples.
+	virtual void setNumSamplesPerFrame(uint num) = 0;
+	virtual uint getNumSamplesPerFrame() const = 0;
+	virtual uint getAccumulatedSamples() const = 0;		// Per pixel, up to the last frame submitted.
+
+	// Restarts the accumulation at the frame of that index, instead of 0, and goes on with the indices after it; the
+	// samples of every frame are seeded by its index, so renders of disjoint ranges of frames draw disjoint samples.
+	virtual void setFirstFrame(uint frame) = 0;
+
+	void setOutputTarget(IOutputTarget* target) { outputTarget = target; }	// nullptr for the tracer's own memory.
+
+	/*
+	Checkpoints of the accumulation (see Checkpoint.h). getSceneHash() covers what the image converges to: the
+	scene, the camera, the image and its traced region, and the settings of the tracer which change the image rather
+	than only its noise. saveAccumulation() takes what was traced up to the last shootRays(). restoreAccumulation()
+	is called after setupScene() and the camera are set up, before the next update(), and returns false, leaving the
+	accumulation as it is, if the state is not of the same scene hash, image and region.
+	*/
+	virtual uint64 getSceneHash() const = 0;
+	virtual void saveAccumulation(AccumulationState& state) = 0;
+	virtual bool restoreAccumulation(const AccumulationState& state) = 0;
 };
\ No newline at end of file
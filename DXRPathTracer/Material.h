@@ -1,5 +1,6 @@
 #pragma once
 #include "basic_types.h"
+#include <cmath>
 
 
 static const int Lambertian = 0;
@@ -9,6 +10,7 @@ static const int Glass = 3;
 static const int Plastic1 = 201;
 static const int Plastic2 = 202;
 static const int Plastic3 = 203;
+static const int AnyMaterial = -1;		// A hit group which reads the type of the material at every hit.
 
 struct Material 
 {
@@ -19,3 +21,44 @@ struct Material
 	float reflectivity	 = 0.1f;
 	float transmittivity = 0.96f;	// transmittivity of glass at normal incidence
 };
+
+
+/*
+A material with the constants which the shaders would otherwise derive from it at every hit. Tracers bake the
+materials of a scene when they set it up and whenever one changes. The layout is that of Material in DXRShader.hlsl.
+*/
+struct BakedMaterial
+{
+	float3 emittance;
+	uint type;
+	float3 albedo;
+	float alpha2;			// Of the Trowbridge-Reitz distribution, roughness^2.
+	float3 F0;				// Reflectance at normal incidence: the albedo of Metal, 1 - transmittivity of Glass.
+	float reflectivity;
+	float ior;				// Of Glass, from the transmittivity at normal incidence.
+	float invIor;
+	float pad[2];
+};
+
+inline BakedMaterial bakeMaterial(const Material& mtl)
+{
+	BakedMaterial baked = {};
+	baked.emittance = mtl.emittance;
+	baked.type = mtl.type;
+	baked.albedo = mtl.albedo;
+	baked.alpha2 = mtl.roughness * mtl.roughness;
+	baked.reflectivity = mtl.reflectivity;
+
+	if (mtl.type == Metal)
+		baked.F0 = mtl.albedo;
+	else if (mtl.type == Glass)
+		baked.F0 = float3(1.0f - mtl.transmittivity);
+	else
+		baked.F0 = float3(mtl.reflectivity);
+
+	// F0 = ((n - 1) / (n + 1))^2 solved for n.
+	float n = sqrtf(1 - mtl.transmittivity);
+	baked.ior = (1 + n) / (1 - n);
+	baked.invIor = 1 / baked.ior;
+	return baked;
+}
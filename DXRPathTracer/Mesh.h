@@ -24,8 +24,34 @@ struct Triangle
 }
 */
 
+enum PrimitiveType { TriangleMesh = 0, AnalyticSphere = 1, AnalyticBox = 2 };
+
+/*
+Exact description of a mesh made by a generator function (see generateMesh.h) in the mesh's own coordinates.
+A tracer which supports analytic primitives may intersect the shape itself instead of its triangles, 
+which removes the tessellation error and keeps the triangles out of its acceleration structure.
+The triangles are always kept too, for tracers which support only triangles (e.g. DXRPathTracer).
+*/
+struct AnalyticShape
+{
+	uint type		= TriangleMesh;
+	float3 center	= float3(0.0f);
+	float radius	= 0.0f;				// AnalyticSphere
+	float3 halfSize	= float3(0.0f);		// AnalyticBox
+};
+
+// A simplified version of a mesh made by generateMeshLODs() (see simplifyMesh.h).
+struct MeshLOD
+{
+	Array<Vertex> vtxArr;
+	Array<Tridex> tdxArr;
+	float error = 0.0f;					// Upper estimate of the distance to the full mesh, in the mesh's own units.
+};
+
 struct Mesh
 {
 	Array<Vertex> vtxArr;
 	Array<Tridex> tdxArr;
+	AnalyticShape shape;
+	Array<MeshLOD> lodArr;				// Coarser and coarser levels of detail, empty if none have been generated.
 };
\ No newline at end of file
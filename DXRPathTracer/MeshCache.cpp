@@ -0,0 +1,499 @@
+#include "pch.h"
+#include "MeshCache.h"
+#include "hash.h"
+#include <vector>
+#include <algorithm>
+
+
+namespace {
+
+const uint entryMagic = 0x3148434d;		// "MCH1"
+const uint entryVersion = 2;			// Increase it whenever Vertex, Tridex or the layout below changes.
+const uint64 defaultMaxCacheSize = 2048ULL << 20;
+const uint64 staleTempFileAge = 3600ULL * 10000000ULL;		// One hour in FILETIME units(100ns).
+
+struct EntryHeader
+{
+	uint magic;
+	uint version;
+	uint64 key;
+	uint numBlocks;
+	uint vertexSize;
+	uint64 payloadHash;
+};
+
+struct ReferenceRecord
+{
+	uint64 contentHash;
+	uint64 sourceSize;
+};
+
+inline uint64 toUint64(DWORD high, DWORD low)
+{
+	return ((uint64) high << 32) | (uint64) low;
+}
+
+std::string tempPathFor(const std::string& path)
+{
+	char suffix[64];
+	snprintf(suffix, sizeof(suffix), ".%lu.%lu.tmp", (unsigned long) GetCurrentProcessId(), (unsigned long) GetCurrentThreadId());
+	return path + suffix;
+}
+
+// Write-to-temp then rename, so other processes see either nothing or a complete file.
+// If the rename fails because someone else holds or has just written the same entry, ours is simply dropped.
+bool publishFile(const std::string& path, const void* header, uint64 headerSize,
+	const Array<const void*>& chunks, const Array<uint64>& chunkSizes)
+{
+	std::string tempPath = tempPathFor(path);
+	FILE* file = fopen(tempPath.c_str(), "wb");
+	if (!file)
+		return false;
+
+	bool ok = fwrite(header, 1, (size_t) headerSize, file) == headerSize;
+	for (uint i = 0; ok && i < chunks.size(); ++i)
+	{
+		if (chunkSizes[i] > 0)
+			ok = fwrite(chunks[i], 1, (size_t) chunkSizes[i], file) == chunkSizes[i];
+	}
+	ok = (fclose(file) == 0) && ok;
+
+	if (ok && MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+		return true;
+
+	DeleteFileA(tempPath.c_str());
+	return false;
+}
+
+}	// namespace
+
+
+// An entry is a list of geometry blocks: each mesh is followed by the blocks of its levels of detail.
+struct MeshCache::BlockRecord
+{
+	uint numVertices;
+	uint numTridices;
+	uint lodLevel;			// 0 for a mesh, 1.. for its mesh.lodArr[lodLevel - 1].
+	float lodError;
+};
+
+// The block records and the pieces of geometry of an entry, in the order of the file.
+struct MeshCache::EntryWriter
+{
+	Array<BlockRecord> blockArr;
+	Array<const void*> chunks;
+	Array<uint64> chunkSizes;
+
+	EntryWriter()
+	{
+		chunks.push_back(nullptr);		// Placeholder for the block records, which are complete only at the end.
+		chunkSizes.push_back(0);
+	}
+
+	void addBlock(const Vertex* vertices, uint numVertices, const Tridex* tridices, uint numTridices, uint lodLevel, float lodError)
+	{
+		blockArr.push_back({ numVertices, numTridices, lodLevel, lodError });
+		chunks.push_back(vertices);
+		chunkSizes.push_back(sizeof(Vertex) * numVertices);
+		chunks.push_back(tridices);
+		chunkSizes.push_back(sizeof(Tridex) * numTridices);
+	}
+};
+
+MeshCache::MeshCache()
+{
+	const char* dir = getenv("MESH_CACHE_DIR");
+	setDirectory(dir ? dir : "../data/cache");
+
+	const char* maxMB = getenv("MESH_CACHE_MAX_MB");
+	maxCacheSize = maxMB ? (uint64) strtoull(maxMB, nullptr, 10) << 20 : defaultMaxCacheSize;
+
+	enabled = getenv("MESH_CACHE_DISABLE") == nullptr;
+}
+
+MeshCache& MeshCache::get()
+{
+	static MeshCache cache;
+	return cache;
+}
+
+void MeshCache::setDirectory(const char* dir)
+{
+	directory = dir;
+	if (!directory.empty() && directory.back() != '/' && directory.back() != '\\')
+		directory += '/';
+
+	CreateDirectoryA(directory.c_str(), nullptr);		// It fails harmlessly if the directory already exists.
+}
+
+std::string MeshCache::entryPath(uint64 key, const char* extension) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx", (unsigned long long) key);
+	return directory + name + extension;
+}
+
+void MeshCache::touch(const std::string& path) const
+{
+	HANDLE file = CreateFileA(path.c_str(), FILE_WRITE_ATTRIBUTES,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return;
+
+	FILETIME now;
+	GetSystemTimeAsFileTime(&now);
+	SetFileTime(file, nullptr, nullptr, &now);
+	CloseHandle(file);
+}
+
+uint64 MeshCache::makeKey(const char* sourceFile, uint64 variant)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attr;
+	if (!GetFileAttributesExA(sourceFile, GetFileExInfoStandard, &attr))
+		return 0;
+
+	uint64 sourceSize = toUint64(attr.nFileSizeHigh, attr.nFileSizeLow);
+	uint64 sourceTime = toUint64(attr.ftLastWriteTime.dwHighDateTime, attr.ftLastWriteTime.dwLowDateTime);
+	uint64 stampKey = hashCombine(hashCombine(hashString(sourceFile), sourceSize), sourceTime);
+	std::string refPath = entryPath(stampKey, ".ref");
+
+	ReferenceRecord ref = {};
+	bool found = false;
+
+	if (FILE* file = fopen(refPath.c_str(), "rb"))
+	{
+		found = fread(&ref, sizeof(ref), 1, file) == 1 && ref.sourceSize == sourceSize;
+		fclose(file);
+	}
+
+	if (found)
+	{
+		touch(refPath);
+	}
+	else
+	{
+		FILE* file = fopen(sourceFile, "rb");
+		if (!file)
+			return 0;
+
+		const uint64 chunkSize = 16ULL << 20;
+		std::vector<uint8> buffer((size_t) _min(chunkSize, _max(sourceSize, (uint64) 1)));
+		uint64 contentHash = 0, readSize = 0;
+		size_t n;
+		while ((n = fread(buffer.data(), 1, buffer.size(), file)) > 0)
+		{
+			contentHash = hashBytes(buffer.data(), n, contentHash);
+			readSize += n;
+		}
+		fclose(file);
+
+		ref.contentHash = contentHash;
+		ref.sourceSize = readSize;
+		publishFile(refPath, &ref, sizeof(ref), {}, {});
+	}
+
+	// The path and the time stamp are not part of the final key, so identical files share one entry.
+	return hashCombine(hashCombine(ref.contentHash, ref.sourceSize), variant) | 1;
+}
+
+bool MeshCache::openEntry(uint64 key, FILE*& file, Array<BlockRecord>& blockArr, uint64& payloadHash)
+{
+	file = nullptr;
+	if (!enabled || key == 0)
+		return false;
+
+	std::string path = entryPath(key, ".mesh");
+	file = fopen(path.c_str(), "rb");
+	if (!file)
+		return false;
+
+	// The sizes in the header and the records are checked against the file before anything is allocated by them.
+	uint64 fileSize = 0;
+	if (_fseeki64(file, 0, SEEK_END) == 0)
+		fileSize = (uint64) _ftelli64(file);
+	bool ok = _fseeki64(file, 0, SEEK_SET) == 0;
+
+	EntryHeader header;
+	ok = ok && fread(&header, sizeof(header), 1, file) == 1 && header.magic == entryMagic;
+	if (ok && (header.version != entryVersion || header.vertexSize != sizeof(Vertex)))
+	{
+		// Written by another version, not corrupted: the caller's store() replaces it.
+		fclose(file);
+		file = nullptr;
+		return false;
+	}
+
+	uint64 recordsEnd = sizeof(header) + (uint64) header.numBlocks * sizeof(BlockRecord);
+	ok = ok && header.key == key && header.numBlocks > 0 && recordsEnd <= fileSize;
+	if (ok)
+	{
+		blockArr.resize(header.numBlocks);
+		ok = fread(blockArr.data(), sizeof(BlockRecord), header.numBlocks, file) == header.numBlocks
+			&& blockArr[0].lodLevel == 0;
+	}
+
+	uint64 geometrySize = 0;
+	for (uint i = 0; ok && i < blockArr.size(); ++i)
+	{
+		geometrySize += sizeof(Vertex) * (uint64) blockArr[i].numVertices;
+		geometrySize += sizeof(Tridex) * (uint64) blockArr[i].numTridices;
+	}
+	ok = ok && recordsEnd + geometrySize == fileSize;
+
+	// The checksum of the records and the geometry, which the caller verifies while reading the latter.
+	payloadHash = header.payloadHash;
+	if (ok)
+		return true;
+
+	closeEntry(key, file, false);
+	return false;
+}
+
+bool MeshCache::closeEntry(uint64 key, FILE* file, bool ok)
+{
+	fclose(file);
+	std::string path = entryPath(key, ".mesh");
+
+	if (!ok)
+	{
+		// Truncated or corrupted by an interrupted copy; an entry of another version never gets here. It will be
+		// rewritten by the caller's store().
+		DeleteFileA(path.c_str());
+		return false;
+	}
+
+	touch(path);
+	return true;
+}
+
+bool MeshCache::load(uint64 key, Array<Mesh>& meshArr)
+{
+	FILE* file;
+	Array<BlockRecord> blockArr;
+	uint64 expectedHash;
+	if (!openEntry(key, file, blockArr, expectedHash))
+		return false;
+
+	uint64 payloadHash = hashBytes(blockArr.data(), sizeof(BlockRecord) * blockArr.size(), 0);
+
+	uint numMeshes = 0;
+	for (const BlockRecord& block : blockArr)
+		numMeshes += (block.lodLevel == 0);
+	meshArr.clear();
+	meshArr.resize(numMeshes);
+
+	bool ok = true;
+	Mesh* mesh = nullptr;
+	for (uint i = 0; ok && i < blockArr.size(); ++i)
+	{
+		const BlockRecord& block = blockArr[i];
+		Array<Vertex>* vtxArr;
+		Array<Tridex>* tdxArr;
+
+		if (block.lodLevel == 0)
+		{
+			mesh = (mesh == nullptr) ? &meshArr[0] : mesh + 1;
+			vtxArr = &mesh->vtxArr;
+			tdxArr = &mesh->tdxArr;
+		}
+		else
+		{
+			if (block.lodLevel != mesh->lodArr.size() + 1)
+			{
+				ok = false;
+				break;
+			}
+			mesh->lodArr.push_back(MeshLOD());
+			MeshLOD& lod = mesh->lodArr[mesh->lodArr.size() - 1];
+			lod.error = block.lodError;
+			vtxArr = &lod.vtxArr;
+			tdxArr = &lod.tdxArr;
+		}
+
+		vtxArr->resize(block.numVertices);
+		tdxArr->resize(block.numTridices);
+		ok = readBlock(file, vtxArr->data(), tdxArr->data(), block, payloadHash);
+	}
+	ok = ok && payloadHash == expectedHash;
+
+	if (!ok)
+		meshArr.clear();
+	return closeEntry(key, file, ok);
+}
+
+bool MeshCache::peek(uint64 key, uint& numVertices, uint& numTridices, uint& numLODVertices, uint& numLODTridices)
+{
+	FILE* file;
+	Array<BlockRecord> blockArr;
+	uint64 expectedHash;
+	if (!openEntry(key, file, blockArr, expectedHash))
+		return false;
+	fclose(file);
+
+	numVertices = blockArr[0].numVertices;
+	numTridices = blockArr[0].numTridices;
+	numLODVertices = numLODTridices = 0;
+	for (uint i = 1; i < blockArr.size(); ++i)
+	{
+		if (blockArr[i].lodLevel == 0)
+			return false;		// Not an entry of a single mesh.
+		numLODVertices += blockArr[i].numVertices;
+		numLODTridices += blockArr[i].numTridices;
+	}
+	return true;
+}
+
+bool MeshCache::loadInto(uint64 key, Vertex* vertices, uint numVertices, Tridex* tridices, uint numTridices,
+	Array<MeshLOD>& lodArr)
+{
+	FILE* file;
+	Array<BlockRecord> blockArr;
+	uint64 expectedHash;
+	if (!openEntry(key, file, blockArr, expectedHash))
+		return false;
+
+	uint64 payloadHash = hashBytes(blockArr.data(), sizeof(BlockRecord) * blockArr.size(), 0);
+	bool ok = blockArr[0].numVertices == numVertices && blockArr[0].numTridices == numTridices
+		&& readBlock(file, vertices, tridices, blockArr[0], payloadHash);
+
+	lodArr.clear();
+	lodArr.resize(blockArr.size() - 1);
+	for (uint i = 1; ok && i < blockArr.size(); ++i)
+	{
+		const BlockRecord& block = blockArr[i];
+		MeshLOD& lod = lodArr[i - 1];
+		ok = block.lodLevel == i;
+		lod.error = block.lodError;
+		lod.vtxArr.resize(block.numVertices);
+		lod.tdxArr.resize(block.numTridices);
+		ok = ok && readBlock(file, lod.vtxArr.data(), lod.tdxArr.data(), block, payloadHash);
+	}
+	ok = ok && payloadHash == expectedHash;
+
+	if (!ok)
+		lodArr.clear();
+	return closeEntry(key, file, ok);
+}
+
+bool MeshCache::readBlock(FILE* file, Vertex* vertices, Tridex* tridices, const BlockRecord& block, uint64& payloadHash)
+{
+	bool ok = fread(vertices, sizeof(Vertex), block.numVertices, file) == block.numVertices
+		&& fread(tridices, sizeof(Tridex), block.numTridices, file) == block.numTridices;
+
+	payloadHash = hashBytes(vertices, sizeof(Vertex) * block.numVertices, payloadHash);
+	payloadHash = hashBytes(tridices, sizeof(Tridex) * block.numTridices, payloadHash);
+	return ok;
+}
+
+void MeshCache::store(uint64 key, const Mesh* meshes, uint numMeshes)
+{
+	if (!enabled || key == 0 || numMeshes == 0)
+		return;
+
+	EntryWriter writer;
+	for (uint i = 0; i < numMeshes; ++i)
+	{
+		writer.addBlock(meshes[i].vtxArr.data(), meshes[i].vtxArr.size(), meshes[i].tdxArr.data(), meshes[i].tdxArr.size(), 0, 0.0f);
+		for (uint level = 0; level < meshes[i].lodArr.size(); ++level)
+		{
+			const MeshLOD& lod = meshes[i].lodArr[level];
+			writer.addBlock(lod.vtxArr.data(), lod.vtxArr.size(), lod.tdxArr.data(), lod.tdxArr.size(), level + 1, lod.error);
+		}
+	}
+	publish(key, writer);
+}
+
+void MeshCache::store(uint64 key, const Vertex* vertices, uint numVertices, const Tridex* tridices, uint numTridices,
+	const Array<MeshLOD>& lodArr)
+{
+	if (!enabled || key == 0)
+		return;
+
+	EntryWriter writer;
+	writer.addBlock(vertices, numVertices, tridices, numTridices, 0, 0.0f);
+	for (uint level = 0; level < lodArr.size(); ++level)
+	{
+		const MeshLOD& lod = lodArr[level];
+		writer.addBlock(lod.vtxArr.data(), lod.vtxArr.size(), lod.tdxArr.data(), lod.tdxArr.size(), level + 1, lod.error);
+	}
+	publish(key, writer);
+}
+
+void MeshCache::publish(uint64 key, EntryWriter& writer)
+{
+	writer.chunks[0] = writer.blockArr.data();
+	writer.chunkSizes[0] = sizeof(BlockRecord) * writer.blockArr.size();
+
+	EntryHeader header = {};
+	header.magic = entryMagic;
+	header.version = entryVersion;
+	header.key = key;
+	header.numBlocks = writer.blockArr.size();
+	header.vertexSize = sizeof(Vertex);
+	for (uint i = 0; i < writer.chunks.size(); ++i)
+		header.payloadHash = hashBytes(writer.chunks[i], writer.chunkSizes[i], header.payloadHash);
+
+	if (publishFile(entryPath(key, ".mesh"), &header, sizeof(header), writer.chunks, writer.chunkSizes))
+		evict();
+}
+
+void MeshCache::evict()
+{
+	std::unique_lock<std::mutex> lock(evictionLock, std::try_to_lock);
+	if (!lock.owns_lock())
+		return;		// Another thread is already evicting.
+
+	struct FileInfo
+	{
+		std::string name;
+		uint64 size;
+		uint64 lastWrite;
+	};
+	std::vector<FileInfo> entries;
+	uint64 totalSize = 0;
+
+	FILETIME nowTime;
+	GetSystemTimeAsFileTime(&nowTime);
+	uint64 now = toUint64(nowTime.dwHighDateTime, nowTime.dwLowDateTime);
+
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA((directory + "*").c_str(), &data);
+	if (find == INVALID_HANDLE_VALUE)
+		return;
+
+	do
+	{
+		if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			continue;
+
+		std::string name = data.cFileName;
+		uint64 size = toUint64(data.nFileSizeHigh, data.nFileSizeLow);
+		uint64 lastWrite = toUint64(data.ftLastWriteTime.dwHighDateTime, data.ftLastWriteTime.dwLowDateTime);
+		size_t dot = name.find_last_of('.');
+		std::string extension = (dot == std::string::npos) ? "" : name.substr(dot);
+
+		if (extension == ".mesh" || extension == ".ref")
+		{
+			entries.push_back({ name, size, lastWrite });
+			totalSize += size;
+		}
+		else if (extension == ".tmp" && now > lastWrite + staleTempFileAge)
+		{
+			DeleteFileA((directory + name).c_str());		// Left behind by a crashed writer.
+		}
+	} while (FindNextFileA(find, &data));
+	FindClose(find);
+
+	if (totalSize <= maxCacheSize)
+		return;
+
+	std::sort(entries.begin(), entries.end(),
+		[](const FileInfo& a, const FileInfo& b) { return a.lastWrite < b.lastWrite; });
+
+	// Deleting fails if another process is reading the entry at this moment, and then we just go on.
+	for (uint i = 0; i < entries.size() && totalSize > maxCacheSize; ++i)
+	{
+		if (DeleteFileA((directory + entries[i].name).c_str()))
+			totalSize -= entries[i].size;
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "pch.h"
+#include "Mesh.h"
+#include <string>
+#include <mutex>
+
+
+/*
+Persistent on-disk cache of processed meshes, shared by every process which points at the same directory.
+
+An entry is addressed by the content of its source file (not by its path) together with a variant key that
+encodes how the mesh was processed (e.g. the optimizeVertexxCount flag of the OBJ loader and the number of
+levels of detail, which are stored in the same entry as their mesh). To avoid hashing
+the source on every launch, a small reference file keyed by (path, size, mtime) remembers the content hash.
+
+Entries are written to a process-unique temporary file and renamed into place, and every entry carries a
+checksum of its payload. Thus concurrent writers of the same entry and readers which see a half-written file
+on a network share never produce a corrupted mesh; they just miss. When the total size of the entries exceeds
+the limit, the least recently used entries are deleted (a hit refreshes the entry's modification time).
+*/
+class MeshCache
+{
+	std::string	directory;
+	uint64		maxCacheSize;
+	bool		enabled;
+	std::mutex	evictionLock;
+
+	struct BlockRecord;
+	struct EntryWriter;
+
+	std::string entryPath(uint64 key, const char* extension) const;
+	void touch(const std::string& path) const;
+	void evict();
+
+	bool openEntry(uint64 key, FILE*& file, Array<BlockRecord>& blockArr, uint64& payloadHash);
+	bool closeEntry(uint64 key, FILE* file, bool ok);
+	static bool readBlock(FILE* file, Vertex* vertices, Tridex* tridices, const BlockRecord& block, uint64& payloadHash);
+	void publish(uint64 key, EntryWriter& writer);
+
+public:
+	MeshCache();
+	static MeshCache& get();
+
+	// The environment variables MESH_CACHE_DIR, MESH_CACHE_MAX_MB and MESH_CACHE_DISABLE override the defaults.
+	void setDirectory(const char* dir);
+	void setMaxCacheSize(uint64 bytes)	{ maxCacheSize = bytes; }
+	void setEnabled(bool enable)		{ enabled = enable; }
+	bool isEnabled() const				{ return enabled; }
+
+	// Returns 0 if the source file cannot be read.
+	uint64 makeKey(const char* sourceFile, uint64 variant);
+
+	bool load(uint64 key, Array<Mesh>& meshArr);
+	void store(uint64 key, const Mesh* meshes, uint numMeshes);
+
+	// For an entry of one mesh which the caller loads straight into its final storage (see PendingMesh):
+	// peek() reads only the sizes, and loadInto() checks them and reads the mesh into the given storage.
+	bool peek(uint64 key, uint& numVertices, uint& numTridices, uint& numLODVertices, uint& numLODTridices);
+	bool loadInto(uint64 key, Vertex* vertices, uint numVertices, Tridex* tridices, uint numTridices,
+		Array<MeshLOD>& lodArr);
+	void store(uint64 key, const Vertex* vertices, uint numVertices, const Tridex* tridices, uint numTridices,
+		const Array<MeshLOD>& lodArr);
+};
@@ -0,0 +1,130 @@
+#include "pch.h"
+#include "Scene.h"
+#include "preprocessGeometry.h"
+#include "ThreadPool.h"
+
+
+void Scene::updateObjectTransform(uint objIdx, const float3& translation, const float4& rotation, float scale)
+{
+	SceneObject& obj = objArr[objIdx];
+	obj.translation = translation;
+	obj.rotation = rotation;
+	obj.scale = scale;
+	obj.modelMatrix = composeMatrix(translation, rotation, scale);
+	obj.worldBox = transformAABB(obj.modelMatrix, obj.meshBox);
+	obj.worldSphere = transformBoundingSphere(obj.modelMatrix, obj.meshSphere);
+	changes.objects.add(objIdx);
+}
+
+void Scene::updateMaterial(uint mtlIdx, const Material& material)
+{
+	mtlArr[mtlIdx] = material;
+	changes.materials.add(mtlIdx);
+}
+
+// The material type which the hit group of an object can be specialized for: that of its material, or AnyMaterial
+// if it is two-sided with a back material of another type. Glass shades both sides with the front material.
+int Scene::getShadingType(uint objIdx) const
+{
+	const SceneObject& obj = objArr[objIdx];
+	int type = (int) mtlArr[obj.materialIdx].type;
+	if (type != Glass && obj.twoSided && (int) mtlArr[obj.backMaterialIdx].type != type)
+		return AnyMaterial;
+	return type;
+}
+
+uint Scene::addObject(const SceneObject& obj)
+{
+	assert(obj.vertexOffset + obj.numVertices <= vtxArr.size());
+	assert(obj.tridexOffset + obj.numTridices <= tdxArr.size());
+
+	uint objIdx = objArr.size();
+	objArr.push_back(obj);
+	updateObjectTransform(objIdx, obj.translation, obj.rotation, obj.scale);
+	changes.numObjectsChanged = true;
+	return objIdx;
+}
+
+void Scene::removeObject(uint objIdx)
+{
+	uint lastIdx = objArr.size() - 1;
+	if (objIdx != lastIdx)
+	{
+		objArr[objIdx] = objArr[lastIdx];
+		changes.objects.add(objIdx);
+	}
+	objArr.resize(lastIdx);
+	changes.numObjectsChanged = true;
+}
+
+void Scene::updateVertices(uint firstVertex, uint numVertices, const Vertex* vertices)
+{
+	assert(firstVertex + numVertices <= vtxArr.size());
+	memcpy(&vtxArr[firstVertex], vertices, sizeof(Vertex) * numVertices);
+	changes.vertices.add(firstVertex, numVertices);
+
+	// The meshes which own some of the vertices, each once however many objects instance it.
+	Array<MeshRange> rangeArr;
+	Array<uint> rangeOfObject(objArr.size(), uint(-1));
+	for (uint objIdx = 0; objIdx < objArr.size(); ++objIdx)
+	{
+		const SceneObject& obj = objArr[objIdx];
+		if (obj.vertexOffset >= firstVertex + numVertices || obj.vertexOffset + obj.numVertices <= firstVertex)
+			continue;
+
+		for (uint r = 0; r < rangeArr.size() && rangeOfObject[objIdx] == uint(-1); ++r)
+		{
+			if (rangeArr[r].vertexOffset == obj.vertexOffset && rangeArr[r].tridexOffset == obj.tridexOffset)
+				rangeOfObject[objIdx] = r;
+		}
+		if (rangeOfObject[objIdx] == uint(-1))
+		{
+			rangeOfObject[objIdx] = rangeArr.size();
+			rangeArr.push_back({ obj.vertexOffset, obj.tridexOffset, obj.numVertices, obj.numTridices });
+		}
+	}
+
+	Array<MeshProperties> propArr;
+	preprocessGeometry(vtxArr, tdxArr, rangeArr, cdfArr, propArr);
+
+	for (uint objIdx = 0; objIdx < objArr.size(); ++objIdx)
+	{
+		if (rangeOfObject[objIdx] == uint(-1))
+			continue;
+
+		SceneObject& obj = objArr[objIdx];
+		const MeshProperties& prop = propArr[rangeOfObject[objIdx]];
+		obj.meshArea = prop.area;
+		obj.meshBox = prop.box;
+		obj.meshSphere = prop.sphere;
+		obj.numLODs = 0;
+		obj.shape.type = TriangleMesh;
+		updateObjectTransform(objIdx, obj.translation, obj.rotation, obj.scale);
+	}
+}
+
+void SceneGeometryStreams::build(const Scene& scene)
+{
+	uint numVertices = scene.getVertexArray().size();
+	positionArr.resize(numVertices);
+	attributeArr.resize(numVertices);
+
+	DirtyRange all;
+	all.add(0, numVertices);
+	update(scene, all);
+}
+
+void SceneGeometryStreams::update(const Scene& scene, const DirtyRange& vertices)
+{
+	const Array<Vertex>& vtxArr = scene.getVertexArray();
+	uint end = _min(vertices.end, vtxArr.size());
+
+	ThreadPool::get().parallelForRange(vertices.begin, _max(vertices.begin, end), 1 << 16, [&](uint begin, uint end) {
+		for (uint i = begin; i < end; ++i)
+		{
+			positionArr[i] = vtxArr[i].position;
+			attributeArr[i].normal = vtxArr[i].normal;
+			attributeArr[i].texcoord = vtxArr[i].texcoord;
+		}
+	});
+}
@@ -1,6 +1,8 @@
 #pragma once
 #include "Mesh.h"
 #include "Material.h"
+#include "BVH.h"
+#include "Animation.h"
 
 
 struct GPUSceneObject
@@ -21,6 +23,17 @@ struct GPUSceneObject
 };
 
 
+// Range of one level of detail of a mesh in the vertex and tridex arrays of the scene.
+struct LODRange
+{
+	uint vertexOffset;
+	uint tridexOffset;
+	uint numVertices;
+	uint numTridices;
+	float error;					// In the mesh's own units, see MeshLOD::error.
+};
+
+
 struct SceneObject
 {	
 	uint vertexOffset;
@@ -28,7 +41,11 @@ struct SceneObject
 	uint numVertices;
 	uint numTridices;
 
-	float meshArea			= 0.0f;
+	float meshArea			= 0.0f;	// Of the full mesh, and so are the bounds below.
+	AABB meshBox;					// In the mesh's own coordinates.
+	BoundingSphere meshSphere;
+	AABB worldBox;					// Of meshBox and meshSphere under modelMatrix.
+	BoundingSphere worldSphere;
 
 	uint twoSided			= 0;
 	uint materialIdx		= uint(-1);	
@@ -42,6 +59,33 @@ struct SceneObject
 	float scale				= 1.0f;	// Do not support anisotropic scale for several reasons (especially, cdf calculation).
 	Transform modelMatrix	= Transform::identity();
 	//uint transformIdx		= 0;	// zero transformIdx means identity matrix.
+
+	AnalyticShape shape;			// Copied from the source mesh. shape.type == TriangleMesh for loaded meshes.
+	uint lodOffset			= 0;	// The coarser levels of the source mesh, from fine to coarse, are
+	uint numLODs			= 0;	// Scene::lodArr[lodOffset] ... Scene::lodArr[lodOffset + numLODs - 1].
+};
+
+
+// Half-open range of the indices touched by the edits since the tracer last applied them.
+struct DirtyRange
+{
+	uint begin = uint(-1);
+	uint end = 0;
+
+	void add(uint i)			{ begin = _min(begin, i); end = _max(end, i + 1); }
+	void add(uint first, uint num)	{ if (num > 0) { begin = _min(begin, first); end = _max(end, first + num); } }
+	bool empty() const			{ return begin >= end; }
+};
+
+
+struct SceneChanges
+{
+	DirtyRange objects;				// Moved, added, or refilled by removeObject().
+	DirtyRange materials;
+	DirtyRange vertices;
+	bool numObjectsChanged = false;
+
+	bool empty() const			{ return objects.empty() && materials.empty() && vertices.empty() && !numObjectsChanged; }
 };
 
 
@@ -53,6 +97,9 @@ class Scene
 	Array<float>		cdfArr;
 	Array<Transform>	trmArr;
 	Array<Material>		mtlArr;
+	Array<LODRange>		lodArr;
+	SceneChanges		changes;
+	Animation			animation;
 	
 	friend class SceneLoader;
 
@@ -64,6 +111,9 @@ public:
 		cdfArr.clear();
 		trmArr.clear();
 		mtlArr.clear();
+		lodArr.clear();
+		changes = SceneChanges();
+		animation.clear();
 	}
 	const Array<Vertex>& getVertexArray() const			{ return vtxArr; }
 	const Array<Tridex>& getTridexArray() const			{ return tdxArr; }
@@ -71,5 +121,54 @@ public:
 	const Array<Transform>& getTransformArray() const	{ return trmArr; }
 	const Array<Material>& getMaterialArray() const		{ return mtlArr; }
 	const SceneObject& getObject(uint i) const			{ return objArr[i]; }
+	const LODRange& getLOD(uint i) const				{ return lodArr[i]; }
 	uint numObjects() const								{ return objArr.size(); }
+	int getShadingType(uint objIdx) const;
+	const Animation& getAnimation() const				{ return animation; }
+	Animation& getAnimation()							{ return animation; }
+
+	/*
+	Incremental edits. The tracer of the scene applies them on its next update(), re-uploading and rebuilding only
+	the parts which the recorded changes cover, instead of a full setupScene(). Objects added by addObject() must use
+	geometry which is already in the scene, e.g. a copy of getObject(i) with another transform or material.
+	removeObject() moves the last object into the index of the removed one.
+	updateVertices() deforms meshes in place: the areas, bounds and cdfs of the meshes which own the vertices are
+	computed again, and their objects lose the levels of detail and the analytic shape, which no longer match.
+	*/
+	void updateObjectTransform(uint objIdx, const float3& translation, const float4& rotation, float scale);
+	void updateMaterial(uint mtlIdx, const Material& material);
+	uint addObject(const SceneObject& obj);
+	void removeObject(uint objIdx);
+	void updateVertices(uint firstVertex, uint numVertices, const Vertex* vertices);
+	const SceneChanges& getChanges() const				{ return changes; }
+	void clearChanges()									{ changes = SceneChanges(); }
+};
+
+
+// The attributes of a vertex which only shading reads.
+struct VertexAttributes
+{
+	float3 normal;
+	float2 texcoord;
+};
+
+/*
+Structure-of-arrays copy of the vertices of a scene, for the CPU tracer: the positions alone for intersection, and
+the other attributes apart for shading. Traversal then pulls 12 bytes per vertex into the cache instead of the 32
+of an interleaved Vertex. update() copies again the vertices of the dirty range of the scene's changes.
+*/
+class SceneGeometryStreams
+{
+	Array<float3>			positionArr;
+	Array<VertexAttributes>	attributeArr;
+
+public:
+	void build(const Scene& scene);
+	void update(const Scene& scene, const DirtyRange& vertices);
+	void clear()										{ positionArr.clear(); attributeArr.clear(); }
+
+	bool empty() const									{ return positionArr.size() == 0; }
+	const float3* getPositions() const					{ return positionArr.data(); }
+	const VertexAttributes* getAttributes() const		{ return attributeArr.data(); }
+	uint64 memorySize() const	{ return positionArr.size() * sizeof(float3) + attributeArr.size() * sizeof(VertexAttributes); }
 };
@@ -2,9 +2,32 @@
 #include "SceneLoader.h"
 #include "generateMesh.h"
 #include "loadMesh.h"
+#include "preprocessGeometry.h"
+#include "ThreadPool.h"
+#include "timer.h"
+#include "memoryUsage.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
 
 
-void SceneLoader::initializeGeometryFromMeshes(Scene* scene, const Array<Mesh*>& meshes)
+// Levels of detail generated for every OBJ mesh (see simplifyMesh.h); a scene file can override it per mesh.
+static const uint defaultMaxLODs = 4;
+
+// The peak covers the temporary meshes, which are gone by the time the scene is returned.
+static void printMemoryUsage(uint64 bytesBefore)
+{
+	printf("    memory %.1f MB before loading, %.1f MB after, peak %.1f MB\n",
+		toMegabytes(bytesBefore), toMegabytes(getMemoryUsage()), toMegabytes(getPeakMemoryUsage()));
+}
+
+/*
+The full meshes are written straight into the scene's arrays, in parallel, and then their levels of detail after
+all of them. The arrays are reserved for both at once, so that the LODs of meshes generating them (whose sizes are
+only estimated before) hardly ever move the full meshes once more.
+*/
+void SceneLoader::initializeGeometryFromMeshes(Scene* scene, const Array<PendingMesh*>& meshes)
 {
 	scene->clear();
 
@@ -17,19 +40,59 @@ void SceneLoader::initializeGeometryFromMeshes(Scene* scene, const Array<Mesh*>&
 
 	uint totVertices = 0;
 	uint totTridices = 0;
+	uint totLODVertices = 0;
+	uint totLODTridices = 0;
 	
 	for (uint i = 0; i < numObjs; ++i)
 	{
-		uint nowVertices = meshes[i]->vtxArr.size();
-		uint nowTridices = meshes[i]->tdxArr.size();
+		uint nowVertices = meshes[i]->numVertices;
+		uint nowTridices = meshes[i]->numTridices;
 
 		objArr[i].vertexOffset = totVertices;
 		objArr[i].tridexOffset = totTridices;
 		objArr[i].numVertices = nowVertices;
 		objArr[i].numTridices = nowTridices;
+		objArr[i].shape = meshes[i]->shape;
 
 		totVertices += nowVertices;
 		totTridices += nowTridices;
+		totLODVertices += meshes[i]->numLODVertices;
+		totLODTridices += meshes[i]->numLODTridices;
+	}
+
+	vtxArr.reserve(totVertices + totLODVertices);
+	tdxArr.reserve(totTridices + totLODTridices);
+	vtxArr.resize(totVertices);
+	tdxArr.resize(totTridices);
+
+	ThreadPool::get().parallelFor(0, numObjs, 1, [&](uint i) {
+		double startTime = getCurrentTime();
+		meshes[i]->write(vtxArr.data() + objArr[i].vertexOffset, tdxArr.data() + objArr[i].tridexOffset);
+		meshes[i]->loadTime += getCurrentTime() - startTime;
+	});
+
+	// The levels of detail follow all the full meshes, so the latter keep the same layout as without them.
+	Array<LODRange>& lodArr = scene->lodArr;
+
+	for (uint i = 0; i < numObjs; ++i)
+	{
+		const Array<MeshLOD>& meshLODs = meshes[i]->lodArr;
+		objArr[i].lodOffset = lodArr.size();
+		objArr[i].numLODs = meshLODs.size();
+
+		for (const MeshLOD& lod : meshLODs)
+		{
+			LODRange range;
+			range.vertexOffset = totVertices;
+			range.tridexOffset = totTridices;
+			range.numVertices = lod.vtxArr.size();
+			range.numTridices = lod.tdxArr.size();
+			range.error = lod.error;
+			lodArr.push_back(range);
+
+			totVertices += range.numVertices;
+			totTridices += range.numTridices;
+		}
 	}
 
 	vtxArr.resize(totVertices);
@@ -37,9 +100,34 @@ void SceneLoader::initializeGeometryFromMeshes(Scene* scene, const Array<Mesh*>&
 
 	for (uint i = 0; i < numObjs; ++i)
 	{
-		memcpy(&vtxArr[objArr[i].vertexOffset], &meshes[i]->vtxArr[0], sizeof(Vertex) * objArr[i].numVertices);
-		memcpy(&tdxArr[objArr[i].tridexOffset], &meshes[i]->tdxArr[0], sizeof(Tridex) * objArr[i].numTridices);
+		for (uint level = 0; level < objArr[i].numLODs; ++level)
+		{
+			const MeshLOD& lod = meshes[i]->lodArr[level];
+			const LODRange& range = lodArr[objArr[i].lodOffset + level];
+			memcpy(&vtxArr[range.vertexOffset], lod.vtxArr.data(), sizeof(Vertex) * range.numVertices);
+			memcpy(&tdxArr[range.tridexOffset], lod.tdxArr.data(), sizeof(Tridex) * range.numTridices);
+		}
+	}
+
+	// Areas, bounds and triangle cdfs of the full meshes and of the levels of detail, which need their own cdfs.
+	double startTime = getCurrentTime();
+	Array<MeshRange> rangeArr(numObjs + lodArr.size());
+	for (uint i = 0; i < numObjs; ++i)
+		rangeArr[i] = { objArr[i].vertexOffset, objArr[i].tridexOffset, objArr[i].numVertices, objArr[i].numTridices };
+	for (uint i = 0; i < lodArr.size(); ++i)
+		rangeArr[numObjs + i] = { lodArr[i].vertexOffset, lodArr[i].tridexOffset, lodArr[i].numVertices, lodArr[i].numTridices };
+
+	Array<MeshProperties> propArr;
+	scene->cdfArr.resize(totTridices);
+	preprocessGeometry(vtxArr, tdxArr, rangeArr, scene->cdfArr, propArr);
+
+	for (uint i = 0; i < numObjs; ++i)
+	{
+		objArr[i].meshArea = propArr[i].area;
+		objArr[i].meshBox = propArr[i].box;
+		objArr[i].meshSphere = propArr[i].sphere;
 	}
+	printf("Geometry preprocessed: %u triangles in %.2f ms\n", totTridices, (getCurrentTime() - startTime) * 1000.0);
 }
 
 void SceneLoader::computeModelMatrices(Scene* scene)
@@ -47,6 +135,8 @@ void SceneLoader::computeModelMatrices(Scene* scene)
 	for (auto& obj : scene->objArr)
 	{
 		obj.modelMatrix = composeMatrix(obj.translation, obj.rotation, obj.scale);
+		obj.worldBox = transformAABB(obj.modelMatrix, obj.meshBox);
+		obj.worldSphere = transformBoundingSphere(obj.modelMatrix, obj.meshSphere);
 	}
 }
 
@@ -55,11 +145,15 @@ Scene* SceneLoader::push_testScene1()
 	Scene* scene = new Scene;
 	sceneArr.push_back(scene);
 
-	Mesh ground = generateRectangleMesh(float3(0.0f), float3(20.f, 0.f, 20.f), FaceDir::up);
-	Mesh box = generateCubeMesh(float3(0.0f, 1.0f, 0.0f), float3(5.f, 2.f, 3.f)); 
-	Mesh quadLight = generateRectangleMesh(float3(0.0f), float3(3.0f, 0.f, 3.0f), FaceDir::down);
+	Array<PendingMesh*> meshes = {
+		prepareMesh(generateRectangleMesh(float3(0.0f), float3(20.f, 0.f, 20.f), FaceDir::up)),		// ground
+		prepareMesh(generateCubeMesh(float3(0.0f, 1.0f, 0.0f), float3(5.f, 2.f, 3.f))),				// box
+		prepareMesh(generateRectangleMesh(float3(0.0f), float3(3.0f, 0.f, 3.0f), FaceDir::down)),	// quadLight
+	};
 	
-	initializeGeometryFromMeshes(scene, { &ground, &box, &quadLight });
+	initializeGeometryFromMeshes(scene, meshes);
+	for (PendingMesh* mesh : meshes)
+		delete mesh;
 
 	Array<Material>& mtlArr = scene->mtlArr;
 	mtlArr.resize(3);
@@ -91,16 +185,25 @@ Scene* SceneLoader::push_testScene1()
 
 Scene* SceneLoader::push_hyperionTestScene()
 {
+	uint64 bytesBefore = getMemoryUsage();
 	Scene* scene = new Scene;
 	sceneArr.push_back(scene);
 
-	Mesh groundM	= generateRectangleMesh(float3(0.0, -0.4, 0.0), float3(40.0, 0.0, 40.0), FaceDir::up);
-	Mesh tableM		= generateBoxMesh(float3(-5.0, -0.38, -4.0), float3(5.0, -0.01, 3.0));
-	Mesh sphereM	= generateSphereMesh(float3(0,1,0), 1.0f);
-	Mesh ringM		= loadMeshFromOBJFile("../data/mesh/ring.obj", true);
-	Mesh golfBallM	= loadMeshFromOBJFile("../data/mesh/golfball.obj", true);
-	Mesh puzzleM	= loadMeshFromOBJFile("../data/mesh/burrPuzzle.obj", true);
-	initializeGeometryFromMeshes(scene, { &groundM, &tableM, &sphereM, &ringM, &golfBallM, &puzzleM });
+	// The mesh entries: groundM, tableM, sphereM, ringM, golfBallM and puzzleM.
+	Array<PendingMesh*> meshes(6, nullptr);
+	meshes[0] = prepareMesh(generateRectangleMesh(float3(0.0, -0.4, 0.0), float3(40.0, 0.0, 40.0), FaceDir::up));
+	meshes[1] = prepareMesh(generateBoxMesh(float3(-5.0, -0.38, -4.0), float3(5.0, -0.01, 3.0)));
+	meshes[2] = prepareMesh(generateSphereMesh(float3(0,1,0), 1.0f));
+
+	// The OBJ meshes are parsed in parallel, and their levels of detail generated in parallel too, while they
+	// are written into the scene.
+	const char* objFiles[] = { "../data/mesh/ring.obj", "../data/mesh/golfball.obj", "../data/mesh/burrPuzzle.obj" };
+	ThreadPool::get().parallelFor(0, 3, 1, [&](uint i) {
+		meshes[3 + i] = prepareMeshFromOBJFile(objFiles[i], true, defaultMaxLODs);
+	});
+	initializeGeometryFromMeshes(scene, meshes);
+	for (PendingMesh* mesh : meshes)
+		delete mesh;
 
 	enum SceneObjectId {
 		ground, table, light, glass, metal, pingpong, bouncy, orange, wood, golfball, marble1, 
@@ -111,14 +214,21 @@ Scene* SceneLoader::push_hyperionTestScene()
 		marble2Mtl, ringMtl, numMtls
 	};
 
-	Array<SceneObject> objArr(numObjs, scene->objArr[2]);
-	objArr[ground  ] = scene->objArr[0];
-	objArr[table   ] = scene->objArr[1];
-	objArr[ring1   ] = scene->objArr[3];
-	objArr[ring2   ] = scene->objArr[3];
-	objArr[ring3   ] = scene->objArr[3];
-	objArr[golfball] = scene->objArr[4];
-	objArr[wood    ] = scene->objArr[5];
+	// The objects are instances of the six mesh entries, filled in place over them.
+	SceneObject meshObjs[6];
+	for (uint i = 0; i < 6; ++i)
+		meshObjs[i] = scene->objArr[i];
+
+	Array<SceneObject>& objArr = scene->objArr;
+	objArr.clear();
+	objArr.resize(numObjs, meshObjs[2]);
+	objArr[ground  ] = meshObjs[0];
+	objArr[table   ] = meshObjs[1];
+	objArr[ring1   ] = meshObjs[3];
+	objArr[ring2   ] = meshObjs[3];
+	objArr[ring3   ] = meshObjs[3];
+	objArr[golfball] = meshObjs[4];
+	objArr[wood    ] = meshObjs[5];
 
 	objArr[light   ].scale = 2.0f;
 	objArr[light   ].translation = float3(-20, 17, 0);
@@ -157,8 +267,6 @@ Scene* SceneLoader::push_hyperionTestScene()
 	objArr[wood    ].rotation = getRotationAsQuternion({0,1,0}, 30.0f);
 	objArr[wood    ].scale = 20.0f;
 
-	objArr.swap(scene->objArr);
-
 
 	Array<Material>& mtlArr = scene->mtlArr;
 	mtlArr.resize(numMtls);
@@ -220,7 +328,525 @@ Scene* SceneLoader::push_hyperionTestScene()
 	scene->objArr[ring2].materialIdx = ringMtl;
 	scene->objArr[ring3].materialIdx = ringMtl;
 
+	computeModelMatrices(scene);
+	printMemoryUsage(bytesBefore);
+
+	return scene;
+}
+
+
+/*
+Scene description file (*.scene)
+A plain text file in which each line is one statement, and '#' starts a comment.
+Every statement is a keyword, a name, and a list of <key value...> pairs in any order.
+
+	mesh     <name> obj       <path> [optimize 0|1] [lod maxLevels]
+	mesh     <name> rectangle center x y z size x y z dir up|down|front|back|left|right
+	mesh     <name> box       lower x y z upper x y z
+	mesh     <name> cube      center x y z size x y z [bottomCenter 0|1]
+	mesh     <name> sphere    center x y z radius r [segments meridian equator]
+
+	material <name> [type lambertian|metal|plastic|glass] [albedo r g b] [emittance r g b]
+	                [roughness x] [reflectivity x] [transmittivity x]
+
+	object   <name> mesh <meshName> material <materialName> [backMaterial <materialName>] [twoSided 0|1]
+	                [translation x y z] [rotation axisX axisY axisZ degree] [scale s]
+
+	key      <objectName> time t [translation x y z] [rotation axisX axisY axisZ degree] [scale s]
+	key      camera       time t [target x y z] [distance d] [azimuth turns] [altitude a] [fovY degree]
+
+Relative obj paths are resolved against the directory of the scene file. Obj meshes get up to 4 levels of detail
+unless 'lod' says otherwise ('lod 0' disables them).
+Each mesh is loaded once however many objects refer to it, and all meshes are loaded in parallel.
+Keys animate an object defined before them, or the camera (so no object can be named 'camera'); see Animation.h.
+A value which a key leaves out is that of the previous key of the same track, or of the object or the default
+camera for the first key.
+*/
+namespace {
+
+enum class MeshSource { obj, rectangle, box, cube, sphere };
+
+struct MeshStatement
+{
+	std::string name;
+	std::string path;
+	MeshSource source;
+	bool optimize = true;
+	uint maxLODs = defaultMaxLODs;
+	bool bottomCenter = false;
+	float3 v0 = float3(0.0f);		// center or lower corner
+	float3 v1 = float3(0.0f);		// size or upper corner
+	float radius = 1.0f;
+	uint meridianSegments = 50;
+	uint equatorSegments = 100;
+	FaceDir dir = FaceDir::up;
+	uint line = 0;
+};
+
+struct ObjectStatement
+{
+	std::string name;
+	std::string mesh;
+	std::string material;
+	std::string backMaterial;
+	bool twoSided = false;
+	float3 translation = float3(0.0f);
+	float4 rotation = float4(0.f, 0.f, 0.f, 1.f);
+	float scale = 1.0f;
+	uint line = 0;
+};
+
+struct KeyStatement
+{
+	uint objIdx;				// uint(-1) for the camera.
+	TransformKey objectKey;
+	CameraKey cameraKey;
+};
+
+class SceneFileParser
+{
+	const char* filename;
+	uint line = 0;
+	std::vector<std::string> tokens;
+	uint cursor = 0;
+
+public:
+	SceneFileParser(const char* filename) : filename(filename) {}
+
+	void error(const char* format, const char* arg = "") const
+	{
+		char what[256], message[512];
+		snprintf(what, sizeof(what), format, arg);
+		snprintf(message, sizeof(message), "%s(%u): %s", filename, line, what);
+		throw Error(message);
+	}
+
+	void setLine(uint lineNumber, const char* text)
+	{
+		line = lineNumber;
+		cursor = 0;
+		tokens.clear();
+
+		std::string token;
+		for (const char* c = text; ; ++c)
+		{
+			if (*c == '\0' || *c == '#' || *c == ' ' || *c == '\t' || *c == '\r' || *c == '\n')
+			{
+				if (!token.empty())
+					tokens.push_back(token);
+				token.clear();
+				if (*c == '\0' || *c == '#')
+					break;
+			}
+			else
+			{
+				token += *c;
+			}
+		}
+	}
+
+	uint getLine() const		{ return line; }
+	bool empty() const			{ return tokens.empty(); }
+	bool hasMore() const		{ return cursor < tokens.size(); }
+
+	const std::string& word()
+	{
+		if (!hasMore())
+			error("Unexpected end of statement.");
+		return tokens[cursor++];
+	}
+
+	float number()
+	{
+		const std::string& token = word();
+		char* end;
+		float value = strtof(token.c_str(), &end);
+		if (*end != '\0')
+			error("'%s' is not a number.", token.c_str());
+		return value;
+	}
+
+	uint integer()
+	{
+		float value = number();
+		if (value < 0.0f || value != (float)(uint) value)
+			error("Expected a non-negative integer.");
+		return (uint) value;
+	}
+
+	bool boolean()		{ return integer() != 0; }
+	float3 vector3()	{ float x = number(); float y = number(); float z = number(); return float3(x, y, z); }
+
+	// An axis and an angle in degrees, as a quaternion.
+	float4 rotation()
+	{
+		float3 axis = vector3();
+		float degree = number();
+		if (squaredLength(axis) == 0.0f)
+			error("A rotation axis has no length.");
+		return getRotationAsQuternion(normalize(axis), degree);
+	}
+};
+
+MeshStatement parseMesh(SceneFileParser& parser)
+{
+	MeshStatement stmt;
+	stmt.line = parser.getLine();
+	stmt.name = parser.word();
+
+	const std::string& source = parser.word();
+	if		(source == "obj")		{ stmt.source = MeshSource::obj; stmt.path = parser.word(); }
+	else if (source == "rectangle")	{ stmt.source = MeshSource::rectangle; }
+	else if (source == "box")		{ stmt.source = MeshSource::box; }
+	else if (source == "cube")		{ stmt.source = MeshSource::cube; }
+	else if (source == "sphere")	{ stmt.source = MeshSource::sphere; }
+	else parser.error("Unknown mesh source '%s'.", source.c_str());
+
+	while (parser.hasMore())
+	{
+		const std::string& key = parser.word();
+		if		(key == "optimize")		stmt.optimize = parser.boolean();
+		else if (key == "lod")			stmt.maxLODs = parser.integer();
+		else if (key == "center")		stmt.v0 = parser.vector3();
+		else if (key == "lower")		stmt.v0 = parser.vector3();
+		else if (key == "size")			stmt.v1 = parser.vector3();
+		else if (key == "upper")		stmt.v1 = parser.vector3();
+		else if (key == "radius")		stmt.radius = parser.number();
+		else if (key == "bottomCenter")	stmt.bottomCenter = parser.boolean();
+		else if (key == "segments")
+		{
+			stmt.meridianSegments = parser.integer();
+			stmt.equatorSegments = parser.integer();
+		}
+		else if (key == "dir")
+		{
+			const std::string& dir = parser.word();
+			if		(dir == "down")		stmt.dir = FaceDir::down;
+			else if (dir == "up")		stmt.dir = FaceDir::up;
+			else if (dir == "front")	stmt.dir = FaceDir::front;
+			else if (dir == "back")		stmt.dir = FaceDir::back;
+			else if (dir == "left")		stmt.dir = FaceDir::left;
+			else if (dir == "right")	stmt.dir = FaceDir::right;
+			else parser.error("Unknown face direction '%s'.", dir.c_str());
+		}
+		else parser.error("Unknown mesh attribute '%s'.", key.c_str());
+	}
+
+	return stmt;
+}
+
+Material parseMaterial(SceneFileParser& parser)
+{
+	Material mtl;
+
+	while (parser.hasMore())
+	{
+		const std::string& key = parser.word();
+		if		(key == "albedo")			mtl.albedo = parser.vector3();
+		else if (key == "emittance")		mtl.emittance = parser.vector3();
+		else if (key == "roughness")		mtl.roughness = parser.number();
+		else if (key == "reflectivity")		mtl.reflectivity = parser.number();
+		else if (key == "transmittivity")	mtl.transmittivity = parser.number();
+		else if (key == "type")
+		{
+			const std::string& type = parser.word();
+			if		(type == "lambertian")	mtl.type = Lambertian;
+			else if (type == "metal")		mtl.type = Metal;
+			else if (type == "plastic")		mtl.type = Plastic;
+			else if (type == "glass")		mtl.type = Glass;
+			else parser.error("Unknown material type '%s'.", type.c_str());
+		}
+		else parser.error("Unknown material attribute '%s'.", key.c_str());
+	}
+
+	return mtl;
+}
+
+ObjectStatement parseObject(SceneFileParser& parser)
+{
+	ObjectStatement stmt;
+	stmt.line = parser.getLine();
+	stmt.name = parser.word();
+
+	while (parser.hasMore())
+	{
+		const std::string& key = parser.word();
+		if		(key == "mesh")			stmt.mesh = parser.word();
+		else if (key == "material")		stmt.material = parser.word();
+		else if (key == "backMaterial")	stmt.backMaterial = parser.word();
+		else if (key == "twoSided")		stmt.twoSided = parser.boolean();
+		else if (key == "translation")	stmt.translation = parser.vector3();
+		else if (key == "scale")		stmt.scale = parser.number();
+		else if (key == "rotation")		stmt.rotation = parser.rotation();
+		else parser.error("Unknown object attribute '%s'.", key.c_str());
+	}
+
+	if (stmt.mesh.empty())
+		parser.error("Object '%s' has no mesh.", stmt.name.c_str());
+	if (stmt.material.empty())
+		parser.error("Object '%s' has no material.", stmt.name.c_str());
+
+	return stmt;
+}
+
+void parseKey(SceneFileParser& parser, KeyStatement& stmt)
+{
+	bool hasTime = false;
+	bool camera = stmt.objIdx == uint(-1);
+
+	while (parser.hasMore())
+	{
+		const std::string& key = parser.word();
+		if (key == "time")
+		{
+			stmt.objectKey.time = stmt.cameraKey.time = parser.number();
+			hasTime = true;
+		}
+		else if (!camera && key == "translation")	stmt.objectKey.translation = parser.vector3();
+		else if (!camera && key == "scale")			stmt.objectKey.scale = parser.number();
+		else if (!camera && key == "rotation")		stmt.objectKey.rotation = parser.rotation();
+		else if (camera && key == "target")			stmt.cameraKey.target = parser.vector3();
+		else if (camera && key == "distance")		stmt.cameraKey.distance = parser.number();
+		else if (camera && key == "azimuth")		stmt.cameraKey.azimuth = parser.number();
+		else if (camera && key == "altitude")		stmt.cameraKey.altitude = parser.number();
+		else if (camera && key == "fovY")			stmt.cameraKey.fovY = parser.number();
+		else parser.error("Unknown key attribute '%s'.", key.c_str());
+	}
+
+	if (!hasTime)
+		parser.error("A key has no time.");
+}
+
+std::string resolvePath(const char* sceneFile, const std::string& path)
+{
+	bool absolute = (path.size() > 0 && (path[0] == '/' || path[0] == '\\')) || 
+		(path.size() > 1 && path[1] == ':');
+	if (absolute)
+		return path;
+
+	std::string sceneDir(sceneFile);
+	size_t slash = sceneDir.find_last_of("/\\");
+	if (slash == std::string::npos)
+		return path;
+
+	return sceneDir.substr(0, slash + 1) + path;
+}
+
+PendingMesh* prepareMesh(const MeshStatement& stmt)
+{
+	switch (stmt.source)
+	{
+	case MeshSource::obj:		return prepareMeshFromOBJFile(stmt.path.c_str(), stmt.optimize, stmt.maxLODs);
+	case MeshSource::rectangle:	return prepareMesh(generateRectangleMesh(stmt.v0, stmt.v1, stmt.dir));
+	case MeshSource::box:		return prepareMesh(generateBoxMesh(stmt.v0, stmt.v1));
+	case MeshSource::cube:		return prepareMesh(generateCubeMesh(stmt.v0, stmt.v1, stmt.bottomCenter));
+	default:					return prepareMesh(generateSphereMesh(stmt.v0, stmt.radius, stmt.meridianSegments, stmt.equatorSegments));
+	}
+}
+
+const char* meshSourceName(MeshSource source)
+{
+	static const char* names[] = { "obj", "rectangle", "box", "cube", "sphere" };
+	return names[(int) source];
+}
+
+}	// namespace
+
+
+Scene* SceneLoader::push_sceneFromFile(const char* filename)
+{
+	uint64 bytesBefore = getMemoryUsage();
+	FILE* file = fopen(filename, "r");
+	if (!file)
+	{
+		char message[512];
+		snprintf(message, sizeof(message), "Cannot open the scene file %s.", filename);
+		throw Error(message);
+	}
+
+	SceneFileParser parser(filename);
+	std::vector<MeshStatement> meshStmts;
+	std::vector<ObjectStatement> objStmts;
+	std::vector<KeyStatement> keyStmts;
+	std::map<std::string, uint> meshIdx;
+	std::map<std::string, uint> mtlIdx;
+	std::map<std::string, uint> objIdx;
+	Array<Material> mtlArr;
+
+	try
+	{
+		char text[1024];
+		for (uint lineNumber = 1; fgets(text, sizeof(text), file); ++lineNumber)
+		{
+			parser.setLine(lineNumber, text);
+			// fgets() would return the rest of a longer line as the next one; a full buffer is the whole line only
+			// at the end of the file.
+			size_t length = strlen(text);
+			if (length == sizeof(text) - 1 && text[length - 1] != '\n' && ungetc(getc(file), file) != EOF)
+				parser.error("The line is too long.");
+			if (parser.empty())
+				continue;
+
+			const std::string& keyword = parser.word();
+			if (keyword == "mesh")
+			{
+				MeshStatement stmt = parseMesh(parser);
+				if (!meshIdx.insert({ stmt.name, (uint) meshStmts.size() }).second)
+					parser.error("Mesh '%s' is already defined.", stmt.name.c_str());
+				if (stmt.source == MeshSource::obj)
+					stmt.path = resolvePath(filename, stmt.path);
+				meshStmts.push_back(stmt);
+			}
+			else if (keyword == "material")
+			{
+				std::string name = parser.word();
+				if (!mtlIdx.insert({ name, mtlArr.size() }).second)
+					parser.error("Material '%s' is already defined.", name.c_str());
+				mtlArr.push_back(parseMaterial(parser));
+			}
+			else if (keyword == "object")
+			{
+				ObjectStatement stmt = parseObject(parser);
+				if (meshIdx.find(stmt.mesh) == meshIdx.end())
+					parser.error("Mesh '%s' is not defined before.", stmt.mesh.c_str());
+				if (mtlIdx.find(stmt.material) == mtlIdx.end())
+					parser.error("Material '%s' is not defined before.", stmt.material.c_str());
+				if (!stmt.backMaterial.empty() && mtlIdx.find(stmt.backMaterial) == mtlIdx.end())
+					parser.error("Material '%s' is not defined before.", stmt.backMaterial.c_str());
+				if (stmt.name == "camera" || !objIdx.insert({ stmt.name, (uint) objStmts.size() }).second)
+					parser.error("Object '%s' is already defined.", stmt.name.c_str());
+				objStmts.push_back(stmt);
+			}
+			else if (keyword == "key")
+			{
+				std::string name = parser.word();
+				KeyStatement stmt;
+				stmt.objIdx = uint(-1);
+				if (name != "camera")
+				{
+					auto found = objIdx.find(name);
+					if (found == objIdx.end())
+						parser.error("Object '%s' is not defined before.", name.c_str());
+					stmt.objIdx = found->second;
+				}
+
+				// Start from the previous key of the track, or from the object's own pose.
+				auto previous = std::find_if(keyStmts.rbegin(), keyStmts.rend(), 
+					[&](const KeyStatement& k) { return k.objIdx == stmt.objIdx; });
+				if (previous != keyStmts.rend())
+				{
+					stmt.objectKey = previous->objectKey;
+					stmt.cameraKey = previous->cameraKey;
+				}
+				else if (stmt.objIdx != uint(-1))
+				{
+					stmt.objectKey.translation = objStmts[stmt.objIdx].translation;
+					stmt.objectKey.rotation = objStmts[stmt.objIdx].rotation;
+					stmt.objectKey.scale = objStmts[stmt.objIdx].scale;
+				}
+
+				parseKey(parser, stmt);
+				keyStmts.push_back(stmt);
+			}
+			else
+			{
+				parser.error("Unknown statement '%s'.", keyword.c_str());
+			}
+		}
+	}
+	catch (...)
+	{
+		fclose(file);
+		throw;
+	}
+	fclose(file);
+
+	if (objStmts.empty())
+		parser.error("The scene has no objects.");
+
+	// Load every mesh on the thread pool, so the loading time is that of the largest mesh rather than the sum.
+	// The meshes are parsed first, and then written straight into the scene (see PendingMesh).
+	uint numMeshes = (uint) meshStmts.size();
+	Array<PendingMesh*> meshArr(numMeshes, nullptr);
+	ThreadPool& pool = ThreadPool::get();
+
+	Scene* scene = new Scene;
+	
+	double startTime = getCurrentTime();
+	try
+	{
+		TaskGroup group;
+		for (uint i = 0; i < numMeshes; ++i)
+		{
+			pool.run(group, [&, i]() {
+				double meshStartTime = getCurrentTime();
+				meshArr[i] = prepareMesh(meshStmts[i]);
+				meshArr[i]->loadTime += getCurrentTime() - meshStartTime;
+			});
+		}
+		pool.wait(group);
+
+		initializeGeometryFromMeshes(scene, meshArr);
+	}
+	catch (...)
+	{
+		for (PendingMesh* mesh : meshArr)
+			delete mesh;
+		delete scene;
+		throw;
+	}
+	double totalTime = getCurrentTime() - startTime;
+	sceneArr.push_back(scene);
+
+	double sumTime = 0.0;
+	printf("Scene %s: %u meshes loaded in %.1f ms on %u threads\n", filename, numMeshes, totalTime * 1000.0, pool.numThreads());
+	for (uint i = 0; i < numMeshes; ++i)
+	{
+		const MeshStatement& stmt = meshStmts[i];
+		printf("    %-16s %-9s %8u vertices %8u triangles %2u LODs %9.1f ms  %s\n", stmt.name.c_str(), meshSourceName(stmt.source),
+			meshArr[i]->numVertices, meshArr[i]->numTridices, meshArr[i]->lodArr.size(), meshArr[i]->loadTime * 1000.0, stmt.path.c_str());
+		sumTime += meshArr[i]->loadTime;
+	}
+	printf("    (sum of per-mesh times %.1f ms)\n", sumTime * 1000.0);
+	
+	for (PendingMesh* mesh : meshArr)
+		delete mesh;
+
+	// Objects are instances of the mesh entries initialized above, as in push_hyperionTestScene().
+	Array<SceneObject> meshObjArr(numMeshes);
+	memcpy(meshObjArr.data(), scene->objArr.data(), sizeof(SceneObject) * numMeshes);
+
+	uint numObjs = (uint) objStmts.size();
+	Array<SceneObject>& objArr = scene->objArr;
+	objArr.resize(numObjs);
+	for (uint i = 0; i < numObjs; ++i)
+	{
+		const ObjectStatement& stmt = objStmts[i];
+		SceneObject& obj = objArr[i];
+
+		obj = meshObjArr[ meshIdx[stmt.mesh] ];
+		obj.materialIdx = mtlIdx[stmt.material];
+		obj.backMaterialIdx = mtlIdx[stmt.backMaterial.empty() ? stmt.material : stmt.backMaterial];
+		obj.twoSided = stmt.twoSided;
+		obj.translation = stmt.translation;
+		obj.rotation = stmt.rotation;
+		obj.scale = stmt.scale;
+	}
+	mtlArr.swap(scene->mtlArr);
+
 	computeModelMatrices(scene);
 
+	for (const KeyStatement& stmt : keyStmts)
+	{
+		if (stmt.objIdx == uint(-1))
+			scene->animation.addCameraKey(stmt.cameraKey);
+		else
+			scene->animation.addObjectKey(stmt.objIdx, stmt.objectKey);
+	}
+	if (!scene->animation.empty())
+		printf("    animation of %u objects%s, %.2f s\n", scene->animation.numObjectTracks(),
+			scene->animation.hasCamera() ? " and the camera" : "", scene->animation.getDuration());
+	printMemoryUsage(bytesBefore);
+
 	return scene;
-}
\ No newline at end of file
+}
@@ -2,16 +2,19 @@
 #include "pch.h"
 #include "Scene.h"
 
+class PendingMesh;
+
 
 class SceneLoader
 {
 	Array<Scene*> sceneArr;
 
-	void initializeGeometryFromMeshes(Scene* scene, const Array<Mesh*>& meshes);
+	void initializeGeometryFromMeshes(Scene* scene, const Array<PendingMesh*>& meshes);
 	void computeModelMatrices(Scene* scene);
 
 public:
 	Scene* getScene(uint sceneIdx) const { return sceneArr[sceneIdx]; }
 	Scene* push_testScene1();
 	Scene* push_hyperionTestScene();
+	Scene* push_sceneFromFile(const char* filename);
 };
@@ -0,0 +1,78 @@
+#include "pch.h"
+#include "SoftwareQueue.h"
+
+
+SoftwareQueue::SoftwareQueue()
+{
+	worker = std::thread([this]() { workerLoop(); });
+}
+
+SoftwareQueue::~SoftwareQueue()
+{
+	{
+		std::lock_guard<std::mutex> lock(queueLock);
+		stopping = true;
+	}
+	queueSignal.notify_all();
+	worker.join();
+}
+
+void SoftwareQueue::workerLoop()
+{
+	std::unique_lock<std::mutex> lock(queueLock);
+	for (;;)
+	{
+		queueSignal.wait(lock, [this]() { return stopping || !itemQueue.empty(); });
+		if (itemQueue.empty())
+			return;
+
+		Item item = std::move(itemQueue.front());
+		itemQueue.pop_front();
+
+		if (item.work)
+		{
+			lock.unlock();
+			item.work();
+			lock.lock();
+		}
+
+		if (item.signalValue != 0)
+		{
+			completedValue = item.signalValue;
+			completedSignal.notify_all();
+		}
+	}
+}
+
+void SoftwareQueue::submit(std::function<void()> work)
+{
+	{
+		std::lock_guard<std::mutex> lock(queueLock);
+		itemQueue.push_back(Item{ std::move(work), 0 });
+	}
+	queueSignal.notify_one();
+}
+
+uint64 SoftwareQueue::signal()
+{
+	uint64 value;
+	{
+		std::lock_guard<std::mutex> lock(queueLock);
+		value = ++lastSignaled;
+		itemQueue.push_back(Item{ nullptr, value });
+	}
+	queueSignal.notify_one();
+	return value;
+}
+
+uint64 SoftwareQueue::getCompletedValue()
+{
+	std::lock_guard<std::mutex> lock(queueLock);
+	return completedValue;
+}
+
+void SoftwareQueue::waitForValue(uint64 value)
+{
+	std::unique_lock<std::mutex> lock(queueLock);
+	completedSignal.wait(lock, [&]() { return completedValue >= value; });
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "FrameRing.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+
+
+/*
+A queue whose work runs in submission order on a thread of its own, as a GPU queue runs its command lists, with
+the timeline of its signals. It stands in for the D3D12 queues where FrameRing and frame pacing are tested or
+measured without a GPU (see "--bench pipeline" in Benchmark.cpp).
+*/
+class SoftwareQueue : public ITimeline
+{
+	struct Item
+	{
+		std::function<void()>	work;
+		uint64					signalValue;	// Reached after work, if not 0.
+	};
+
+	std::thread					worker;
+	std::deque<Item>			itemQueue;
+	std::mutex					queueLock;
+	std::condition_variable		queueSignal;
+	std::condition_variable		completedSignal;
+	uint64						lastSignaled = 0;
+	uint64						completedValue = 0;
+	bool						stopping = false;
+
+	void workerLoop();
+
+public:
+	~SoftwareQueue();
+	SoftwareQueue();
+
+	void submit(std::function<void()> work);
+	virtual uint64 signal();
+	virtual uint64 getCompletedValue();
+	virtual void waitForValue(uint64 value);
+};
@@ -0,0 +1,117 @@
+#include "pch.h"
+#include "ThreadPool.h"
+
+
+uint ThreadPool::processThreads = 0;
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> guard(queueLock);
+		stopping = true;
+	}
+	queueSignal.notify_all();
+
+	for (auto& worker : workers)
+		worker.join();
+}
+
+ThreadPool::ThreadPool(uint numThreads)
+{
+	if (numThreads == 0)
+		numThreads = _max(std::thread::hardware_concurrency(), 1u);
+
+	// The thread which waits on a group also runs tasks, so one less worker is enough.
+	for (uint i = 1; i < numThreads; ++i)
+		workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+ThreadPool& ThreadPool::get()
+{
+	static ThreadPool pool(processThreads);
+	return pool;
+}
+
+bool ThreadPool::runOneTask(std::unique_lock<std::mutex>& lock)
+{
+	if (taskQueue.empty())
+		return false;
+
+	Task task = move2(taskQueue.front());
+	taskQueue.pop_front();
+	lock.unlock();
+
+	try
+	{
+		task.work();
+	}
+	catch (...)
+	{
+		std::lock_guard<std::mutex> guard(task.group->exceptionLock);
+		if (!task.group->exception)
+			task.group->exception = std::current_exception();
+	}
+
+	lock.lock();
+	if (--task.group->numPending == 0)
+		doneSignal.notify_all();
+
+	return true;
+}
+
+void ThreadPool::workerLoop()
+{
+	std::unique_lock<std::mutex> lock(queueLock);
+
+	while (true)
+	{
+		queueSignal.wait(lock, [this]() { return stopping || !taskQueue.empty(); });
+
+		if (stopping && taskQueue.empty())
+			return;
+
+		runOneTask(lock);
+	}
+}
+
+void ThreadPool::run(TaskGroup& group, std::function<void()> work)
+{
+	++group.numPending;
+
+	if (workers.empty())
+	{
+		std::unique_lock<std::mutex> lock(queueLock);
+		taskQueue.push_back({ move2(work), &group });
+		runOneTask(lock);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(queueLock);
+		taskQueue.push_back({ move2(work), &group });
+	}
+	queueSignal.notify_one();
+	doneSignal.notify_all();	// Threads blocked in wait() may help with the new task.
+}
+
+void ThreadPool::wait(TaskGroup& group)
+{
+	{
+		std::unique_lock<std::mutex> lock(queueLock);
+
+		while (!group.done())
+		{
+			// Help the workers instead of sleeping. The task taken might belong to another group,
+			// which is fine since it has to be executed by someone anyway.
+			if (!runOneTask(lock))
+				doneSignal.wait(lock, [this, &group]() { return group.done() || !taskQueue.empty(); });
+		}
+	}
+
+	if (group.exception)
+	{
+		std::exception_ptr exception = group.exception;
+		group.exception = nullptr;
+		std::rethrow_exception(exception);
+	}
+}
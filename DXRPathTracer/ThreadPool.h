@@ -0,0 +1,119 @@
+#pragma once
+#include "pch.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <exception>
+#include <deque>
+#include <vector>
+
+
+/*
+A small work-queue thread pool shared by every CPU-side stage (asset loading, preprocessing, CPU tracing).
+Tasks are grouped by a TaskGroup, and the thread waiting on a group keeps executing queued tasks until the
+group is done. Thus a task may itself spawn and wait on another group without dead-locking the pool.
+Any exception thrown by a task is captured and re-thrown on the waiting thread.
+*/
+class TaskGroup
+{
+	std::atomic<uint>	numPending{0};
+	std::exception_ptr	exception;
+	std::mutex			exceptionLock;
+
+	friend class ThreadPool;
+
+public:
+	bool done() const { return numPending.load() == 0; }
+};
+
+
+class ThreadPool
+{
+	struct Task
+	{
+		std::function<void()> work;
+		TaskGroup* group;
+	};
+
+	static uint					processThreads;
+
+	std::vector<std::thread>	workers;
+	std::deque<Task>			taskQueue;
+	std::mutex					queueLock;
+	std::condition_variable		queueSignal;
+	std::condition_variable		doneSignal;
+	bool						stopping = false;
+
+	void workerLoop();
+	bool runOneTask(std::unique_lock<std::mutex>& lock);
+
+public:
+	~ThreadPool();
+	ThreadPool(uint numThreads = 0);	// 0 means the number of hardware threads.
+
+	static ThreadPool& get();			// Process-wide pool.
+	static void setProcessThreads(uint num) { processThreads = num; }	// Of get(), if called before it; 0 as above.
+
+	uint numThreads() const { return (uint) workers.size() + 1; }	// Workers plus the waiting(calling) thread.
+
+	void run(TaskGroup& group, std::function<void()> work);
+	void wait(TaskGroup& group);
+
+	// func(uint begin, uint end) is called on disjoint chunks which cover [begin, end).
+	template<typename Func>
+	void parallelForRange(uint begin, uint end, uint grainSize, Func&& func);
+
+	// func(uint i) is called for every i in [begin, end).
+	template<typename Func>
+	void parallelFor(uint begin, uint end, uint grainSize, Func&& func);
+};
+
+
+template<typename Func>
+void ThreadPool::parallelForRange(uint begin, uint end, uint grainSize, Func&& func)
+{
+	if (end <= begin)
+		return;
+
+	grainSize = _max(grainSize, 1u);
+	uint numItems = end - begin;
+
+	if (numItems <= grainSize || workers.empty())
+	{
+		func(begin, end);
+		return;
+	}
+
+	// Never split finer than about 4 chunks per thread, scheduling overhead dominates otherwise.
+	uint numChunks = _min((numItems + grainSize - 1) / grainSize, numThreads() * 4);
+	uint chunkSize = (numItems + numChunks - 1) / numChunks;
+
+	TaskGroup group;
+	for (uint chunkBegin = begin + chunkSize; chunkBegin < end; chunkBegin += chunkSize)
+	{
+		uint chunkEnd = _min(chunkBegin + chunkSize, end);
+		run(group, [&func, chunkBegin, chunkEnd]() { func(chunkBegin, chunkEnd); });
+	}
+
+	try
+	{
+		func(begin, _min(begin + chunkSize, end));
+	}
+	catch (...)
+	{
+		wait(group);
+		throw;
+	}
+	wait(group);
+}
+
+template<typename Func>
+void ThreadPool::parallelFor(uint begin, uint end, uint grainSize, Func&& func)
+{
+	parallelForRange(begin, end, grainSize, [&func](uint chunkBegin, uint chunkEnd) {
+		for (uint i = chunkBegin; i < chunkEnd; ++i)
+			func(i);
+	});
+}
@@ -0,0 +1,73 @@
+#include "pch.h"
+#include "TiledRender.h"
+#include "IGRTTracer.h"
+
+
+TiledRender::TiledRender(IGRTTracer& tracer, uint imageWidth, uint imageHeight, uint tileWidth, uint tileHeight,
+	const PixelRegion& area)
+	: tracer(tracer), imageW(imageWidth), imageH(imageHeight), area(clampRegion(area, imageWidth, imageHeight)),
+	tileW(_max(tileWidth, 1u)), tileH(_max(tileHeight, 1u))
+{
+}
+
+TracedResult TiledRender::renderBand(uint bandIdx, uint numFrames, const InputEngine& input,
+	const std::function<void(const PixelRegion& tile)>& onTile)
+{
+	uint y = area.y + bandY(bandIdx);
+	uint height = _min(tileH, area.y + area.height - y);
+
+	for (uint x = area.x; x < area.x + area.width; x += tileW)
+	{
+		tile = { x, y, _min(tileW, area.x + area.width - x), height };
+		tracer.setRegion(imageW, imageH, tile);
+
+		TracedResult trResult = {};
+		for (uint frame = 0; frame < _max(numFrames, 1u); ++frame)
+		{
+			tracer.setOutputTarget(frame + 1 >= numFrames ? this : nullptr);
+			tracer.update(input);
+			trResult = tracer.shootRays();
+		}
+		tracer.setOutputTarget(nullptr);
+
+		// Unless the tracer wrote it into the band.
+		uint8* dst = (uint8*) acquireOutput(trResult.width, trResult.height, trResult.format).data;
+		if (!dst)
+			throw Error("The tracer returned another frame than that of the tile.");
+		if (trResult.data != dst)
+		{
+			uint64 rowSize = (uint64) trResult.width * trResult.pixelSize;
+			for (uint row = 0; row < trResult.height; ++row)
+				memcpy(dst + row * bandPitch, (const uint8*) trResult.data + row * trResult.getRowPitch(), rowSize);
+		}
+
+		if (onTile)
+			onTile(tile);
+	}
+
+	TracedResult result;
+	result.data = band.data();
+	result.width = area.width;
+	result.height = height;
+	result.pixelSize = pixelSizeOf(bandFormat);
+	result.format = bandFormat;
+	result.rowPitch = bandPitch;
+	return result;
+}
+
+// The place of the tile being traced in the band, which is sized for the format of the frames.
+OutputBuffer TiledRender::acquireOutput(uint width, uint height, PixelFormat format)
+{
+	if (width != tile.width || height != tile.height)
+		return OutputBuffer();
+
+	bandFormat = format;
+	bandPitch = (uint64) area.width * pixelSizeOf(format);
+	if (band.size() < bandPitch * tileH)
+		band.resize((uint) (bandPitch * tileH));
+
+	OutputBuffer buffer;
+	buffer.data = band.data() + (tile.x - area.x) * pixelSizeOf(format);
+	buffer.rowPitch = bandPitch;
+	return buffer;
+}
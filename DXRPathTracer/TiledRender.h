@@ -0,0 +1,46 @@
+#pragma once
+#include "IGRTCommon.h"
+#include <functional>
+
+
+class IGRTTracer;
+class InputEngine;
+
+/*
+Renders an image of any size with a tracer which only ever holds one tile of it, e.g. a poster of 16K or more. The
+tiles are regions of the image (IGRTTracer::setRegion()), each accumulated over its own frames, and they are gathered
+into bands of one row of tiles, which are handed out whole from the top of the image down, for the writers of
+writeImage.h. The memory is that of one band, width x tileHeight pixels, and of one tile in the tracer, whatever the
+size of the image; and the pixels are those the tracer would trace in the whole image, at the edges of the tiles too.
+As the IOutputTarget of the tracer, the band lends it the memory of the last frame of each tile. The tracer must
+return the frame it traced, which DXRPathTracer does with one frame in flight.
+*/
+class TiledRender : public IOutputTarget
+{
+	IGRTTracer&		tracer;
+	uint			imageW;
+	uint			imageH;
+	PixelRegion		area;						// Of the image which is rendered; the whole image by default.
+	uint			tileW;
+	uint			tileH;
+
+	Array<uint8>	band;
+	uint64			bandPitch = 0;
+	PixelFormat		bandFormat = PixelFormat::RGBA32F;
+	PixelRegion		tile;						// Being traced.
+
+public:
+	TiledRender(IGRTTracer& tracer, uint imageWidth, uint imageHeight, uint tileWidth, uint tileHeight,
+		const PixelRegion& area = PixelRegion());
+
+	uint numBands() const						{ return (area.height + tileH - 1) / tileH; }
+	uint bandY(uint bandIdx) const				{ return bandIdx * tileH; }		// From the top of the area.
+
+	// The tiles of a band, numFrames frames each, in the output format of the tracer; the result is valid until the
+	// next call. onTile is called once each tile is traced, while it is still the region of the tracer.
+	TracedResult renderBand(uint bandIdx, uint numFrames, const InputEngine& input,
+		const std::function<void(const PixelRegion& tile)>& onTile = nullptr);
+
+	virtual OutputBuffer acquireOutput(uint width, uint height, PixelFormat format);
+	uint64 bandMemory() const					{ return band.size(); }
+};
@@ -0,0 +1,228 @@
+#include "pch.h"
+#include "ToneMapper.h"
+#include "ThreadPool.h"
+#include "fastMath.h"
+#include "pixelFormat.h"
+#include <atomic>
+
+
+namespace {
+
+// The table covers the exposed values from 2^minExponent to 2^(maxExponent+1); below it every curve is under half
+// a level, above it every curve is at 255.
+const int minExponent = -20;
+const int maxExponent = 8;
+const uint mantissaBits = 8;
+const uint tableSize = (maxExponent - minExponent + 1) << mantissaBits;
+const int tableBias = (127 + minExponent) << mantissaBits;		// Of the biased exponent and mantissa bits.
+
+// The histogram of the automatic exposure: bin 0 counts the pixels darker than 2^minLog2, which are left out of
+// the average, and the others cover binsPerStop bins per stop from there.
+const uint numBins = 128;
+const float minLog2 = -16.0f;
+const float binsPerStop = 4.0f;
+const float lowFraction = 0.05f;
+const float highFraction = 0.95f;
+const uint histogramStride = 2;			// Every other pixel of every other row.
+
+inline __m128i tableIndices(__m128 pixel, __m128 absMask, __m128 exposure, __m128i bias)
+{
+	__m128 exposed = _mm_mul_ps(_mm_and_ps(pixel, absMask), exposure);
+	return _mm_sub_epi32(_mm_srli_epi32(_mm_castps_si128(exposed), 23 - mantissaBits), bias);
+}
+
+inline uint packPixel(const uint8* table, __m128i indices, int base)
+{
+	return (uint) table[_mm_extract_epi16(indices, base)] | ((uint) table[_mm_extract_epi16(indices, base + 1)] << 8) |
+		((uint) table[_mm_extract_epi16(indices, base + 2)] << 16) | 0xFF000000u;
+}
+
+// Row y of trResult as float4, converted into scratch unless it already is.
+inline const float4* rowPixels(const TracedResult& trResult, uint y, Array<float4>& scratch)
+{
+	const uint8* line = (const uint8*) trResult.data + (size_t) (y * trResult.getRowPitch());
+	if (trResult.format == PixelFormat::RGBA32F)
+		return (const float4*) line;
+
+	scratch.resize(trResult.width);
+	convertToFloat4(line, trResult.format, scratch.data(), trResult.width);
+	return scratch.data();
+}
+
+}	// namespace
+
+
+ToneMapper::ToneMapper(const ToneMapSettings& settings)
+	: settings(settings), lastExposure(settings.exposure)
+{
+	buildCurveTable();
+}
+
+void ToneMapper::setSettings(const ToneMapSettings& newSettings)
+{
+	bool curveChanged = newSettings.op != settings.op || newSettings.srgbCurve != settings.srgbCurve;
+	settings = newSettings;
+	if (curveChanged)
+		buildCurveTable();
+}
+
+float ToneMapper::mapChannel(float exposed, ToneOperator op, bool srgbCurve)
+{
+	float v = fabsf(exposed), ldr;
+	switch (op)
+	{
+	case ToneOperator::ACES:		ldr = (v * (2.51f * v + 0.03f)) / (v * (2.43f * v + 0.59f) + 0.14f);	break;
+	case ToneOperator::Reinhard:	ldr = v / (1.0f + v);													break;
+	default:						ldr = 1.0f - expf(-v);													break;
+	}
+	ldr = _min(_max(ldr, 0.0f), 1.0f);
+
+	if (!srgbCurve)
+		return powf(ldr, 1.0f / 2.2f);
+	return ldr <= 0.0031308f ? 12.92f * ldr : 1.055f * powf(ldr, 1.0f / 2.4f) - 0.055f;
+}
+
+// Each entry is the curve at the middle of its range of values.
+void ToneMapper::buildCurveTable()
+{
+	curveTable.resize(tableSize);
+	for (uint i = 0; i < tableSize; ++i)
+	{
+		uint bits = (uint) (tableBias + (int) i) << (23 - mantissaBits) | 1u << (22 - mantissaBits);
+		float middle;
+		memcpy(&middle, &bits, sizeof(float));
+		curveTable[i] = (uint8) (mapChannel(middle, settings.op, settings.srgbCurve) * 255.0f + 0.5f);
+	}
+}
+
+float ToneMapper::measureExposure(const TracedResult& trResult) const
+{
+	assert(trResult.pixelSize == pixelSizeOf(trResult.format));
+	uint width = trResult.width;
+	uint numRows = (trResult.height + histogramStride - 1) / histogramStride;
+
+	std::atomic<uint> histogram[numBins];
+	for (std::atomic<uint>& count : histogram)
+		count = 0;
+
+	ThreadPool::get().parallelForRange(0, numRows, 16, [&](uint rowBegin, uint rowEnd) {
+		uint localHistogram[numBins] = {};
+		Array<float4> scratch;
+		const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+		const __m128 offset = _mm_set1_ps(1.0f - minLog2 * binsPerStop);
+		const __m128i maxBin = _mm_set1_epi32(numBins - 1);
+		const uint groupWidth = 4 * histogramStride;
+
+		for (uint row = rowBegin; row < rowEnd; ++row)
+		{
+			const float4* line = rowPixels(trResult, row * histogramStride, scratch);
+			uint x = 0;
+			for (; x + groupWidth <= width; x += groupWidth)
+			{
+				// Four pixels, transposed to their channels.
+				__m128 r = _mm_loadu_ps(&line[x].x);
+				__m128 g = _mm_loadu_ps(&line[x + histogramStride].x);
+				__m128 b = _mm_loadu_ps(&line[x + 2 * histogramStride].x);
+				__m128 a = _mm_loadu_ps(&line[x + 3 * histogramStride].x);
+				_MM_TRANSPOSE4_PS(r, g, b, a);
+
+				__m128 luminance = _mm_add_ps(_mm_add_ps(
+					_mm_mul_ps(_mm_and_ps(r, absMask), _mm_set1_ps(0.2126f)),
+					_mm_mul_ps(_mm_and_ps(g, absMask), _mm_set1_ps(0.7152f))),
+					_mm_mul_ps(_mm_and_ps(b, absMask), _mm_set1_ps(0.0722f)));
+				__m128 binf = _mm_add_ps(_mm_mul_ps(fastLog2(luminance), _mm_set1_ps(binsPerStop)), offset);
+				__m128i bin = _mm_cvttps_epi32(_mm_max_ps(binf, _mm_setzero_ps()));
+				__m128i over = _mm_cmpgt_epi32(bin, maxBin);
+				bin = _mm_or_si128(_mm_and_si128(over, maxBin), _mm_andnot_si128(over, bin));
+
+				++localHistogram[_mm_cvtsi128_si32(bin)];
+				++localHistogram[_mm_extract_epi16(bin, 2)];
+				++localHistogram[_mm_extract_epi16(bin, 4)];
+				++localHistogram[_mm_extract_epi16(bin, 6)];
+			}
+			for (; x < width; x += histogramStride)
+			{
+				const float4& p = line[x];
+				float luminance = 0.2126f * fabsf(p.x) + 0.7152f * fabsf(p.y) + 0.0722f * fabsf(p.z);
+				float binf = _max(fastLog2(luminance) * binsPerStop + (1.0f - minLog2 * binsPerStop), 0.0f);
+				++localHistogram[_min((uint) binf, numBins - 1)];
+			}
+		}
+
+		for (uint bin = 0; bin < numBins; ++bin)
+		{
+			if (localHistogram[bin])
+				histogram[bin] += localHistogram[bin];
+		}
+	});
+
+	uint64 total = 0;
+	for (uint bin = 1; bin < numBins; ++bin)
+		total += histogram[bin];
+	if (total == 0)
+		return settings.exposure;
+
+	// The mean of the bins between the two fractions of the pixels, counting the bins on the edges in part.
+	double low = total * lowFraction, high = total * highFraction;
+	double below = 0.0, sum = 0.0, weight = 0.0;
+	for (uint bin = 1; bin < numBins; ++bin)
+	{
+		double count = histogram[bin];
+		double taken = _min(below + count, high) - _max(below, low);
+		below += count;
+		if (taken <= 0.0)
+			continue;
+
+		sum += taken * (minLog2 + (bin - 0.5f) / binsPerStop);
+		weight += taken;
+	}
+
+	float averageLog2 = (float) (sum / weight);
+	return settings.keyValue / exp2f(averageLog2);
+}
+
+void ToneMapper::apply(const TracedResult& trResult, uint8* dst, uint dstPitch)
+{
+	assert(trResult.pixelSize == pixelSizeOf(trResult.format));
+	lastExposure = settings.autoExposure ? measureExposure(trResult) : settings.exposure;
+
+	uint width = trResult.width;
+	const uint8* table = curveTable.data();
+	float exposure = lastExposure;
+
+	ThreadPool::get().parallelForRange(0, trResult.height, 16, [&](uint rowBegin, uint rowEnd) {
+		const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+		const __m128 scale = _mm_set1_ps(exposure);
+		const __m128i bias = _mm_set1_epi32(tableBias);
+		const __m128i maxIndex = _mm_set1_epi16((short) (tableSize - 1));
+		Array<float4> scratch;
+
+		for (uint row = rowBegin; row < rowEnd; ++row)
+		{
+			const float4* src = rowPixels(trResult, row, scratch);
+			uint* out = (uint*) (dst + (size_t) row * dstPitch);
+
+			// Four pixels at a time, their indices saturated to 16 bits and clamped to the table.
+			uint x = 0;
+			for (; x + 4 <= width; x += 4)
+			{
+				__m128i i0 = tableIndices(_mm_loadu_ps(&src[x].x), absMask, scale, bias);
+				__m128i i1 = tableIndices(_mm_loadu_ps(&src[x + 1].x), absMask, scale, bias);
+				__m128i i2 = tableIndices(_mm_loadu_ps(&src[x + 2].x), absMask, scale, bias);
+				__m128i i3 = tableIndices(_mm_loadu_ps(&src[x + 3].x), absMask, scale, bias);
+				__m128i i01 = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(i0, i1), _mm_setzero_si128()), maxIndex);
+				__m128i i23 = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(i2, i3), _mm_setzero_si128()), maxIndex);
+
+				out[x] = packPixel(table, i01, 0);
+				out[x + 1] = packPixel(table, i01, 4);
+				out[x + 2] = packPixel(table, i23, 0);
+				out[x + 3] = packPixel(table, i23, 4);
+			}
+			for (; x < width; ++x)
+			{
+				__m128i i0 = tableIndices(_mm_loadu_ps(&src[x].x), absMask, scale, bias);
+				out[x] = packPixel(table, _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(i0, i0), _mm_setzero_si128()), maxIndex), 0);
+			}
+		}
+	});
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "IGRTCommon.h"
+
+
+enum class ToneOperator
+{
+	Exponential,	// 1 - exp(-x), as D3D12Screen.hlsl.
+	ACES,			// Narkowicz's fit of the ACES filmic curve.
+	Reinhard,		// x / (1 + x) per channel.
+};
+
+struct ToneMapSettings
+{
+	ToneOperator	op = ToneOperator::Exponential;
+	float			exposure = 1.66f;		// Of D3D12Screen.hlsl; replaced by the measured one with autoExposure.
+	bool			autoExposure = false;
+	float			keyValue = 0.18f;		// What the average luminance of the image is exposed to, with autoExposure.
+	bool			srgbCurve = false;		// The piecewise sRGB curve rather than the gamma 2.2 of D3D12Screen.hlsl.
+};
+
+
+/*
+CPU counterpart of the pixel shader of D3D12Screen, for the images which never reach a screen: turns the float4
+HDR output of a tracer into 8-bit RGBA, on the threads of the ThreadPool.
+The operator and the gamma are one increasing function of the exposed value of a channel, so they are baked into
+a table indexed by the exponent and the top 8 mantissa bits of that value; each channel then costs a multiply,
+a shift and a load, and lands within one level of the exact curve. Results in the packed PixelFormats are
+expanded a row at a time on the way in. The automatic exposure is the average log2
+luminance of a histogram of the image, without its darkest and brightest 5%.
+*/
+class ToneMapper
+{
+	ToneMapSettings	settings;
+	float			lastExposure;
+	Array<uint8>	curveTable;
+
+	void buildCurveTable();
+
+public:
+	ToneMapper(const ToneMapSettings& settings = ToneMapSettings());
+
+	void setSettings(const ToneMapSettings& settings);
+	const ToneMapSettings& getSettings() const		{ return settings; }
+	float getLastExposure() const					{ return lastExposure; }	// Used by the last apply().
+
+	// dst gets trResult.height rows of dstPitch bytes, with an alpha of 255.
+	void apply(const TracedResult& trResult, uint8* dst, uint dstPitch);
+	float measureExposure(const TracedResult& trResult) const;
+
+	// The operator and the gamma of one channel, exactly; what the table approximates.
+	static float mapChannel(float exposed, ToneOperator op, bool srgbCurve);
+};
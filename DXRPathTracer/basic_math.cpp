@@ -0,0 +1,154 @@
+#include "pch.h"
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+
+namespace {
+
+// Four float3 (12 floats) into their x, y and z, and back.
+inline void loadFloat3x4(const float3* p, __m128& x, __m128& y, __m128& z)
+{
+	const float* f = &p->x;
+	__m128 a = _mm_loadu_ps(f);			// x0 y0 z0 x1
+	__m128 b = _mm_loadu_ps(f + 4);		// y1 z1 x2 y2
+	__m128 c = _mm_loadu_ps(f + 8);		// z2 x3 y3 z3
+
+	x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 0, 3, 2)), _MM_SHUFFLE(3, 0, 3, 0));
+	y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)),
+		_MM_SHUFFLE(2, 0, 2, 0));
+	z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)),
+		_MM_SHUFFLE(2, 0, 2, 0));
+}
+
+inline void storeFloat3x4(float3* p, __m128 x, __m128 y, __m128 z)
+{
+	__m128 xyLo = _mm_unpacklo_ps(x, y);	// x0 y0 x1 y1
+	__m128 xyHi = _mm_unpackhi_ps(x, y);	// x2 y2 x3 y3
+
+	float* f = &p->x;
+	_mm_storeu_ps(f, _mm_shuffle_ps(xyLo, _mm_shuffle_ps(z, x, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 1, 0)));
+	_mm_storeu_ps(f + 4, _mm_shuffle_ps(_mm_shuffle_ps(y, z, _MM_SHUFFLE(1, 1, 1, 1)),
+		_mm_shuffle_ps(x, y, _MM_SHUFFLE(2, 2, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0)));
+	_mm_storeu_ps(f + 8, _mm_shuffle_ps(_mm_shuffle_ps(z, xyHi, _MM_SHUFFLE(3, 2, 2, 2)),
+		_mm_shuffle_ps(xyHi, z, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+inline __m128 add(__m128 a, __m128 b)		{ return _mm_add_ps(a, b); }
+inline __m128 mul(__m128 a, __m128 b)		{ return _mm_mul_ps(a, b); }
+inline __m128 div(__m128 a, __m128 b)		{ return _mm_div_ps(a, b); }
+inline __m128 sqrt(__m128 a)				{ return _mm_sqrt_ps(a); }
+inline void set1(__m128& v, float s)		{ v = _mm_set1_ps(s); }
+
+#ifdef __AVX__
+inline __m256 add(__m256 a, __m256 b)		{ return _mm256_add_ps(a, b); }
+inline __m256 mul(__m256 a, __m256 b)		{ return _mm256_mul_ps(a, b); }
+inline __m256 div(__m256 a, __m256 b)		{ return _mm256_div_ps(a, b); }
+inline __m256 sqrt(__m256 a)				{ return _mm256_sqrt_ps(a); }
+inline void set1(__m256& v, float s)		{ v = _mm256_set1_ps(s); }
+
+inline void loadFloat3x8(const float3* p, __m256& x, __m256& y, __m256& z)
+{
+	__m128 x0, y0, z0, x1, y1, z1;
+	loadFloat3x4(p, x0, y0, z0);
+	loadFloat3x4(p + 4, x1, y1, z1);
+	x = _mm256_insertf128_ps(_mm256_castps128_ps256(x0), x1, 1);
+	y = _mm256_insertf128_ps(_mm256_castps128_ps256(y0), y1, 1);
+	z = _mm256_insertf128_ps(_mm256_castps128_ps256(z0), z1, 1);
+}
+
+inline void storeFloat3x8(float3* p, __m256 x, __m256 y, __m256 z)
+{
+	storeFloat3x4(p, _mm256_castps256_ps128(x), _mm256_castps256_ps128(y), _mm256_castps256_ps128(z));
+	storeFloat3x4(p + 4, _mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1), _mm256_extractf128_ps(z, 1));
+}
+#endif
+
+// The matrix with every element in all the lanes of a register, and the transform of a batch in those registers.
+template<typename V>
+struct WideTransform
+{
+	V m[3][4];
+
+	WideTransform(const Transform& tm)
+	{
+		for (int i = 0; i < 3; ++i)
+			for (int j = 0; j < 4; ++j)
+				set1(m[i][j], tm.mat[i][j]);
+	}
+
+	template<bool translate, bool normalize>
+	void apply(V& x, V& y, V& z) const
+	{
+		V rx = add(add(mul(m[0][0], x), mul(m[0][1], y)), mul(m[0][2], z));
+		V ry = add(add(mul(m[1][0], x), mul(m[1][1], y)), mul(m[1][2], z));
+		V rz = add(add(mul(m[2][0], x), mul(m[2][1], y)), mul(m[2][2], z));
+		if (translate)
+		{
+			rx = add(rx, m[0][3]);
+			ry = add(ry, m[1][3]);
+			rz = add(rz, m[2][3]);
+		}
+		if (normalize)
+		{
+			V len = sqrt(add(add(mul(rx, rx), mul(ry, ry)), mul(rz, rz)));
+			rx = div(rx, len);
+			ry = div(ry, len);
+			rz = div(rz, len);
+		}
+		x = rx;
+		y = ry;
+		z = rz;
+	}
+};
+
+// Every group is loaded whole before it is stored, so that src and dst can be the same.
+template<bool translate, bool normalize>
+void transformBatch(const Transform& tm, const float3* src, float3* dst, uint count)
+{
+	uint i = 0;
+
+#ifdef __AVX__
+	WideTransform<__m256> wide8(tm);
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 x, y, z;
+		loadFloat3x8(src + i, x, y, z);
+		wide8.apply<translate, normalize>(x, y, z);
+		storeFloat3x8(dst + i, x, y, z);
+	}
+#endif
+
+	WideTransform<__m128> wide4(tm);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 x, y, z;
+		loadFloat3x4(src + i, x, y, z);
+		wide4.apply<translate, normalize>(x, y, z);
+		storeFloat3x4(dst + i, x, y, z);
+	}
+
+	for (; i < count; ++i)
+	{
+		float3 r = translate ? transformPoint(tm, src[i]) : transformVector(tm, src[i]);
+		dst[i] = normalize ? ::normalize(r) : r;
+	}
+}
+
+}	// namespace
+
+
+void transformPoints(const Transform& tm, const float3* src, float3* dst, uint count)
+{
+	transformBatch<true, false>(tm, src, dst, count);
+}
+
+void transformVectors(const Transform& tm, const float3* src, float3* dst, uint count)
+{
+	transformBatch<false, false>(tm, src, dst, count);
+}
+
+void transformNormals(const Transform& normalMatrix, const float3* src, float3* dst, uint count)
+{
+	transformBatch<false, true>(normalMatrix, src, dst, count);
+}
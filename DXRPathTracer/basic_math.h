@@ -1,6 +1,7 @@
 #pragma once
 #include "basic_types.h"
 #include <cmath>
+#include <xmmintrin.h>
 #define PI 3.14159265358979323846f
 #define DEGREE (PI / 180.0f)
 
@@ -54,6 +55,32 @@ inline float3 operator/(const float3& v, T s)
 	float ss = 1.0f / (float)s;
 	return float3(v.x*ss, v.y*ss, v.z*ss);
 }
+inline float3 operator*(const float3& v, const float3& w)
+{
+	return float3(v.x*w.x, v.y*w.y, v.z*w.z);
+}
+inline float3 operator/(const float3& v, const float3& w)
+{
+	return float3(v.x/w.x, v.y/w.y, v.z/w.z);
+}
+inline float3& operator+=(float3& v, const float3& w)
+{
+	v.x += w.x; v.y += w.y; v.z += w.z;
+	return v;
+}
+inline float3& operator*=(float3& v, const float3& w)
+{
+	v.x *= w.x; v.y *= w.y; v.z *= w.z;
+	return v;
+}
+inline float3 _min(const float3& v, const float3& w)
+{
+	return float3(_min(v.x, w.x), _min(v.y, w.y), _min(v.z, w.z));
+}
+inline float3 _max(const float3& v, const float3& w)
+{
+	return float3(_max(v.x, w.x), _max(v.y, w.y), _max(v.z, w.z));
+}
 inline float dot(const float3& v, const float3& w)
 {
 	return v.x * w.x + v.y * w.y + v.z * w.z;
@@ -117,6 +144,121 @@ inline void composeMatrix(float matrix[16], const float3& translation, const flo
 	matrix[15] = 1.f;
 }
 
+// The inverse of composeMatrix(), i.e. (T*R*S)^-1 = S^-1 * R^T * T^-1.
+inline Transform composeInverseMatrix(const float3& translation, const float4& rotation, float scale)
+{
+	Transform rs = composeMatrix(float3(0.0f), rotation, 1.0f / scale);
+	Transform ret;
+	for (int i = 0; i < 3; ++i)
+	{
+		for (int j = 0; j < 3; ++j)
+			ret.mat[i][j] = rs.mat[j][i];
+		ret.mat[i][3] = -(ret.mat[i][0] * translation.x + ret.mat[i][1] * translation.y + ret.mat[i][2] * translation.z);
+	}
+	ret.mat[3][0] = ret.mat[3][1] = ret.mat[3][2] = 0.f;
+	ret.mat[3][3] = 1.f;
+	return ret;
+}
+
+inline float3 transformPoint(const Transform& tm, const float3& p)
+{
+	return float3(
+		tm.mat[0][0] * p.x + tm.mat[0][1] * p.y + tm.mat[0][2] * p.z + tm.mat[0][3],
+		tm.mat[1][0] * p.x + tm.mat[1][1] * p.y + tm.mat[1][2] * p.z + tm.mat[1][3],
+		tm.mat[2][0] * p.x + tm.mat[2][1] * p.y + tm.mat[2][2] * p.z + tm.mat[2][3]);
+}
+
+inline float3 transformVector(const Transform& tm, const float3& v)
+{
+	return float3(
+		tm.mat[0][0] * v.x + tm.mat[0][1] * v.y + tm.mat[0][2] * v.z,
+		tm.mat[1][0] * v.x + tm.mat[1][1] * v.y + tm.mat[1][2] * v.z,
+		tm.mat[2][0] * v.x + tm.mat[2][1] * v.y + tm.mat[2][2] * v.z);
+}
+
+// The SSE helpers below load the rows of a Transform with the translation in w. Transforms are affine: the last
+// row is (0, 0, 0, 1), which is kept rather than computed.
+inline __m128 _cross3(__m128 a, __m128 b)
+{
+	__m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 c = _mm_sub_ps(_mm_mul_ps(a, bYZX), _mm_mul_ps(aYZX, b));
+	return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));		// w = a.w*b.w - a.w*b.w = 0
+}
+
+inline float _dot3(__m128 a, __m128 b)
+{
+	__m128 p = _mm_mul_ps(a, b);
+	return _mm_cvtss_f32(p) + _mm_cvtss_f32(_mm_shuffle_ps(p, p, 1)) + _mm_cvtss_f32(_mm_shuffle_ps(p, p, 2));
+}
+
+inline Transform operator*(const Transform& a, const Transform& b)
+{
+	__m128 b0 = _mm_loadu_ps(b.mat[0]);
+	__m128 b1 = _mm_loadu_ps(b.mat[1]);
+	__m128 b2 = _mm_loadu_ps(b.mat[2]);
+	__m128 b3 = _mm_loadu_ps(b.mat[3]);
+
+	Transform ret;
+	for (int i = 0; i < 4; ++i)
+	{
+		__m128 row = _mm_mul_ps(_mm_set1_ps(a.mat[i][0]), b0);
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a.mat[i][1]), b1));
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a.mat[i][2]), b2));
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a.mat[i][3]), b3));
+		_mm_storeu_ps(ret.mat[i], row);
+	}
+	return ret;
+}
+
+// The matrix which transforms the normals: the inverse transpose of the 3x3 part, without translation.
+// Its rows are the cross products of the rows of tm over the determinant, which must not be 0.
+inline Transform inverseTranspose(const Transform& tm)
+{
+	__m128 r0 = _mm_loadu_ps(tm.mat[0]);
+	__m128 r1 = _mm_loadu_ps(tm.mat[1]);
+	__m128 r2 = _mm_loadu_ps(tm.mat[2]);
+
+	__m128 c0 = _cross3(r1, r2);
+	float det = _dot3(r0, c0);
+	assert(det != 0.0f);
+	__m128 invDet = _mm_set1_ps(1.0f / det);
+
+	Transform ret;
+	_mm_storeu_ps(ret.mat[0], _mm_mul_ps(c0, invDet));
+	_mm_storeu_ps(ret.mat[1], _mm_mul_ps(_cross3(r2, r0), invDet));
+	_mm_storeu_ps(ret.mat[2], _mm_mul_ps(_cross3(r0, r1), invDet));
+	_mm_storeu_ps(ret.mat[3], _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f));
+	return ret;
+}
+
+// Of any invertible affine transform; composeInverseMatrix() is exact for the ones made by composeMatrix().
+inline Transform inverse(const Transform& tm)
+{
+	Transform normalMatrix = inverseTranspose(tm);
+	// The rows of the normal matrix are the columns of the inverse, so -A^-1 * t is their sum weighted by -t.
+	__m128 r0 = _mm_loadu_ps(normalMatrix.mat[0]);
+	__m128 r1 = _mm_loadu_ps(normalMatrix.mat[1]);
+	__m128 r2 = _mm_loadu_ps(normalMatrix.mat[2]);
+	__m128 t = _mm_mul_ps(r0, _mm_set1_ps(-tm.mat[0][3]));
+	t = _mm_sub_ps(t, _mm_mul_ps(r1, _mm_set1_ps(tm.mat[1][3])));
+	t = _mm_sub_ps(t, _mm_mul_ps(r2, _mm_set1_ps(tm.mat[2][3])));
+	_MM_TRANSPOSE4_PS(r0, r1, r2, t);
+
+	Transform ret;
+	_mm_storeu_ps(ret.mat[0], r0);
+	_mm_storeu_ps(ret.mat[1], r1);
+	_mm_storeu_ps(ret.mat[2], r2);
+	_mm_storeu_ps(ret.mat[3], _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f));
+	return ret;
+}
+
+// Batches of tightly packed float3, four (SSE) or eight (AVX builds) at a time; dst may be src (see basic_math.cpp).
+void transformPoints(const Transform& tm, const float3* src, float3* dst, uint count);
+void transformVectors(const Transform& tm, const float3* src, float3* dst, uint count);
+// With normalMatrix = inverseTranspose(modelMatrix); the results are normalized.
+void transformNormals(const Transform& normalMatrix, const float3* src, float3* dst, uint count);
+
 inline float4 getRotationAsQuternion(const float3& axis, float degree)
 {
 	float angle = degree * DEGREE;
@@ -2,6 +2,7 @@
 
 typedef wchar_t wchar;
 typedef unsigned char uint8;
+typedef unsigned short uint16;
 typedef unsigned int uint;
 typedef unsigned long long uint64;
 
@@ -0,0 +1,676 @@
+#include "pch.h"
+#include "deflate.h"
+#include <algorithm>
+
+
+namespace {
+
+const uint windowSize = 32768;
+const uint hashBits = 15;
+const uint minMatch = 3;
+const uint maxMatch = 258;
+const uint maxChainLength = 4;			// Candidates tried per position.
+const uint tokensPerBlock = 1 << 15;	// A block gets codes of its own every so many tokens.
+
+const uint numLitLenSymbols = 286;
+const uint numDistSymbols = 30;
+const uint numCodeLengthSymbols = 19;
+const uint endOfBlock = 256;
+
+const uint16 lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99,
+	115, 131, 163, 195, 227, 258 };
+const uint8 lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const uint16 distBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025,
+	1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const uint8 distExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12,
+	13, 13 };
+const uint8 codeLengthOrder[numCodeLengthSymbols] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// The length and distance codes of every length and distance.
+struct CodeTables
+{
+	uint8 lengthCode[256];		// Of length - 3.
+	uint8 distCode[512];		// Of distance - 1 up to 256, then of 256 + (distance - 1) / 128.
+
+	CodeTables()
+	{
+		for (uint code = 0; code < 29; ++code)
+		{
+			for (uint length = lengthBase[code]; length < lengthBase[code] + (1u << lengthExtra[code]); ++length)
+				lengthCode[length - 3] = (uint8) code;
+		}
+		for (uint code = 0; code < 30; ++code)
+		{
+			for (uint distance = distBase[code]; distance < distBase[code] + (1u << distExtra[code]); ++distance)
+				distCode[distance <= 256 ? distance - 1 : 256 + ((distance - 1) >> 7)] = (uint8) code;
+		}
+	}
+
+	uint distanceCode(uint distance) const
+	{
+		return distCode[distance <= 256 ? distance - 1 : 256 + ((distance - 1) >> 7)];
+	}
+};
+
+const CodeTables& codeTables()
+{
+	static CodeTables tables;
+	return tables;
+}
+
+// A literal byte, or a match of length bytes at distance back.
+struct Token
+{
+	uint16 length;				// 0 for a literal.
+	uint16 value;				// The literal, or the distance.
+};
+
+class BitWriter
+{
+	Array<uint8>&	out;
+	uint64			bits = 0;
+	uint			numBits = 0;
+
+public:
+	BitWriter(Array<uint8>& out) : out(out) {}
+
+	void put(uint value, uint count)		// The low count bits of value, lowest first.
+	{
+		bits |= (uint64) value << numBits;
+		numBits += count;
+		for (; numBits >= 8; numBits -= 8, bits >>= 8)
+			out.push_back((uint8) bits);
+	}
+
+	void flush()
+	{
+		if (numBits > 0)
+			out.push_back((uint8) bits);
+		bits = 0;
+		numBits = 0;
+	}
+};
+
+inline uint reverseBits(uint code, uint length)
+{
+	uint reversed = 0;
+	for (uint i = 0; i < length; ++i, code >>= 1)
+		reversed = reversed << 1 | (code & 1);
+	return reversed;
+}
+
+/*
+Lengths of the minimum redundancy code of n frequencies in non-decreasing order, in place, by the algorithm of
+Moffat and Katajainen: the first pass pairs the nodes into a tree of parent indices, the second turns them into
+depths of the internal nodes, and the third into the depths of the leaves, longest first.
+*/
+void minimumRedundancyLengths(uint* a, uint n)
+{
+	if (n == 1)
+	{
+		a[0] = 1;
+		return;
+	}
+
+	a[0] += a[1];
+	uint root = 0, leaf = 2;
+	for (uint next = 1; next < n - 1; ++next)
+	{
+		if (leaf >= n || a[root] < a[leaf])
+		{
+			a[next] = a[root];
+			a[root++] = next;
+		}
+		else
+			a[next] = a[leaf++];
+
+		if (leaf >= n || (root < next && a[root] < a[leaf]))
+		{
+			a[next] += a[root];
+			a[root++] = next;
+		}
+		else
+			a[next] += a[leaf++];
+	}
+
+	a[n - 2] = 0;
+	for (int next = (int) n - 3; next >= 0; --next)
+		a[next] = a[a[next]] + 1;
+
+	int available = 1, used = 0, depth = 0;
+	int rootIdx = (int) n - 2, nextIdx = (int) n - 1;
+	while (available > 0)
+	{
+		for (; rootIdx >= 0 && (int) a[rootIdx] == depth; --rootIdx)
+			++used;
+		for (; available > used; --available)
+			a[nextIdx--] = (uint) depth;
+		available = 2 * used;
+		++depth;
+		used = 0;
+	}
+}
+
+struct HuffmanCode
+{
+	uint8	lengths[numLitLenSymbols];
+	uint16	codes[numLitLenSymbols];	// Bit reversed, to be written lowest bit first.
+
+	void build(const uint* freqs, uint numSymbols, uint maxLength);
+	void put(BitWriter& writer, uint symbol) const		{ writer.put(codes[symbol], lengths[symbol]); }
+};
+
+/*
+Canonical code lengths of at most maxLength bits. At least two symbols get a code, those in use or else the first
+ones, so that the code is complete as inflate requires. Codes longer than maxLength are shortened by the usual
+redistribution over the counts of each length, which keeps the code complete, and the lengths are then dealt out
+again by frequency.
+*/
+void HuffmanCode::build(const uint* freqs, uint numSymbols, uint maxLength)
+{
+	memset(lengths, 0, sizeof(lengths));
+	memset(codes, 0, sizeof(codes));
+
+	uint symbols[numLitLenSymbols], weights[numLitLenSymbols];
+	uint numUsed = 0;
+	for (uint s = 0; s < numSymbols; ++s)
+	{
+		if (freqs[s])
+			symbols[numUsed++] = s;
+	}
+	for (uint s = 0; numUsed < 2; ++s)
+	{
+		if (!freqs[s])
+			symbols[numUsed++] = s;
+	}
+
+	auto weightOf = [&](uint s) { return _max(freqs[s], 1u); };
+	std::sort(symbols, symbols + numUsed, [&](uint a, uint b) {
+		return weightOf(a) < weightOf(b) || (weightOf(a) == weightOf(b) && a > b);
+	});
+	for (uint i = 0; i < numUsed; ++i)
+		weights[i] = weightOf(symbols[i]);
+	minimumRedundancyLengths(weights, numUsed);
+
+	uint numCodes[17] = {};
+	for (uint i = 0; i < numUsed; ++i)
+		++numCodes[_min(weights[i], maxLength)];
+
+	uint total = 0;
+	for (uint length = 1; length <= maxLength; ++length)
+		total += numCodes[length] << (maxLength - length);
+	for (; total != 1u << maxLength; --total)
+	{
+		--numCodes[maxLength];
+		for (uint length = maxLength - 1; length > 0; --length)
+		{
+			if (numCodes[length])
+			{
+				--numCodes[length];
+				numCodes[length + 1] += 2;
+				break;
+			}
+		}
+	}
+
+	// The most frequent symbols, at the end, get the shortest codes.
+	uint length = 1, i = numUsed;
+	for (; length <= maxLength; ++length)
+	{
+		for (uint n = 0; n < numCodes[length]; ++n)
+			lengths[symbols[--i]] = (uint8) length;
+	}
+
+	uint lengthCounts[17] = {}, nextCode[17] = {};
+	for (uint s = 0; s < numSymbols; ++s)
+		++lengthCounts[lengths[s]];
+	lengthCounts[0] = 0;
+	for (uint code = 0, len = 1; len <= maxLength; ++len)
+	{
+		code = (code + lengthCounts[len - 1]) << 1;
+		nextCode[len] = code;
+	}
+	for (uint s = 0; s < numSymbols; ++s)
+	{
+		if (lengths[s])
+			codes[s] = (uint16) reverseBits(nextCode[lengths[s]]++, lengths[s]);
+	}
+}
+
+void writeBlock(BitWriter& writer, const Token* tokens, uint numTokens, bool last)
+{
+	const CodeTables& tables = codeTables();
+	uint litFreqs[numLitLenSymbols] = {}, distFreqs[numDistSymbols] = {};
+	for (uint i = 0; i < numTokens; ++i)
+	{
+		const Token& token = tokens[i];
+		if (token.length == 0)
+			++litFreqs[token.value];
+		else
+		{
+			++litFreqs[257 + tables.lengthCode[token.length - 3]];
+			++distFreqs[tables.distanceCode(token.value)];
+		}
+	}
+	litFreqs[endOfBlock] = 1;
+
+	HuffmanCode litCode, distCode, lengthCode;
+	litCode.build(litFreqs, numLitLenSymbols, 15);
+	distCode.build(distFreqs, numDistSymbols, 15);
+
+	uint numLit = numLitLenSymbols, numDist = numDistSymbols;
+	for (; numLit > 257 && !litCode.lengths[numLit - 1]; --numLit);
+	for (; numDist > 1 && !distCode.lengths[numDist - 1]; --numDist);
+
+	// The code lengths of both codes, with the runs in the symbols 16 to 18.
+	uint8 lengths[numLitLenSymbols + numDistSymbols];
+	uint numLengths = numLit + numDist;
+	memcpy(lengths, litCode.lengths, numLit);
+	memcpy(lengths + numLit, distCode.lengths, numDist);
+
+	uint8 runSymbols[numLitLenSymbols + numDistSymbols], runExtras[numLitLenSymbols + numDistSymbols];
+	uint numRuns = 0;
+	uint lengthFreqs[numCodeLengthSymbols] = {};
+	auto emit = [&](uint symbol, uint extra) {
+		runSymbols[numRuns] = (uint8) symbol;
+		runExtras[numRuns++] = (uint8) extra;
+		++lengthFreqs[symbol];
+	};
+
+	for (uint i = 0; i < numLengths; )
+	{
+		uint length = lengths[i], run = 1;
+		for (; i + run < numLengths && lengths[i + run] == length; ++run);
+		i += run;
+
+		if (length == 0)
+		{
+			for (; run >= 11; run -= _min(run, 138u))
+				emit(18, _min(run, 138u) - 11);
+			if (run >= 3)
+			{
+				emit(17, run - 3);
+				run = 0;
+			}
+		}
+		else
+		{
+			emit(length, 0);
+			for (--run; run >= 3; run -= _min(run, 6u))
+				emit(16, _min(run, 6u) - 3);
+		}
+		for (; run > 0; --run)
+			emit(length, 0);
+	}
+
+	lengthCode.build(lengthFreqs, numCodeLengthSymbols, 7);
+	uint numLengthCodes = numCodeLengthSymbols;
+	for (; numLengthCodes > 4 && !lengthCode.lengths[codeLengthOrder[numLengthCodes - 1]]; --numLengthCodes);
+
+	writer.put(last ? 1 : 0, 1);
+	writer.put(2, 2);						// Dynamic Huffman codes.
+	writer.put(numLit - 257, 5);
+	writer.put(numDist - 1, 5);
+	writer.put(numLengthCodes - 4, 4);
+	for (uint i = 0; i < numLengthCodes; ++i)
+		writer.put(lengthCode.lengths[codeLengthOrder[i]], 3);
+
+	const uint runExtraBits[3] = { 2, 3, 7 };
+	for (uint i = 0; i < numRuns; ++i)
+	{
+		lengthCode.put(writer, runSymbols[i]);
+		if (runSymbols[i] >= 16)
+			writer.put(runExtras[i], runExtraBits[runSymbols[i] - 16]);
+	}
+
+	for (uint i = 0; i < numTokens; ++i)
+	{
+		const Token& token = tokens[i];
+		if (token.length == 0)
+		{
+			litCode.put(writer, token.value);
+			continue;
+		}
+
+		uint code = tables.lengthCode[token.length - 3];
+		litCode.put(writer, 257 + code);
+		writer.put(token.length - lengthBase[code], lengthExtra[code]);
+
+		code = tables.distanceCode(token.value);
+		distCode.put(writer, code);
+		writer.put(token.value - distBase[code], distExtra[code]);
+	}
+	litCode.put(writer, endOfBlock);
+}
+
+class BitReader
+{
+	const uint8*	src;
+	uint			size;
+	uint			pos = 0;
+	uint64			bits = 0;
+	uint			numBits = 0;
+
+public:
+	bool			overrun = false;		// Bits were read past the end, as zeros.
+
+	BitReader(const uint8* src, uint size) : src(src), size(size) {}
+
+	uint get(uint count)					// The next count bits, lowest first; count <= 24.
+	{
+		for (; numBits < count; numBits += 8, ++pos)
+		{
+			overrun |= pos >= size;
+			bits |= (uint64) (pos < size ? src[pos] : 0) << numBits;
+		}
+		uint value = (uint) bits & ((1u << count) - 1);
+		bits >>= count;
+		numBits -= count;
+		return value;
+	}
+
+	void alignToByte()						{ get(numBits % 8); }
+};
+
+/*
+A canonical Huffman code of the deflate blocks, decoded a bit at a time from the number of codes of each length:
+the codes of one length are consecutive and follow those of the length before, shifted by one bit.
+*/
+struct HuffmanDecoder
+{
+	uint16 counts[16];
+	uint16 symbols[numLitLenSymbols + 2];
+
+	// Returns false if the lengths give more codes than the bits can hold.
+	bool build(const uint8* lengths, uint numSymbols)
+	{
+		memset(counts, 0, sizeof(counts));
+		for (uint s = 0; s < numSymbols; ++s)
+			counts[lengths[s]]++;
+		counts[0] = 0;
+
+		int left = 1;
+		uint16 offsets[16] = {};
+		for (uint length = 1; length < 16; ++length)
+		{
+			left = 2 * left - counts[length];
+			if (left < 0)
+				return false;
+			if (length < 15)
+				offsets[length + 1] = offsets[length] + counts[length];
+		}
+		for (uint s = 0; s < numSymbols; ++s)
+		{
+			if (lengths[s] != 0)
+				symbols[offsets[lengths[s]]++] = (uint16) s;
+		}
+		return true;
+	}
+
+	int decode(BitReader& reader) const		// -1 for a code which is not in the table.
+	{
+		int code = 0, first = 0, index = 0;
+		for (uint length = 1; length < 16; ++length)
+		{
+			code |= (int) reader.get(1);
+			if (code - first < counts[length])
+				return symbols[index + code - first];
+			index += counts[length];
+			first = (first + counts[length]) << 1;
+			code <<= 1;
+		}
+		return -1;
+	}
+};
+
+// The literals and matches of one block up to its end, appended to dst.
+bool inflateBlock(BitReader& reader, const HuffmanDecoder& litCode, const HuffmanDecoder& distCode,
+	Array<uint8>& dst, uint dstBegin)
+{
+	for (;;)
+	{
+		int symbol = litCode.decode(reader);
+		if (symbol < 0 || reader.overrun)
+			return false;
+		if (symbol < (int) endOfBlock)
+		{
+			dst.push_back((uint8) symbol);
+			continue;
+		}
+		if (symbol == (int) endOfBlock)
+			return true;
+
+		uint code = symbol - 257;
+		if (code >= 29)
+			return false;
+		uint length = lengthBase[code] + reader.get(lengthExtra[code]);
+		int distSymbol = distCode.decode(reader);
+		if (distSymbol < 0 || distSymbol >= (int) numDistSymbols)
+			return false;
+		uint distance = distBase[distSymbol] + reader.get(distExtra[distSymbol]);
+		if (distance > dst.size() - dstBegin)
+			return false;
+		for (uint i = 0; i < length; ++i)
+		{
+			uint8 byte = dst[dst.size() - distance];
+			dst.push_back(byte);
+		}
+	}
+}
+
+// The code lengths of a block with dynamic Huffman codes, themselves coded as in writeBlock().
+bool readDynamicCodes(BitReader& reader, HuffmanDecoder& litCode, HuffmanDecoder& distCode)
+{
+	uint numLit = reader.get(5) + 257;
+	uint numDist = reader.get(5) + 1;
+	uint numCodeLengths = reader.get(4) + 4;
+	if (numLit > numLitLenSymbols || numDist > numDistSymbols)
+		return false;
+
+	uint8 lengths[numLitLenSymbols + numDistSymbols] = {};
+	for (uint i = 0; i < numCodeLengths; ++i)
+		lengths[codeLengthOrder[i]] = (uint8) reader.get(3);
+	HuffmanDecoder lengthCode;
+	if (!lengthCode.build(lengths, numCodeLengthSymbols))
+		return false;
+
+	memset(lengths, 0, sizeof(lengths));
+	for (uint i = 0; i < numLit + numDist; )
+	{
+		int symbol = lengthCode.decode(reader);
+		if (symbol < 0 || reader.overrun)
+			return false;
+		uint repeat = 1;
+		uint8 length = (uint8) symbol;
+		if (symbol == 16)
+		{
+			if (i == 0)
+				return false;
+			length = lengths[i - 1];
+			repeat = 3 + reader.get(2);
+		}
+		else if (symbol == 17)
+		{
+			length = 0;
+			repeat = 3 + reader.get(3);
+		}
+		else if (symbol == 18)
+		{
+			length = 0;
+			repeat = 11 + reader.get(7);
+		}
+		if (i + repeat > numLit + numDist)
+			return false;
+		for (; repeat > 0; --repeat)
+			lengths[i++] = length;
+	}
+	return lengths[endOfBlock] != 0 && litCode.build(lengths, numLit) && distCode.build(lengths + numLit, numDist);
+}
+
+}	// namespace
+
+
+uint adler32(const uint8* data, uint size, uint adler)
+{
+	uint a = adler & 0xFFFF, b = adler >> 16;
+	while (size > 0)
+	{
+		uint n = _min(size, 5552u);			// The most bytes before b could overflow.
+		size -= n;
+		for (; n > 0; --n)
+		{
+			a += *data++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return b << 16 | a;
+}
+
+void zlibCompress(const uint8* src, uint size, Array<uint8>& dst)
+{
+	const uint windowMask = windowSize - 1;
+	dst.reserve(dst.size() + size + size / 8 + 64);
+	BitWriter writer(dst);
+	writer.put(0x78, 8);					// Deflate with a 32 KB window,
+	writer.put(0x01, 8);					// and the check bits of the header.
+
+	Array<int> head(1 << hashBits, -1);		// Last position of each hash,
+	Array<int> prev(windowSize, -1);		// and the one before it with the same hash, by position in the window.
+	Array<Token> tokens(tokensPerBlock);
+	uint numTokens = 0;
+	bool finished = false;
+
+	auto hashAt = [&](uint pos) {
+		uint bytes = src[pos] | (uint) src[pos + 1] << 8 | (uint) src[pos + 2] << 16;
+		return (bytes * 2654435761u) >> (32 - hashBits);
+	};
+	auto insert = [&](uint pos) {
+		uint hash = hashAt(pos);
+		int candidate = head[hash];
+		prev[pos & windowMask] = candidate;
+		head[hash] = (int) pos;
+		return candidate;
+	};
+
+	for (uint pos = 0; pos < size; )
+	{
+		uint bestLength = 0, bestDistance = 0;
+		if (pos + minMatch <= size)
+		{
+			uint maxLength = _min(maxMatch, size - pos);
+			int candidate = insert(pos);
+			for (uint chain = 0; candidate >= 0 && chain < maxChainLength; ++chain)
+			{
+				uint distance = pos - (uint) candidate;
+				if (distance > windowSize)
+					break;
+
+				// A longer match has to differ from the best one at its end.
+				if (src[candidate + bestLength] == src[pos + bestLength])
+				{
+					uint length = 0;
+					for (; length < maxLength && src[candidate + length] == src[pos + length]; ++length);
+					if (length > bestLength)
+					{
+						bestLength = length;
+						bestDistance = distance;
+						if (length == maxLength)
+							break;
+					}
+				}
+
+				// The chains only go back; a later position means the slot has been reused.
+				int next = prev[candidate & windowMask];
+				if (next >= candidate)
+					break;
+				candidate = next;
+			}
+		}
+
+		if (bestLength >= minMatch)
+		{
+			tokens[numTokens++] = { (uint16) bestLength, (uint16) bestDistance };
+			for (uint p = pos + 1; p < pos + bestLength && p + minMatch <= size; ++p)
+				insert(p);
+			pos += bestLength;
+		}
+		else
+		{
+			tokens[numTokens++] = { 0, src[pos] };
+			++pos;
+		}
+
+		if (numTokens == tokensPerBlock)
+		{
+			finished = pos == size;
+			writeBlock(writer, tokens.data(), numTokens, finished);
+			numTokens = 0;
+		}
+	}
+	if (!finished)
+		writeBlock(writer, tokens.data(), numTokens, true);
+	writer.flush();
+
+	uint adler = adler32(src, size);
+	for (int shift = 24; shift >= 0; shift -= 8)
+		dst.push_back((uint8) (adler >> shift));
+}
+
+bool zlibDecompress(const uint8* src, uint size, Array<uint8>& dst)
+{
+	// Deflate with a window of at most 32 KB and no preset dictionary.
+	if (size < 6 || (src[0] & 0x0F) != 8 || (src[0] >> 4) > 7 || (src[0] << 8 | src[1]) % 31 != 0 || (src[1] & 0x20))
+		return false;
+
+	uint dstBegin = dst.size();
+	BitReader reader(src + 2, size - 6);
+	bool last = false;
+	while (!last)
+	{
+		last = reader.get(1) != 0;
+		uint type = reader.get(2);
+		if (type == 0)
+		{
+			reader.alignToByte();
+			uint length = reader.get(16);
+			if ((reader.get(16) ^ 0xFFFF) != length)
+				return false;
+			for (; length > 0 && !reader.overrun; --length)
+				dst.push_back((uint8) reader.get(8));
+		}
+		else if (type == 1)
+		{
+			// The fixed codes of RFC 1951, 3.2.6.
+			uint8 lengths[288 + numDistSymbols];
+			memset(lengths, 8, 144);
+			memset(lengths + 144, 9, 112);
+			memset(lengths + 256, 7, 24);
+			memset(lengths + 280, 8, 8);
+			memset(lengths + 288, 5, numDistSymbols);
+			HuffmanDecoder litCode, distCode;
+			litCode.build(lengths, 288);
+			distCode.build(lengths + 288, numDistSymbols);
+			if (!inflateBlock(reader, litCode, distCode, dst, dstBegin))
+				return false;
+		}
+		else if (type == 2)
+		{
+			HuffmanDecoder litCode, distCode;
+			if (!readDynamicCodes(reader, litCode, distCode) || !inflateBlock(reader, litCode, distCode, dst, dstBegin))
+				return false;
+		}
+		else
+		{
+			return false;
+		}
+		if (reader.overrun)
+			return false;
+	}
+
+	// The checksum follows the last block in the four bytes which the reader was not given.
+	const uint8* end = src + size - 4;
+	uint adler = (uint) end[0] << 24 | (uint) end[1] << 16 | (uint) end[2] << 8 | end[3];
+	return adler32(dst.data() + dstBegin, dst.size() - dstBegin) == adler;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include "pch.h"
+
+
+/*
+A zlib stream (RFC 1950, 1951) compressor for the image writers, so that they need no library: greedy LZ77 over
+hash chains in a 32 KB window, and deflate blocks with dynamic Huffman codes built for each block. It compresses
+about as well as zlib at its fastest levels. One call is single threaded; the EXR writer runs one per block of
+scanlines.
+*/
+
+// Appends the zlib stream of src[0 .. size) to dst.
+void zlibCompress(const uint8* src, uint size, Array<uint8>& dst);
+
+// Appends what the zlib stream src[0 .. size) holds to dst, such as to check the files written; returns false if
+// the stream is not valid or does not end within size, or its checksum does not match.
+bool zlibDecompress(const uint8* src, uint size, Array<uint8>& dst);
+
+uint adler32(const uint8* data, uint size, uint adler = 1);
@@ -710,7 +710,10 @@ void ReadbackBuffer::readback(ID3D12GraphicsCommandList* cmdList, dxResource& so
 	if (desc.Dimension == D3D12_RESOURCE_DIMENSION_BUFFER)
 	{
 		if(desc.Width > maxReadbackSize)
+		{
+			destroy();
 			create(desc.Width * 2);
+		}
 
 		D3D12_RESOURCE_STATES prevState = source.changeResourceState(cmdList, D3D12_RESOURCE_STATE_COPY_SOURCE);
 		cmdList->CopyBufferRegion(readbackBuffer, 0, source.get(), 0, desc.Width);
@@ -729,7 +732,10 @@ void ReadbackBuffer::readback(ID3D12GraphicsCommandList* cmdList, dxResource& so
 		rowPitch = textureLayout.Footprint.RowPitch;
 
 		if(copyableSize > maxReadbackSize)
+		{
+			destroy();
 			create(copyableSize * 2);
+		}
 
 		D3D12_RESOURCE_STATES prevState = source.changeResourceState(cmdList, D3D12_RESOURCE_STATE_COPY_SOURCE);
 
@@ -907,6 +913,45 @@ void dxShader::load(LPCWSTR hlslFile, const char* entryFtn, const char* target)
 
 
 
+// [GPUTimestamps]
+void GPUTimestamps::destroy()
+{
+	readbackBuffer.destroy();
+	SAFE_RELEASE(queryHeap);
+	numStamps = 0;
+}
+
+void GPUTimestamps::create(ID3D12CommandQueue* cmdQueue, uint numStamps)
+{
+	if (queryHeap != nullptr)
+		throw Error("destroy() must be called before re-creating.");
+
+	D3D12_QUERY_HEAP_DESC desc = {};
+	desc.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+	desc.Count = numStamps;
+	ThrowFailedHR(gDevice->CreateQueryHeap(&desc, IID_PPV_ARGS(&queryHeap)));
+
+	UINT64 frequency;
+	ThrowFailedHR(cmdQueue->GetTimestampFrequency(&frequency));
+	msPerTick = 1000.0 / frequency;
+
+	readbackBuffer.create(numStamps * sizeof(UINT64));
+	this->numStamps = numStamps;
+}
+
+void GPUTimestamps::resolve(ID3D12GraphicsCommandList* cmdList)
+{
+	cmdList->ResolveQueryData(queryHeap, D3D12_QUERY_TYPE_TIMESTAMP, 0, numStamps, readbackBuffer.get(), 0);
+}
+
+double GPUTimestamps::getElapsedTime(uint fromIdx, uint toIdx)
+{
+	const UINT64* ticks = (const UINT64*) readbackBuffer.map();
+	return (ticks[toIdx] > ticks[fromIdx]) ? (ticks[toIdx] - ticks[fromIdx]) * msPerTick : 0.0;
+}
+
+
+
 
 //---------------------From here, DXR related helper---------------------------------//
 
@@ -923,7 +968,8 @@ ID3D12Resource* createAS(
     D3D12_RAYTRACING_ACCELERATION_STRUCTURE_PREBUILD_INFO info;
     device->GetRaytracingAccelerationStructurePrebuildInfo(&buildInput, &info);
 
-	*scrach = createCommittedBuffer(info.ScratchDataSizeInBytes, 
+	// Large enough for the updates too, if buildInput allows them.
+	*scrach = createCommittedBuffer(_max(info.ScratchDataSizeInBytes, info.UpdateScratchDataSizeInBytes), 
 		D3D12_HEAP_TYPE_DEFAULT, 
 		D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
 		D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
@@ -950,6 +996,34 @@ ID3D12Resource* createAS(
 }
 
 
+static D3D12_RAYTRACING_GEOMETRY_DESC makeGeometryDesc(
+	const GPUMesh& gpuMesh,
+	D3D12_GPU_VIRTUAL_ADDRESS gpuTransformAddress,
+	uint vertexStride)
+{
+	D3D12_RAYTRACING_GEOMETRY_DESC meshDesc = {};
+	meshDesc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
+	meshDesc.Flags = D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE;
+	meshDesc.Triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
+	meshDesc.Triangles.VertexBuffer.StrideInBytes = vertexStride;
+	meshDesc.Triangles.IndexFormat = DXGI_FORMAT_R32_UINT;
+	meshDesc.Triangles.VertexCount = gpuMesh.numVertices;
+	meshDesc.Triangles.VertexBuffer.StartAddress = gpuMesh.vertexBufferVA;
+	meshDesc.Triangles.IndexCount = gpuMesh.numTridices * 3;
+	meshDesc.Triangles.IndexBuffer = gpuMesh.tridexBufferVA;
+	meshDesc.Triangles.Transform3x4 = gpuTransformAddress;
+	return meshDesc;
+}
+
+static void addUAVBarrier(ID3D12GraphicsCommandList4* cmdList, ID3D12Resource* resource)
+{
+	D3D12_RESOURCE_BARRIER uavBarrier = {};
+	uavBarrier.Type = D3D12_RESOURCE_BARRIER_TYPE_UAV;
+	uavBarrier.UAV.pResource = resource;
+	cmdList->ResourceBarrier(1, &uavBarrier);
+}
+
+
 void buildBLAS(ID3D12GraphicsCommandList4* cmdList,
 	ID3D12Resource** blas,
 	ID3D12Resource** scrach,
@@ -959,22 +1033,10 @@ void buildBLAS(ID3D12GraphicsCommandList4* cmdList,
 	uint vertexStride,
 	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags)
 {
-	D3D12_RAYTRACING_GEOMETRY_DESC meshDesc = {};
-	meshDesc.Type = D3D12_RAYTRACING_GEOMETRY_TYPE_TRIANGLES;
-	meshDesc.Flags = D3D12_RAYTRACING_GEOMETRY_FLAG_OPAQUE;
-	meshDesc.Triangles.VertexFormat = DXGI_FORMAT_R32G32B32_FLOAT;
-	meshDesc.Triangles.VertexBuffer.StrideInBytes = vertexStride;
-	meshDesc.Triangles.IndexFormat = DXGI_FORMAT_R32_UINT;
-
 	Array<D3D12_RAYTRACING_GEOMETRY_DESC> geoDesc(numMeshes);
 	for (uint i = 0; i < numMeshes; ++i)
 	{
-		geoDesc[i] = meshDesc;
-		geoDesc[i].Triangles.VertexCount = gpuMeshArr[i].numVertices;
-		geoDesc[i].Triangles.VertexBuffer.StartAddress = gpuMeshArr[i].vertexBufferVA;
-		geoDesc[i].Triangles.IndexCount = gpuMeshArr[i].numTridices * 3;
-		geoDesc[i].Triangles.IndexBuffer = gpuMeshArr[i].tridexBufferVA;
-		geoDesc[i].Triangles.Transform3x4 = gpuTransformAddressArr[i];
+		geoDesc[i] = makeGeometryDesc(gpuMeshArr[i], gpuTransformAddressArr[i], vertexStride);
 	}
 	
 	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS buildInput = {};
@@ -989,20 +1051,15 @@ void buildBLAS(ID3D12GraphicsCommandList4* cmdList,
 }
 
 
-void buildTLAS(ID3D12GraphicsCommandList4* cmdList,
-	ID3D12Resource** tlas,
-	ID3D12Resource** scrach,
-	ID3D12Resource** instanceDescArr,
+static void writeInstanceDescs(
+	ID3D12Resource* instanceDescArr,
 	ID3D12Resource* const blasArr[],
 	const dxTransform transformArr[],
 	uint numBlas,
-	uint instanceMultiplier,
-	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags)
+	uint instanceMultiplier)
 {
-	*instanceDescArr = createCommittedBuffer(sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * numBlas);
-
 	D3D12_RAYTRACING_INSTANCE_DESC* pInsDescArr; 
-	(*instanceDescArr)->Map(0, &Range(0), (void**)&pInsDescArr);
+	instanceDescArr->Map(0, &Range(0), (void**)&pInsDescArr);
 	{
 		memset(pInsDescArr, 0, sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * numBlas);
 		for (uint i = 0; i < numBlas; ++i)
@@ -1013,7 +1070,23 @@ void buildTLAS(ID3D12GraphicsCommandList4* cmdList,
 			pInsDescArr[i].AccelerationStructure = const_cast<ID3D12Resource*>(blasArr[i])->GetGPUVirtualAddress();
 		}
 	}
-	(*instanceDescArr)->Unmap(0, nullptr);
+	instanceDescArr->Unmap(0, nullptr);
+}
+
+
+void buildTLAS(ID3D12GraphicsCommandList4* cmdList,
+	ID3D12Resource** tlas,
+	ID3D12Resource** scrach,
+	ID3D12Resource** instanceDescArr,
+	ID3D12Resource* const blasArr[],
+	const dxTransform transformArr[],
+	uint numBlas,
+	uint instanceMultiplier,
+	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags)
+{
+	*instanceDescArr = createCommittedBuffer(sizeof(D3D12_RAYTRACING_INSTANCE_DESC) * numBlas);
+
+	writeInstanceDescs(*instanceDescArr, blasArr, transformArr, numBlas, instanceMultiplier);
 
 	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_INPUTS buildInput = {};
     buildInput.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
@@ -1061,7 +1134,7 @@ void dxAccelerationStructure::build(
 	uint numObjsPerBlas = (buildMode == ONLY_ONE_BLAS) ? numObjs : 1;
 	uint numBottomLevels = (buildMode == ONLY_ONE_BLAS) ? 1 : numObjs;
 	blas.resize(numBottomLevels, nullptr);
-	scratch.resize(numBottomLevels + 1, nullptr);
+	scratch.resize(numBottomLevels, nullptr);
 
 	for (uint i = 0; i < numBottomLevels; ++i)
 	{
@@ -1081,19 +1154,128 @@ void dxAccelerationStructure::build(
 		topLevelTransform = &transformArr;
 	}
 
-	buildTLAS(cmdList, &tlas, &scratch[numBottomLevels], &instances, 
+	buildTLAS(cmdList, &tlas, &tlasScratch, &instances, 
 		&blas[0], &(*topLevelTransform)[0], numBottomLevels, instanceMultiplier, buildFlags);
+	numInstances = numBottomLevels;
+	tlasFlags = buildFlags;
+}
+
+uint dxAccelerationStructure::addBottomLevel(
+	ID3D12GraphicsCommandList4* cmdList,
+	const GPUMesh& gpuMesh,
+	uint vertexStride,
+	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags)
+{
+	D3D12_GPU_VIRTUAL_ADDRESS noTransform = 0;
+	blas.push_back(nullptr);
+	blasScratch.push_back(nullptr);
+	blasMeshArr.push_back(gpuMesh);
+	blasFlagsArr.push_back(buildFlags);
+	buildBLAS(cmdList, &blas[blas.size() - 1], &blasScratch[blasScratch.size() - 1], 
+		&gpuMesh, &noTransform, 1, vertexStride, buildFlags);
+	return blas.size() - 1;
+}
+
+bool dxAccelerationStructure::rebuildBottomLevel(
+	ID3D12GraphicsCommandList4* cmdList,
+	uint blasIdx,
+	uint vertexStride,
+	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags,
+	bool update)
+{
+	// Other flags need other sizes of the level and its scratch.
+	if (buildFlags != blasFlagsArr[blasIdx])
+	{
+		assert(!update);
+		D3D12_GPU_VIRTUAL_ADDRESS noTransform = 0;
+		SAFE_RELEASE(blas[blasIdx]);
+		SAFE_RELEASE(blasScratch[blasIdx]);
+		blasFlagsArr[blasIdx] = buildFlags;
+		buildBLAS(cmdList, &blas[blasIdx], &blasScratch[blasIdx], 
+			&blasMeshArr[blasIdx], &noTransform, 1, vertexStride, buildFlags);
+		return true;
+	}
+
+	D3D12_RAYTRACING_GEOMETRY_DESC geoDesc = makeGeometryDesc(blasMeshArr[blasIdx], 0, vertexStride);
+
+	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC asDesc = {};
+	asDesc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL;
+	asDesc.Inputs.NumDescs = 1;
+	asDesc.Inputs.Flags = buildFlags;
+	asDesc.Inputs.pGeometryDescs = &geoDesc;
+	asDesc.DestAccelerationStructureData = blas[blasIdx]->GetGPUVirtualAddress();
+	asDesc.ScratchAccelerationStructureData = blasScratch[blasIdx]->GetGPUVirtualAddress();
+	if (update)
+	{
+		assert(buildFlags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE);
+		asDesc.Inputs.Flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+		asDesc.SourceAccelerationStructureData = asDesc.DestAccelerationStructureData;
+	}
+	cmdList->BuildRaytracingAccelerationStructure(&asDesc, 0, nullptr);
+	addUAVBarrier(cmdList, blas[blasIdx]);
+	return false;
+}
+
+void dxAccelerationStructure::buildTopLevel(
+	ID3D12GraphicsCommandList4* cmdList,
+	const Array<uint>& blasIdxArr,
+	const Array<dxTransform>& transformArr,
+	uint instanceMultiplier,
+	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags,
+	bool update)
+{
+	assert(blasIdxArr.size() == transformArr.size());
+
+	uint numNewInstances = transformArr.size();
+	Array<ID3D12Resource*> instanceBlasArr(numNewInstances);
+	for (uint i = 0; i < numNewInstances; ++i)
+		instanceBlasArr[i] = blas[blasIdxArr[i]];
+
+	if (tlas == nullptr || instances == nullptr || numInstances != numNewInstances || buildFlags != tlasFlags)
+	{
+		SAFE_RELEASE(tlas);
+		SAFE_RELEASE(tlasScratch);
+		SAFE_RELEASE(instances);
+		buildTLAS(cmdList, &tlas, &tlasScratch, &instances, 
+			instanceBlasArr.data(), transformArr.data(), numNewInstances, instanceMultiplier, buildFlags);
+		numInstances = numNewInstances;
+		tlasFlags = buildFlags;
+		return;
+	}
+
+	// Same size as before, so the instance descriptions, the top level and its scratch are reused as they are.
+	// An update refits the previous top level to the new transforms instead of building it.
+	writeInstanceDescs(instances, instanceBlasArr.data(), transformArr.data(), numInstances, instanceMultiplier);
+
+	D3D12_BUILD_RAYTRACING_ACCELERATION_STRUCTURE_DESC asDesc = {};
+	asDesc.Inputs.Type = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL;
+	asDesc.Inputs.NumDescs = numInstances;
+	asDesc.Inputs.Flags = buildFlags;
+	asDesc.Inputs.InstanceDescs = instances->GetGPUVirtualAddress();
+	asDesc.DestAccelerationStructureData = tlas->GetGPUVirtualAddress();
+	asDesc.ScratchAccelerationStructureData = tlasScratch->GetGPUVirtualAddress();
+	if (update)
+	{
+		assert(buildFlags & D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_ALLOW_UPDATE);
+		asDesc.Inputs.Flags |= D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_PERFORM_UPDATE;
+		asDesc.SourceAccelerationStructureData = asDesc.DestAccelerationStructureData;
+	}
+	cmdList->BuildRaytracingAccelerationStructure(&asDesc, 0, nullptr);
+	addUAVBarrier(cmdList, tlas);
 }
 
 void dxAccelerationStructure::destroy()
 {
 	flush();
-	for (uint i = 0; i < scratch.size(); ++i)
+	for (uint i = 0; i < blas.size(); ++i)
 	{
 		SAFE_RELEASE(blas[i]);
 	}
 	SAFE_RELEASE(tlas);
 	blas.clear();
+	blasMeshArr.clear();
+	blasFlagsArr.clear();
+	numInstances = 0;
 }
 
 void dxAccelerationStructure::flush()
@@ -1102,6 +1284,12 @@ void dxAccelerationStructure::flush()
 	{
 		SAFE_RELEASE(scratch[i]);
 	}
+	for (uint i = 0; i < blasScratch.size(); ++i)
+	{
+		SAFE_RELEASE(blasScratch[i]);
+	}
+	SAFE_RELEASE(tlasScratch);
+	blasScratch.clear();
 	SAFE_RELEASE(instances);
 	transformBuff.destroy();
 	scratch.clear();
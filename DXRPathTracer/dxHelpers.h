@@ -2,6 +2,7 @@
 #include "pch.h"
 #include <d3d12.h>
 #include <dxgi1_4.h>
+#include "FrameRing.h"
 
 
 #define SAFE_DELETE(x) if(x) delete x; x=nullptr
@@ -26,8 +27,13 @@ inline constexpr uint _bpp(DXGI_FORMAT format)	//bytes per pixel
 	{
 	case DXGI_FORMAT_R8G8B8A8_UNORM:
 	case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+	case DXGI_FORMAT_R9G9B9E5_SHAREDEXP:
+	case DXGI_FORMAT_R32_UINT:
 		return 4;
 
+	case DXGI_FORMAT_R16G16B16A16_FLOAT:
+		return 8;
+
 	case DXGI_FORMAT_R32G32B32A32_FLOAT:
 		return 16;
 
@@ -560,13 +566,15 @@ class ReadbackBuffer
 protected:
 	ID3D12Resource* readbackBuffer = nullptr;
 	void* cpuAddress = nullptr;
-	uint64 maxReadbackSize;
+	uint64 maxReadbackSize = 0;
 
 public:
 	~ReadbackBuffer() { destroy(); }
 	ReadbackBuffer()  {}
 	ReadbackBuffer(uint64 requiredSize) { create(requiredSize); }
 
+	ID3D12Resource* get() const { return readbackBuffer; }
+	uint64 getMaxReadbackSize() const { return readbackBuffer ? maxReadbackSize : 0; }
 	void destroy();
 	void create(uint64 requiredSize);
 	void* map();
@@ -635,42 +643,69 @@ public:
 };
 
 
-class BinaryFence
+// The timeline of one command queue: signal() enqueues the next value of the fence after the commands executed so far.
+class TimelineFence : public ITimeline
 {
-	ID3D12Fence*	mFence;
-	HANDLE			mFenceEvent = nullptr;
-	
-	enum FenceValue {
-		zero = 0, one = 1
-	};
+	ID3D12Fence*		mFence = nullptr;
+	HANDLE				mFenceEvent = nullptr;
+	ID3D12CommandQueue*	mCmdQueue = nullptr;
+	uint64				lastSignaled = 0;
 
 public:
-
-	~BinaryFence()
+	~TimelineFence()
 	{
 		if(mFenceEvent)
 			CloseHandle(mFenceEvent);
 		SAFE_RELEASE(mFence);
 	}
 
-	void create(ID3D12Device* device)
+	void create(ID3D12Device* device, ID3D12CommandQueue* cmdQueue)
 	{
-		ThrowFailedHR(device->CreateFence(zero, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&mFence)));
+		ThrowFailedHR(device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&mFence)));
 		mFenceEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+		mCmdQueue = cmdQueue;
 	}
 
-	void waitCommandQueue(ID3D12CommandQueue* cmdQueue)
+	virtual uint64 signal()
 	{
-		ThrowFailedHR(cmdQueue->Signal(mFence, one));
+		ThrowFailedHR(mCmdQueue->Signal(mFence, ++lastSignaled));
+		return lastSignaled;
+	}
 
-		if (mFence->GetCompletedValue() != one)
+	virtual uint64 getCompletedValue()
+	{
+		return mFence->GetCompletedValue();
+	}
+
+	virtual void waitForValue(uint64 value)
+	{
+		if (mFence->GetCompletedValue() < value)
 		{
-			ThrowFailedHR(mFence->SetEventOnCompletion(one, mFenceEvent));
+			ThrowFailedHR(mFence->SetEventOnCompletion(value, mFenceEvent));
 			WaitForSingleObject(mFenceEvent, INFINITE);
 		}
+	}
+};
+
 
-		ThrowFailedHR(cmdQueue->Signal(mFence, zero));
+// GPU timestamps written between the commands of a frame. They can be read once the command list has completed.
+class GPUTimestamps
+{
+	ID3D12QueryHeap*	queryHeap = nullptr;
+	ReadbackBuffer		readbackBuffer;
+	uint				numStamps = 0;
+	double				msPerTick = 0.0;
+
+public:
+	~GPUTimestamps() { destroy(); }
+
+	void destroy();
+	void create(ID3D12CommandQueue* cmdQueue, uint numStamps);
+	void stamp(ID3D12GraphicsCommandList* cmdList, uint stampIdx) {
+		cmdList->EndQuery(queryHeap, D3D12_QUERY_TYPE_TIMESTAMP, stampIdx);
 	}
+	void resolve(ID3D12GraphicsCommandList* cmdList);
+	double getElapsedTime(uint fromIdx, uint toIdx);	// In milliseconds.
 };
 
 
@@ -736,7 +771,13 @@ class dxAccelerationStructure
 	Array<ID3D12Resource*> blas;
 	ID3D12Resource* tlas = nullptr;
 	Array<ID3D12Resource*> scratch;
+	ID3D12Resource* tlasScratch = nullptr;
+	Array<ID3D12Resource*> blasScratch;		// Of the bottom levels added by addBottomLevel(), kept for their updates.
+	Array<GPUMesh> blasMeshArr;
+	Array<D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS> blasFlagsArr;
 	ID3D12Resource* instances = nullptr;
+	uint numInstances = 0;
+	D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS tlasFlags = D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAG_NONE;
 	UploadBuffer transformBuff;
 
 public:
@@ -753,6 +794,27 @@ public:
 		uint instanceMultiplier,
 		AccelerationStructureBuildMode buildMode,
 		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags);
+
+	// Incremental alternative to build() for top level transforms: a bottom level is built once per mesh and
+	// shared by its instances, and the top level is rebuilt in place while the number of instances stays the same.
+	// With update, which needs ALLOW_UPDATE in buildFlags, a level is refitted (PERFORM_UPDATE) instead of built.
+	// A level built with other flags than before is allocated again, so that rebuildBottomLevel() returns whether
+	// the top level must be built to point to the level's new address.
+	uint addBottomLevel(ID3D12GraphicsCommandList4* cmdList,
+		const GPUMesh& gpuMesh,
+		uint vertexStride,
+		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags);
+	bool rebuildBottomLevel(ID3D12GraphicsCommandList4* cmdList,
+		uint blasIdx,
+		uint vertexStride,
+		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags,
+		bool update);
+	void buildTopLevel(ID3D12GraphicsCommandList4* cmdList,
+		const Array<uint>& blasIdxArr,
+		const Array<dxTransform>& transformArr,
+		uint instanceMultiplier,
+		D3D12_RAYTRACING_ACCELERATION_STRUCTURE_BUILD_FLAGS buildFlags,
+		bool update = false);
 };
 
 
@@ -0,0 +1,194 @@
+#pragma once
+#include "basic_types.h"
+#include <cmath>
+#include <emmintrin.h>
+
+
+/*
+Approximations of the transcendental functions of shading and tone mapping, four lanes at a time on SSE2, with
+scalar wrappers. The bounds are the largest errors against libm over the given domains, which "--bench fastmath"
+checks on dense sweeps (see Benchmark.cpp):
+
+	fastSin, fastCos, fastSinCos	|x| <= 8192					absolute 2e-7
+	fastExp2						-126 <= x <= 127			relative 3e-7
+	fastExp							-87 <= x <= 88				relative 3e-7
+	fastLog2						normal x > 0				absolute 2e-7 in [1/2, 2], relative 2e-7 elsewhere
+	fastPow							x > 0, |y*log2(x)| <= 64	relative 5e-6;  0 for x <= 0
+	fastPow5						normal results				relative 4e-7
+	fastSqrt						normal x >= 0				relative 4e-7
+
+Out of the domains, fastExp2 and fastExp clamp the exponent, and fastLog2 of 0 is -127 rather than -inf.
+The callers choose per call between these and libm with the math*<MathMode>() functions at the bottom.
+*/
+
+namespace fastMathDetail {
+
+inline __m128 select(__m128 mask, __m128 a, __m128 b)		// mask ? a : b
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// 2^n for integer lanes n in [-126, 127].
+inline __m128 exp2i(__m128i n)
+{
+	return _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23));
+}
+
+// e^r for |r| <= ln(2)/2, Taylor to the 6th power.
+inline __m128 expReduced(__m128 r)
+{
+	__m128 p = _mm_set1_ps(1.0f / 720.0f);
+	p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.0f / 120.0f));
+	p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.0f / 24.0f));
+	p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.0f / 6.0f));
+	p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(0.5f));
+	p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.0f));
+	return _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.0f));
+}
+
+}	// namespace fastMathDetail
+
+
+// Both at once, as the hemisphere samplers need them: x = k*Pi/2 + r with |r| <= Pi/4, split in three parts so that
+// k*Pi/2 is exact, and the quadrant k picks and negates the polynomials of r.
+inline void fastSinCos(__m128 x, __m128& s, __m128& c)
+{
+	using namespace fastMathDetail;
+	__m128i k = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(0.636619772f)));		// round(x * 2/Pi)
+	__m128 kf = _mm_cvtepi32_ps(k);
+	__m128 r = _mm_sub_ps(x, _mm_mul_ps(kf, _mm_set1_ps(1.5703125f)));
+	r = _mm_sub_ps(r, _mm_mul_ps(kf, _mm_set1_ps(4.837512969970703125e-4f)));
+	r = _mm_sub_ps(r, _mm_mul_ps(kf, _mm_set1_ps(7.549789954891882e-8f)));
+	__m128 r2 = _mm_mul_ps(r, r);
+
+	__m128 ps = _mm_set1_ps(1.0f / 362880.0f);
+	ps = _mm_add_ps(_mm_mul_ps(ps, r2), _mm_set1_ps(-1.0f / 5040.0f));
+	ps = _mm_add_ps(_mm_mul_ps(ps, r2), _mm_set1_ps(1.0f / 120.0f));
+	ps = _mm_add_ps(_mm_mul_ps(ps, r2), _mm_set1_ps(-1.0f / 6.0f));
+	ps = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(ps, r2), r), r);
+
+	__m128 pc = _mm_set1_ps(1.0f / 40320.0f);
+	pc = _mm_add_ps(_mm_mul_ps(pc, r2), _mm_set1_ps(-1.0f / 720.0f));
+	pc = _mm_add_ps(_mm_mul_ps(pc, r2), _mm_set1_ps(1.0f / 24.0f));
+	pc = _mm_add_ps(_mm_mul_ps(pc, r2), _mm_set1_ps(-0.5f));
+	pc = _mm_add_ps(_mm_mul_ps(pc, r2), _mm_set1_ps(1.0f));
+
+	// Quadrants 1 and 3 swap sine and cosine; the sine is negated in 2 and 3, the cosine in 1 and 2.
+	__m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(k, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+	__m128 sinSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(k, _mm_set1_epi32(2)), 30));
+	__m128 cosSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(k, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+	s = _mm_xor_ps(select(swap, pc, ps), sinSign);
+	c = _mm_xor_ps(select(swap, ps, pc), cosSign);
+}
+
+inline __m128 fastSin(__m128 x)		{ __m128 s, c; fastSinCos(x, s, c); return s; }
+inline __m128 fastCos(__m128 x)		{ __m128 s, c; fastSinCos(x, s, c); return c; }
+
+inline __m128 fastExp2(__m128 x)
+{
+	using namespace fastMathDetail;
+	x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-126.0f)), _mm_set1_ps(127.0f));
+	__m128i n = _mm_cvtps_epi32(x);
+	__m128 f = _mm_sub_ps(x, _mm_cvtepi32_ps(n));			// |f| <= 1/2, exact
+	return _mm_mul_ps(expReduced(_mm_mul_ps(f, _mm_set1_ps(0.693147181f))), exp2i(n));
+}
+
+// x = n*ln(2) + r with ln(2) split in two, so that the reduction stays exact over the whole domain.
+inline __m128 fastExp(__m128 x)
+{
+	using namespace fastMathDetail;
+	x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-87.0f)), _mm_set1_ps(88.0f));
+	__m128i n = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.44269504f)));
+	__m128 nf = _mm_cvtepi32_ps(n);
+	__m128 r = _mm_sub_ps(x, _mm_mul_ps(nf, _mm_set1_ps(0.693359375f)));
+	r = _mm_sub_ps(r, _mm_mul_ps(nf, _mm_set1_ps(-2.12194440e-4f)));
+	return _mm_mul_ps(expReduced(r), exp2i(n));
+}
+
+// x = 2^e * m with m in [sqrt(1/2), sqrt(2)), and log2(m) = 2/ln(2) * atanh(s) with s = (m - 1) / (m + 1).
+inline __m128 fastLog2(__m128 x)
+{
+	using namespace fastMathDetail;
+	__m128i bits = _mm_castps_si128(x);
+	__m128i e = _mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127));
+	__m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007FFFFF)), _mm_set1_epi32(0x3F800000)));
+
+	__m128 big = _mm_cmpgt_ps(m, _mm_set1_ps(1.41421356f));
+	m = select(big, _mm_mul_ps(m, _mm_set1_ps(0.5f)), m);
+	__m128 ef = _mm_add_ps(_mm_cvtepi32_ps(e), _mm_and_ps(big, _mm_set1_ps(1.0f)));
+
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 s = _mm_div_ps(_mm_sub_ps(m, one), _mm_add_ps(m, one));
+	__m128 s2 = _mm_mul_ps(s, s);
+	__m128 p = _mm_set1_ps(2.885390082f / 9.0f);
+	p = _mm_add_ps(_mm_mul_ps(p, s2), _mm_set1_ps(2.885390082f / 7.0f));
+	p = _mm_add_ps(_mm_mul_ps(p, s2), _mm_set1_ps(2.885390082f / 5.0f));
+	p = _mm_add_ps(_mm_mul_ps(p, s2), _mm_set1_ps(2.885390082f / 3.0f));
+	p = _mm_add_ps(_mm_mul_ps(p, s2), _mm_set1_ps(2.885390082f));
+	return _mm_add_ps(_mm_mul_ps(p, s), ef);
+}
+
+inline __m128 fastPow(__m128 x, __m128 y)
+{
+	__m128 positive = _mm_cmpgt_ps(x, _mm_setzero_ps());
+	return _mm_and_ps(positive, fastExp2(_mm_mul_ps(y, fastLog2(x))));
+}
+
+inline __m128 fastPow5(__m128 x)
+{
+	__m128 x2 = _mm_mul_ps(x, x);
+	return _mm_mul_ps(_mm_mul_ps(x2, x2), x);
+}
+
+// One Newton step on the estimate of the reciprocal square root; 0 stays 0 rather than 0 * inf.
+inline __m128 fastSqrt(__m128 x)
+{
+	__m128 y = _mm_rsqrt_ps(x);
+	__m128 xy = _mm_mul_ps(x, y);
+	__m128 r = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), xy), _mm_sub_ps(_mm_set1_ps(3.0f), _mm_mul_ps(xy, y)));
+	return _mm_and_ps(_mm_cmpgt_ps(x, _mm_setzero_ps()), r);
+}
+
+
+inline float fastSin(float x)				{ return _mm_cvtss_f32(fastSin(_mm_set_ss(x))); }
+inline float fastCos(float x)				{ return _mm_cvtss_f32(fastCos(_mm_set_ss(x))); }
+inline float fastExp2(float x)				{ return _mm_cvtss_f32(fastExp2(_mm_set_ss(x))); }
+inline float fastExp(float x)				{ return _mm_cvtss_f32(fastExp(_mm_set_ss(x))); }
+inline float fastLog2(float x)				{ return _mm_cvtss_f32(fastLog2(_mm_set1_ps(x))); }
+inline float fastPow(float x, float y)		{ return _mm_cvtss_f32(fastPow(_mm_set1_ps(x), _mm_set1_ps(y))); }
+inline float fastPow5(float x)				{ float x2 = x * x; return x2 * x2 * x; }
+inline float fastSqrt(float x)				{ return _mm_cvtss_f32(fastSqrt(_mm_set1_ps(x))); }
+
+inline void fastSinCos(float x, float& s, float& c)
+{
+	__m128 vs, vc;
+	fastSinCos(_mm_set_ss(x), vs, vc);
+	s = _mm_cvtss_f32(vs);
+	c = _mm_cvtss_f32(vc);
+}
+
+
+// libm or the approximations above, chosen at compile time by the caller.
+enum class MathMode
+{
+	Exact,
+	Fast,
+};
+
+template<MathMode Mode> inline float mathSqrt(float x)			{ return Mode == MathMode::Fast ? fastSqrt(x) : sqrtf(x); }
+template<MathMode Mode> inline float mathExp(float x)			{ return Mode == MathMode::Fast ? fastExp(x) : expf(x); }
+template<MathMode Mode> inline float mathPow(float x, float y)	{ return Mode == MathMode::Fast ? fastPow(x, y) : powf(x, y); }
+template<MathMode Mode> inline float mathPow5(float x)			{ return Mode == MathMode::Fast ? fastPow5(x) : powf(x, 5); }
+
+template<MathMode Mode> inline void mathSinCos(float x, float& s, float& c)
+{
+	if (Mode == MathMode::Fast)
+	{
+		fastSinCos(x, s, c);
+	}
+	else
+	{
+		s = sinf(x);
+		c = cosf(x);
+	}
+}
@@ -112,6 +112,10 @@ Mesh generateBoxMesh(const float3& lowerCroner, const float3& upperCroner)
 		box.tdxArr[i*2 + 1].z += i * 4;
 	}
 
+	box.shape.type = AnalyticBox;
+	box.shape.center = 0.5f * (lowerCroner + upperCroner);
+	box.shape.halfSize = 0.5f * diff;
+
 	return box;
 }
 
@@ -153,6 +157,10 @@ Mesh generateCubeMesh(const float3& center, const float3& size, bool bottomCente
 		box.tdxArr[i*2 + 1].z += i * 4;
 	}
 
+	box.shape.type = AnalyticBox;
+	box.shape.center = center + add;
+	box.shape.halfSize = 0.5f * size;
+
 	return box;
 }
 
@@ -231,5 +239,9 @@ Mesh generateSphereMesh(const float3& center, float radius, uint numSegmentsInMe
 	mesh.vtxArr[vertexCount].texcoord = float2(0.f, 0.f);
 	++vertexCount;
 
+	mesh.shape.type = AnalyticSphere;
+	mesh.shape.center = center;
+	mesh.shape.radius = radius;
+
 	return mesh;
 }
\ No newline at end of file
@@ -0,0 +1,48 @@
+#pragma once
+#include "basic_types.h"
+#include <string.h>
+
+
+// 64-bit non-cryptographic hash for cache keys and content fingerprints.
+// It consumes 8 bytes per step, so hashing a mesh file is much cheaper than parsing it.
+inline uint64 hashMix64(uint64 h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+inline uint64 hashBytes(const void* data, uint64 size, uint64 seed = 0)
+{
+	const uint64 prime = 0x9e3779b97f4a7c15ULL;
+	const uint8* bytes = (const uint8*) data;
+	uint64 h = seed ^ (size * prime);
+
+	uint64 numWords = size / 8;
+	for (uint64 i = 0; i < numWords; ++i)
+	{
+		uint64 word;
+		memcpy(&word, bytes + i * 8, 8);
+		h = (h ^ hashMix64(word)) * prime;
+		h = (h << 31) | (h >> 33);
+	}
+
+	uint64 tail = 0;
+	memcpy(&tail, bytes + numWords * 8, size - numWords * 8);
+	h ^= hashMix64(tail);
+
+	return hashMix64(h);
+}
+
+inline uint64 hashString(const char* str, uint64 seed = 0)
+{
+	return hashBytes(str, strlen(str), seed);
+}
+
+inline uint64 hashCombine(uint64 h, uint64 value)
+{
+	return hashMix64(h ^ (value + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2)));
+}
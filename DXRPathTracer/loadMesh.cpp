@@ -1,7 +1,11 @@
 #include "pch.h"
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
-#include "Mesh.h"
+#include "loadMesh.h"
+#include "MeshCache.h"
+#include "simplifyMesh.h"
+#include "hash.h"
+#include "Arena.h"
 #include <map>
 
 class compTynyIdx
@@ -16,14 +20,86 @@ public:
 
 };
 
-Mesh loadMeshFromOBJFile(const char* filename, bool optimizeVertexxCount)
+namespace {
+
+class PendingMemoryMesh : public PendingMesh
+{
+	Mesh mesh;
+
+public:
+	PendingMemoryMesh(Mesh&& src) : mesh(move2(src))
+	{
+		numVertices = mesh.vtxArr.size();
+		numTridices = mesh.tdxArr.size();
+		for (const MeshLOD& lod : mesh.lodArr)
+		{
+			numLODVertices += lod.vtxArr.size();
+			numLODTridices += lod.tdxArr.size();
+		}
+		shape = mesh.shape;
+	}
+
+	void write(Vertex* vertices, Tridex* tridices) override
+	{
+		memcpy(vertices, mesh.vtxArr.data(), sizeof(Vertex) * numVertices);
+		memcpy(tridices, mesh.tdxArr.data(), sizeof(Tridex) * numTridices);
+		lodArr.swap(mesh.lodArr);
+	}
+};
+
+class PendingOBJMesh : public PendingMesh
 {
+	std::string filename;
+	bool optimizeVertexxCount;
+	uint maxLODs;
+	uint64 cacheKey = 0;
+	bool cached = false;
+
 	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::index_t> vertexSources;	// The attribute indices of every vertex of the mesh.
+	Array<Tridex> tdxArr;							// Empty if every vertex is used once, in order.
+
+	void parse();
+	void fill(Vertex* vertices, Tridex* tridices);
+
+public:
+	PendingOBJMesh(const char* filename, bool optimizeVertexxCount, uint maxLODs);
+	void write(Vertex* vertices, Tridex* tridices) override;
+};
+
+PendingOBJMesh::PendingOBJMesh(const char* filename, bool optimizeVertexxCount, uint maxLODs)
+	: filename(filename), optimizeVertexxCount(optimizeVertexxCount), maxLODs(maxLODs)
+{
+	MeshCache& cache = MeshCache::get();
+	if (cache.isEnabled())
+	{
+		uint64 variant = hashString(optimizeVertexxCount ? "obj:optimized" : "obj");
+		if (maxLODs > 0)
+			variant = hashCombine(hashCombine(variant, hashString("lod")), maxLODs);
+		cacheKey = cache.makeKey(filename, variant);
+		cached = cache.peek(cacheKey, numVertices, numTridices, numLODVertices, numLODTridices);
+	}
+
+	if (!cached)
+	{
+		parse();
+
+		// The levels reduce the triangles to a quarter each, so all of them are about a third of the mesh.
+		if (maxLODs > 0)
+		{
+			numLODVertices = numVertices / 3;
+			numLODTridices = numTridices / 3;
+		}
+	}
+}
+
+void PendingOBJMesh::parse()
+{
 	std::vector<tinyobj::shape_t> shapes;
 	std::vector<tinyobj::material_t> materials;
 	std::string warn, err;
 
-	bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename);
+	tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename.c_str());
 	
 	if (!err.empty())
 	{
@@ -42,48 +118,117 @@ Mesh loadMeshFromOBJFile(const char* filename, bool optimizeVertexxCount)
 	{
 		throw Error("The mesh includes non-triangle faces.\n");
 	}
-	
-	Mesh mesh;
-	mesh.vtxArr.resize(numTri * 3);
-	mesh.tdxArr.resize(numTri);
-	
-	std::map<tinyobj::index_t, uint, compTynyIdx> tinyIdxToVtxIdx;
-	uint numVtx = 0;
+
+	numTridices = numTri;
 
 	if (optimizeVertexxCount)
 	{
+		// One node per distinct vertex: from the arena, all freed at once instead of node by node.
+		ScopedArena arena;
+		std::map<tinyobj::index_t, uint, compTynyIdx, ArenaStlAllocator<std::pair<const tinyobj::index_t, uint>>> tinyIdxToVtxIdx;
+		tdxArr.resize(numTri);
+
 		for (uint i = 0; i < 3 * numTri; ++i)
 		{
 			tinyobj::index_t& tinyIdx = I[i];
-			auto iterAndBool = tinyIdxToVtxIdx.insert({ tinyIdx, numVtx });
+			auto iterAndBool = tinyIdxToVtxIdx.insert({ tinyIdx, (uint) vertexSources.size() });
 
 			if (iterAndBool.second)
-			{
-				mesh.vtxArr[numVtx].position = *((float3*)&attrib.vertices[tinyIdx.vertex_index * 3]);
-				mesh.vtxArr[numVtx].normal = *((float3*)&attrib.normals[tinyIdx.normal_index * 3]);
-				mesh.vtxArr[numVtx].texcoord = (tinyIdx.texcoord_index == -1) ? float2(0, 0) :
-					*((float2*)&attrib.texcoords[tinyIdx.texcoord_index * 2]);
-				numVtx++;
-			}
-
-			((uint*)mesh.tdxArr.data())[i] = iterAndBool.first->second;
+				vertexSources.push_back(tinyIdx);
+
+			((uint*)tdxArr.data())[i] = iterAndBool.first->second;
 		}
-		mesh.vtxArr.resize(numVtx);
+		vertexSources.shrink_to_fit();
 	}
 	
 	else
 	{
-		for (uint i = 0; i < 3 * numTri; ++i)
-		{
-			tinyobj::index_t& idx = I[i];
-			mesh.vtxArr[i].position = *((float3*) &attrib.vertices[idx.vertex_index*3]);
-			mesh.vtxArr[i].normal = *((float3*) &attrib.normals[idx.normal_index*3]);
-			mesh.vtxArr[i].texcoord = (idx.texcoord_index == -1) ? 
-				float2(0, 0) : *((float2*) &attrib.texcoords[idx.texcoord_index*2]) ;
+		vertexSources.swap(I);
+	}
+
+	numVertices = (uint) vertexSources.size();
+}
+
+void PendingOBJMesh::fill(Vertex* vertices, Tridex* tridices)
+{
+	for (uint i = 0; i < numVertices; ++i)
+	{
+		const tinyobj::index_t& idx = vertexSources[i];
+		vertices[i].position = *((float3*) &attrib.vertices[idx.vertex_index*3]);
+		vertices[i].normal = *((float3*) &attrib.normals[idx.normal_index*3]);
+		vertices[i].texcoord = (idx.texcoord_index == -1) ? 
+			float2(0, 0) : *((float2*) &attrib.texcoords[idx.texcoord_index*2]) ;
+	}
 
-			((uint*) mesh.tdxArr.data()) [i] = i;
+	if (tdxArr.size() > 0)
+	{
+		memcpy(tridices, tdxArr.data(), sizeof(Tridex) * numTridices);
+	}
+	else
+	{
+		for (uint i = 0; i < 3 * numTridices; ++i)
+			((uint*) tridices) [i] = i;
+	}
+
+	// The source is no longer needed, and the levels of detail below are the biggest part of the loading.
+	attrib = tinyobj::attrib_t();
+	std::vector<tinyobj::index_t>().swap(vertexSources);
+	tdxArr.clear();
+	tdxArr.shrink_to_fit();
+}
+
+void PendingOBJMesh::write(Vertex* vertices, Tridex* tridices)
+{
+	MeshCache& cache = MeshCache::get();
+	if (cached)
+	{
+		if (cache.loadInto(cacheKey, vertices, numVertices, tridices, numTridices, lodArr))
+			return;
+
+		// The entry has been corrupted since peek(); a mesh parsed again has the same size, as it has the same source.
+		uint expectedVertices = numVertices, expectedTridices = numTridices;
+		parse();
+		if (numVertices != expectedVertices || numTridices != expectedTridices)
+			throw Error("The obj file has changed while it was being loaded.\n");
+	}
+
+	fill(vertices, tridices);
+
+	if (maxLODs > 0)
+	{
+		generateMeshLODs(vertices, numVertices, tridices, numTridices, lodArr, maxLODs);
+		numLODVertices = numLODTridices = 0;
+		for (const MeshLOD& lod : lodArr)
+		{
+			numLODVertices += lod.vtxArr.size();
+			numLODTridices += lod.tdxArr.size();
 		}
 	}
+	cache.store(cacheKey, vertices, numVertices, tridices, numTridices, lodArr);
+}
+
+}	// namespace
+
+
+PendingMesh* prepareMesh(Mesh&& mesh)
+{
+	return new PendingMemoryMesh(move2(mesh));
+}
+
+PendingMesh* prepareMeshFromOBJFile(const char* filename, bool optimizeVertexxCount, uint maxLODs)
+{
+	return new PendingOBJMesh(filename, optimizeVertexxCount, maxLODs);
+}
+
+Mesh loadMeshFromOBJFile(const char* filename, bool optimizeVertexxCount, uint maxLODs)
+{
+	PendingOBJMesh pending(filename, optimizeVertexxCount, maxLODs);
+
+	Mesh mesh;
+	mesh.vtxArr.resize(pending.numVertices);
+	mesh.tdxArr.resize(pending.numTridices);
+	pending.write(mesh.vtxArr.data(), mesh.tdxArr.data());
+	mesh.lodArr.swap(pending.lodArr);
 
 	return mesh;
-}
\ No newline at end of file
+}
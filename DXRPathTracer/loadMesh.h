@@ -1,4 +1,33 @@
 #pragma once
 #include "Mesh.h"
 
-Mesh loadMeshFromOBJFile(const char* filename, bool optimizeVertexxCount);
\ No newline at end of file
+/*
+A mesh loaded in two steps, so that it can be written straight into the arrays of a scene (see SceneLoader)
+without a whole copy of it in between. Once the mesh is prepared, the exact size of its full geometry is known;
+write() fills the storage which the caller has reserved for it, then generates the levels of detail from that
+storage into lodArr. Until then only the source is held: tinyobj's arrays and the deduplicated tridices of an
+OBJ file, nothing but the sizes for a cache hit, or the Mesh given to prepareMesh().
+*/
+class PendingMesh
+{
+public:
+	virtual ~PendingMesh() {}
+
+	uint numVertices = 0;
+	uint numTridices = 0;
+	uint numLODVertices = 0;		// Of all the levels of detail; only an estimate until write() generates them.
+	uint numLODTridices = 0;
+	AnalyticShape shape;
+	Array<MeshLOD> lodArr;			// Filled by write().
+	double loadTime = 0.0;			// Seconds of preparing and writing, for the caller's statistics.
+
+	// The tridices index the mesh's own vertices, from 0.
+	virtual void write(Vertex* vertices, Tridex* tridices) = 0;
+};
+
+// Takes over a mesh built in memory, e.g. by a generator function (see generateMesh.h).
+PendingMesh* prepareMesh(Mesh&& mesh);
+
+// With maxLODs > 0, the levels of detail are generated by generateMeshLODs() (and cached together with the mesh).
+PendingMesh* prepareMeshFromOBJFile(const char* filename, bool optimizeVertexxCount, uint maxLODs = 0);
+Mesh loadMeshFromOBJFile(const char* filename, bool optimizeVertexxCount, uint maxLODs = 0);
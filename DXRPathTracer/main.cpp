@@ -1,32 +1,273 @@
 #include "pch.h"
 #include "DXRPathTracer.h"
+#include "CPUPathTracer.h"
 #include "D3D12Screen.h"
 #include "SceneLoader.h"
+#include "Camera.h"
+#include "Benchmark.h"
+#include "ToneMapper.h"
+#include "FrameQueue.h"
+#include "TiledRender.h"
+#include "FrameBudget.h"
+#include "Checkpoint.h"
+#include "DistributedRender.h"
+#include "writeImage.h"
+#include "ThreadPool.h"
 #include "Input.h"
 #include "timer.h"
+#include <thread>
+#include <chrono>
+#include <memory>
 
 
 HWND createWindow(const char* winTitle, uint width, uint height);
+void playAnimation(Scene* scene, InputEngine& input, HWND hwnd, uint numFrames);
+bool renderToFile(uint numFrames, const char* outputFile, const ToneMapSettings& toneMapping,
+	const ExrSettings& exrSettings, bool writeAOVs);
+bool renderDistributed(uint numFrames, uint numWorkers, const char* outputFile, const ToneMapSettings& toneMapping,
+	const ExrSettings& exrSettings, bool writeAOVs);
+void writeRender(uint numFrames, double traceTime, const char* outputFile, const TracedResult& trResult,
+	const ToneMapSettings& toneMapping, const ExrSettings& exrSettings, bool writeAOVs);
+void renderTiledToFile(uint numFrames, const char* outputFile, const ToneMapSettings& toneMapping,
+	const ExrSettings& exrSettings, bool writeAOVs);
+void runAsync(HWND hwnd, FrameQueuePolicy policy);
+PixelRegion tracedRegion(uint width, uint height);
+void setTracerSize(uint width, uint height);
+PixelRegion scaledRegion(uint width, uint height);
+void applyFrameBudget(const TracedResult& trResult, uint windowWidth, uint windowHeight);
 
 IGRTTracer* tracer;
 IGRTScreen* screen;
 uint width  = 1200;
 uint height = 900;
-bool minimized = false;
+PixelRegion crop;							// Of the image or the window, which is all the tracer traces if set.
+uint tileSize = 0;							// Of the tiles of a headless render, or 0 to render it at once.
+const char* checkpointFile = nullptr;		// Of a headless render, with --checkpoint.
+double checkpointInterval = 60.0;			// In seconds.
+bool resumeRender = false;					// From checkpointFile, if it exists.
+WorkSplit workSplit = WorkSplit::Samples;	// Among the workers of a distributed render.
+FrameBudget* frameBudget = nullptr;			// Of the interactive frames, with --budget.
+std::atomic<float> resolutionScale(1.0f);	// Of the traced image to the window, set by the frame budget.
+std::atomic<bool> minimized(false);
+bool tracerOnOwnThread = false;				// Then only that thread calls the tracer, and resizes go through:
+std::atomic<uint64> pendingTracerSize(0);	// width << 32 | height, or 0 once applied.
 
-int main()
+// usage: DXRPathTracer [--cpu] [--play numFrames] [--format rgba32f|rgba16f|rgb9e5] [--frames-in-flight 1|2|3]
+//                      [--async latest|drop|block] [--crop x y width height] [--budget ms [--budget-scale min]]
+//                      [scene file]
+//        DXRPathTracer [--cpu] --render numFrames output.ppm|pfm|exr [--size width height]
+//                      [--tonemap exp|aces|reinhard] [--exposure value|auto] [--exr none|rle|zips|zip] [--exr-float]
+//                      [--aov] [--crop x y width height] [--tile size]
+//                      [--checkpoint file [--checkpoint-interval seconds] [--resume]]
+//                      [--workers count [--split samples|tiles]] [--threads count] [scene file]
+//        DXRPathTracer --bench <name|all>
+int main(int argc, char** argv)
 {
-	HWND hwnd = createWindow("Integrated GPU Path Tracer", width, height);
-	ShowWindow(hwnd, SW_SHOW);
+	bool useCPUTracer = false;
+	uint playFrames = 0;
+	uint renderFrames = 0;
+	const char* outputFile = nullptr;
+	ToneMapSettings toneMapping;
+	ExrSettings exrSettings;
+	bool writeAOVs = false;
+	PixelFormat outputFormat = PixelFormat::RGBA32F;
+	uint framesInFlight = 2;
+	bool async = false;
+	FrameQueuePolicy queuePolicy = FrameQueuePolicy::LatestWins;
+	FrameBudgetSettings budgetSettings;
+	bool useBudget = false;
+	uint numWorkers = 0;
+	int workerIdx = -1;						// Given to the worker processes by the coordinator.
+	const char* sceneFile = nullptr;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--cpu") == 0)
+			useCPUTracer = true;
+		else if (strcmp(argv[i], "--play") == 0 && i + 1 < argc)
+			playFrames = (uint) atoi(argv[++i]);
+		else if (strcmp(argv[i], "--render") == 0 && i + 2 < argc)
+		{
+			renderFrames = _max((uint) atoi(argv[++i]), 1u);
+			outputFile = argv[++i];
+		}
+		else if (strcmp(argv[i], "--size") == 0 && i + 2 < argc)
+		{
+			width = (uint) atoi(argv[++i]);
+			height = (uint) atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--crop") == 0 && i + 4 < argc)
+		{
+			crop.x = (uint) atoi(argv[++i]);
+			crop.y = (uint) atoi(argv[++i]);
+			crop.width = (uint) atoi(argv[++i]);
+			crop.height = (uint) atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--tile") == 0 && i + 1 < argc)
+			tileSize = ((uint) atoi(argv[++i]) + 15) & ~15u;	// In whole blocks of the scanlines of an EXR.
+		else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc)
+			checkpointFile = argv[++i];
+		else if (strcmp(argv[i], "--checkpoint-interval") == 0 && i + 1 < argc)
+			checkpointInterval = atof(argv[++i]);
+		else if (strcmp(argv[i], "--resume") == 0)
+			resumeRender = true;
+		else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+			numWorkers = _max((uint) atoi(argv[++i]), 1u);
+		else if (strcmp(argv[i], "--split") == 0 && i + 1 < argc)
+			workSplit = strcmp(argv[++i], "tiles") == 0 ? WorkSplit::Tiles : WorkSplit::Samples;
+		else if (strcmp(argv[i], "--worker") == 0 && i + 1 < argc)
+			workerIdx = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			ThreadPool::setProcessThreads((uint) atoi(argv[++i]));
+		else if (strcmp(argv[i], "--tonemap") == 0 && i + 1 < argc)
+		{
+			++i;
+			toneMapping.op = strcmp(argv[i], "aces") == 0 ? ToneOperator::ACES :
+				strcmp(argv[i], "reinhard") == 0 ? ToneOperator::Reinhard : ToneOperator::Exponential;
+		}
+		else if (strcmp(argv[i], "--exposure") == 0 && i + 1 < argc)
+		{
+			++i;
+			toneMapping.autoExposure = strcmp(argv[i], "auto") == 0;
+			if (!toneMapping.autoExposure)
+				toneMapping.exposure = (float) atof(argv[i]);
+		}
+		else if (strcmp(argv[i], "--exr") == 0 && i + 1 < argc)
+		{
+			++i;
+			exrSettings.compression = strcmp(argv[i], "none") == 0 ? ExrCompression::None :
+				strcmp(argv[i], "rle") == 0 ? ExrCompression::RLE :
+				strcmp(argv[i], "zips") == 0 ? ExrCompression::ZIPS : ExrCompression::ZIP;
+		}
+		else if (strcmp(argv[i], "--exr-float") == 0)
+			exrSettings.halfFloat = false;
+		else if (strcmp(argv[i], "--aov") == 0)
+			writeAOVs = true;
+		else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc)
+		{
+			++i;
+			outputFormat = strcmp(argv[i], "rgba16f") == 0 ? PixelFormat::RGBA16F :
+				strcmp(argv[i], "rgb9e5") == 0 ? PixelFormat::RGB9E5 : PixelFormat::RGBA32F;
+		}
+		else if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc)
+			framesInFlight = (uint) atoi(argv[++i]);
+		else if (strcmp(argv[i], "--async") == 0 && i + 1 < argc)
+		{
+			++i;
+			async = true;
+			queuePolicy = strcmp(argv[i], "drop") == 0 ? FrameQueuePolicy::DropNewest :
+				strcmp(argv[i], "block") == 0 ? FrameQueuePolicy::Block : FrameQueuePolicy::LatestWins;
+		}
+		else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc)
+		{
+			useBudget = true;
+			budgetSettings.targetTime = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--budget-scale") == 0 && i + 1 < argc)
+		{
+			budgetSettings.scaleResolution = true;
+			budgetSettings.minScale = (float) atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc)
+			return runBenchmark(argv[i + 1]) ? 0 : 1;
+		else
+			sceneFile = argv[i];
+	}
+
+	// A worker prints to its standard error, since its standard output carries the partials to the coordinator.
+	bool worker = renderFrames > 0 && numWorkers > 0 && workerIdx >= 0 && (uint) workerIdx < numWorkers;
+	FILE* workerStream = worker ? openWorkerStream() : nullptr;
+
+	// Rendering to a file opens no window, so the screen and its device are not created.
+	HWND hwnd = nullptr;
+	if (renderFrames == 0)
+	{
+		hwnd = createWindow("Integrated GPU Path Tracer", width, height);
+		ShowWindow(hwnd, SW_SHOW);
+	}
 	InputEngine input(hwnd);
 
-	tracer = new DXRPathTracer(width, height);
-	screen = new D3D12Screen(hwnd, width, height);
+	// The tracer gets the size of what it traces first, so that a tiled poster never takes the memory of the whole.
+	bool tiled = renderFrames > 0 && tileSize > 0 && numWorkers == 0;
+	PixelRegion first = tiled ?
+		PixelRegion{ 0, 0, _min(tileSize, width), _min(tileSize, height) } : tracedRegion(width, height);
+	if (useCPUTracer)
+		tracer = new CPUPathTracer(first.width, first.height);
+	else
+		tracer = new DXRPathTracer(first.width, first.height, renderFrames > 0 ? 1 : framesInFlight);	// The file gets the last frame.
+	if (!tiled)
+		tracer->setRegion(width, height, first);
+	tracer->setOutputFormat(outputFormat);
+	if (hwnd)
+	{
+		D3D12Screen* d3d12Screen = new D3D12Screen(hwnd, width, height, framesInFlight);
+		tracer->setOutputTarget(d3d12Screen);		// The frames are traced into its upload buffers.
+		screen = d3d12Screen;
+	}
 
 	SceneLoader sceneLoader;
 	//Scene* scene = sceneLoader.push_testScene1();
-	Scene* scene = sceneLoader.push_hyperionTestScene();
+	Scene* scene = sceneFile ? 
+		sceneLoader.push_sceneFromFile(sceneFile) : 
+		sceneLoader.push_hyperionTestScene();
 	tracer->setupScene(scene);
+
+	// The samples of the interactive frames follow their trace time, and headless renders keep the tracer's own.
+	if (useBudget && hwnd)
+	{
+		frameBudget = new FrameBudget(budgetSettings);
+		frameBudget->setNumPixels((uint64) first.width * first.height);
+		tracer->setNumSamplesPerFrame(frameBudget->getNumSamples());
+	}
+
+	if (renderFrames > 0)
+	{
+		// An EXR of a crop keeps its place in the image.
+		if (!crop.empty())
+		{
+			PixelRegion area = clampRegion(crop, width, height);
+			exrSettings.fullWidth = width;
+			exrSettings.fullHeight = height;
+			exrSettings.cropX = area.x;
+			exrSettings.cropY = area.y;
+		}
+
+		if (worker)
+		{
+			WorkerJob job;
+			job.workerIdx = (uint) workerIdx;
+			job.numWorkers = numWorkers;
+			job.split = workSplit;
+			job.tileSize = tileSize ? tileSize : job.tileSize;
+			job.numFrames = renderFrames;
+			job.imageWidth = width;
+			job.imageHeight = height;
+			job.area = tracedRegion(width, height);
+			return runWorker(*tracer, job, workerStream);
+		}
+		if (numWorkers > 0)
+			return renderDistributed(renderFrames, numWorkers, outputFile, toneMapping, exrSettings,
+				writeAOVs && useCPUTracer) ? 0 : 1;
+		if (tiled)
+		{
+			if (checkpointFile)
+				printf("Checkpoints are not taken of tiled renders, whose tiles are written as they complete\n");
+			renderTiledToFile(renderFrames, outputFile, toneMapping, exrSettings, writeAOVs && useCPUTracer);
+			return 0;
+		}
+		return renderToFile(renderFrames, outputFile, toneMapping, exrSettings, writeAOVs && useCPUTracer) ? 0 : 1;
+	}
+
+	if (playFrames > 0)
+	{
+		playAnimation(scene, input, hwnd, playFrames);
+		return 0;
+	}
+
+	if (async)
+	{
+		runAsync(hwnd, queuePolicy);
+		return 0;
+	}
 	
 	double fps, old_fps = 0;
 	while (IsWindow(hwnd))
@@ -38,6 +279,7 @@ int main()
 			tracer->update(input);
 			TracedResult trResult = tracer->shootRays();
 			screen->display(trResult);
+			applyFrameBudget(trResult, screen->getScreenWidth(), screen->getScreenHeight());
 		}
 
 		MSG msg;
@@ -50,7 +292,11 @@ int main()
 		fps = updateFPS(1.0);
 		if (fps != old_fps)
 		{
-			printf("FPS: %f\n", fps);
+			if (frameBudget)
+				printf("FPS: %f, %u samples per frame, %u accumulated, resolution %.0f%%\n", fps,
+					tracer->getNumSamplesPerFrame(), tracer->getAccumulatedSamples(), resolutionScale * 100.0f);
+			else
+				printf("FPS: %f\n", fps);
 			old_fps = fps;
 		}
 	}
@@ -58,6 +304,492 @@ int main()
 	return 0;
 }
 
+/*
+Asynchronous mode: the tracer runs on a thread of its own, which reads the input and applies the resizes, and hands
+its frames to this thread through a FrameQueue, so a slow present or a burst of window messages does not hold the
+tracing up. Frames of another size than the screen traces, from before a resize reached the tracer, are not shown.
+Once a second it prints the frames traced and shown, those dropped by the policy, and the latency from the start
+of a frame to the end of its display().
+*/
+void runAsync(HWND hwnd, FrameQueuePolicy policy)
+{
+	FrameQueue queue(policy);
+	std::atomic<bool> stopping(false);
+	std::atomic<uint> numTraced(0);
+	tracerOnOwnThread = true;
+	tracer->setOutputTarget(&queue);		// The screen belongs to this thread.
+
+	uint windowWidth = screen->getScreenWidth(), windowHeight = screen->getScreenHeight();
+	std::thread tracerThread([&]() {
+		InputEngine input(hwnd);
+		while (!stopping)
+		{
+			if (minimized)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+				continue;
+			}
+
+			uint64 size = pendingTracerSize.exchange(0);
+			if (size != 0)
+			{
+				windowWidth = (uint) (size >> 32);
+				windowHeight = (uint) size;
+				setTracerSize(windowWidth, windowHeight);
+			}
+
+			double startTime = getCurrentTime();
+			input.update();
+			tracer->update(input);
+			TracedResult trResult = tracer->shootRays();
+			queue.publish(trResult, startTime);
+			applyFrameBudget(trResult, windowWidth, windowHeight);
+			++numTraced;
+		}
+	});
+
+	uint numShown = 0, lastTraced = 0;
+	uint64 lastDropped = 0;
+	double latencySum = 0.0, lastPrintTime = getCurrentTime();
+	while (IsWindow(hwnd))
+	{
+		MSG msg;
+		while(PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
+		{
+			TranslateMessage(&msg);
+			DispatchMessage(&msg);
+		}
+
+		const QueuedFrame* frame = queue.acquire();
+		PixelRegion shown = scaledRegion(screen->getScreenWidth(), screen->getScreenHeight());
+		if (!frame)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		else if (frame->width == shown.width && frame->height == shown.height)
+		{
+			screen->display(frame->result());
+			latencySum += getCurrentTime() - frame->startTime;
+			++numShown;
+		}
+
+		double elapsed = getCurrentTime() - lastPrintTime;
+		if (elapsed >= 1.0)
+		{
+			uint traced = numTraced;
+			uint64 dropped = queue.getStats().numDropped;
+			printf("FPS: traced %.1f, shown %.1f, dropped %llu, latency %.1f ms\n", (traced - lastTraced) / elapsed,
+				numShown / elapsed, dropped - lastDropped, numShown ? latencySum * 1000.0 / numShown : 0.0);
+			lastTraced = traced;
+			lastDropped = dropped;
+			numShown = 0;
+			latencySum = 0.0;
+			lastPrintTime += elapsed;
+		}
+	}
+
+	// Emptying the queue once lets a blocked tracer publish its last frame and see the stop.
+	stopping = true;
+	while (queue.acquire())
+		;
+	tracerThread.join();
+	tracer->setOutputTarget(nullptr);
+}
+
+/*
+Playback mode: renders numFrames frames spread evenly over the animation of the scene, or over one turn of the
+camera if the scene has none, and prints where the time of every frame goes. The input is not read, so the camera
+follows only the animation. Each frame is a single sample per pixel of the new poses, as the edits restart the
+accumulation; the acceleration structures are refitted rather than built (see Scene::updateObjectTransform()).
+*/
+void playAnimation(Scene* scene, InputEngine& input, HWND hwnd, uint numFrames)
+{
+	Animation turntable;
+	const Animation* animation = &scene->getAnimation();
+	if (animation->empty())
+	{
+		turntable.addTurntable(CameraKey(), 1.0f);
+		animation = &turntable;
+	}
+	float duration = animation->getDuration();
+
+	printf("Playing %u frames over %.2f s (times in ms)\n", numFrames, duration);
+	printf("%6s %8s %9s %9s %9s %9s %9s\n", "frame", "time", "animate", "scene", "AS", "trace", "total");
+
+	FrameTimings sum;
+	double animateSum = 0.0, totalSum = 0.0;
+	uint frame = 0;
+	for (; frame < numFrames && IsWindow(hwnd); ++frame)
+	{
+		double startTime = getCurrentTime();
+		float time = numFrames > 1 ? duration * frame / (numFrames - 1) : 0.0f;
+		animation->applyToScene(scene, time);
+		animation->applyToCamera(tracer->getCamera(), time);
+		double animateTime = (getCurrentTime() - startTime) * 1000.0;
+
+		tracer->update(input);
+		TracedResult trResult = tracer->shootRays();
+		screen->display(trResult);
+		double totalTime = (getCurrentTime() - startTime) * 1000.0;
+
+		FrameTimings timings = tracer->getFrameTimings();
+		printf("%6u %8.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n", frame, time, animateTime,
+			timings.sceneUpdate, timings.accelUpdate, timings.trace, totalTime);
+		animateSum += animateTime;
+		sum.sceneUpdate += timings.sceneUpdate;
+		sum.accelUpdate += timings.accelUpdate;
+		sum.trace += timings.trace;
+		totalSum += totalTime;
+
+		MSG msg;
+		while(PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
+		{
+			TranslateMessage(&msg);
+			DispatchMessage(&msg);
+		}
+	}
+
+	if (frame == 0)
+		return;
+
+	double n = frame;
+	printf("%6s %8s %9.3f %9.3f %9.3f %9.3f %9.3f\n", "mean", "", animateSum / n,
+		sum.sceneUpdate / n, sum.accelUpdate / n, sum.trace / n, totalSum / n);
+	printf("%6s %8s %8.1f%% %8.1f%% %8.1f%% %8.1f%%\n", "share", "", 100.0 * animateSum / totalSum,
+		100.0 * sum.sceneUpdate / totalSum, 100.0 * sum.accelUpdate / totalSum, 100.0 * sum.trace / totalSum);
+}
+
+// The crop within an image of width x height, or the whole image if there is no crop or the image does not reach it.
+PixelRegion tracedRegion(uint width, uint height)
+{
+	if (crop.empty() || crop.x >= width || crop.y >= height)
+		return { 0, 0, width, height };
+	return clampRegion(crop, width, height);
+}
+
+// What the tracer traces for a window of width x height: tracedRegion() of the window, in the image of the window
+// at the resolution scale of the frame budget.
+PixelRegion scaledRegion(uint width, uint height)
+{
+	PixelRegion region = tracedRegion(width, height);
+	float scale = resolutionScale;
+	if (scale == 1.0f)
+		return region;
+
+	uint x = (uint) (region.x * scale), y = (uint) (region.y * scale);
+	return { x, y, _max(scaleSize(region.x + region.width, scale), x + 1) - x,
+		_max(scaleSize(region.y + region.height, scale), y + 1) - y };
+}
+
+void setTracerSize(uint width, uint height)
+{
+	float scale = resolutionScale;
+	tracer->setRegion(scaleSize(width, scale), scaleSize(height, scale), scaledRegion(width, height));
+	if (frameBudget)
+	{
+		PixelRegion region = tracedRegion(width, height);
+		frameBudget->setNumPixels((uint64) region.width * region.height);
+	}
+}
+
+// Feeds the frame just traced to the frame budget, if there is one, and sets the samples of the next frame and the
+// internal resolution from it. A new resolution restarts the accumulation; the screen stretches the frames.
+void applyFrameBudget(const TracedResult& trResult, uint windowWidth, uint windowHeight)
+{
+	if (!frameBudget)
+		return;
+
+	frameBudget->addFrame(tracer->getFrameTimings(), (uint64) trResult.width * trResult.height);
+	tracer->setNumSamplesPerFrame(frameBudget->getNumSamples());
+	if (frameBudget->getResolutionScale() != resolutionScale)
+	{
+		resolutionScale = frameBudget->getResolutionScale();
+		setTracerSize(windowWidth, windowHeight);
+	}
+}
+
+bool hasExtension(const char* filename, const char* extension)
+{
+	size_t length = strlen(filename), extensionLength = strlen(extension);
+	return length >= extensionLength && _stricmp(filename + length - extensionLength, extension) == 0;
+}
+
+/*
+Headless mode: accumulates numFrames frames of the camera of the scene and writes them to outputFile. A .pfm or
+.exr file gets the accumulation itself, the EXR with the depth and normal AOVs of the CPU tracer if writeAOVs;
+anything else is tone mapped on the CPU as the screen would, into a PPM. The input is never read, so every frame
+after the first adds to the accumulation. With a crop, only the crop is traced and written, and an EXR of it keeps
+its place in the image in its data window.
+With a checkpoint file, the accumulation is saved to it every checkpointInterval seconds and once more at the end,
+by a CheckpointWriter while the frames go on. With resumeRender, the frames of the checkpoint count towards
+numFrames, and a checkpoint of another scene, camera, size or crop is refused rather than overwritten; returns false
+then.
+*/
+bool renderToFile(uint numFrames, const char* outputFile, const ToneMapSettings& toneMapping,
+	const ExrSettings& exrSettings, bool writeAOVs)
+{
+	InputEngine input(nullptr);
+	TracedResult trResult = {};
+	AccumulationState resumed;
+	uint firstFrame = 0;
+	if (checkpointFile && resumeRender)
+	{
+		if (!readCheckpoint(checkpointFile, resumed))
+			printf("No checkpoint to resume from in %s, starting over\n", checkpointFile);
+		else if (!tracer->restoreAccumulation(resumed))
+		{
+			printf("Refusing to resume from %s, which is of another scene, camera or image\n", checkpointFile);
+			return false;
+		}
+		else
+		{
+			firstFrame = _min(resumed.accumulatedFrames + 1, numFrames);
+			printf("Resuming from %s after %u frames, %u samples per pixel\n", checkpointFile,
+				resumed.accumulatedFrames + 1, resumed.accumulatedSamples);
+
+			// The accumulation as it was, should no frame be left to trace.
+			trResult.data = resumed.pixels.data();
+			trResult.width = resumed.region.width;
+			trResult.height = resumed.region.height;
+			trResult.pixelSize = pixelSizeOf(PixelFormat::RGBA32F);
+			trResult.format = PixelFormat::RGBA32F;
+		}
+	}
+
+	std::unique_ptr<CheckpointWriter> checkpoints(checkpointFile ? new CheckpointWriter(checkpointFile) : nullptr);
+	double startTime = getCurrentTime();
+	double nextCheckpoint = startTime + checkpointInterval;
+	double checkpointWait = 0.0;
+	for (uint frame = firstFrame; frame < numFrames; ++frame)
+	{
+		tracer->update(input);
+		trResult = tracer->shootRays();
+		if (checkpoints && getCurrentTime() >= nextCheckpoint)
+		{
+			checkpointWait += checkpoints->save(*tracer);
+			nextCheckpoint = getCurrentTime() + checkpointInterval;
+		}
+	}
+	double traceTime = getCurrentTime() - startTime;
+
+	if (checkpoints)
+	{
+		if (firstFrame < numFrames)
+			checkpointWait += checkpoints->save(*tracer);
+		checkpoints->flush();
+		CheckpointStats stats = checkpoints->getStats();
+		printf("Checkpoints: %u written to %s, %u failed, %.2f ms of tracing spent on them, %.2f ms writing\n",
+			stats.numWritten, checkpointFile, stats.numFailed, checkpointWait, stats.writeTime);
+	}
+
+	writeRender(numFrames, traceTime, outputFile, trResult, toneMapping, exrSettings, writeAOVs);
+	return true;
+}
+
+/*
+Distributed headless mode: renders what renderToFile() would, split by workSplit among numWorkers processes
+(DistributedRender.h), and writes the merged accumulation as renderToFile() does. The workers run this program with
+the command line of this one and --worker i, each on its share of the hardware threads; the tracer of this process
+only checks their partials against its scene hash, and traces the AOVs. Checkpoints are not taken. Returns false if
+a worker fails.
+*/
+bool renderDistributed(uint numFrames, uint numWorkers, const char* outputFile, const ToneMapSettings& toneMapping,
+	const ExrSettings& exrSettings, bool writeAOVs)
+{
+	PixelRegion area = tracedRegion(width, height);
+	AccumulationMerger merger(width, height, area, tracer->getSceneHash());
+	uint workerThreads = _max(ThreadPool::get().numThreads() / numWorkers, 1u);
+	Array<std::string> commandLines(numWorkers);
+	for (uint i = 0; i < numWorkers; ++i)
+	{
+		char workerArgs[64];
+		snprintf(workerArgs, sizeof(workerArgs), " --worker %u --threads %u", i, workerThreads);
+		commandLines[i] = std::string(GetCommandLineA()) + workerArgs;
+	}
+
+	printf("Rendering %u frames at %ux%u on %u workers, %u threads each, split by %s\n", numFrames, area.width,
+		area.height, numWorkers, workerThreads, workSplit == WorkSplit::Tiles ? "tiles" : "samples");
+	double startTime = getCurrentTime();
+	Array<WorkerResult> results;
+	bool succeeded = runWorkers(commandLines, merger, results);
+	double traceTime = getCurrentTime() - startTime;
+	for (uint i = 0; i < numWorkers; ++i)
+	{
+		printf("    worker %u: %s, %u partials, done after %.2f s\n", i, results[i].succeeded ? "succeeded" : "FAILED",
+			results[i].numPartials, results[i].finishTime);
+	}
+	if (!succeeded)
+	{
+		printf("The distributed render failed, and nothing is written\n");
+		return false;
+	}
+
+	startTime = getCurrentTime();
+	Array<float4> pixels;
+	Array<uint> samples;
+	merger.resolve(pixels, samples);
+	MergerStats stats = merger.getStats();
+	printf("Merged %u partials of %.1f MB in %.2f ms\n", stats.numPartials, stats.bytesReceived / 1e6,
+		(getCurrentTime() - startTime) * 1000.0);
+
+	TracedResult trResult = {};
+	trResult.data = pixels.data();
+	trResult.width = area.width;
+	trResult.height = area.height;
+	trResult.pixelSize = pixelSizeOf(PixelFormat::RGBA32F);
+	trResult.format = PixelFormat::RGBA32F;
+	writeRender(numFrames, traceTime, outputFile, trResult, toneMapping, exrSettings, writeAOVs);
+	return true;
+}
+
+// The file of renderToFile(), of the accumulation in trResult; AOVs come from the CPU tracer, over its region.
+void writeRender(uint numFrames, double traceTime, const char* outputFile, const TracedResult& trResult,
+	const ToneMapSettings& toneMapping, const ExrSettings& exrSettings, bool writeAOVs)
+{
+	bool exr = hasExtension(outputFile, ".exr");
+	if (exr || hasExtension(outputFile, ".pfm"))
+	{
+		Array<float> depthArr;
+		Array<float3> normalArr;
+		Array<ExrLayer> layers;
+		if (exr && writeAOVs)
+		{
+			static_cast<CPUPathTracer*>(tracer)->renderAOVs(depthArr, normalArr);
+			layers.push_back({ "depth", "Z", depthArr.data(), false });
+			layers.push_back({ "normal", "XYZ", &normalArr[0].x, true });
+		}
+
+		double startTime = getCurrentTime();
+		if (exr)
+			writeEXR(outputFile, trResult, exrSettings, layers.data(), layers.size());
+		else
+			writePFM(outputFile, trResult);
+		printf("Rendered %u frames at %ux%u in %.2f s, written to %s in %.2f ms\n", numFrames, trResult.width,
+			trResult.height, traceTime, outputFile, (getCurrentTime() - startTime) * 1000.0);
+		return;
+	}
+
+	uint pitch = trResult.width * 4;
+	Array<uint8> ldrImage(pitch * trResult.height);
+	ToneMapper toneMapper(toneMapping);
+	double startTime = getCurrentTime();
+	toneMapper.apply(trResult, ldrImage.data(), pitch);
+	double toneMapTime = getCurrentTime() - startTime;
+
+	writePPM(outputFile, ldrImage.data(), trResult.width, trResult.height, pitch);
+	printf("Rendered %u frames at %ux%u in %.2f s, tone mapped in %.2f ms with exposure %.3f, written to %s\n",
+		numFrames, trResult.width, trResult.height, traceTime, toneMapTime * 1000.0, toneMapper.getLastExposure(),
+		outputFile);
+}
+
+/*
+Headless mode for an image of any size: renders the image, or its crop, by tiles of tileSize pixels, numFrames
+frames each (TiledRender.h), and writes it a band of tiles at a time, so that no more than a band is ever held. The
+files are those of renderToFile(). An automatic exposure for the PPM is measured beforehand, on a render of the whole
+image at a small size, since the tone mapping of every band must use the same.
+*/
+void renderTiledToFile(uint numFrames, const char* outputFile, const ToneMapSettings& toneMapping,
+	const ExrSettings& exrSettings, bool writeAOVs)
+{
+	InputEngine input(nullptr);
+	PixelRegion area = clampRegion(crop, width, height);
+	TiledRender tiled(*tracer, width, height, tileSize, tileSize, area);
+	double startTime = getCurrentTime();
+
+	bool exr = hasExtension(outputFile, ".exr");
+	bool pfm = hasExtension(outputFile, ".pfm");
+	std::unique_ptr<ExrWriter> exrWriter;
+	std::unique_ptr<PfmWriter> pfmWriter;
+	std::unique_ptr<PpmWriter> ppmWriter;
+	ToneMapper toneMapper(toneMapping);
+
+	// The AOVs of the tiles of a band, gathered as the band itself is.
+	Array<float> depthBand, depthTile;
+	Array<float3> normalBand, normalTile;
+	ExrLayer layers[] = { { "depth", "Z", nullptr, false }, { "normal", "XYZ", nullptr, true } };
+	if (exr)
+		exrWriter.reset(new ExrWriter(outputFile, area.width, area.height, exrSettings, layers, writeAOVs ? 2 : 0));
+	else if (pfm)
+		pfmWriter.reset(new PfmWriter(outputFile, area.width, area.height));
+	else
+	{
+		if (toneMapping.autoExposure)
+		{
+			uint previewWidth = _min(width, 480u);
+			uint previewHeight = _max(height * previewWidth / width, 1u);
+			tracer->setRegion(previewWidth, previewHeight, PixelRegion());
+			TracedResult preview = {};
+			for (uint frame = 0; frame < numFrames; ++frame)
+			{
+				tracer->update(input);
+				preview = tracer->shootRays();
+			}
+
+			ToneMapSettings fixed = toneMapping;
+			fixed.autoExposure = false;
+			fixed.exposure = toneMapper.measureExposure(preview);
+			toneMapper.setSettings(fixed);
+		}
+		ppmWriter.reset(new PpmWriter(outputFile, area.width, area.height));
+	}
+
+	Array<uint8> ldrBand;
+	uint64 peakMemory = 0;
+	for (uint bandIdx = 0; bandIdx < tiled.numBands(); ++bandIdx)
+	{
+		uint bandHeight = _min(tileSize, area.height - tiled.bandY(bandIdx));
+		if (writeAOVs && exr)
+		{
+			depthBand.resize(area.width * bandHeight);
+			normalBand.resize(area.width * bandHeight);
+		}
+
+		TracedResult band = tiled.renderBand(bandIdx, numFrames, input, [&](const PixelRegion& tile) {
+			if (!writeAOVs || !exr)
+				return;
+			static_cast<CPUPathTracer*>(tracer)->renderAOVs(depthTile, normalTile);
+			for (uint y = 0; y < tile.height; ++y)
+			{
+				uint dst = area.width * y + tile.x - area.x;
+				memcpy(&depthBand[dst], &depthTile[tile.width * y], tile.width * sizeof(float));
+				memcpy(&normalBand[dst], &normalTile[tile.width * y], tile.width * sizeof(float3));
+			}
+		});
+
+		if (exrWriter)
+		{
+			layers[0].data = depthBand.data();
+			layers[1].data = normalBand.data() ? &normalBand[0].x : nullptr;
+			exrWriter->writeRows(band, layers);
+		}
+		else if (pfmWriter)
+		{
+			pfmWriter->writeRows(band);
+		}
+		else
+		{
+			ldrBand.resize(band.width * band.height * 4);
+			toneMapper.apply(band, ldrBand.data(), band.width * 4);
+			ppmWriter->writeRows(ldrBand.data(), band.height, band.width * 4);
+		}
+
+		peakMemory = _max(peakMemory, tiled.bandMemory() + ldrBand.size() +
+			(uint64) depthBand.size() * sizeof(float) + (uint64) normalBand.size() * sizeof(float3));
+		printf("\rBand %u of %u", bandIdx + 1, tiled.numBands());
+		fflush(stdout);
+	}
+
+	if (exrWriter)
+		exrWriter->finish();
+	else if (pfmWriter)
+		pfmWriter->finish();
+	else
+		ppmWriter->finish();
+
+	printf("\rRendered %u frames at %ux%u by tiles of %u in %.2f s, written to %s, %.1f MB for the bands\n",
+		numFrames, area.width, area.height, tileSize, getCurrentTime() - startTime, outputFile, peakMemory / 1e6);
+}
+
 LRESULT CALLBACK msgProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam);
 
 HWND createWindow(const char* winTitle, uint width, uint height)
@@ -108,7 +840,10 @@ LRESULT CALLBACK msgProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 				minimized = false;
 			}
 
-			tracer->onSizeChanged(width, height);
+			if (tracerOnOwnThread)
+				pendingTracerSize = (uint64) width << 32 | height;
+			else
+				setTracerSize(width, height);
 			screen->onSizeChanged(width, height);
 		}
 		return 0;
@@ -0,0 +1,25 @@
+#pragma once
+#include "pch.h"
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+
+
+// Resident memory of the process (the working set) in bytes, now and at its peak so far.
+inline uint64 getMemoryUsage()
+{
+	PROCESS_MEMORY_COUNTERS counters = {};
+	GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+	return counters.WorkingSetSize;
+}
+
+inline uint64 getPeakMemoryUsage()
+{
+	PROCESS_MEMORY_COUNTERS counters = {};
+	GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+	return counters.PeakWorkingSetSize;
+}
+
+inline double toMegabytes(uint64 bytes)
+{
+	return bytes / (1024.0 * 1024.0);
+}
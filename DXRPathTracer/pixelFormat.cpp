@@ -0,0 +1,235 @@
+#include "pch.h"
+#include "pixelFormat.h"
+#include <emmintrin.h>
+#if defined(__F16C__) || defined(__AVX2__)
+#include <immintrin.h>
+#define USE_F16C
+#endif
+
+
+namespace {
+
+inline __m128 select(__m128 mask, __m128 a, __m128 b)		// mask ? a : b
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+inline __m128i select(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+#ifndef USE_F16C
+// Four floats to halves in the low 16 bits of their lanes. The normal results are rounded by adding the bias of
+// the dropped bits; the denormal ones by a float addition which shifts them into place.
+inline __m128i floatToHalf4(__m128 f)
+{
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+	const __m128i denormalMagic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+
+	__m128 absf = _mm_andnot_ps(signMask, f);
+	__m128i bits = _mm_castps_si128(absf);
+
+	__m128i isNaN = _mm_castps_si128(_mm_cmpunord_ps(absf, absf));
+	__m128i isFinite = _mm_cmpgt_epi32(_mm_set1_epi32((127 + 16) << 23), bits);		// Below the overflow to inf.
+	__m128i isDenormal = _mm_cmpgt_epi32(_mm_set1_epi32((127 - 14) << 23), bits);
+	__m128i special = _mm_or_si128(_mm_and_si128(isNaN, _mm_set1_epi32(0x200)), _mm_set1_epi32(0x7C00));
+
+	__m128i denormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(absf, _mm_castsi128_ps(denormalMagic))), denormalMagic);
+
+	__m128i mantissaOdd = _mm_srai_epi32(_mm_slli_epi32(bits, 31 - 13), 31);		// -1 if the kept mantissa is odd.
+	__m128i rounded = _mm_sub_epi32(_mm_add_epi32(bits, _mm_set1_epi32(0xFFF - ((127 - 15) << 23))), mantissaOdd);
+	__m128i normal = _mm_srli_epi32(rounded, 13);
+
+	__m128i half = select(isFinite, select(isDenormal, denormal, normal), special);
+	return _mm_or_si128(half, _mm_srli_epi32(_mm_castps_si128(_mm_and_ps(f, signMask)), 16));
+}
+
+// Halves in the low 16 bits of the lanes to floats; the multiply rebiases the exponent and normalizes denormals.
+inline __m128 halfToFloat4(__m128i h)
+{
+	__m128i exponentMantissa = _mm_and_si128(h, _mm_set1_epi32(0x7FFF));
+	__m128 scaled = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(exponentMantissa, 13)),
+		_mm_castsi128_ps(_mm_set1_epi32((254 - 15) << 23)));
+	__m128i wasInfNaN = _mm_cmpgt_epi32(exponentMantissa, _mm_set1_epi32(0x7BFF));
+	__m128i sign = _mm_slli_epi32(_mm_xor_si128(h, exponentMantissa), 16);
+	__m128i infNaNExponent = _mm_and_si128(wasInfNaN, _mm_set1_epi32(255 << 23));
+	return _mm_or_ps(scaled, _mm_castsi128_ps(_mm_or_si128(sign, infNaNExponent)));
+}
+#endif
+
+// Two float4 to their eight halves, and back.
+inline __m128i floatsToHalves(__m128 a, __m128 b)
+{
+#ifdef USE_F16C
+	return _mm_unpacklo_epi64(_mm_cvtps_ph(a, _MM_FROUND_TO_NEAREST_INT), _mm_cvtps_ph(b, _MM_FROUND_TO_NEAREST_INT));
+#else
+	// Sign extended, so that the signed saturation of the pack keeps all 16 bits.
+	__m128i ha = _mm_srai_epi32(_mm_slli_epi32(floatToHalf4(a), 16), 16);
+	__m128i hb = _mm_srai_epi32(_mm_slli_epi32(floatToHalf4(b), 16), 16);
+	return _mm_packs_epi32(ha, hb);
+#endif
+}
+
+inline void halvesToFloats(__m128i h, __m128& a, __m128& b)
+{
+#ifdef USE_F16C
+	a = _mm_cvtph_ps(h);
+	b = _mm_cvtph_ps(_mm_srli_si128(h, 8));
+#else
+	a = halfToFloat4(_mm_unpacklo_epi16(h, _mm_setzero_si128()));
+	b = halfToFloat4(_mm_unpackhi_epi16(h, _mm_setzero_si128()));
+#endif
+}
+
+// Four pixels in their channels. The shared exponent is the one of the largest channel, at least 2^-16, and it
+// moves up if that channel rounds to 512.
+inline __m128i packRGB9E5x4(__m128 r, __m128 g, __m128 b)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 maxValue = _mm_set1_ps(65408.0f);
+	const __m128 half = _mm_set1_ps(0.5f);
+	r = _mm_min_ps(_mm_max_ps(r, zero), maxValue);		// The max turns NaNs to 0.
+	g = _mm_min_ps(_mm_max_ps(g, zero), maxValue);
+	b = _mm_min_ps(_mm_max_ps(b, zero), maxValue);
+
+	__m128 maxChannel = _mm_max_ps(_mm_max_ps(r, g), _mm_max_ps(b, _mm_set1_ps(1.0f / 65536.0f)));
+	__m128i biasedExponent = _mm_srli_epi32(_mm_castps_si128(maxChannel), 23);
+	__m128i sharedExponent = _mm_sub_epi32(biasedExponent, _mm_set1_epi32(127 - 16));
+	__m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_sub_epi32(_mm_set1_epi32(127 + 24 + 127 - 16), biasedExponent), 23));
+
+	__m128i maxMantissa = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(maxChannel, scale), half));
+	__m128i carry = _mm_cmpeq_epi32(maxMantissa, _mm_set1_epi32(512));
+	sharedExponent = _mm_sub_epi32(sharedExponent, carry);
+	scale = _mm_mul_ps(scale, select(_mm_castsi128_ps(carry), half, _mm_set1_ps(1.0f)));
+
+	__m128i rm = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(r, scale), half));
+	__m128i gm = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(g, scale), half));
+	__m128i bm = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(b, scale), half));
+	return _mm_or_si128(_mm_or_si128(rm, _mm_slli_epi32(gm, 9)), _mm_or_si128(_mm_slli_epi32(bm, 18), _mm_slli_epi32(sharedExponent, 27)));
+}
+
+inline void unpackRGB9E5x4(__m128i packed, __m128& r, __m128& g, __m128& b)
+{
+	const __m128i mantissaMask = _mm_set1_epi32(511);
+	__m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_srli_epi32(packed, 27), _mm_set1_epi32(127 - 24)), 23));
+	r = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(packed, mantissaMask)), scale);
+	g = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(packed, 9), mantissaMask)), scale);
+	b = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(packed, 18), mantissaMask)), scale);
+}
+
+}	// namespace
+
+
+uint16 floatToHalf(float value)
+{
+	__m128i halves = floatsToHalves(_mm_set1_ps(value), _mm_set1_ps(value));
+	return (uint16) _mm_extract_epi16(halves, 0);
+}
+
+float halfToFloat(uint16 half)
+{
+	__m128 a, b;
+	halvesToFloats(_mm_set1_epi16((short) half), a, b);
+	return _mm_cvtss_f32(a);
+}
+
+uint packRGB9E5(const float3& rgb)
+{
+	return (uint) _mm_cvtsi128_si32(packRGB9E5x4(_mm_set1_ps(rgb.x), _mm_set1_ps(rgb.y), _mm_set1_ps(rgb.z)));
+}
+
+float3 unpackRGB9E5(uint packed)
+{
+	__m128 r, g, b;
+	unpackRGB9E5x4(_mm_set1_epi32((int) packed), r, g, b);
+	return float3(_mm_cvtss_f32(r), _mm_cvtss_f32(g), _mm_cvtss_f32(b));
+}
+
+void convertPixels(const float4* src, void* dst, PixelFormat dstFormat, uint count)
+{
+	if (dstFormat == PixelFormat::RGBA32F)
+	{
+		memcpy(dst, src, sizeof(float4) * (size_t) count);
+	}
+	else if (dstFormat == PixelFormat::RGBA16F)
+	{
+		uint16* out = (uint16*) dst;
+		uint i = 0;
+		for (; i + 2 <= count; i += 2)
+			_mm_storeu_si128((__m128i*) (out + 4 * i), floatsToHalves(_mm_loadu_ps(&src[i].x), _mm_loadu_ps(&src[i + 1].x)));
+		if (i < count)
+		{
+			__m128 last = _mm_loadu_ps(&src[i].x);
+			_mm_storel_epi64((__m128i*) (out + 4 * i), floatsToHalves(last, last));
+		}
+	}
+	else
+	{
+		uint* out = (uint*) dst;
+		uint i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 r = _mm_loadu_ps(&src[i].x);
+			__m128 g = _mm_loadu_ps(&src[i + 1].x);
+			__m128 b = _mm_loadu_ps(&src[i + 2].x);
+			__m128 a = _mm_loadu_ps(&src[i + 3].x);
+			_MM_TRANSPOSE4_PS(r, g, b, a);
+			_mm_storeu_si128((__m128i*) (out + i), packRGB9E5x4(r, g, b));
+		}
+		for (; i < count; ++i)
+			out[i] = packRGB9E5(float3(src[i].x, src[i].y, src[i].z));
+	}
+}
+
+void convertToHalves(const float* src, uint16* dst, uint count)
+{
+	uint i = 0;
+	for (; i + 8 <= count; i += 8)
+		_mm_storeu_si128((__m128i*) (dst + i), floatsToHalves(_mm_loadu_ps(src + i), _mm_loadu_ps(src + i + 4)));
+	for (; i < count; ++i)
+		dst[i] = floatToHalf(src[i]);
+}
+
+void convertToFloat4(const void* src, PixelFormat srcFormat, float4* dst, uint count)
+{
+	if (srcFormat == PixelFormat::RGBA32F)
+	{
+		memcpy(dst, src, sizeof(float4) * (size_t) count);
+	}
+	else if (srcFormat == PixelFormat::RGBA16F)
+	{
+		const uint16* in = (const uint16*) src;
+		uint i = 0;
+		for (; i + 2 <= count; i += 2)
+		{
+			__m128 a, b;
+			halvesToFloats(_mm_loadu_si128((const __m128i*) (in + 4 * i)), a, b);
+			_mm_storeu_ps(&dst[i].x, a);
+			_mm_storeu_ps(&dst[i + 1].x, b);
+		}
+		if (i < count)
+		{
+			__m128 a, b;
+			halvesToFloats(_mm_loadl_epi64((const __m128i*) (in + 4 * i)), a, b);
+			_mm_storeu_ps(&dst[i].x, a);
+		}
+	}
+	else
+	{
+		const uint* in = (const uint*) src;
+		uint i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 r, g, b, a = _mm_set1_ps(1.0f);
+			unpackRGB9E5x4(_mm_loadu_si128((const __m128i*) (in + i)), r, g, b);
+			_MM_TRANSPOSE4_PS(r, g, b, a);
+			_mm_storeu_ps(&dst[i].x, r);
+			_mm_storeu_ps(&dst[i + 1].x, g);
+			_mm_storeu_ps(&dst[i + 2].x, b);
+			_mm_storeu_ps(&dst[i + 3].x, a);
+		}
+		for (; i < count; ++i)
+			dst[i] = float4(unpackRGB9E5(in[i]), 1.0f);
+	}
+}
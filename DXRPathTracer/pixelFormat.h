@@ -0,0 +1,20 @@
+#pragma once
+#include "IGRTCommon.h"
+
+
+/*
+Conversions between the float4 accumulation of the CPU tracer and the display formats of PixelFormat, as the GPU
+does them: halves are rounded to nearest even with denormals, infinities and NaNs kept, and RGB9E5 follows the
+packing of the D3D specification (negative values and NaNs become 0, values over 65408 saturate).
+The batch functions convert four pixels per SSE2 instruction, or use the F16C instructions when the compiler
+targets them.
+*/
+
+uint16 floatToHalf(float value);
+float halfToFloat(uint16 half);
+uint packRGB9E5(const float3& rgb);
+float3 unpackRGB9E5(uint packed);
+
+void convertPixels(const float4* src, void* dst, PixelFormat dstFormat, uint count);
+void convertToFloat4(const void* src, PixelFormat srcFormat, float4* dst, uint count);	// Alpha is 1 for RGB9E5.
+void convertToHalves(const float* src, uint16* dst, uint count);
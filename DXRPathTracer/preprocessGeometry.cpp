@@ -0,0 +1,230 @@
+#include "pch.h"
+#include "preprocessGeometry.h"
+#include "ThreadPool.h"
+#include <emmintrin.h>
+
+
+namespace {
+
+const uint chunkSize = 1 << 16;		// Triangles or vertices; large enough to amortize the scheduling.
+
+struct Chunk
+{
+	uint rangeIdx;
+	uint begin;			// Triangle or vertex index relative to the start of the range.
+	uint end;
+	bool triangles;
+};
+
+struct ChunkResult
+{
+	float area = 0.0f;			// Triangle chunks: sum of the triangle areas.
+	double areaOffset = 0.0;	// Triangle chunks: sum of the areas of the preceding chunks of the range.
+	AABB box;					// Vertex chunks.
+	float maxDistance2 = 0.0f;	// Vertex chunks: squared distance from the sphere center to the farthest vertex.
+};
+
+// Reads the position and one float after it, which is always in the vertex (the normal).
+inline __m128 loadPosition(const Vertex& v)
+{
+	return _mm_loadu_ps(&v.position.x);
+}
+
+inline float triangleArea(const Vertex* vtx, const Tridex& tdx)
+{
+	float3 e1 = vtx[tdx.y].position - vtx[tdx.x].position;
+	float3 e2 = vtx[tdx.z].position - vtx[tdx.x].position;
+	return 0.5f * length(cross(e1, e2));
+}
+
+// Writes the inclusive prefix sums of the triangle areas into cdf and returns their total.
+float prefixSumAreas(const Vertex* vtx, const Tridex* tdx, uint numTridices, float* cdf)
+{
+	const __m128 half = _mm_set1_ps(0.5f);
+	__m128 running = _mm_setzero_ps();
+	uint i = 0;
+
+	for (; i + 4 <= numTridices; i += 4)
+	{
+		// Transposed, the first three registers of each corner hold x, y and z of the 4 triangles.
+		__m128 a0 = loadPosition(vtx[tdx[i].x]), a1 = loadPosition(vtx[tdx[i+1].x]);
+		__m128 a2 = loadPosition(vtx[tdx[i+2].x]), a3 = loadPosition(vtx[tdx[i+3].x]);
+		__m128 b0 = loadPosition(vtx[tdx[i].y]), b1 = loadPosition(vtx[tdx[i+1].y]);
+		__m128 b2 = loadPosition(vtx[tdx[i+2].y]), b3 = loadPosition(vtx[tdx[i+3].y]);
+		__m128 c0 = loadPosition(vtx[tdx[i].z]), c1 = loadPosition(vtx[tdx[i+1].z]);
+		__m128 c2 = loadPosition(vtx[tdx[i+2].z]), c3 = loadPosition(vtx[tdx[i+3].z]);
+		_MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+		_MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+		_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+		__m128 e1x = _mm_sub_ps(b0, a0), e1y = _mm_sub_ps(b1, a1), e1z = _mm_sub_ps(b2, a2);
+		__m128 e2x = _mm_sub_ps(c0, a0), e2y = _mm_sub_ps(c1, a1), e2z = _mm_sub_ps(c2, a2);
+		__m128 nx = _mm_sub_ps(_mm_mul_ps(e1y, e2z), _mm_mul_ps(e1z, e2y));
+		__m128 ny = _mm_sub_ps(_mm_mul_ps(e1z, e2x), _mm_mul_ps(e1x, e2z));
+		__m128 nz = _mm_sub_ps(_mm_mul_ps(e1x, e2y), _mm_mul_ps(e1y, e2x));
+		__m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz));
+		__m128 area = _mm_mul_ps(half, _mm_sqrt_ps(len2));
+
+		// Prefix sum within the register by two shifted adds, then add the sum of the previous triangles.
+		area = _mm_add_ps(area, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(area), 4)));
+		area = _mm_add_ps(area, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(area), 8)));
+		area = _mm_add_ps(area, running);
+		_mm_storeu_ps(cdf + i, area);
+		running = _mm_shuffle_ps(area, area, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+
+	float sum = _mm_cvtss_f32(running);
+	for (; i < numTridices; ++i)
+	{
+		sum += triangleArea(vtx, tdx[i]);
+		cdf[i] = sum;
+	}
+	return sum;
+}
+
+AABB boundVertices(const Vertex* vtx, uint numVertices)
+{
+	__m128 lower = _mm_set1_ps(FLT_MAX);
+	__m128 upper = _mm_set1_ps(-FLT_MAX);
+	for (uint i = 0; i < numVertices; ++i)
+	{
+		__m128 p = loadPosition(vtx[i]);
+		lower = _mm_min_ps(lower, p);
+		upper = _mm_max_ps(upper, p);
+	}
+
+	float4 lo, up;
+	_mm_storeu_ps(lo.data, lower);
+	_mm_storeu_ps(up.data, upper);
+	return AABB(float3(lo.x, lo.y, lo.z), float3(up.x, up.y, up.z));
+}
+
+float maxSquaredDistance(const Vertex* vtx, uint numVertices, const float3& center)
+{
+	const __m128 cx = _mm_set1_ps(center.x), cy = _mm_set1_ps(center.y), cz = _mm_set1_ps(center.z);
+	__m128 maxDist2 = _mm_setzero_ps();
+	uint i = 0;
+
+	for (; i + 4 <= numVertices; i += 4)
+	{
+		__m128 p0 = loadPosition(vtx[i]), p1 = loadPosition(vtx[i+1]);
+		__m128 p2 = loadPosition(vtx[i+2]), p3 = loadPosition(vtx[i+3]);
+		_MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+		__m128 dx = _mm_sub_ps(p0, cx), dy = _mm_sub_ps(p1, cy), dz = _mm_sub_ps(p2, cz);
+		__m128 dist2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		maxDist2 = _mm_max_ps(maxDist2, dist2);
+	}
+
+	float4 lanes;
+	_mm_storeu_ps(lanes.data, maxDist2);
+	float ret = _max(_max(lanes.x, lanes.y), _max(lanes.z, lanes.w));
+	for (; i < numVertices; ++i)
+		ret = _max(ret, squaredLength(vtx[i].position - center));
+	return ret;
+}
+
+}
+
+
+void preprocessGeometry(const Array<Vertex>& vtxArr, const Array<Tridex>& tdxArr, const Array<MeshRange>& rangeArr,
+	Array<float>& cdfArr, Array<MeshProperties>& propArr)
+{
+	assert(cdfArr.size() == tdxArr.size());
+	uint numRanges = rangeArr.size();
+
+	// The chunks of a range are consecutive and in order, which the offsets of the cdf rely on.
+	Array<Chunk> chunkArr;
+	for (uint r = 0; r < numRanges; ++r)
+	{
+		for (uint begin = 0; begin < rangeArr[r].numTridices; begin += chunkSize)
+			chunkArr.push_back({ r, begin, _min(begin + chunkSize, rangeArr[r].numTridices), true });
+		for (uint begin = 0; begin < rangeArr[r].numVertices; begin += chunkSize)
+			chunkArr.push_back({ r, begin, _min(begin + chunkSize, rangeArr[r].numVertices), false });
+	}
+
+	uint numChunks = chunkArr.size();
+	Array<ChunkResult> resultArr(numChunks);
+	ThreadPool& pool = ThreadPool::get();
+
+	pool.parallelFor(0, numChunks, 1, [&](uint c) {
+		const Chunk& chunk = chunkArr[c];
+		const MeshRange& range = rangeArr[chunk.rangeIdx];
+		const Vertex* vtx = vtxArr.data() + range.vertexOffset;
+
+		if (chunk.triangles)
+		{
+			uint first = range.tridexOffset + chunk.begin;
+			resultArr[c].area = prefixSumAreas(vtx, tdxArr.data() + first, chunk.end - chunk.begin, cdfArr.data() + first);
+		}
+		else
+		{
+			resultArr[c].box = boundVertices(vtx + chunk.begin, chunk.end - chunk.begin);
+		}
+	});
+
+	// Sums in double, so the cdf of a large mesh does not lose its last chunks to rounding.
+	Array<double> areaArr(numRanges, 0.0);
+	propArr.clear();
+	propArr.resize(numRanges);
+	for (uint c = 0; c < numChunks; ++c)
+	{
+		uint r = chunkArr[c].rangeIdx;
+		if (chunkArr[c].triangles)
+		{
+			resultArr[c].areaOffset = areaArr[r];
+			areaArr[r] += resultArr[c].area;
+		}
+		else
+		{
+			propArr[r].box.grow(resultArr[c].box);
+		}
+	}
+	for (uint r = 0; r < numRanges; ++r)
+	{
+		propArr[r].area = (float) areaArr[r];
+		if (!propArr[r].box.empty())
+			propArr[r].sphere.center = propArr[r].box.center();
+	}
+
+	pool.parallelFor(0, numChunks, 1, [&](uint c) {
+		const Chunk& chunk = chunkArr[c];
+		const MeshRange& range = rangeArr[chunk.rangeIdx];
+
+		if (chunk.triangles)
+		{
+			float* cdf = cdfArr.data() + range.tridexOffset;
+			if (areaArr[chunk.rangeIdx] > 0.0)
+			{
+				float invArea = float(1.0 / areaArr[chunk.rangeIdx]);
+				float offset = (float) resultArr[c].areaOffset;
+				for (uint i = chunk.begin; i < chunk.end; ++i)
+					cdf[i] = (cdf[i] + offset) * invArea;
+			}
+			else
+			{
+				float invNum = 1.0f / range.numTridices;
+				for (uint i = chunk.begin; i < chunk.end; ++i)
+					cdf[i] = (i + 1) * invNum;
+			}
+		}
+		else
+		{
+			const Vertex* vtx = vtxArr.data() + range.vertexOffset;
+			resultArr[c].maxDistance2 = maxSquaredDistance(vtx + chunk.begin, chunk.end - chunk.begin, propArr[chunk.rangeIdx].sphere.center);
+		}
+	});
+
+	for (uint c = 0; c < numChunks; ++c)
+	{
+		if (!chunkArr[c].triangles)
+		{
+			BoundingSphere& sphere = propArr[chunkArr[c].rangeIdx].sphere;
+			sphere.radius = _max(sphere.radius, sqrtf(resultArr[c].maxDistance2));
+		}
+	}
+	for (uint r = 0; r < numRanges; ++r)
+	{
+		if (rangeArr[r].numTridices > 0)
+			cdfArr[rangeArr[r].tridexOffset + rangeArr[r].numTridices - 1] = 1.0f;
+	}
+}
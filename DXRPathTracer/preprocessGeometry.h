@@ -0,0 +1,35 @@
+#pragma once
+#include "Mesh.h"
+#include "BVH.h"
+
+
+// A mesh in the vertex and tridex arrays of a scene; the tridices index its vertices from vertexOffset.
+struct MeshRange
+{
+	uint vertexOffset;
+	uint tridexOffset;
+	uint numVertices;
+	uint numTridices;
+};
+
+
+struct MeshProperties
+{
+	float area = 0.0f;
+	AABB box;
+	BoundingSphere sphere;			// Centered at the box center, so never larger than the box's circumsphere.
+};
+
+
+/*
+Computes the surface area, bounds and triangle cdf of every range at once.
+For the range r, cdfArr[r.tridexOffset + i] becomes the sum of the areas of its triangles 0 ... i divided by the
+area of the range, so the last one is exactly 1 (degenerate ranges get a uniform cdf). Sampling a point on the
+mesh proportional to area is then a binary search on the range's cdf.
+
+The triangles and the vertices of all ranges are cut into fixed size chunks which are processed on the thread pool,
+4 triangles or 4 vertices per SSE instruction, in two passes: chunk sums, boxes and local prefix sums first, then
+the chunk offsets and the sphere radii. cdfArr must already have the size of tdxArr.
+*/
+void preprocessGeometry(const Array<Vertex>& vtxArr, const Array<Tridex>& tdxArr, const Array<MeshRange>& rangeArr,
+	Array<float>& cdfArr, Array<MeshProperties>& propArr);
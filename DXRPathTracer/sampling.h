@@ -0,0 +1,113 @@
+#pragma once
+#include "pch.h"
+#include "fastMath.h"
+
+/*
+C++ counterpart of sampling.hlsli for the CPU tracer.
+The functions are kept line by line identical to the HLSL ones, so both tracers consume random numbers in the
+same order and converge to the same image. The samplers take the MathMode of their caller: Exact keeps them
+identical to the HLSL ones, Fast trades the last bits of the square roots and sines for speed.
+*/
+
+static const float Pi = 3.141592654f;
+static const float Pi2 = 6.283185307f;
+static const float InvPi = 0.318309886f;
+
+
+inline uint getNewSeed(uint param1, uint param2, uint numPermutation)
+{
+	uint s0 = 0;
+	uint v0 = param1;
+	uint v1 = param2;
+
+	for (uint perm = 0; perm < numPermutation; perm++)
+	{
+		s0 += 0x9e3779b9;
+		v0 += ((v1 << 4) + 0xa341316c) ^ (v1 + s0) ^ ((v1 >> 5) + 0xc8013ea4);
+		v1 += ((v0 << 4) + 0xad90777d) ^ (v0 + s0) ^ ((v0 >> 5) + 0x7e95761e);
+	}
+
+	return v0;
+}
+
+inline float rnd(uint& seed)
+{
+	seed = (1664525u * seed + 1013904223u);
+	return ((float) (seed & 0x00FFFFFF) / (float) 0x01000000);
+}
+
+inline float3 applyRotationMappingZToN(const float3& N, float3 v)
+{
+	float  s = (N.z >= 0.0f) ? 1.0f : -1.0f;
+	v.z *= s;
+
+	float3 h = float3(N.x, N.y, N.z + s);
+	float  k = dot(v, h) / (1.0f + fabsf(N.z));
+
+	return k * h - v;
+}
+
+template<MathMode Mode = MathMode::Exact>
+inline float3 sample_hemisphere_cos(uint& seed)
+{
+	float3 sampleDir;
+
+	float param1 = rnd(seed);
+	float param2 = rnd(seed);
+
+	// Uniformly sample disk.
+	float r   = mathSqrt<Mode>(param1);
+	float phi = 2.0f * Pi * param2;
+	float sinPhi, cosPhi;
+	mathSinCos<Mode>(phi, sinPhi, cosPhi);
+	sampleDir.x = r * cosPhi;
+	sampleDir.y = r * sinPhi;
+
+	// Project up to hemisphere.
+	sampleDir.z = mathSqrt<Mode>(_max(0.0f, 1.0f - r*r));
+
+	return sampleDir;
+}
+
+inline float TrowbridgeReitz(float cos2, float alpha2)
+{
+	float x = alpha2 + (1 - cos2) / cos2;
+	return alpha2 / (Pi*cos2*cos2*x*x);
+}
+
+template<MathMode Mode = MathMode::Exact>
+inline float3 sample_hemisphere_TrowbridgeReitzCos(float alpha2, uint& seed)
+{
+	float3 sampleDir;
+
+	float u = rnd(seed);
+	float v = rnd(seed);
+
+	float tan2theta = alpha2 * (u / (1 - u));
+	float cos2theta = 1 / (1 + tan2theta);
+	float sinTheta = mathSqrt<Mode>(1 - cos2theta);
+	float phi = 2 * Pi * v;
+	float sinPhi, cosPhi;
+	mathSinCos<Mode>(phi, sinPhi, cosPhi);
+
+	sampleDir.x = sinTheta * cosPhi;
+	sampleDir.y = sinTheta * sinPhi;
+	sampleDir.z = mathSqrt<Mode>(cos2theta);
+
+	return sampleDir;
+}
+
+template<MathMode Mode = MathMode::Exact>
+inline float Smith_TrowbridgeReitz(const float3& wi, const float3& wo, const float3& wm, const float3& wn, float alpha2)
+{
+	if (dot(wo, wm) < 0 || dot(wi, wm) < 0)
+		return 0.0f;
+
+	float cos2 = dot(wn, wo);
+	cos2 *= cos2;
+	float lambda1 = 0.5f * (-1 + mathSqrt<Mode>(1 + alpha2*(1 - cos2) / cos2));
+	cos2 = dot(wn, wi);
+	cos2 *= cos2;
+	float lambda2 = 0.5f * (-1 + mathSqrt<Mode>(1 + alpha2*(1 - cos2) / cos2));
+	return 1 / (1 + lambda1 + lambda2);
+}
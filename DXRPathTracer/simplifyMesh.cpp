@@ -0,0 +1,487 @@
+#include "pch.h"
+#include "simplifyMesh.h"
+#include "Arena.h"
+#include <float.h>
+#include <vector>
+#include <queue>
+#include <algorithm>
+
+
+namespace {
+
+const double boundaryWeight = 10.0;		// Boundary planes count as much as ten faces, so borders stay in place.
+const float minFlipCosine = 0.2f;		// A collapse may turn a neighboring triangle by about 78 degrees at most.
+
+struct Quadric
+{
+	double aa = 0, ab = 0, ac = 0, ad = 0;
+	double bb = 0, bc = 0, bd = 0;
+	double cc = 0, cd = 0;
+	double dd = 0;
+
+	// The plane n.p + d = 0 with unit normal n.
+	void addPlane(const float3& n, float d, double weight)
+	{
+		double a = n.x, b = n.y, c = n.z;
+		aa += weight * a*a;	ab += weight * a*b;	ac += weight * a*c;	ad += weight * a*d;
+		bb += weight * b*b;	bc += weight * b*c;	bd += weight * b*d;
+		cc += weight * c*c;	cd += weight * c*d;
+		dd += weight * d*d;
+	}
+
+	Quadric& operator+=(const Quadric& q)
+	{
+		aa += q.aa;	ab += q.ab;	ac += q.ac;	ad += q.ad;
+		bb += q.bb;	bc += q.bc;	bd += q.bd;
+		cc += q.cc;	cd += q.cd;
+		dd += q.dd;
+		return *this;
+	}
+
+	double evaluate(const float3& p) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double e = aa*x*x + 2*ab*x*y + 2*ac*x*z + 2*ad*x
+				 + bb*y*y + 2*bc*y*z + 2*bd*y
+				 + cc*z*z + 2*cd*z
+				 + dd;
+		return _max(e, 0.0);
+	}
+};
+
+struct Collapse
+{
+	double cost;
+	uint from;
+	uint to;
+	uint fromVersion;
+	uint toVersion;
+
+	bool operator<(const Collapse& c) const { return cost > c.cost; }	// The cheapest on the top of std::priority_queue.
+};
+
+/*
+The source vertices which share a position form one point, and the topology is that of the points.
+Vertices are split at normal or texcoord seams, and simplifying them separately would tear the mesh apart.
+All the working memory comes from the arena of simplifyMesh() and is freed at once when it returns.
+*/
+class Simplifier
+{
+	const Vertex* vertices;
+	const Tridex* tridices;
+	uint numVertices;
+	uint numTridices;
+
+	ScratchVector<uint> pointOfVertex;
+	ScratchVector<float3> pointPos;
+	ScratchVector<uint> pointVertStart;		// Vertices of point p are pointVertList[pointVertStart[p] .. pointVertStart[p+1]).
+	ScratchVector<uint> pointVertList;
+	ScratchVector<Quadric> quadrics;
+	ScratchVector<uint> version;
+	ScratchVector<bool> pointAlive;
+	ScratchVector<ScratchVector<uint>> pointTris;
+
+	ScratchVector<uint3> triPoints;
+	ScratchVector<uint3> triVerts;
+	ScratchVector<bool> triAlive;
+	uint numAliveTris = 0;
+
+	std::priority_queue<Collapse, ScratchVector<Collapse>> heap;
+
+	// Of isCollapseValid(), kept to reuse their memory: the arena cannot free the blocks of every call.
+	mutable ScratchVector<uint> fromNeighbors;
+	mutable ScratchVector<uint> toNeighbors;
+
+	void weldPoints();
+	void initTriangles();
+	void initQuadrics();
+	void pushEdge(uint p, uint q);
+	bool isCollapseValid(uint from, uint to) const;
+	void collapse(uint from, uint to);
+	uint matchVertex(uint srcVertex, uint point) const;
+
+public:
+	Simplifier(const Vertex* vertices, uint numVertices, const Tridex* tridices, uint numTridices)
+		: vertices(vertices), tridices(tridices), numVertices(numVertices), numTridices(numTridices) {}
+	float run(uint targetTridices, Array<Vertex>& dstVtxArr, Array<Tridex>& dstTdxArr);
+};
+
+void Simplifier::weldPoints()
+{
+	ScratchVector<uint> order(numVertices);
+	for (uint i = 0; i < numVertices; ++i)
+		order[i] = i;
+
+	auto less = [&](uint a, uint b) {
+		const float3& p = vertices[a].position;
+		const float3& q = vertices[b].position;
+		return (p.x != q.x) ? p.x < q.x : (p.y != q.y) ? p.y < q.y : p.z < q.z;
+	};
+	std::sort(order.begin(), order.end(), less);
+
+	pointOfVertex.resize(numVertices);
+	for (uint i = 0; i < numVertices; ++i)
+	{
+		if (i == 0 || less(order[i - 1], order[i]))
+		{
+			pointPos.push_back(vertices[order[i]].position);
+			pointVertStart.push_back(i);
+		}
+		pointOfVertex[order[i]] = (uint) pointPos.size() - 1;
+	}
+	pointVertStart.push_back(numVertices);
+	pointVertList.swap(order);
+}
+
+void Simplifier::initTriangles()
+{
+	uint numPoints = (uint) pointPos.size();
+	pointTris.resize(numPoints);
+
+	for (uint i = 0; i < numTridices; ++i)
+	{
+		const Tridex& tdx = tridices[i];
+		uint3 points(pointOfVertex[tdx.x], pointOfVertex[tdx.y], pointOfVertex[tdx.z]);
+		if (points.x == points.y || points.y == points.z || points.z == points.x)
+			continue;
+
+		uint t = (uint) triPoints.size();
+		triPoints.push_back(points);
+		triVerts.push_back(tdx);
+		for (uint k = 0; k < 3; ++k)
+			pointTris[points[k]].push_back(t);
+	}
+
+	numAliveTris = (uint) triPoints.size();
+	triAlive.assign(numAliveTris, true);
+	pointAlive.assign(numPoints, true);
+	version.assign(numPoints, 0);
+}
+
+void Simplifier::initQuadrics()
+{
+	quadrics.resize(pointPos.size());
+
+	// Edges used by only one triangle are the open boundary.
+	ScratchVector<uint64> edges;
+	edges.reserve(triPoints.size() * 3);
+
+	for (uint t = 0; t < triPoints.size(); ++t)
+	{
+		const uint3& tp = triPoints[t];
+		float3 p0 = pointPos[tp.x], p1 = pointPos[tp.y], p2 = pointPos[tp.z];
+		float3 n = cross(p1 - p0, p2 - p0);
+		float len = length(n);
+		if (len > 0.0f)
+		{
+			n = n / len;
+			Quadric q;
+			q.addPlane(n, -dot(n, p0), 1.0);
+			quadrics[tp.x] += q;
+			quadrics[tp.y] += q;
+			quadrics[tp.z] += q;
+		}
+
+		for (uint k = 0; k < 3; ++k)
+		{
+			uint a = tp[k], b = tp[(k + 1) % 3];
+			edges.push_back(((uint64) _min(a, b) << 32) | _max(a, b));
+		}
+	}
+
+	std::sort(edges.begin(), edges.end());
+
+	for (uint t = 0; t < triPoints.size(); ++t)
+	{
+		const uint3& tp = triPoints[t];
+		float3 p0 = pointPos[tp.x], p1 = pointPos[tp.y], p2 = pointPos[tp.z];
+		float3 faceNormal = cross(p1 - p0, p2 - p0);
+		if (squaredLength(faceNormal) == 0.0f)
+			continue;
+
+		for (uint k = 0; k < 3; ++k)
+		{
+			uint a = tp[k], b = tp[(k + 1) % 3];
+			uint64 key = ((uint64) _min(a, b) << 32) | _max(a, b);
+			auto range = std::equal_range(edges.begin(), edges.end(), key);
+			if (range.second - range.first != 1)
+				continue;
+
+			float3 edge = pointPos[b] - pointPos[a];
+			float3 n = cross(edge, faceNormal);
+			float len = length(n);
+			if (len == 0.0f)
+				continue;
+			n = n / len;
+
+			Quadric q;
+			q.addPlane(n, -dot(n, pointPos[a]), boundaryWeight);
+			quadrics[a] += q;
+			quadrics[b] += q;
+		}
+	}
+}
+
+void Simplifier::pushEdge(uint p, uint q)
+{
+	Quadric sum = quadrics[p];
+	sum += quadrics[q];
+	double costToQ = sum.evaluate(pointPos[q]);
+	double costToP = sum.evaluate(pointPos[p]);
+
+	if (costToQ <= costToP)
+		heap.push({ costToQ, p, q, version[p], version[q] });
+	else
+		heap.push({ costToP, q, p, version[q], version[p] });
+}
+
+bool Simplifier::isCollapseValid(uint from, uint to) const
+{
+	// Link condition: the two points may share only the opposite points of the triangles on the edge.
+	fromNeighbors.clear();
+	toNeighbors.clear();
+	uint numSharedTris = 0;
+
+	for (uint t : pointTris[from])
+	{
+		if (!triAlive[t])
+			continue;
+		const uint3& tp = triPoints[t];
+		bool shared = (tp.x == to || tp.y == to || tp.z == to);
+		numSharedTris += shared;
+
+		for (uint k = 0; k < 3; ++k)
+			if (tp[k] != from && tp[k] != to)
+				fromNeighbors.push_back(tp[k]);
+
+		if (shared)
+			continue;
+
+		// The triangle must not flip or collapse when its corner moves from 'from' to 'to'.
+		float3 p[3], q[3];
+		for (uint k = 0; k < 3; ++k)
+		{
+			p[k] = pointPos[tp[k]];
+			q[k] = (tp[k] == from) ? pointPos[to] : p[k];
+		}
+		float3 nOld = cross(p[1] - p[0], p[2] - p[0]);
+		float3 nNew = cross(q[1] - q[0], q[2] - q[0]);
+		float lenOld = length(nOld);
+		if (lenOld > 0.0f && dot(nOld, nNew) <= minFlipCosine * lenOld * length(nNew))
+			return false;
+	}
+
+	if (numSharedTris == 0)
+		return false;
+
+	for (uint t : pointTris[to])
+	{
+		if (!triAlive[t])
+			continue;
+		const uint3& tp = triPoints[t];
+		for (uint k = 0; k < 3; ++k)
+			if (tp[k] != from && tp[k] != to)
+				toNeighbors.push_back(tp[k]);
+	}
+
+	std::sort(fromNeighbors.begin(), fromNeighbors.end());
+	fromNeighbors.erase(std::unique(fromNeighbors.begin(), fromNeighbors.end()), fromNeighbors.end());
+	std::sort(toNeighbors.begin(), toNeighbors.end());
+	toNeighbors.erase(std::unique(toNeighbors.begin(), toNeighbors.end()), toNeighbors.end());
+
+	uint numShared = 0;
+	for (uint i = 0, j = 0; i < fromNeighbors.size() && j < toNeighbors.size(); )
+	{
+		if (fromNeighbors[i] < toNeighbors[j])			++i;
+		else if (fromNeighbors[i] > toNeighbors[j])		++j;
+		else											{ ++numShared; ++i; ++j; }
+	}
+	return numShared == numSharedTris;
+}
+
+// The vertex of the point whose attributes are the closest to those of the source vertex.
+uint Simplifier::matchVertex(uint srcVertex, uint point) const
+{
+	const Vertex& src = vertices[srcVertex];
+	uint best = pointVertList[pointVertStart[point]];
+	float bestScore = -FLT_MAX;
+
+	for (uint i = pointVertStart[point]; i < pointVertStart[point + 1]; ++i)
+	{
+		const Vertex& v = vertices[pointVertList[i]];
+		float2 dt(v.texcoord.x - src.texcoord.x, v.texcoord.y - src.texcoord.y);
+		float score = dot(v.normal, src.normal) - (dt.x*dt.x + dt.y*dt.y);
+		if (score > bestScore)
+		{
+			bestScore = score;
+			best = pointVertList[i];
+		}
+	}
+	return best;
+}
+
+void Simplifier::collapse(uint from, uint to)
+{
+	for (uint t : pointTris[from])
+	{
+		if (!triAlive[t])
+			continue;
+
+		uint3& tp = triPoints[t];
+		if (tp.x == to || tp.y == to || tp.z == to)
+		{
+			triAlive[t] = false;
+			--numAliveTris;
+			continue;
+		}
+
+		for (uint k = 0; k < 3; ++k)
+		{
+			if (tp[k] == from)
+			{
+				tp[k] = to;
+				triVerts[t][k] = matchVertex(triVerts[t][k], to);
+			}
+		}
+		pointTris[to].push_back(t);
+	}
+
+	quadrics[to] += quadrics[from];
+	pointAlive[from] = false;
+	ScratchVector<uint>().swap(pointTris[from]);
+	++version[to];
+
+	// Drop the dead triangles of 'to' and queue its edges again with the merged quadric.
+	ScratchVector<uint>& tris = pointTris[to];
+	tris.erase(std::remove_if(tris.begin(), tris.end(), [&](uint t) { return !triAlive[t]; }), tris.end());
+
+	for (uint t : tris)
+	{
+		const uint3& tp = triPoints[t];
+		for (uint k = 0; k < 3; ++k)
+			if (tp[k] != to)
+				pushEdge(to, tp[k]);
+	}
+}
+
+float Simplifier::run(uint targetTridices, Array<Vertex>& dstVtxArr, Array<Tridex>& dstTdxArr)
+{
+	weldPoints();
+	initTriangles();
+	initQuadrics();
+
+	// Every edge is queued once per triangle first; reserving that spares the arena the copies of the growth.
+	ScratchVector<Collapse> queued;
+	queued.reserve(triPoints.size() * 3);
+	heap = std::priority_queue<Collapse, ScratchVector<Collapse>>(std::less<Collapse>(), std::move(queued));
+
+	for (uint t = 0; t < triPoints.size(); ++t)
+	{
+		const uint3& tp = triPoints[t];
+		pushEdge(tp.x, tp.y);
+		pushEdge(tp.y, tp.z);
+		pushEdge(tp.z, tp.x);
+	}
+
+	double maxCost = 0.0;
+	while (numAliveTris > targetTridices && !heap.empty())
+	{
+		Collapse c = heap.top();
+		heap.pop();
+
+		if (!pointAlive[c.from] || !pointAlive[c.to] || c.fromVersion != version[c.from] || c.toVersion != version[c.to])
+			continue;	// Stale: one of the points has changed since this entry was queued.
+
+		if (!isCollapseValid(c.from, c.to))
+			continue;	// It is queued again if a neighboring collapse changes the situation.
+
+		collapse(c.from, c.to);
+		maxCost = _max(maxCost, c.cost);
+	}
+
+	ScratchVector<uint> remap(numVertices, uint(-1));
+	dstVtxArr.clear();
+	dstTdxArr.clear();
+	dstTdxArr.reserve(numAliveTris);
+
+	for (uint t = 0; t < triPoints.size(); ++t)
+	{
+		if (!triAlive[t])
+			continue;
+
+		Tridex tdx;
+		for (uint k = 0; k < 3; ++k)
+		{
+			uint v = triVerts[t][k];
+			if (remap[v] == uint(-1))
+			{
+				remap[v] = dstVtxArr.size();
+				dstVtxArr.push_back(vertices[v]);
+			}
+			tdx[k] = remap[v];
+		}
+		dstTdxArr.push_back(tdx);
+	}
+
+	return (float) sqrt(maxCost);
+}
+
+}	// namespace
+
+
+float simplifyMesh(const Vertex* srcVertices, uint numSrcVertices, const Tridex* srcTridices, uint numSrcTridices,
+	uint targetTridices, Array<Vertex>& dstVtxArr, Array<Tridex>& dstTdxArr)
+{
+	ScopedArena arena;
+	Simplifier simplifier(srcVertices, numSrcVertices, srcTridices, numSrcTridices);
+	return simplifier.run(targetTridices, dstVtxArr, dstTdxArr);
+}
+
+float simplifyMesh(const Array<Vertex>& srcVtxArr, const Array<Tridex>& srcTdxArr, uint targetTridices,
+	Array<Vertex>& dstVtxArr, Array<Tridex>& dstTdxArr)
+{
+	return simplifyMesh(srcVtxArr.data(), srcVtxArr.size(), srcTdxArr.data(), srcTdxArr.size(), targetTridices,
+		dstVtxArr, dstTdxArr);
+}
+
+void generateMeshLODs(const Vertex* vertices, uint numVertices, const Tridex* tridices, uint numTridices,
+	Array<MeshLOD>& lodArr, uint maxLevels, float reduction, uint minTridices)
+{
+	lodArr.clear();
+	lodArr.reserve(maxLevels);		// No reallocation below, which keeps the previous level referable.
+
+	const Vertex* prevVertices = vertices;
+	const Tridex* prevTridices = tridices;
+	uint numPrevVertices = numVertices;
+	uint numPrevTridices = numTridices;
+	float prevError = 0.0f;
+
+	for (uint level = 0; level < maxLevels; ++level)
+	{
+		uint target = (uint) (numPrevTridices * reduction);
+		if (target < minTridices)
+			break;
+
+		MeshLOD lod;
+		float error = simplifyMesh(prevVertices, numPrevVertices, prevTridices, numPrevTridices, target,
+			lod.vtxArr, lod.tdxArr);
+		if (lod.tdxArr.size() > numPrevTridices * 0.9f)
+			break;
+
+		// Errors of the successive levels add up at most, by the triangle inequality.
+		lod.error = prevError + error;
+		prevError = lod.error;
+
+		lodArr.push_back(move2(lod));
+		prevVertices = lodArr[level].vtxArr.data();
+		prevTridices = lodArr[level].tdxArr.data();
+		numPrevVertices = lodArr[level].vtxArr.size();
+		numPrevTridices = lodArr[level].tdxArr.size();
+	}
+}
+
+void generateMeshLODs(Mesh& mesh, uint maxLevels, float reduction, uint minTridices)
+{
+	generateMeshLODs(mesh.vtxArr.data(), mesh.vtxArr.size(), mesh.tdxArr.data(), mesh.tdxArr.size(), mesh.lodArr,
+		maxLevels, reduction, minTridices);
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include "Mesh.h"
+
+/*
+Quadric error metric simplification (Garland and Heckbert, "Surface Simplification Using Quadric Error Metrics").
+Edges are collapsed in the order of their quadric error, always onto one of their end points, so the simplified
+mesh reuses a subset of the source vertices and stays inside the bounding box of the source. Open boundaries are
+kept by additional planes perpendicular to the boundary, and collapses which flip a triangle or make the surface
+non-manifold are rejected.
+
+The returned error is in the mesh's own units: the square root of the largest quadric error of the collapses,
+which is the distance from the collapsed vertex to its original planes.
+*/
+float simplifyMesh(const Array<Vertex>& srcVtxArr, const Array<Tridex>& srcTdxArr, uint targetTridices,
+	Array<Vertex>& dstVtxArr, Array<Tridex>& dstTdxArr);
+float simplifyMesh(const Vertex* srcVertices, uint numSrcVertices, const Tridex* srcTridices, uint numSrcTridices,
+	uint targetTridices, Array<Vertex>& dstVtxArr, Array<Tridex>& dstTdxArr);
+
+// Appends up to maxLevels levels to mesh.lodArr, each simplified from the previous one to about reduction times
+// its triangles. It stops early at minTridices or when the simplification no longer makes progress.
+void generateMeshLODs(Mesh& mesh, uint maxLevels, float reduction = 0.25f, uint minTridices = 512);
+
+// The same for a mesh which is not held by a Mesh, e.g. one already written into the arrays of a scene.
+void generateMeshLODs(const Vertex* vertices, uint numVertices, const Tridex* tridices, uint numTridices,
+	Array<MeshLOD>& lodArr, uint maxLevels, float reduction = 0.25f, uint minTridices = 512);
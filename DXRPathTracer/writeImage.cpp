@@ -0,0 +1,382 @@
+#include "pch.h"
+#include "writeImage.h"
+#include "pixelFormat.h"
+#include "deflate.h"
+#include "ThreadPool.h"
+#include <string>
+#include <algorithm>
+
+
+namespace {
+
+FILE* openForWriting(const char* filename)
+{
+	FILE* file = fopen(filename, "wb");
+	if (!file)
+	{
+		char message[512];
+		snprintf(message, sizeof(message), "Cannot open the image file %s for writing.", filename);
+		throw Error(message);
+	}
+	return file;
+}
+
+void finishWriting(FILE* file, bool ok, const char* filename)
+{
+	ok = (fclose(file) == 0) && ok;
+	if (!ok)
+	{
+		char message[512];
+		snprintf(message, sizeof(message), "Cannot write the image file %s.", filename);
+		throw Error(message);
+	}
+}
+
+// Row y of image as float4, converted into scratch unless it already is.
+const float4* imageRow(const TracedResult& image, uint y, Array<float4>& scratch)
+{
+	const uint8* line = (const uint8*) image.data + (size_t) (y * image.getRowPitch());
+	if (image.format == PixelFormat::RGBA32F)
+		return (const float4*) line;
+
+	scratch.resize(image.width);
+	convertToFloat4(line, image.format, scratch.data(), image.width);
+	return scratch.data();
+}
+
+// EXR stores its values little-endian, as are the targets.
+template<typename T>
+void append(Array<uint8>& out, const T& value)
+{
+	const uint8* bytes = (const uint8*) &value;
+	for (uint i = 0; i < sizeof(T); ++i)
+		out.push_back(bytes[i]);
+}
+
+void appendString(Array<uint8>& out, const char* str)
+{
+	for (; *str; ++str)
+		out.push_back((uint8) *str);
+	out.push_back(0);
+}
+
+void appendAttribute(Array<uint8>& out, const char* name, const char* type, uint size)
+{
+	appendString(out, name);
+	appendString(out, type);
+	append(out, size);
+}
+
+/*
+The run length coding of OpenEXR: a count n >= 0 and a byte repeated n + 1 times, or a count -n and n bytes.
+Runs shorter than three bytes stay in the literals.
+*/
+void rleCompress(const uint8* in, uint size, Array<uint8>& out)
+{
+	const int minRun = 3, maxRun = 127;
+	const uint8* end = in + size;
+	const uint8* runStart = in;
+	const uint8* runEnd = in + 1;
+	while (runStart < end)
+	{
+		for (; runEnd < end && *runStart == *runEnd && runEnd - runStart - 1 < maxRun; ++runEnd);
+		if (runEnd - runStart >= minRun)
+		{
+			out.push_back((uint8) (runEnd - runStart - 1));
+			out.push_back(*runStart);
+			runStart = runEnd;
+		}
+		else
+		{
+			// The literals end where a run of three begins.
+			while (runEnd < end && runEnd - runStart < maxRun &&
+				(runEnd + 2 >= end || runEnd[0] != runEnd[1] || runEnd[1] != runEnd[2]))
+				++runEnd;
+			out.push_back((uint8) -(int) (runEnd - runStart));
+			for (; runStart < runEnd; ++runStart)
+				out.push_back(*runStart);
+		}
+		++runEnd;
+	}
+}
+
+}	// namespace
+
+
+ImageFileWriter::ImageFileWriter(const char* filename, uint width, uint height)
+	: file(openForWriting(filename)), filename(filename), width(width), height(height)
+{
+}
+
+ImageFileWriter::~ImageFileWriter()
+{
+	if (file)
+		fclose(file);
+}
+
+void ImageFileWriter::beginRows(uint numRows)
+{
+	if (nextRow + numRows > height)
+		throw Error("More rows than the image has were written.");
+}
+
+void ImageFileWriter::finish()
+{
+	FILE* closed = file;
+	file = nullptr;
+	finishWriting(closed, ok && nextRow == height, filename.c_str());
+}
+
+
+PpmWriter::PpmWriter(const char* filename, uint width, uint height)
+	: ImageFileWriter(filename, width, height), line(width * 3)
+{
+	ok = fprintf(file, "P6\n%u %u\n255\n", width, height) > 0;
+}
+
+void PpmWriter::writeRows(const uint8* rgba, uint numRows, uint pitch)
+{
+	beginRows(numRows);
+	for (uint y = 0; ok && y < numRows; ++y)
+	{
+		const uint8* src = rgba + (size_t) y * pitch;
+		for (uint x = 0; x < width; ++x)
+		{
+			line[3 * x] = src[4 * x];
+			line[3 * x + 1] = src[4 * x + 1];
+			line[3 * x + 2] = src[4 * x + 2];
+		}
+		ok = fwrite(line.data(), 1, line.size(), file) == line.size();
+	}
+	nextRow += numRows;
+}
+
+
+PfmWriter::PfmWriter(const char* filename, uint width, uint height)
+	: ImageFileWriter(filename, width, height), line(3 * width)
+{
+	int size = fprintf(file, "PF\n%u %u\n-1.0\n", width, height);	// Negative for little-endian.
+	ok = size > 0;
+	headerSize = (uint64) _max(size, 0);
+}
+
+void PfmWriter::writeRows(const TracedResult& rows)
+{
+	assert(rows.width == width);
+	beginRows(rows.height);
+
+	// The rows of the band are together in the file, bottom row first.
+	uint64 rowSize = sizeof(float) * (uint64) line.size();
+	ok = ok && _fseeki64(file, headerSize + rowSize * (height - nextRow - rows.height), SEEK_SET) == 0;
+
+	Array<float4> scratch;
+	for (uint y = rows.height; ok && y-- > 0; )
+	{
+		const float4* src = imageRow(rows, y, scratch);
+		for (uint x = 0; x < width; ++x)
+		{
+			line[3 * x] = src[x].x;
+			line[3 * x + 1] = src[x].y;
+			line[3 * x + 2] = src[x].z;
+		}
+		ok = fwrite(line.data(), sizeof(float), line.size(), file) == line.size();
+	}
+	nextRow += rows.height;
+}
+
+
+ExrWriter::ExrWriter(const char* filename, uint width, uint height, const ExrSettings& settings,
+	const ExrLayer* layers, uint numLayers)
+	: ImageFileWriter(filename, width, height), settings(settings), numLayers(numLayers)
+{
+	// The channels in the order of their names, as the file has them.
+	for (uint c = 0; c < 3; ++c)
+		channels.push_back({ std::string(1, "RGB"[c]), -1, c, 4, settings.halfFloat });
+	for (uint l = 0; l < numLayers; ++l)
+	{
+		uint numComponents = (uint) strlen(layers[l].channels);
+		for (uint c = 0; c < numComponents; ++c)
+		{
+			std::string name = std::string(layers[l].name) + "." + layers[l].channels[c];
+			channels.push_back({ name, (int) l, c, numComponents, layers[l].halfFloat });
+		}
+	}
+	std::sort(channels.begin(), channels.end(), [](const Channel& a, const Channel& b) { return a.name < b.name; });
+
+	bool longNames = false;
+	uint channelListSize = 1;
+	for (const Channel& channel : channels)
+	{
+		longNames |= channel.name.size() > 31;
+		channelListSize += (uint) channel.name.size() + 1 + 16;
+	}
+
+	Array<uint8> header;
+	append(header, 20000630);								// The magic number,
+	append(header, 2 | (longNames ? 0x400 : 0));			// and the version of a scanline file.
+
+	appendAttribute(header, "channels", "chlist", channelListSize);
+	for (const Channel& channel : channels)
+	{
+		appendString(header, channel.name.c_str());
+		append(header, channel.halfFloat ? 1 : 2);			// HALF or FLOAT,
+		append(header, 0);									// not perceptually linear, three reserved bytes,
+		append(header, 1);									// and no subsampling.
+		append(header, 1);
+	}
+	header.push_back(0);
+
+	appendAttribute(header, "compression", "compression", 1);
+	header.push_back((uint8) settings.compression);
+	if (settings.fullWidth == 0)
+	{
+		this->settings.fullWidth = width;
+		this->settings.fullHeight = height;
+		this->settings.cropX = this->settings.cropY = 0;
+	}
+	const ExrSettings& window = this->settings;
+	int dataWindow[4] = { (int) window.cropX, (int) window.cropY,
+		(int) (window.cropX + width) - 1, (int) (window.cropY + height) - 1 };
+	int displayWindow[4] = { 0, 0, (int) window.fullWidth - 1, (int) window.fullHeight - 1 };
+	appendAttribute(header, "dataWindow", "box2i", sizeof(dataWindow));
+	append(header, dataWindow);
+	appendAttribute(header, "displayWindow", "box2i", sizeof(displayWindow));
+	append(header, displayWindow);
+	appendAttribute(header, "lineOrder", "lineOrder", 1);
+	header.push_back(0);									// Increasing y.
+	appendAttribute(header, "pixelAspectRatio", "float", 4);
+	append(header, 1.0f);
+	appendAttribute(header, "screenWindowCenter", "v2f", 8);
+	append(header, 0.0f);
+	append(header, 0.0f);
+	appendAttribute(header, "screenWindowWidth", "float", 4);
+	append(header, 1.0f);
+	header.push_back(0);
+
+	linesPerBlock = settings.compression == ExrCompression::ZIP ? 16 : 1;
+	uint numBlocks = (height + linesPerBlock - 1) / linesPerBlock;
+	offsets.resize(numBlocks, 0);
+	headerSize = header.size();
+	position = headerSize + sizeof(uint64) * (uint64) numBlocks;
+
+	ok = fwrite(header.data(), 1, header.size(), file) == header.size();
+	ok = ok && fwrite(offsets.data(), sizeof(uint64), numBlocks, file) == numBlocks;
+}
+
+/*
+One block of scanlines of the band, as its chunk in the file: the first line in the data window, the size of the
+data, and the data. Each line holds the values of every channel in turn. RLE and ZIP first split the even and odd
+bytes into two halves and replace every byte by its difference to the one before, which turns smooth values into
+runs of small bytes.
+*/
+void ExrWriter::encodeBlock(const TracedResult& rows, const ExrLayer* layers, uint yBegin, uint yEnd,
+	Array<uint8>& chunk) const
+{
+	Array<float4> scratch;
+	Array<float> values(width);
+	Array<uint8> raw;
+	for (uint y = yBegin; y < yEnd; ++y)
+	{
+		const float4* row = imageRow(rows, y, scratch);
+		for (const Channel& channel : channels)
+		{
+			const float* src = channel.layer < 0 ? &row[0].x + channel.component :
+				layers[channel.layer].data + (size_t) y * width * channel.stride + channel.component;
+			for (uint x = 0; x < width; ++x)
+				values[x] = src[(size_t) x * channel.stride];
+
+			uint offset = raw.size();
+			raw.resize(offset + width * (channel.halfFloat ? 2 : 4));
+			if (channel.halfFloat)
+				convertToHalves(values.data(), (uint16*) &raw[offset], width);
+			else
+				memcpy(&raw[offset], values.data(), width * sizeof(float));
+		}
+	}
+
+	Array<uint8> packed;
+	if (settings.compression != ExrCompression::None)
+	{
+		uint size = raw.size();
+		Array<uint8> predicted(size);
+		uint half = (size + 1) / 2;
+		for (uint i = 0; i < size; ++i)
+			predicted[(i & 1) ? half + i / 2 : i / 2] = raw[i];
+		for (uint i = size; i-- > 1; )
+			predicted[i] = (uint8) (predicted[i] - predicted[i - 1] + 128);
+
+		if (settings.compression == ExrCompression::RLE)
+			rleCompress(predicted.data(), size, packed);
+		else
+			zlibCompress(predicted.data(), size, packed);
+	}
+	const Array<uint8>& data = packed.size() > 0 && packed.size() < raw.size() ? packed : raw;
+
+	chunk.resize(0);
+	append(chunk, (int) (settings.cropY + nextRow + yBegin));
+	append(chunk, data.size());
+	uint offset = chunk.size();
+	chunk.resize(offset + data.size());
+	memcpy(&chunk[offset], data.data(), data.size());
+}
+
+void ExrWriter::writeRows(const TracedResult& rows, const ExrLayer* layers)
+{
+	assert(rows.width == width && (layers || numLayers == 0));
+	beginRows(rows.height);
+	if (rows.height % linesPerBlock != 0 && nextRow + rows.height != height)
+		throw Error("The bands of an EXR file must be of whole blocks of scanlines, but for the last one.");
+
+	// The batches hold about 64 lines for each thread.
+	uint numBlocks = (rows.height + linesPerBlock - 1) / linesPerBlock;
+	uint firstBlock = nextRow / linesPerBlock;
+	uint batchSize = ThreadPool::get().numThreads() * _max(64 / linesPerBlock, 1u);
+	Array<Array<uint8>> chunks(_min(batchSize, numBlocks));
+	for (uint batchBegin = 0; ok && batchBegin < numBlocks; batchBegin += batchSize)
+	{
+		uint batchEnd = _min(batchBegin + batchSize, numBlocks);
+		ThreadPool::get().parallelFor(batchBegin, batchEnd, 1, [&](uint block) {
+			uint yBegin = block * linesPerBlock;
+			encodeBlock(rows, layers, yBegin, _min(yBegin + linesPerBlock, rows.height), chunks[block - batchBegin]);
+		});
+
+		for (uint block = batchBegin; ok && block < batchEnd; ++block)
+		{
+			const Array<uint8>& chunk = chunks[block - batchBegin];
+			offsets[firstBlock + block] = position;
+			position += chunk.size();
+			ok = fwrite(chunk.data(), 1, chunk.size(), file) == chunk.size();
+		}
+	}
+	nextRow += rows.height;
+}
+
+void ExrWriter::finish()
+{
+	ok = ok && _fseeki64(file, headerSize, SEEK_SET) == 0;
+	ok = ok && fwrite(offsets.data(), sizeof(uint64), offsets.size(), file) == offsets.size();
+	ImageFileWriter::finish();
+}
+
+
+void writePPM(const char* filename, const uint8* rgba, uint width, uint height, uint pitch)
+{
+	PpmWriter writer(filename, width, height);
+	writer.writeRows(rgba, height, pitch);
+	writer.finish();
+}
+
+void writePFM(const char* filename, const TracedResult& image)
+{
+	PfmWriter writer(filename, image.width, image.height);
+	writer.writeRows(image);
+	writer.finish();
+}
+
+void writeEXR(const char* filename, const TracedResult& image, const ExrSettings& settings,
+	const ExrLayer* layers, uint numLayers)
+{
+	ExrWriter writer(filename, image.width, image.height, settings, layers, numLayers);
+	writer.writeRows(image, layers);
+	writer.finish();
+}
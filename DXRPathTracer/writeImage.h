@@ -0,0 +1,133 @@
+#pragma once
+#include "IGRTCommon.h"
+#include <string>
+
+
+/*
+Image files of the headless renders. The writers throw an Error if the file cannot be written.
+*/
+
+// Binary PPM (P6) of 8-bit RGBA rows of pitch bytes, e.g. the output of ToneMapper; the alpha is dropped.
+void writePPM(const char* filename, const uint8* rgba, uint width, uint height, uint pitch);
+
+// Portable float map of the RGB of a TracedResult in any PixelFormat: a raw dump, without compression.
+void writePFM(const char* filename, const TracedResult& image);
+
+
+// The values are those of the compression attribute of OpenEXR.
+enum class ExrCompression
+{
+	None = 0,
+	RLE = 1,			// Byte runs, one scanline per block.
+	ZIPS = 2,			// Deflate, one scanline per block.
+	ZIP = 3,			// Deflate, 16 scanlines per block.
+};
+
+struct ExrSettings
+{
+	ExrCompression	compression = ExrCompression::ZIP;
+	bool			halfFloat = true;			// Of the image; 32-bit floats otherwise.
+
+	// Of an image which is a crop of a larger one, e.g. a region rendered again: the display window is of that
+	// image, and the data window is the crop at cropX, cropY in it. Both are the image itself while fullWidth is 0.
+	uint			fullWidth = 0;
+	uint			fullHeight = 0;
+	uint			cropX = 0;
+	uint			cropY = 0;
+};
+
+// Extra channels (an AOV) of the size of the image, named layer.channel.
+struct ExrLayer
+{
+	const char*		name;						// E.g. "depth".
+	const char*		channels;					// One letter each, e.g. "Z" or "XYZ".
+	const float*	data;						// strlen(channels) floats per pixel, in rows of the image width.
+	bool			halfFloat;
+};
+
+/*
+Scanline OpenEXR of the RGB of a TracedResult in any PixelFormat, with optional AOV layers, written without a
+library: deflate comes from deflate.h. The blocks of scanlines are converted and compressed in parallel on the
+ThreadPool, a batch at a time so that the memory stays bounded at any image size, and written in order. A block
+which does not get smaller is stored as it is, as the format allows.
+*/
+void writeEXR(const char* filename, const TracedResult& image, const ExrSettings& settings,
+	const ExrLayer* layers = nullptr, uint numLayers = 0);
+
+
+/*
+The writers above for an image which arrives a band of rows at a time from the top, such as a tiled render too
+large to be held whole (TiledRender.h): the memory is that of one band. The constructor opens the file and
+writeRows() writes the next rows; finish() completes the file once every row is written, and throws an Error if
+anything could not be written. A writer destroyed unfinished leaves a partial file.
+*/
+class ImageFileWriter
+{
+protected:
+	FILE*			file;
+	std::string		filename;
+	uint			width;
+	uint			height;
+	uint			nextRow = 0;
+	bool			ok = true;
+
+	ImageFileWriter(const char* filename, uint width, uint height);
+	void beginRows(uint numRows);			// Throws an Error past the last row.
+
+public:
+	virtual ~ImageFileWriter();
+	virtual void finish();
+	uint getNextRow() const					{ return nextRow; }
+};
+
+class PpmWriter : public ImageFileWriter
+{
+	Array<uint8>	line;
+
+public:
+	PpmWriter(const char* filename, uint width, uint height);
+	void writeRows(const uint8* rgba, uint numRows, uint pitch);
+};
+
+// The rows go to their place from the bottom of the file, as PFM has them.
+class PfmWriter : public ImageFileWriter
+{
+	uint64			headerSize;
+	Array<float>	line;
+
+public:
+	PfmWriter(const char* filename, uint width, uint height);
+	void writeRows(const TracedResult& rows);
+};
+
+// The layers give the AOVs: names and channels to the constructor, then data of the rows to every writeRows(), in
+// the same order. Every band but the last must be of whole blocks of getLinesPerBlock() scanlines.
+class ExrWriter : public ImageFileWriter
+{
+	struct Channel
+	{
+		std::string	name;
+		int			layer;					// -1 for the image.
+		uint		component;
+		uint		stride;					// Floats from a pixel to the next.
+		bool		halfFloat;
+	};
+
+	ExrSettings		settings;
+	Array<Channel>	channels;
+	uint			numLayers;
+	uint			linesPerBlock;
+	uint64			headerSize;
+	uint64			position;				// Where the next chunk goes.
+	Array<uint64>	offsets;				// Of the chunks, written into the table at the end.
+
+	void encodeBlock(const TracedResult& rows, const ExrLayer* layers, uint yBegin, uint yEnd,
+		Array<uint8>& chunk) const;
+
+public:
+	ExrWriter(const char* filename, uint width, uint height, const ExrSettings& settings,
+		const ExrLayer* layers = nullptr, uint numLayers = 0);
+	void writeRows(const TracedResult& rows, const ExrLayer* layers = nullptr);
+	virtual void finish();
+	uint getLinesPerBlock() const			{ return linesPerBlock; }
+};